@@ -0,0 +1,67 @@
+/* bvh.h - Dynamic bounding volume hierarchy
+ *
+ * An incrementally updated AABB tree over world space entity bounds. Leaves
+ * are inserted where they increase the tree's surface area the least and
+ * tree rotations keep it balanced as leaves are added, moved and removed.
+ * Leaf boxes are fattened by a margin so that small movements don't touch
+ * the tree at all.
+ */
+#ifndef BVH_H_INCLUDED
+#define BVH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cull.h"
+#include "utils.h"
+
+#define BVH_NULL (-1)
+
+struct BVHNode {
+    float lo[3], hi[3];
+    int32_t parent;         /* next free node while on the free list */
+    int32_t child1, child2; /* BVH_NULL for leaves */
+    int32_t height;         /* 0 for leaves, -1 for free nodes */
+    uint32_t user;          /* leaves only */
+};
+
+struct BVH {
+    struct BVHNode *nodes;
+    size_t capacity;
+    size_t nleaves;
+    int32_t root;
+    int32_t free_list;
+    float margin;
+    /* Scratch space for the insertion search */
+    struct BVHCandidate *heap;
+    size_t heap_capacity;
+};
+
+/* Called for every leaf a query finds, return false to stop the query */
+typedef bool (*BVHQueryFunc)(void *ctx, uint32_t user);
+/* Called for every leaf a ray hits, returns the new maximum ray distance
+ * (the hit distance to clip the ray, or @max_t to ignore the leaf) */
+typedef float (*BVHRayFunc)(void *ctx, uint32_t user, const float origin[3],
+        const float dir[3], float max_t);
+
+void    bvh_init(struct BVH *t, float margin) ATTR((nonnull(1)));
+void    bvh_free(struct BVH *t) ATTR((nonnull(1)));
+
+int32_t bvh_insert(struct BVH *t, const float lo[3], const float hi[3],
+        uint32_t user) ATTR((nonnull(1, 2, 3)));
+void    bvh_remove(struct BVH *t, int32_t leaf) ATTR((nonnull(1)));
+bool    bvh_move(struct BVH *t, int32_t leaf, const float lo[3],
+        const float hi[3]) ATTR((nonnull(1, 3, 4)));
+
+size_t  bvh_cull(const struct BVH *t, const struct Frustum *f, uint32_t *out)
+    ATTR((nonnull(1, 2, 3)));
+void    bvh_overlap(const struct BVH *t, const float lo[3], const float hi[3],
+        BVHQueryFunc fn, void *ctx) ATTR((nonnull(1, 2, 3, 4)));
+float   bvh_raycast(const struct BVH *t, const float origin[3],
+        const float dir[3], float max_t, BVHRayFunc fn, void *ctx)
+    ATTR((nonnull(1, 2, 3, 5)));
+
+int32_t bvh_height(const struct BVH *t) ATTR((nonnull(1)));
+float   bvh_cost(const struct BVH *t) ATTR((nonnull(1)));
+
+#endif /* BVH_H_INCLUDED */
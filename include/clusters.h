@@ -0,0 +1,87 @@
+/* clusters.h - Clustered forward lighting
+ *
+ * The view frustum is split into CLUSTER_X x CLUSTER_Y screen tiles and
+ * CLUSTER_Z depth slices, exponentially spaced, and every point light is
+ * binned into the clusters its sphere touches. Each job bins one slice:
+ * it gathers the lights overlapping the slice's depth range, then tests
+ * them against each of the slice's clusters' view space boxes, eight at a
+ * time with AVX2.
+ *
+ * The lights, the offset and count of each cluster's range of light
+ * indices, and the indices are uploaded as buffer textures that the entity
+ * fragment shader walks for the cluster it falls in. The grid's parameters
+ * travel in the Frame block, see clusters_frame().
+ */
+#ifndef CLUSTERS_H_INCLUDED
+#define CLUSTERS_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "frame.h"
+#include "utils.h"
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+/* Lights a single cluster can hold, the rest are dropped and counted */
+#define CLUSTER_MAX_PER_CLUSTER 128
+/* Light indices are 16 bits */
+#define CLUSTER_MAX_LIGHTS 65535
+
+struct PointLight {
+    vec4 position; /* world space xyz, w is the radius of influence */
+    vec4 color;    /* rgb, w is the intensity */
+};
+
+struct ClusterStats {
+    size_t lights;      /* binned */
+    size_t references;  /* cluster-light pairs */
+    size_t overflows;   /* pairs dropped for CLUSTER_MAX_PER_CLUSTER */
+    double bin_seconds;
+};
+
+struct ClusterGrid {
+    float near, far;      /* view distances the slices span */
+    float width, height;  /* viewport in pixels */
+
+    /* View space bounds of each cluster, x fastest, then y, then slice */
+    float min_x[CLUSTER_COUNT], min_y[CLUSTER_COUNT], min_z[CLUSTER_COUNT];
+    float max_x[CLUSTER_COUNT], max_y[CLUSTER_COUNT], max_z[CLUSTER_COUNT];
+    float slice_scale, slice_bias;
+
+    /* Binning output */
+    uint16_t *slots;      /* CLUSTER_MAX_PER_CLUSTER per cluster */
+    uint32_t counts[CLUSTER_COUNT];
+    uint32_t table[CLUSTER_COUNT * 2]; /* offset, count */
+    uint16_t *indices;
+    size_t nindices, indices_capacity;
+
+    /* View space light spheres */
+    float *x, *y, *z, *r;
+    size_t nlights, lights_capacity;
+
+    GLuint buffers[3];    /* lights, table, indices */
+    GLuint textures[3];
+
+    struct ClusterStats stats;
+};
+
+void clusters_init(struct ClusterGrid *g, float width, float height,
+        float far) ATTR((nonnull(1)));
+void clusters_free(struct ClusterGrid *g) ATTR((nonnull(1)));
+
+void clusters_build(struct ClusterGrid *g, mat4 projection)
+    ATTR((nonnull(1, 2)));
+void clusters_bin(struct ClusterGrid *g, mat4 view,
+        const struct PointLight *lights, size_t n) ATTR((nonnull(1, 2)));
+void clusters_upload(struct ClusterGrid *g, const struct PointLight *lights,
+        size_t n) ATTR((nonnull(1)));
+void clusters_frame(const struct ClusterGrid *g, struct FrameUniforms *frame)
+    ATTR((nonnull(1, 2)));
+void clusters_force_scalar(bool scalar);
+
+#endif /* CLUSTERS_H_INCLUDED */
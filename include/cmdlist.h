@@ -0,0 +1,85 @@
+/* cmdlist.h - Draws recorded on worker threads, replayed on the GL thread
+ *
+ * Each frame a CommandQueue reserves room for every instance it may draw,
+ * in the frame ring when it fits. Jobs cull, pick state and pack instance
+ * data on any thread, carving their instances out of that reservation with
+ * an atomic bump and appending compact DrawPackets to the list of the
+ * thread they run on. Nothing in recording touches OpenGL.
+ *
+ * cmdqueue_submit() then merges the per-thread lists on the GL thread,
+ * sorts them by key and recording order, and replays them through the
+ * cached state helpers of glutils.
+ */
+#ifndef CMDLIST_H_INCLUDED
+#define CMDLIST_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "entity.h"
+#include "jobs.h"
+#include "ringbuffer.h"
+#include "transform.h"
+#include "utils.h"
+
+/* One instanced draw of a Model's layout, entity.vertex.glsl attributes */
+struct DrawPacket {
+    uint64_t key;         /* e.g. render_key(), draws replay in key order */
+    uint32_t order;       /* breaks key ties, recording order of the caller */
+    GLuint program, vao, texture;
+    GLsizei count;        /* indices */
+    uint32_t first;       /* instance offset into the frame's matrices */
+    GLuint resident;      /* or into this instance buffer if nonzero */
+    uint32_t ninstances;
+};
+
+struct CommandList {
+    struct DrawPacket *packets;
+    size_t count, capacity;
+};
+
+struct CommandQueueStats {
+    size_t packets;
+    size_t instances;
+    double record_seconds; /* wall time of cmdqueue_record_entities() */
+    double submit_seconds;
+};
+
+struct CommandQueue {
+    struct CommandList lists[JOBS_MAX_THREADS]; /* indexed by job thread */
+    struct DrawPacket *merged;
+    size_t merged_capacity;
+
+    /* This frame's matrices, in the ring or in staging memory */
+    mat4 *instances;
+    struct RingAlloc alloc;
+    bool in_ring;
+    mat4 *staging;
+    GLuint vbo_staging;
+    size_t capacity, staging_capacity;
+    SDL_atomic_t used;
+    uint32_t recorded;    /* entities recorded this frame, orders packets */
+
+    struct CommandQueueStats stats;
+};
+
+void  cmdqueue_init(struct CommandQueue *q) ATTR((nonnull(1)));
+void  cmdqueue_free(struct CommandQueue *q) ATTR((nonnull(1)));
+
+void  cmdqueue_begin(struct CommandQueue *q, size_t max_instances)
+    ATTR((nonnull(1)));
+mat4 *cmdqueue_alloc(struct CommandQueue *q, size_t n, uint32_t *first)
+    ATTR((nonnull(1, 3)));
+void  cmdlist_draw(struct CommandQueue *q, unsigned thread,
+        const struct DrawPacket *packet) ATTR((nonnull(1, 3)));
+void  cmdqueue_submit(struct CommandQueue *q) ATTR((nonnull(1)));
+
+void  cmdqueue_record_entities(struct CommandQueue *q, const struct Model *m,
+        const struct Entity *entity, size_t n) ATTR((nonnull(1, 2, 3)));
+void  cmdqueue_record_transforms(struct CommandQueue *q, const struct Model *m,
+        const struct TransformBatch *b, const uint32_t *indices, size_t n)
+    ATTR((nonnull(1, 2, 3)));
+
+#endif /* CMDLIST_H_INCLUDED */
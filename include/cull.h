@@ -0,0 +1,60 @@
+/* cull.h - Frustum culling of bounding volumes
+ *
+ * Bounds are stored as structure-of-arrays so they can be tested 4 (SSE) or
+ * 8 (AVX) at a time against the six frustum planes.
+ */
+#ifndef CULL_H_INCLUDED
+#define CULL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "utils.h"
+
+/* Six normalized planes, a point p is inside when dot(n, p) + d >= 0 */
+struct Frustum {
+    vec4 planes[6];
+};
+
+/* Bounding spheres, structure-of-arrays */
+struct SphereBatch {
+    float *x, *y, *z, *r;
+    size_t count, capacity;
+};
+
+/* Axis-aligned boxes as center and half extents, structure-of-arrays */
+struct BoxBatch {
+    float *cx, *cy, *cz;
+    float *ex, *ey, *ez;
+    size_t count, capacity;
+};
+
+/* Frustum culling results, accumulated by the caller */
+struct CullStats {
+    size_t visible, culled;
+    double seconds;
+};
+
+/* Which implementation to use, for benchmarking */
+enum CullImpl {
+    CULL_AUTO,
+    CULL_SCALAR,
+    CULL_SSE,
+    CULL_AVX
+};
+
+void frustum_from_matrix(mat4 viewproj, struct Frustum *out) ATTR((nonnull(2)));
+
+void sphere_batch_reserve(struct SphereBatch *b, size_t n) ATTR((nonnull(1)));
+void sphere_batch_free(struct SphereBatch *b) ATTR((nonnull(1)));
+void box_batch_reserve(struct BoxBatch *b, size_t n) ATTR((nonnull(1)));
+void box_batch_free(struct BoxBatch *b) ATTR((nonnull(1)));
+
+size_t cull_spheres(const struct Frustum *f, const struct SphereBatch *b,
+        uint32_t *visible) ATTR((nonnull(1, 2, 3)));
+size_t cull_boxes(const struct Frustum *f, const struct BoxBatch *b,
+        uint32_t *visible) ATTR((nonnull(1, 2, 3)));
+
+void cull_force_impl(enum CullImpl impl);
+
+#endif /* CULL_H_INCLUDED */
@@ -0,0 +1,61 @@
+/* deferred.h - Deferred shading, the alternative to forward rendering
+ *
+ * Entities are drawn once into a G-buffer: albedo, an octahedral packed
+ * world space normal and depth. A full screen pass then reconstructs each
+ * pixel's position from depth and lights it with the sun from the Frame
+ * block plus the point lights of its cluster, read from the same buffers
+ * clusters_upload() fills for the forward path. Lighting cost follows the
+ * pixels on screen rather than the triangles drawn.
+ *
+ * The G-buffer's depth is copied to the framebuffer that was bound before,
+ * so forward passes drawn later still depth test against the entities. Only
+ * the viewport's area is used, which may be smaller than the G-buffer, see
+ * dynres.h.
+ */
+#ifndef DEFERRED_H_INCLUDED
+#define DEFERRED_H_INCLUDED
+
+#include <stddef.h>
+#include <GL/glew.h>
+#include "entity.h"
+#include "shaderpp.h"
+#include "transform.h"
+#include "utils.h"
+
+enum RenderMode {
+    RENDER_FORWARD,
+    RENDER_DEFERRED,
+};
+
+struct GBuffer {
+    GLsizei width, height;
+    GLuint fbo;
+    GLuint albedo;   /* RGBA8 */
+    GLuint normal;   /* RG16_SNORM, octahedral world space normal */
+    GLuint depth;    /* DEPTH24_STENCIL8, as the default framebuffer's */
+
+    /* entity.vertex.glsl + entity.gbuffer.fragment.glsl for each set of
+     * ShaderFeatures, built when a Model first needs it */
+    GLuint geometry[SHADER_VARIANTS];
+    GLuint lighting; /* the full screen pass */
+    GLint inv_view_projection;
+    GLint viewport_size;
+    GLint target;    /* framebuffer bound at deferred_begin() */
+    GLint viewport[4];
+    GLuint vao;      /* empty, the full screen triangle needs no attributes */
+};
+
+enum RenderMode parse_render_mode(int argc, char *argv[]) ATTR((nonnull(2)));
+
+void gbuffer_init(struct GBuffer *g, GLsizei width, GLsizei height)
+    ATTR((nonnull(1)));
+void gbuffer_free(struct GBuffer *g) ATTR((nonnull(1)));
+
+void deferred_begin(struct GBuffer *g) ATTR((nonnull(1)));
+void deferred_entities(struct GBuffer *g, const struct Model *m,
+        const struct Entity *entity, size_t n) ATTR((nonnull(1, 2, 3)));
+void deferred_transforms(struct GBuffer *g, const struct Model *m,
+        struct TransformBatch *b) ATTR((nonnull(1, 2, 3)));
+void deferred_end(const struct GBuffer *g) ATTR((nonnull(1)));
+
+#endif /* DEFERRED_H_INCLUDED */
@@ -0,0 +1,62 @@
+/* dynres.h - Dynamic resolution scaling
+ *
+ * The frame is drawn into an offscreen target whose used area is a fraction
+ * of the window, then stretched onto the window. GPU time of every frame is
+ * measured with GL_TIME_ELAPSED queries, which are only read once the
+ * driver has them, a few frames later, so measuring never stalls. The
+ * fraction is steered from those times towards a frame time target:
+ * straight down when over it, back up slowly when comfortably under it.
+ *
+ * The scale applies to both axes, so the projection's aspect ratio holds.
+ */
+#ifndef DYNRES_H_INCLUDED
+#define DYNRES_H_INCLUDED
+
+#include <stdbool.h>
+#include <GL/glew.h>
+#include "utils.h"
+
+/* Queries in flight, the frames of latency a measurement may have */
+#define DYNRES_QUERIES 4
+
+struct DynResConfig {
+    double target_ms;      /* GPU time per frame to aim for */
+    float min_scale;       /* of the window's width and height */
+    float max_scale;       /* at most 1, the target is window sized */
+    float max_step;        /* largest change of scale per decision */
+    double headroom;       /* fraction under target before scaling up */
+    unsigned settle;       /* frames to wait after a change */
+    bool log;              /* print every change to stderr */
+};
+
+struct DynRes {
+    GLsizei width, height;               /* of the window */
+    GLsizei render_width, render_height; /* of this frame */
+    float scale;
+    struct DynResConfig config;
+
+    GLuint fbo, color, depth;  /* window sized */
+    GLint viewport[4];         /* restored by dynres_end() */
+
+    GLuint queries[DYNRES_QUERIES];
+    bool pending[DYNRES_QUERIES];
+    bool timing;               /* this frame has a query running */
+    unsigned frame;
+    unsigned settling;
+    double gpu_ms;             /* latest measurement, 0 before the first */
+    unsigned changes;
+};
+
+void dynres_default_config(struct DynResConfig *out) ATTR((nonnull(1)));
+void dynres_parse_args(struct DynResConfig *config, int argc, char *argv[])
+    ATTR((nonnull(1, 3)));
+
+void dynres_init(struct DynRes *d, GLsizei width, GLsizei height,
+        const struct DynResConfig *config) ATTR((nonnull(1, 4)));
+void dynres_free(struct DynRes *d) ATTR((nonnull(1)));
+
+void dynres_begin(struct DynRes *d) ATTR((nonnull(1)));
+void dynres_end(struct DynRes *d) ATTR((nonnull(1)));
+float dynres_feedback(struct DynRes *d, double gpu_ms) ATTR((nonnull(1)));
+
+#endif /* DYNRES_H_INCLUDED */
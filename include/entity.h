@@ -2,7 +2,10 @@
 #define ENTITY_H_INCLUDED
 
 #include <GL/glew.h>
+#include <cglm/cglm.h>
 #include "utils.h"
+#include "cull.h"
+#include "occlusion.h"
 
 struct Entity {
     float x, y, z;
@@ -17,13 +20,11 @@ struct Model {
            vbo_texture_uv,
            vbo_normals,
            ebo_indices,
+           vbo_instances,
            texture;
-    GLint model_uniform,
-          view_uniform,
-          projection_uniform,
-          light_pos_uniform,
-          light_color_uniform;
     GLsizei num_indices;
+    unsigned features; /* ShaderFeatures the program was built with */
+    vec4 bounds; /* object space bounding sphere, xyz center + w radius */
 };
 
 struct ModelData {
@@ -45,6 +46,23 @@ void create_model(const struct ModelData *data, struct Model *out)
 void destroy_model(const struct Model *model) 
     ATTR((nonnull(1)));
 
+void entity_model_matrix(const struct Entity *entity, mat4 out)
+    ATTR((nonnull(1, 2)));
+void mesh_bounds(const GLfloat *vertices, GLsizei count, vec4 out)
+    ATTR((nonnull(1, 3)));
+size_t collect_instances(const vec4 bounds, const struct Entity *entity,
+        size_t n, mat4 *out) ATTR((nonnull(1, 2, 4)));
+
+const struct CullStats *entity_cull_stats(void) ATTR((returns_nonnull));
+void reset_entity_cull_stats(void);
+void set_entity_occluders(struct OcclusionBuffer *occluders);
+size_t cull_entity_spheres(const struct SphereBatch *spheres, uint32_t *visible)
+    ATTR((nonnull(1, 2)));
+
+void upload_instances(const struct Model *m, mat4 *instances, size_t n)
+    ATTR((nonnull(1, 2)));
+void point_instances(GLuint buffer, GLintptr offset);
+
 void render_entity(const struct Model *model, const struct Entity *entity)
     ATTR((nonnull(1, 2)));
 void render_entities(const struct Model *model, const struct Entity *entity, 
@@ -0,0 +1,63 @@
+/* frame.h - Per-frame uniform data
+ *
+ * Camera and lighting state that is constant across a frame lives in one
+ * std140 uniform buffer, written once per frame and shared by every program
+ * through the "Frame" uniform block.
+ *
+ * The block is streamed through the frame's RingBuffer, which other modules
+ * use for their own per-frame data, see frame_ring() and stream_buffer().
+ */
+#ifndef FRAME_H_INCLUDED
+#define FRAME_H_INCLUDED
+
+#include <stdint.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "utils.h"
+#include "cull.h"
+#include "ringbuffer.h"
+
+/* Uniform buffer binding point of the Frame block */
+#define FRAME_UBO_BINDING 0
+
+/* First of the texture units holding the clustered light buffers */
+#define FRAME_CLUSTER_UNIT 4
+
+/* Texture unit of the cascaded shadow map array, after the cluster ones */
+#define FRAME_SHADOW_UNIT 7
+
+/* Shadow cascades the Frame block has room for, see shadows.h */
+#define FRAME_SHADOW_CASCADES 4
+
+/* Bytes of streamed data each frame can use */
+#define FRAME_RING_SIZE (8 * 1024 * 1024)
+
+/* Mirrors the std140 "Frame" block in the shaders */
+struct FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 light_pos;   /* xyz used */
+    vec4 light_color; /* rgb used */
+    /* Clustered point lights, see clusters.h, all 0 without */
+    vec4 cluster_scale;       /* tiles per pixel x, y, slice scale, bias */
+    int32_t cluster_dims[4];  /* tiles x, y, slices, point lights */
+    /* Directional sun with cascaded shadows, see shadows.h */
+    vec4 sun_direction;       /* xyz the way the light travels, w intensity */
+    vec4 shadow_splits;       /* view distance each cascade ends at, 0 off */
+    mat4 shadow_matrices[FRAME_SHADOW_CASCADES]; /* world to shadow map */
+};
+
+void init_frame(void);
+void cleanup_frame(void);
+
+void default_frame(struct FrameUniforms *out) ATTR((nonnull(1)));
+void upload_frame(const struct FrameUniforms *frame) ATTR((nonnull(1)));
+const struct FrameUniforms *current_frame(void) ATTR((returns_nonnull));
+const struct Frustum *current_frustum(void) ATTR((returns_nonnull));
+struct RingBuffer *frame_ring(void) ATTR((returns_nonnull));
+GLuint stream_buffer(GLenum target, GLuint fallback, const void *data,
+        size_t size, GLintptr *offset) ATTR((nonnull(3, 5)));
+
+void bind_frame_block(GLuint program);
+
+#endif /* FRAME_H_INCLUDED */
@@ -13,8 +13,13 @@
 
 /* Generating buffers (Array buffers + Element array buffers) */
 GLuint gen_buffer(GLenum type, GLsizei size, const void *data) ATTR((nonnull(3)));
+void   bind_buffer(GLenum target, GLuint buffer);
+void   bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+void   bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+        GLintptr offset, GLsizeiptr size);
 void   attrib_buffer(GLuint index, GLint size, GLenum type, 
         GLsizei stride, intptr_t offset);
+void   attrib_divisor(GLuint index, GLuint divisor);
 void   del_buffer(GLuint buffer);
 
 /* Generating vertex array objects */
@@ -25,16 +30,48 @@ void   del_array(GLuint vao);
 /* Generating shaders */
 GLuint make_shader(GLenum type, const char *src)  ATTR((nonnull(2)));
 GLuint load_shader(GLenum type, const char *path) ATTR((nonnull(2))); 
+GLuint start_shader(GLenum type, const char *src) ATTR((nonnull(2)));
 
 /* Generating shader programs */
 GLuint make_program(GLuint shader1, GLuint shader2);
+GLuint start_program(GLuint shader1, GLuint shader2);
+bool   program_linked(GLuint program);
+void   finish_program(GLuint program);
 GLuint load_program(const char *vpath, const char *fpath) ATTR((nonnull(1,2)));
 void   use_program(GLuint prog); 
 void   del_program(GLuint prog);
 
+/* Setting uniforms */
+void   set_uniform_mat4(GLint loc, const GLfloat *m) ATTR((nonnull(2)));
+void   set_uniform_vec3(GLint loc, const GLfloat *v) ATTR((nonnull(2)));
+void   set_uniform_vec4(GLint loc, const GLfloat *v) ATTR((nonnull(2)));
+void   set_uniform_int(GLint loc, GLint v);
+void   update_uniform_buffer(GLuint ubo, GLintptr offset, GLsizeiptr size,
+        const void *data) ATTR((nonnull(4)));
+
+/* Drawing */
+void   draw_instanced(GLsizei count, GLsizei instances);
+void   draw_arrays_instanced(GLenum mode, GLsizei count, GLsizei instances);
+void   draw_multi_indirect(GLintptr offset, GLsizei ncommands);
+
+/* Call counters, reset once per frame */
+struct GLStats {
+    unsigned uniform_calls;
+    unsigned uniform_buffer_updates;
+    unsigned draw_calls;
+    unsigned state_calls;         /* binds that reached the driver */
+    unsigned state_calls_skipped; /* binds of what was already bound */
+};
+void   reset_gl_stats(void);
+/* Binds are cached, call after changing them without these helpers */
+void   invalidate_gl_state(void);
+const struct GLStats *gl_stats(void) ATTR((returns_nonnull));
+
 /* Generating textures */
 GLuint load_texture(const char *path);
+void   active_texture(GLuint unit);
 void   bind_texture(GLuint tex);
+void   bind_texture_unit(GLuint unit, GLuint tex);
 void   del_texture(GLuint tex);
 
 #if defined(NDEBUG)
@@ -0,0 +1,49 @@
+/* impostor.h - Octahedral impostors for distant entities
+ *
+ * A Model is baked offscreen from a grid of directions spread over the
+ * sphere with an octahedral mapping, into an albedo atlas and a normal +
+ * depth atlas. Past a distance, entities are drawn as one camera facing
+ * quad each that blends the four baked views closest to the direction it
+ * is seen from, and is lit with the baked normals.
+ *
+ * Baking only needs an OpenGL 3.3 context, Mesa's llvmpipe will do.
+ */
+#ifndef IMPOSTOR_H_INCLUDED
+#define IMPOSTOR_H_INCLUDED
+
+#include <stddef.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "entity.h"
+#include "utils.h"
+
+struct Impostor {
+    GLuint albedo;       /* RGBA8, alpha is coverage */
+    GLuint normal_depth; /* RGBA8, object space normal and depth */
+    unsigned grid;       /* views per side of the atlases */
+    unsigned cell;       /* pixels per side of one view */
+    vec4 bounds;         /* the baked Model's */
+
+    GLuint program;
+    GLuint vao;
+    GLuint vbo_instances;
+};
+
+struct ImpostorStats {
+    size_t meshes;          /* entities drawn with the full Model */
+    size_t impostors;       /* entities drawn as quads */
+    size_t triangles_saved; /* Model triangles not drawn */
+};
+
+void impostor_bake(const struct Model *m, unsigned grid, unsigned cell,
+        struct Impostor *out) ATTR((nonnull(1, 4)));
+void impostor_free(struct Impostor *imp) ATTR((nonnull(1)));
+
+void render_impostors(const struct Model *m, const struct Impostor *imp,
+        const struct Entity *entity, size_t n, float distance)
+    ATTR((nonnull(1, 2, 3)));
+
+const struct ImpostorStats *impostor_stats(void) ATTR((returns_nonnull));
+void reset_impostor_stats(void);
+
+#endif /* IMPOSTOR_H_INCLUDED */
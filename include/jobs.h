@@ -0,0 +1,41 @@
+/* jobs.h - A small worker thread pool
+ *
+ * Splits index ranges into chunks that are executed on SDL worker threads.
+ * The submitting thread helps execute queued chunks while it waits, so the
+ * pool still works (serially) when it has no workers or was never started.
+ */
+#ifndef JOBS_H_INCLUDED
+#define JOBS_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <SDL.h>
+#include "utils.h"
+
+/* Maximum number of threads (workers + the submitting thread) */
+#define JOBS_MAX_THREADS 32
+
+/* A job processes the index range [begin, end)
+ * @thread is 0 on the submitting thread and 1..jobs_worker_count() on
+ * workers, which makes it usable as an index into per-thread scratch data */
+typedef void (*JobFunc)(void *arg, size_t begin, size_t end, unsigned thread);
+
+/* Tracks completion of a set of submitted jobs */
+struct JobGroup {
+    SDL_atomic_t pending;
+};
+
+#define JOB_GROUP_INIT { { 0 } }
+
+void     jobs_init(unsigned nworkers);
+void     jobs_shutdown(void);
+unsigned jobs_worker_count(void);
+
+void jobs_submit(struct JobGroup *group, JobFunc fn, void *arg,
+        size_t count, size_t grain) ATTR((nonnull(1, 2)));
+bool jobs_poll(struct JobGroup *group) ATTR((nonnull(1)));
+void jobs_wait(struct JobGroup *group) ATTR((nonnull(1)));
+void jobs_parallel_for(JobFunc fn, void *arg, size_t count, size_t grain)
+    ATTR((nonnull(1)));
+
+#endif /* JOBS_H_INCLUDED */
@@ -0,0 +1,79 @@
+/* lod.h - Screen-space error level of detail selection
+ *
+ * A LodChain lists the Models of one object from finest to coarsest, each
+ * with its geometric error as a fraction of the bounding sphere radius.
+ * Every frame each entity's bounding sphere is projected with the frame's
+ * camera, giving the error of each level in pixels, and the
+ * coarsest level within the threshold is picked. Entities only switch once
+ * the error leaves a band around the threshold, so they don't pop back and
+ * forth at the boundary.
+ *
+ * The threshold is scaled by 2^bias, a global knob lod_feedback() turns
+ * from frame times.
+ *
+ * Without authored levels, lod_simplified() makes coarser ones from a mesh
+ * by clustering its vertices on a grid.
+ */
+#ifndef LOD_H_INCLUDED
+#define LOD_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "entity.h"
+#include "frame.h"
+#include "transform.h"
+#include "utils.h"
+
+#define LOD_MAX_LEVELS 4
+
+/* Entities whose level was not picked yet */
+#define LOD_UNSET UINT8_MAX
+
+struct LodChain {
+    const struct Model *levels[LOD_MAX_LEVELS]; /* finest first */
+    float error[LOD_MAX_LEVELS]; /* fractions of the bounding radius */
+    unsigned nlevels;
+};
+
+struct LodSelector {
+    float threshold;       /* pixels of error allowed */
+    float hysteresis;      /* half width of the switching band, a fraction */
+    float bias;            /* log2 scale of the threshold */
+    float viewport_height; /* pixels */
+
+    uint8_t *level;        /* per entity, kept between frames */
+    size_t capacity;
+
+    unsigned counts[LOD_MAX_LEVELS]; /* entities per level, last selection */
+    unsigned switches;               /* level changes, last selection */
+};
+
+void  lod_init(struct LodSelector *s, float threshold, float viewport_height)
+    ATTR((nonnull(1)));
+void  lod_free(struct LodSelector *s) ATTR((nonnull(1)));
+
+void  lod_select(struct LodSelector *s, const struct LodChain *chain,
+        const struct FrameUniforms *frame, const struct Entity *entity,
+        size_t n) ATTR((nonnull(1, 2, 3)));
+void  lod_select_transforms(struct LodSelector *s,
+        const struct LodChain *chain, const struct FrameUniforms *frame,
+        const struct TransformBatch *b) ATTR((nonnull(1, 2, 3, 4)));
+float lod_feedback(struct LodSelector *s, double frame_ms, double target_ms)
+    ATTR((nonnull(1)));
+
+const struct Entity *lod_group(const struct LodSelector *s,
+        const struct LodChain *chain, const struct Entity *entity, size_t n,
+        size_t start[LOD_MAX_LEVELS + 1]) ATTR((nonnull(1, 2, 3, 5)));
+void  lod_order(const struct LodSelector *s, const struct LodChain *chain,
+        size_t n, uint32_t *order, size_t start[LOD_MAX_LEVELS + 1])
+    ATTR((nonnull(1, 2, 4, 5)));
+void  render_lod(struct LodSelector *s, const struct LodChain *chain,
+        const struct Entity *entity, size_t n) ATTR((nonnull(1, 2, 3)));
+
+GLsizei lod_simplify(const struct ModelData *data, float cell, GLuint *out)
+    ATTR((nonnull(1, 3)));
+void  lod_simplified(struct LodChain *chain, const struct Model *base,
+        const struct ModelData *data, struct Model *coarse, unsigned nlevels)
+    ATTR((nonnull(1, 2, 3, 4)));
+
+#endif /* LOD_H_INCLUDED */
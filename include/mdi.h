@@ -0,0 +1,73 @@
+/* mdi.h - Multi-draw indirect rendering
+ *
+ * A MeshPool packs many meshes into one set of vertex and index buffers so
+ * that Entities of every mesh can be drawn with a single
+ * glMultiDrawElementsIndirect call. Culling happens on the CPU and writes one
+ * DrawElementsIndirectCommand per mesh with visible instances.
+ *
+ * Needs OpenGL 4.3 (or ARB_multi_draw_indirect + ARB_base_instance), check
+ * mdi_supported() and fall back to Models and render_entities() otherwise.
+ */
+#ifndef MDI_H_INCLUDED
+#define MDI_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "entity.h"
+#include "utils.h"
+
+/* Layout fixed by OpenGL */
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint  base_vertex;
+    GLuint base_instance;
+};
+
+struct PoolMesh {
+    GLuint first_index, index_count;
+    GLint  base_vertex;
+    vec4   bounds; /* object space bounding sphere */
+};
+
+struct MeshPool {
+    GLuint program,
+           vao,
+           vbo_vertices,
+           vbo_texture_uv,
+           vbo_normals,
+           ebo_indices,
+           vbo_instances,
+           ibo_commands,
+           texture;
+    struct PoolMesh *meshes;
+    size_t nmeshes, meshes_capacity;
+    /* Geometry staged by mesh_pool_add() until mesh_pool_upload() */
+    struct MeshStaging *staging;
+};
+
+/* Entities that all use the same mesh of a pool */
+struct PoolBatch {
+    uint32_t mesh;
+    const struct Entity *entities;
+    size_t count;
+};
+
+bool     mdi_supported(void);
+
+void     mesh_pool_init(struct MeshPool *pool, const char *vert_filepath,
+        const char *frag_filepath, const char *tex_filepath)
+    ATTR((nonnull(1, 2, 3)));
+uint32_t mesh_pool_add(struct MeshPool *pool, const struct ModelData *data)
+    ATTR((nonnull(1, 2)));
+void     mesh_pool_upload(struct MeshPool *pool) ATTR((nonnull(1)));
+void     mesh_pool_free(struct MeshPool *pool) ATTR((nonnull(1)));
+
+void     render_pool(const struct MeshPool *pool, const struct PoolBatch *batch,
+        size_t nbatches) ATTR((nonnull(1, 2)));
+
+#endif /* MDI_H_INCLUDED */
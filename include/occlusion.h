@@ -0,0 +1,59 @@
+/* occlusion.h - Software occlusion culling
+ *
+ * A few large occluders (low detail meshes) are rasterized into a small
+ * CPU depth buffer, then entity bounds are tested against it before they
+ * are drawn. The buffer keeps the farthest depth of every tile so most
+ * tests finish without looking at individual pixels.
+ *
+ * Everything runs on the CPU, no OpenGL context is needed.
+ */
+#ifndef OCCLUSION_H_INCLUDED
+#define OCCLUSION_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <cglm/cglm.h>
+#include "cull.h"
+#include "utils.h"
+
+/* Tile size of the hierarchical depth, the width is one AVX register */
+#define OCCLUSION_TILE_W 8
+#define OCCLUSION_TILE_H 8
+
+struct OcclusionStats {
+    size_t triangles;  /* occluder triangles rasterized */
+    size_t tested;     /* bounds tested */
+    size_t occluded;   /* bounds found hidden */
+    double raster_seconds, test_seconds;
+};
+
+struct OcclusionBuffer {
+    int width, height;     /* pixels, multiples of the tile size */
+    int tiles_x, tiles_y;
+    float *depth;          /* row-major, 0 at the near plane, 1 at the far */
+    float *tile_max;       /* farthest depth in each tile */
+    mat4 viewproj;
+    struct OcclusionStats stats;
+};
+
+void occlusion_init(struct OcclusionBuffer *b, int width, int height)
+    ATTR((nonnull(1)));
+void occlusion_free(struct OcclusionBuffer *b) ATTR((nonnull(1)));
+
+void occlusion_begin(struct OcclusionBuffer *b, mat4 viewproj)
+    ATTR((nonnull(1, 2)));
+void occlusion_rasterize(struct OcclusionBuffer *b, mat4 model,
+        const float *vertices, const uint32_t *indices, size_t nindices)
+    ATTR((nonnull(1, 2, 3, 4)));
+void occlusion_finish(struct OcclusionBuffer *b) ATTR((nonnull(1)));
+
+bool   occlusion_test_box(struct OcclusionBuffer *b, const float lo[3],
+        const float hi[3]) ATTR((nonnull(1, 2, 3)));
+size_t occlusion_cull_spheres(struct OcclusionBuffer *b,
+        const struct SphereBatch *spheres, const uint32_t *in, size_t n,
+        uint32_t *out) ATTR((nonnull(1, 2, 3, 5)));
+
+void occlusion_force_scalar(bool scalar);
+
+#endif /* OCCLUSION_H_INCLUDED */
@@ -0,0 +1,95 @@
+/* pacer.h - Frame pacing and latency control
+ *
+ * The main loop calls pacer_wait() before it samples input,
+ * pacer_gpu_begin() once the frame's CPU-only work is done and its draws
+ * are about to be issued, and pacer_present() instead of
+ * SDL_GL_SwapWindow(). Between them the pacer:
+ *  - bounds the frames the GPU may lag behind with fence syncs, so input
+ *    is never sampled for a frame that will sit queued in the driver
+ *  - sleeps until the moment the mode wants the next frame started,
+ *    SDL_Delay() for the bulk and a short spin for the rest
+ *  - times each frame's CPU work, its GPU work from pacer_gpu_begin() to
+ *    the swap (timestamp queries, read back without waiting) and the swap
+ *    itself
+ *
+ * Modes:
+ *  - PACE_VSYNC: swap interval 1, whatever the driver does
+ *  - PACE_ADAPTIVE: late swap tearing, swap interval -1, vsync if missing
+ *  - PACE_CAPPED: no vsync, frames started at a fixed rate
+ *  - PACE_LOW_LATENCY: vsync with one frame in flight, input sampled as
+ *    late as the last frames' cost allows before the next vblank
+ */
+#ifndef PACER_H_INCLUDED
+#define PACER_H_INCLUDED
+
+#include <stdbool.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "utils.h"
+
+/* Most frames the GPU may be behind the CPU */
+#define PACER_MAX_IN_FLIGHT 3
+/* GPU timestamp pairs in flight */
+#define PACER_QUERIES 4
+/* Frames of timing kept */
+#define PACER_HISTORY 128
+
+enum PaceMode {
+    PACE_VSYNC,
+    PACE_ADAPTIVE,
+    PACE_CAPPED,
+    PACE_LOW_LATENCY,
+};
+
+struct PacerConfig {
+    enum PaceMode mode;
+    double fps;            /* PACE_CAPPED's rate, 0 for the display's */
+    unsigned in_flight;    /* 1 to PACER_MAX_IN_FLIGHT */
+    double spin_ms;        /* end of a sleep spent spinning, for precision */
+    double margin_ms;      /* PACE_LOW_LATENCY's allowance for misprediction */
+    bool log;              /* print a summary every PACER_HISTORY frames */
+};
+
+struct FrameTiming {
+    double cpu_ms;      /* pacer_wait() returning to pacer_present() */
+    double gpu_ms;      /* pacer_gpu_begin() to the swap on the GPU, filled
+                           in a few frames late, 0 until then */
+    double present_ms;  /* in SDL_GL_SwapWindow() */
+    double fence_ms;    /* waiting for the GPU to catch up */
+    double sleep_ms;    /* sleeping for the mode */
+    double interval_ms; /* since the previous frame started */
+};
+
+struct Pacer {
+    struct PacerConfig config;
+    double period_ms;      /* time between frames the mode aims for */
+    int swap_interval;     /* as set, may differ from the mode's wish */
+
+    GLsync fences[PACER_MAX_IN_FLIGHT];
+    GLuint queries[PACER_QUERIES * 2]; /* start and end of each frame */
+    bool pending[PACER_QUERIES];
+    bool gpu_begun;        /* this frame's start timestamp was issued */
+    unsigned long frames;
+
+    double frame_start, last_start, last_present; /* ms */
+    double work_ms;        /* smoothed max of CPU and GPU time */
+
+    struct FrameTiming history[PACER_HISTORY];
+};
+
+void pacer_default_config(struct PacerConfig *out) ATTR((nonnull(1)));
+void pacer_parse_args(struct PacerConfig *config, int argc, char *argv[])
+    ATTR((nonnull(1, 3)));
+
+void pacer_init(struct Pacer *p, SDL_Window *window,
+        const struct PacerConfig *config) ATTR((nonnull(1, 2, 3)));
+void pacer_free(struct Pacer *p) ATTR((nonnull(1)));
+
+void pacer_wait(struct Pacer *p) ATTR((nonnull(1)));
+void pacer_gpu_begin(struct Pacer *p) ATTR((nonnull(1)));
+void pacer_present(struct Pacer *p, SDL_Window *window) ATTR((nonnull(1, 2)));
+
+const struct FrameTiming *pacer_timing(const struct Pacer *p, unsigned ago)
+    ATTR((nonnull(1)));
+
+#endif /* PACER_H_INCLUDED */
@@ -0,0 +1,43 @@
+/* progcache.h - On-disk cache of linked shader programs
+ *
+ * Linked programs are saved with glGetProgramBinary() into one cache file
+ * and loaded back with glProgramBinary() on later runs, which skips
+ * compiling and linking. Entries are keyed by a hash of both shader
+ * sources, the defines they were built with, and the driver's vendor,
+ * renderer and version strings. A file written by another driver is thrown
+ * away whole; a binary the driver refuses anyway is rebuilt from source
+ * and saved again.
+ *
+ * load_program() goes through the cache. Without progcache_init(), or
+ * without driver support for program binaries, every program is compiled.
+ * progcache_start() and progcache_finish() split a compile so several can
+ * run in the driver at once.
+ */
+#ifndef PROGCACHE_H_INCLUDED
+#define PROGCACHE_H_INCLUDED
+
+#include <stdbool.h>
+#include <GL/glew.h>
+#include "utils.h"
+
+struct ProgCacheStats {
+    unsigned hits;      /* programs loaded from a binary */
+    unsigned misses;    /* compiled, no entry */
+    unsigned rejected;  /* compiled, the driver refused the entry */
+    unsigned stored;    /* binaries written */
+    double seconds;     /* in progcache_program(), total */
+};
+
+bool progcache_init(const char *path);
+void progcache_shutdown(void);
+
+GLuint progcache_program(const char *vertex, const char *fragment,
+        const char *defines) ATTR((nonnull(1, 2)));
+
+GLuint progcache_start(const char *vertex, const char *fragment,
+        const char *defines) ATTR((nonnull(1, 2)));
+bool progcache_finish(GLuint program, bool wait);
+
+const struct ProgCacheStats *progcache_stats(void) ATTR((returns_nonnull));
+
+#endif /* PROGCACHE_H_INCLUDED */
@@ -0,0 +1,63 @@
+/* renderqueue.h - Sorted submission of draws
+ *
+ * Draws are submitted in any order with a 64-bit sort key, radix sorted
+ * once per frame, then walked while only touching GL state that actually
+ * changes. Runs of the same Model in a row become one instanced draw.
+ *
+ * Key layout, most significant bits first:
+ *  opaque:      layer:4 | program:10 | texture:12 | vao:12 | depth:24 | 0:2
+ *  transparent: layer:4 | ~depth:24 | program:10 | texture:12 | vao:12 | 0:2
+ * so opaque draws are grouped by state and go front-to-back inside a group,
+ * while transparent draws go back-to-front regardless of state.
+ */
+#ifndef RENDERQUEUE_H_INCLUDED
+#define RENDERQUEUE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "entity.h"
+#include "utils.h"
+
+enum RenderLayer {
+    RENDER_OPAQUE      = 0,
+    RENDER_TRANSPARENT = 1,
+};
+
+struct RenderItem {
+    uint64_t key;
+    const struct Model *model;
+    uint32_t instance; /* index into the queue's model matrices */
+};
+
+struct RenderQueueStats {
+    size_t items;
+    size_t draws;
+    size_t program_changes;
+    size_t texture_changes;
+    size_t vao_changes;
+    double sort_seconds;
+};
+
+struct RenderQueue {
+    struct RenderItem *items, *scratch;
+    mat4 *instances;       /* model matrices, in submission order */
+    mat4 *sorted;          /* model matrices of one run, in draw order */
+    size_t count, capacity;
+    struct RenderQueueStats stats;
+};
+
+void render_queue_init(struct RenderQueue *q) ATTR((nonnull(1)));
+void render_queue_free(struct RenderQueue *q) ATTR((nonnull(1)));
+
+uint64_t render_key(enum RenderLayer layer, const struct Model *m, float depth)
+    ATTR((nonnull(2)));
+
+void render_queue_begin(struct RenderQueue *q) ATTR((nonnull(1)));
+void render_queue_submit(struct RenderQueue *q, const struct Model *m,
+        const struct Entity *entity, size_t n, enum RenderLayer layer)
+    ATTR((nonnull(1, 2, 3)));
+void render_queue_sort(struct RenderQueue *q) ATTR((nonnull(1)));
+void render_queue_flush(struct RenderQueue *q) ATTR((nonnull(1)));
+
+#endif /* RENDERQUEUE_H_INCLUDED */
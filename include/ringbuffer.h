@@ -0,0 +1,62 @@
+/* ringbuffer.h - Per-frame streaming buffer
+ *
+ * One buffer object split into RING_SEGMENTS segments, one per frame in
+ * flight. Each frame hands out aligned suballocations from its segment that
+ * are written with plain stores, and a fence marks when the GPU is done
+ * with the segment so it can be reused three frames later.
+ *
+ * With ARB_buffer_storage (GL 4.4) the buffer stays persistently mapped.
+ * On plain 3.3 allocations are staged in client memory, the buffer is
+ * orphaned every frame and ring_flush() uploads what was written. Data
+ * written after a later allocation was flushed needs ring_flush_range().
+ */
+#ifndef RINGBUFFER_H_INCLUDED
+#define RINGBUFFER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+#include "utils.h"
+
+#define RING_SEGMENTS 3
+
+struct RingStats {
+    size_t bytes;         /* allocated this frame */
+    size_t overflows;     /* allocations that didn't fit this frame */
+    unsigned waits;       /* fences that weren't signaled yet, total */
+    double wait_seconds;  /* time blocked on them, total */
+};
+
+struct RingBuffer {
+    GLuint buffer;
+    bool persistent;
+    size_t segment_size;
+    size_t alignment;     /* minimum alignment of every allocation */
+    unsigned segment;     /* segment of the current frame */
+    size_t head;          /* next free byte in the current segment */
+    size_t flushed;       /* bytes of the current segment already uploaded */
+    uint8_t *memory;      /* mapping of the whole buffer, or the staging copy */
+    GLsync fences[RING_SEGMENTS];
+    bool in_frame;
+    struct RingStats stats;
+};
+
+/* A suballocation: write through @ptr, point GL at @buffer + @offset */
+struct RingAlloc {
+    void *ptr;
+    GLuint buffer;
+    GLintptr offset;
+};
+
+void ring_init(struct RingBuffer *r, size_t segment_size) ATTR((nonnull(1)));
+void ring_free(struct RingBuffer *r) ATTR((nonnull(1)));
+
+void ring_begin_frame(struct RingBuffer *r) ATTR((nonnull(1)));
+bool ring_alloc(struct RingBuffer *r, size_t size, size_t align,
+        struct RingAlloc *out) ATTR((nonnull(1, 4)));
+void ring_flush(struct RingBuffer *r) ATTR((nonnull(1)));
+void ring_flush_range(struct RingBuffer *r, GLintptr offset, size_t size)
+    ATTR((nonnull(1)));
+
+#endif /* RINGBUFFER_H_INCLUDED */
@@ -0,0 +1,56 @@
+/* scenegraph.h - Parent/child transform hierarchy
+ *
+ * Nodes live in flat arrays sorted breadth-first, so every parent precedes
+ * its children and each level of the hierarchy is one contiguous range.
+ * World matrices are propagated a level at a time, linearly through the
+ * arrays, with the nodes of wide levels split across the job workers.
+ *
+ * Nodes are named by ids that stay valid when the arrays are re-sorted.
+ * World matrices drawn with the entity shaders must scale uniformly, since
+ * those take the normal matrix from the model matrix's upper 3x3.
+ */
+#ifndef SCENEGRAPH_H_INCLUDED
+#define SCENEGRAPH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <cglm/cglm.h>
+#include "entity.h"
+#include "utils.h"
+
+/* Parent of the top level nodes */
+#define SCENE_ROOT UINT32_MAX
+
+struct SceneGraph {
+    /* Per node, by index */
+    uint32_t *parent;  /* index of the parent, SCENE_ROOT for top level */
+    mat4 *local;       /* relative to the parent */
+    mat4 *world;       /* valid after scene_update() */
+    uint32_t *node_id;
+    size_t count, capacity;
+
+    uint32_t *index;   /* index of each node id */
+
+    /* levels[l] is the first index of level l, levels[nlevels] == count */
+    size_t *levels;
+    size_t nlevels, levels_capacity;
+    bool sorted;       /* false after adds, until the next scene_sort() */
+};
+
+void     scene_init(struct SceneGraph *g) ATTR((nonnull(1)));
+void     scene_free(struct SceneGraph *g) ATTR((nonnull(1)));
+
+uint32_t scene_add(struct SceneGraph *g, uint32_t parent, mat4 local)
+    ATTR((nonnull(1, 3)));
+void     scene_set_local(struct SceneGraph *g, uint32_t id, mat4 local)
+    ATTR((nonnull(1, 3)));
+void     scene_set_entity(struct SceneGraph *g, uint32_t id,
+        const struct Entity *entity) ATTR((nonnull(1, 3)));
+void     scene_world(const struct SceneGraph *g, uint32_t id, mat4 out)
+    ATTR((nonnull(1, 3)));
+
+void     scene_sort(struct SceneGraph *g) ATTR((nonnull(1)));
+void     scene_update(struct SceneGraph *g) ATTR((nonnull(1)));
+
+#endif /* SCENEGRAPH_H_INCLUDED */
@@ -0,0 +1,53 @@
+/* shaderpp.h - GLSL includes and specialized shader variants
+ *
+ * preprocess_shader() loads a shader and splices in the files named by its
+ * #include "file" lines, relative to the including file, each file once.
+ * #line directives keep compile errors pointing into the right file: the
+ * source string number is the order files were first included in, 0 for
+ * the shader itself.
+ *
+ * shader_variant() builds a program with a set of ShaderFeatures #defined,
+ * so shaders use #ifdef instead of branching at runtime. Each combination
+ * of files and features is built once and shared by everything that asks
+ * for it.
+ *
+ * With shader_variants_async(), request_shader_variant() only starts a
+ * compile. Requesting every variant up front lets the driver compile them
+ * together, on several threads with KHR_parallel_shader_compile.
+ * poll_shader_variants() once a frame takes in what is done, and draws use
+ * ready_variant() of their program, a flat placeholder until then.
+ */
+#ifndef SHADERPP_H_INCLUDED
+#define SHADERPP_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+#include "utils.h"
+
+/* Each defines the name after SHADER_ in the shaders */
+enum ShaderFeature {
+    SHADER_TEXTURED  = 1 << 0, /* sample texture_sampler for the albedo */
+    SHADER_LIT       = 1 << 1, /* light with the Frame's lights */
+    SHADER_INSTANCED = 1 << 2, /* model matrix per instance, not a uniform */
+};
+#define SHADER_FEATURE_BITS 3
+#define SHADER_VARIANTS (1u << SHADER_FEATURE_BITS)
+
+char *preprocess_shader(const char *path) ATTR((nonnull(1)));
+size_t shader_defines(unsigned features, char *out, size_t size)
+    ATTR((nonnull(2)));
+
+GLuint shader_variant(const char *vpath, const char *fpath, unsigned features)
+    ATTR((nonnull(1, 2)));
+GLuint request_shader_variant(const char *vpath, const char *fpath,
+        unsigned features) ATTR((nonnull(1, 2)));
+void free_shader_variants(void);
+
+/* Compiling in the background */
+void shader_variants_async(bool enable);
+unsigned poll_shader_variants(void);
+void finish_shader_variants(void);
+GLuint ready_variant(GLuint program);
+
+#endif /* SHADERPP_H_INCLUDED */
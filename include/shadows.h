@@ -0,0 +1,76 @@
+/* shadows.h - Cascaded shadow maps for the sun
+ *
+ * The camera frustum is cut into SHADOW_CASCADES slices along the view
+ * direction, spaced between logarithmic and uniform. Each slice gets an
+ * orthographic light view around its bounding sphere. The sphere's radius
+ * doesn't change as the camera turns, and the projection is snapped to
+ * whole shadow map texels, so shadow edges don't shimmer as the camera
+ * moves.
+ *
+ * Casters are culled per cascade with cull_spheres(), the same SIMD test
+ * the camera uses, against the cascade's frustum stretched back towards the
+ * sun. The survivors are drawn with the instanced path, one draw call per
+ * cascade and Model, into one layer of a depth texture array.
+ *
+ * The cascades reach the shaders through the Frame block, see
+ * shadows_fit(), and the depth array through FRAME_SHADOW_UNIT.
+ */
+#ifndef SHADOWS_H_INCLUDED
+#define SHADOWS_H_INCLUDED
+
+#include <stddef.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "cull.h"
+#include "entity.h"
+#include "frame.h"
+#include "transform.h"
+#include "utils.h"
+
+#define SHADOW_CASCADES FRAME_SHADOW_CASCADES
+
+struct ShadowCascade {
+    mat4 view_projection;   /* world to light clip space, texel snapped */
+    struct Frustum frustum; /* including casters between it and the sun */
+    float split;            /* view distance the cascade ends at */
+};
+
+struct ShadowStats {
+    size_t draw_calls;
+    size_t casters[SHADOW_CASCADES]; /* instances drawn into each cascade */
+    size_t culled;                   /* instances culled, all cascades */
+    double cull_seconds;
+};
+
+struct ShadowMaps {
+    GLsizei size;  /* texels per side of each cascade */
+    float range;   /* view distance shadows stop at */
+    float lambda;  /* 0 uniform splits, 1 logarithmic */
+    GLuint depth;  /* DEPTH_COMPONENT24 array, one layer per cascade */
+    GLuint fbo[SHADOW_CASCADES]; /* one per layer */
+    GLuint program;
+    GLint light_view_projection;
+    GLint viewport[4]; /* restored by shadows_end() */
+    GLint target;      /* framebuffer restored by shadows_end() */
+
+    struct ShadowCascade cascades[SHADOW_CASCADES];
+    struct ShadowStats stats;
+};
+
+void shadows_init(struct ShadowMaps *s, GLsizei size, float range)
+    ATTR((nonnull(1)));
+void shadows_free(struct ShadowMaps *s) ATTR((nonnull(1)));
+
+void shadows_fit(struct ShadowMaps *s, struct FrameUniforms *frame)
+    ATTR((nonnull(1, 2)));
+
+void shadows_begin(struct ShadowMaps *s) ATTR((nonnull(1)));
+void shadows_render(struct ShadowMaps *s, const struct Model *m,
+        const struct Entity *entity, size_t n) ATTR((nonnull(1, 2, 3)));
+void shadows_render_transforms(struct ShadowMaps *s, const struct Model *m,
+        const struct TransformBatch *b) ATTR((nonnull(1, 2, 3)));
+void shadows_end(struct ShadowMaps *s) ATTR((nonnull(1)));
+
+void reset_shadow_stats(struct ShadowMaps *s) ATTR((nonnull(1)));
+
+#endif /* SHADOWS_H_INCLUDED */
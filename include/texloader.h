@@ -0,0 +1,28 @@
+/* texloader.h - Batch texture loading
+ *
+ * Decodes many image files in parallel on the job pool and uploads them to
+ * OpenGL on the calling thread as soon as each one is ready.
+ */
+#ifndef TEXLOADER_H_INCLUDED
+#define TEXLOADER_H_INCLUDED
+
+#include <GL/glew.h>
+#include <stddef.h>
+#include "utils.h"
+
+enum TextureFlags {
+    TEXTURE_SRGB        = 1 << 0, /* color data is sRGB encoded */
+    TEXTURE_PREMULTIPLY = 1 << 1, /* multiply color by alpha on decode */
+    TEXTURE_MIPMAPS     = 1 << 2  /* generate a full mip chain */
+};
+
+void load_textures(const char *const *paths, size_t n, unsigned flags,
+        GLuint *out) ATTR((nonnull(1, 4)));
+
+/* Pixel conversion helpers, exposed for benchmarking */
+void expand_rgb_to_rgba(const unsigned char *src, unsigned char *dst,
+        size_t npixels) ATTR((nonnull(1, 2)));
+void premultiply_rgba(unsigned char *pixels, size_t npixels, bool srgb)
+    ATTR((nonnull(1)));
+
+#endif /* TEXLOADER_H_INCLUDED */
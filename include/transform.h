@@ -0,0 +1,77 @@
+/* transform.h - Structure-of-arrays entity transforms
+ *
+ * The same position, rotation and scale as struct Entity, one array per
+ * field. Model matrices are composed directly in closed form,
+ * M = T * Rx * Ry * Rz * S, matching entity_model_matrix(), with one sin/cos
+ * pair per angle. The AVX2 path composes eight entities at a time.
+ *
+ * Each transform caches its world matrix. Mutators mark the transform dirty
+ * and append it to a compacted dirty list, transform_update() recomposes only
+ * the listed ones, and transform_sync() re-uploads only those to the
+ * batch's resident instance buffer, as render_transforms() does each frame.
+ * Other passes read the cached matrices with transform_gather(), or draw
+ * straight from the resident buffer, once the frame's transform_sync() ran.
+ */
+#ifndef TRANSFORM_H_INCLUDED
+#define TRANSFORM_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <cglm/cglm.h>
+#include "entity.h"
+#include "utils.h"
+
+struct TransformBatch {
+    float *x, *y, *z;
+    float *rot_x, *rot_y, *rot_z;
+    float *scale;
+    size_t count, capacity;
+
+    mat4 *world;          /* cached model matrices */
+    uint8_t *dirty;       /* nonzero while listed in dirty_list */
+    uint32_t *dirty_list; /* changed since the last transform_clear_dirty() */
+    size_t ndirty;
+
+    GLuint instances;     /* every world matrix, 0 until first rendered */
+    size_t instances_capacity;
+};
+
+struct TransformStats {
+    size_t uploads;       /* glBufferSubData() calls and buffer creations */
+    size_t bytes;         /* sent to instance buffers */
+};
+
+void transform_batch_reserve(struct TransformBatch *b, size_t n)
+    ATTR((nonnull(1)));
+void transform_batch_free(struct TransformBatch *b) ATTR((nonnull(1)));
+void transform_batch_set(struct TransformBatch *b, size_t i,
+        const struct Entity *entity) ATTR((nonnull(1, 3)));
+void transform_batch_load(struct TransformBatch *b,
+        const struct Entity *entity, size_t n) ATTR((nonnull(1, 2)));
+
+void transform_set_position(struct TransformBatch *b, size_t i,
+        float x, float y, float z) ATTR((nonnull(1)));
+void transform_set_rotation(struct TransformBatch *b, size_t i,
+        float rot_x, float rot_y, float rot_z) ATTR((nonnull(1)));
+void transform_set_scale(struct TransformBatch *b, size_t i, float scale)
+    ATTR((nonnull(1)));
+void transform_mark_dirty(struct TransformBatch *b, size_t i)
+    ATTR((nonnull(1)));
+size_t transform_update(struct TransformBatch *b) ATTR((nonnull(1)));
+void transform_clear_dirty(struct TransformBatch *b) ATTR((nonnull(1)));
+size_t transform_sync(struct TransformBatch *b) ATTR((nonnull(1)));
+
+void transform_compose(const struct TransformBatch *b, const uint32_t *indices,
+        size_t n, mat4 *out) ATTR((nonnull(1, 4)));
+void transform_gather(const struct TransformBatch *b, const uint32_t *indices,
+        size_t n, mat4 *out) ATTR((nonnull(1, 2, 4)));
+void transform_force_scalar(bool scalar);
+
+void render_transforms(const struct Model *m, struct TransformBatch *b)
+    ATTR((nonnull(1, 2)));
+
+const struct TransformStats *transform_stats(void) ATTR((returns_nonnull));
+void reset_transform_stats(void);
+
+#endif /* TRANSFORM_H_INCLUDED */
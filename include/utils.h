@@ -32,6 +32,15 @@ unsigned touint(const char *str);
 # define ATTR(X) __attribute__(X)
 #endif /* NOATTRIBUTES */
 
+/* SIMD paths beyond the baseline ISA are compiled per-function with the
+ * target attribute and selected at runtime with CPU_HAS("avx2") etc. */
+#if !defined(NOATTRIBUTES) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define SIMD_DISPATCH 1
+# define TARGET(isa) __attribute__((target(isa)))
+# define CPU_HAS(isa) __builtin_cpu_supports(isa)
+#endif /* SIMD_DISPATCH */
+
 /* Logging + Error-checking macros */
 #if defined(NDEBUG)
 /* NOTE: sizeof is used to prevent 'unused variable' warnings */
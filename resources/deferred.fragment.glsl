@@ -0,0 +1,38 @@
+#version 330 core
+
+out vec4 out_color;
+
+#include "lighting.glsl"
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_depth;
+uniform mat4 inv_view_projection;
+uniform vec2 viewport_size;
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f)
+        n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f,
+                                         n.y >= 0.0f ? 1.0f : -1.0f);
+    return normalize(n);
+}
+
+void main(void)
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbuffer_depth, pixel, 0).r;
+    if (depth == 1.0f)
+        discard;
+
+    /* World position back from window depth */
+    vec2 ndc = gl_FragCoord.xy / viewport_size * 2.0f - 1.0f;
+    vec4 world = inv_view_projection * vec4(ndc, depth * 2.0f - 1.0f, 1.0f);
+    vec3 frag_pos = world.xyz / world.w;
+
+    vec3 pixel_color = texelFetch(gbuffer_albedo, pixel, 0).rgb;
+    vec3 norm = oct_decode(texelFetch(gbuffer_normal, pixel, 0).xy);
+
+    out_color = vec4(shade(frag_pos, norm, pixel_color), 1.0f);
+}
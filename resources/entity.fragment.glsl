@@ -6,29 +6,22 @@ in vec3 frag_pos;
 
 out vec4 out_color;
 
+#include "lighting.glsl"
+
 uniform sampler2D texture_sampler;
-uniform vec3 light_pos;
-uniform vec3 light_color;
 
 void main(void)
 {
-    vec3 pixel_color = vec3(1.0f, 0.8f, 0.8f);// texture(texture_sampler, pass_texture_uv);
-
-    /* ambient */
-    float ambient_strength = 0.13f;
-    vec3 ambient = ambient_strength * light_color;
-
-    /* diffuse */
-    vec3 norm = normalize(pass_normal);
-    vec3 light_direction = normalize(light_pos - frag_pos);
-    float diff = dot(norm, light_direction);
-    diff = max(diff, 0.0f);
-    vec3 diffuse = diff * light_color;
-
-    /* specular */
-    float specular_strength = 0.5f;
-    // vec3 view_direction = normalize(view_pos)
-
-    vec3 result = (diffuse + ambient) * pixel_color;
+#ifdef TEXTURED
+    vec3 pixel_color = texture(texture_sampler, pass_texture_uv).rgb;
+#else
+    vec3 pixel_color = vec3(1.0f, 0.8f, 0.8f);
+#endif
+
+#ifdef LIT
+    vec3 result = shade(frag_pos, normalize(pass_normal), pixel_color);
+#else
+    vec3 result = pixel_color;
+#endif
     out_color = vec4(result, 1.0f);
 }
@@ -0,0 +1,30 @@
+#version 330 core
+
+in vec2 pass_texture_uv;
+in vec3 pass_normal;
+in vec3 frag_pos;
+
+layout (location = 0) out vec4 out_albedo;
+layout (location = 1) out vec2 out_normal;
+
+uniform sampler2D texture_sampler;
+
+/* Unit vector to the octahedral map, in [-1, 1]^2 */
+vec2 oct_encode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f,
+                                            n.y >= 0.0f ? 1.0f : -1.0f);
+    return n.z >= 0.0f ? n.xy : folded;
+}
+
+void main(void)
+{
+    /* Same surface as entity.fragment.glsl, lit later by the deferred pass */
+#ifdef TEXTURED
+    out_albedo = vec4(texture(texture_sampler, pass_texture_uv).rgb, 1.0f);
+#else
+    out_albedo = vec4(1.0f, 0.8f, 0.8f, 1.0f);
+#endif
+    out_normal = oct_encode(normalize(pass_normal));
+}
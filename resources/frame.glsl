@@ -0,0 +1,13 @@
+/* The Frame uniform block, see struct FrameUniforms in frame.h. Every stage
+ * of a program has to declare it the same, so all include this */
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec4 light_pos;
+    vec4 light_color;
+    vec4 cluster_scale;  /* tiles per pixel x, y, slice scale, bias */
+    ivec4 cluster_dims;  /* tiles x, y, slices, point lights */
+    vec4 sun_direction;  /* xyz the way the light travels, w intensity */
+    vec4 shadow_splits;  /* view distance each cascade ends at */
+    mat4 shadow_matrices[4];
+};
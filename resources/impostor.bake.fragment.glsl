@@ -0,0 +1,24 @@
+#version 330 core
+
+in vec2 pass_texture_uv;
+in vec3 pass_normal;
+
+layout (location = 0) out vec4 out_albedo;
+layout (location = 1) out vec4 out_normal_depth;
+
+uniform sampler2D texture_sampler;
+
+void main(void)
+{
+    /* Same surface as entity.fragment.glsl, alpha marks coverage */
+#ifdef TEXTURED
+    vec3 pixel_color = texture(texture_sampler, pass_texture_uv).rgb;
+#else
+    vec3 pixel_color = vec3(1.0f, 0.8f, 0.8f);
+#endif
+    out_albedo = vec4(pixel_color, 1.0f);
+
+    /* Depth is linear across the bounding sphere, 0 at the front */
+    out_normal_depth = vec4(normalize(pass_normal) * 0.5f + 0.5f,
+                            gl_FragCoord.z);
+}
@@ -0,0 +1,18 @@
+#version 330 core
+
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 texture_uv;
+layout (location = 2) in vec3 normal;
+
+/* Orthographic, fitted to the bounding sphere, for one atlas view */
+uniform mat4 view_projection;
+
+out vec2 pass_texture_uv;
+out vec3 pass_normal;
+
+void main(void)
+{
+    gl_Position = view_projection * vec4(position, 1.0f);
+    pass_texture_uv = texture_uv;
+    pass_normal = normal; /* object space */
+}
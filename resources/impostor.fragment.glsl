@@ -0,0 +1,35 @@
+#version 330 core
+
+in vec2 pass_uv;
+in vec3 frag_pos;
+flat in vec2 pass_cells[4];
+flat in vec4 pass_weights;
+flat in mat3 pass_rotation;
+
+out vec4 out_color;
+
+uniform sampler2D albedo_atlas;
+uniform sampler2D normal_atlas;
+uniform int grid;
+
+#include "lighting.glsl"
+
+void main(void)
+{
+    /* Blend the four baked views around the view direction */
+    vec4 albedo = vec4(0.0f);
+    vec3 normal = vec3(0.0f);
+    for (int i = 0; i < 4; i++) {
+        vec2 uv = (pass_cells[i] + pass_uv) / float(grid);
+        vec4 a = texture(albedo_atlas, uv) * pass_weights[i];
+        albedo += a;
+        normal += texture(normal_atlas, uv).xyz * a.a; /* covered texels only */
+    }
+    if (albedo.a < 0.5f)
+        discard;
+
+    /* Lit like a LIT entity.fragment.glsl */
+    vec3 norm = normalize(pass_rotation * (normal / albedo.a * 2.0f - 1.0f));
+    vec3 result = shade(frag_pos, norm, albedo.rgb / albedo.a);
+    out_color = vec4(result, 1.0f);
+}
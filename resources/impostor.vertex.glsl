@@ -0,0 +1,70 @@
+#version 330 core
+
+layout (location = 0) in vec4 center_scale; /* per-instance Entity x, y, z, scale */
+layout (location = 1) in vec3 rotation;     /* per-instance Entity rot_x, y, z */
+
+uniform vec4 bounds; /* the Model's object space bounding sphere */
+uniform int grid;    /* views per side of the atlas */
+
+out vec2 pass_uv;
+out vec3 frag_pos;
+flat out vec2 pass_cells[4];
+flat out vec4 pass_weights;
+flat out mat3 pass_rotation;
+
+#include "frame.glsl"
+
+/* Rx * Ry * Rz, as entity_model_matrix() */
+mat3 rotate(vec3 angles)
+{
+    vec3 s = sin(angles), c = cos(angles);
+    return mat3(c.y * c.z, c.x * s.z + s.x * s.y * c.z, s.x * s.z - c.x * s.y * c.z,
+               -c.y * s.z, c.x * c.z - s.x * s.y * s.z, s.x * c.z + c.x * s.y * s.z,
+                s.y,      -s.x * c.y,                   c.x * c.y);
+}
+
+/* Unit vector to [0, 1]^2, the inverse of oct_decode() in impostor.c */
+vec2 oct_encode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 p = n.xy;
+    if (n.z < 0.0f) {
+        vec2 flip = vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        p = (1.0f - abs(n.yx)) * flip;
+    }
+    return p * 0.5f + 0.5f;
+}
+
+void main(void)
+{
+    mat3 r = rotate(rotation);
+    float scale = center_scale.w;
+    vec3 center = center_scale.xyz + r * (bounds.xyz * scale);
+
+    /* Direction to the camera in object space picks the views */
+    vec3 camera = -transpose(mat3(view)) * view[3].xyz;
+    vec3 dir = transpose(r) * normalize(camera - center);
+
+    float last = float(grid - 1);
+    vec2 f = oct_encode(dir) * last;
+    vec2 base = min(floor(f), vec2(last - 1.0f));
+    vec2 t = clamp(f - base, 0.0f, 1.0f);
+    pass_cells[0] = base;
+    pass_cells[1] = base + vec2(1.0f, 0.0f);
+    pass_cells[2] = base + vec2(0.0f, 1.0f);
+    pass_cells[3] = base + vec2(1.0f, 1.0f);
+    pass_weights = vec4((1.0f - t.x) * (1.0f - t.y), t.x * (1.0f - t.y),
+                        (1.0f - t.x) * t.y, t.x * t.y);
+    pass_rotation = r;
+
+    /* Quad facing the camera with the basis the views were baked with */
+    vec3 up = abs(dir.y) < 0.999f ? vec3(0.0f, 1.0f, 0.0f) : vec3(0.0f, 0.0f, 1.0f);
+    vec3 right = normalize(cross(up, dir));
+    up = cross(dir, right);
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0f - 1.0f;
+    vec3 offset = (corner.x * right + corner.y * up) * bounds.w * scale;
+
+    frag_pos = center + r * offset;
+    gl_Position = projection * view * vec4(frag_pos, 1.0f);
+    pass_uv = corner * 0.5f + 0.5f;
+}
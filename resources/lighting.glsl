@@ -0,0 +1,67 @@
+/* Lighting shared by the forward and deferred paths */
+#include "frame.glsl"
+
+/* Clustered point lights, see clusters.h */
+uniform samplerBuffer cluster_lights;   /* position, radius; color, intensity */
+uniform usamplerBuffer cluster_table;   /* offset, count per cluster */
+uniform usamplerBuffer cluster_indices;
+
+/* Cascaded shadow map, see shadows.h */
+uniform sampler2DArrayShadow shadow_map;
+
+/* Fraction of the sun reaching @frag_pos, @depth along the view axis */
+float sun_visibility(vec3 frag_pos, float depth)
+{
+    for (int i = 0; i < 4; i++) {
+        if (depth < shadow_splits[i]) {
+            vec3 p = (shadow_matrices[i] * vec4(frag_pos, 1.0f)).xyz;
+            p = p * 0.5f + 0.5f;
+            return texture(shadow_map, vec4(p.xy, float(i), p.z));
+        }
+    }
+    return 1.0f;
+}
+
+vec3 point_lights(vec3 frag_pos, vec3 norm)
+{
+    vec3 view_pos = (view * vec4(frag_pos, 1.0f)).xyz;
+    ivec3 tile = ivec3(gl_FragCoord.xy * cluster_scale.xy,
+                       log(-view_pos.z) * cluster_scale.z + cluster_scale.w);
+    tile = clamp(tile, ivec3(0), cluster_dims.xyz - 1);
+    int cluster = (tile.z * cluster_dims.y + tile.y) * cluster_dims.x + tile.x;
+
+    uvec2 range = texelFetch(cluster_table, cluster).xy;
+    vec3 sum = vec3(0.0f);
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(cluster_indices, int(range.x + i)).x);
+        vec4 position = texelFetch(cluster_lights, light * 2);
+        vec4 color = texelFetch(cluster_lights, light * 2 + 1);
+        vec3 to_light = position.xyz - frag_pos;
+        float d2 = dot(to_light, to_light);
+        float falloff = max(1.0f - d2 / (position.w * position.w), 0.0f);
+        float diff = max(dot(norm, to_light * inversesqrt(d2)), 0.0f);
+        sum += diff * falloff * falloff * color.w * color.rgb;
+    }
+    return sum;
+}
+
+/* Ambient, the Frame's light, the sun and the point lights on a surface of
+ * @albedo at @frag_pos facing @norm */
+vec3 shade(vec3 frag_pos, vec3 norm, vec3 albedo)
+{
+    float ambient_strength = 0.13f;
+    vec3 ambient = ambient_strength * light_color.rgb;
+
+    vec3 light_direction = normalize(light_pos.xyz - frag_pos);
+    float diff = max(dot(norm, light_direction), 0.0f);
+    vec3 diffuse = diff * light_color.rgb;
+    if (sun_direction.w > 0.0f) {
+        float depth = -(view * vec4(frag_pos, 1.0f)).z;
+        float sun = max(dot(norm, -sun_direction.xyz), 0.0f) * sun_direction.w;
+        diffuse += sun * sun_visibility(frag_pos, depth) * light_color.rgb;
+    }
+    if (cluster_dims.w > 0)
+        diffuse += point_lights(frag_pos, norm);
+
+    return (diffuse + ambient) * albedo;
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+/* Flat grey, also fills the G-buffer's normal with one facing +z */
+layout (location = 0) out vec4 out_color;
+layout (location = 1) out vec2 out_normal;
+
+void main(void)
+{
+    out_color = vec4(0.5f, 0.5f, 0.5f, 1.0f);
+    out_normal = vec2(0.0f);
+}
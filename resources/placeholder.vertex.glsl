@@ -0,0 +1,16 @@
+#version 330 core
+
+/* Stands in for entity.vertex.glsl while its variant compiles */
+layout (location = 0) in vec3 position;
+#ifdef INSTANCED
+layout (location = 3) in mat4 model; /* per-instance, locations 3-6 */
+#else
+uniform mat4 model;
+#endif
+
+#include "frame.glsl"
+
+void main(void)
+{
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+layout (location = 0) in vec3 position;
+layout (location = 3) in mat4 model; /* per-instance, locations 3-6 */
+
+uniform mat4 light_view_projection;
+
+void main(void)
+{
+    gl_Position = light_view_projection * model * vec4(position, 1.0f);
+}
@@ -0,0 +1,606 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bvh.h"
+#include "utils.h"
+
+/* Traversal stacks live on the C stack up to this depth */
+#define STACK_SIZE 256
+
+/* A candidate sibling during insertion, ordered by inherited cost */
+struct BVHCandidate {
+    int32_t node;
+    float inherited;
+};
+
+static int32_t alloc_node(struct BVH *t) ATTR((nonnull(1)));
+static void    free_node(struct BVH *t, int32_t node) ATTR((nonnull(1)));
+static void    insert_leaf(struct BVH *t, int32_t leaf) ATTR((nonnull(1)));
+static void    remove_leaf(struct BVH *t, int32_t leaf) ATTR((nonnull(1)));
+static int32_t find_sibling(struct BVH *t, int32_t leaf) ATTR((nonnull(1)));
+static void    refit_upwards(struct BVH *t, int32_t node) ATTR((nonnull(1)));
+static void    rotate(struct BVH *t, int32_t a) ATTR((nonnull(1)));
+static void    refit(struct BVH *t, int32_t node) ATTR((nonnull(1)));
+static void    heap_push(struct BVH *t, size_t *n, struct BVHCandidate c)
+    ATTR((nonnull(1, 2)));
+static struct BVHCandidate heap_pop(struct BVH *t, size_t *n)
+    ATTR((nonnull(1, 2)));
+
+static inline bool is_leaf(const struct BVHNode *n)
+{
+    return n->child1 == BVH_NULL;
+}
+
+static inline float area(const float lo[3], const float hi[3])
+{
+    float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline float union_area(const struct BVHNode *a, const struct BVHNode *b)
+{
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = MIN(a->lo[k], b->lo[k]);
+        hi[k] = MAX(a->hi[k], b->hi[k]);
+    }
+    return area(lo, hi);
+}
+
+static inline bool contains(const struct BVHNode *n, const float lo[3],
+        const float hi[3])
+{
+    return n->lo[0] <= lo[0] && n->lo[1] <= lo[1] && n->lo[2] <= lo[2]
+        && n->hi[0] >= hi[0] && n->hi[1] >= hi[1] && n->hi[2] >= hi[2];
+}
+
+static inline bool overlaps(const struct BVHNode *n, const float lo[3],
+        const float hi[3])
+{
+    return n->lo[0] <= hi[0] && n->lo[1] <= hi[1] && n->lo[2] <= hi[2]
+        && n->hi[0] >= lo[0] && n->hi[1] >= lo[1] && n->hi[2] >= lo[2];
+}
+
+/* bvh_init - create an empty tree
+ * @t: the BVH to initialize
+ * @margin: how far leaf boxes are fattened on each side
+ *
+ * Responsibilities:
+ *  - Call bvh_free() after use
+ */
+void bvh_init(struct BVH *t, float margin)
+{
+    memset(t, 0, sizeof *t);
+    t->root = BVH_NULL;
+    t->free_list = BVH_NULL;
+    t->margin = margin;
+}
+
+void bvh_free(struct BVH *t)
+{
+    free(t->nodes);
+    free(t->heap);
+    memset(t, 0, sizeof *t);
+    t->root = BVH_NULL;
+    t->free_list = BVH_NULL;
+}
+
+/* bvh_insert - add a box to the tree
+ * @t: the BVH
+ * @lo, @hi: the box's corners
+ * @user: returned by queries that find this box
+ *
+ * Returns the leaf's id, used by bvh_move() and bvh_remove()
+ */
+int32_t bvh_insert(struct BVH *t, const float lo[3], const float hi[3],
+        uint32_t user)
+{
+    int32_t leaf = alloc_node(t);
+    struct BVHNode *n = &t->nodes[leaf];
+    for (int k = 0; k < 3; k++) {
+        n->lo[k] = lo[k] - t->margin;
+        n->hi[k] = hi[k] + t->margin;
+    }
+    n->user = user;
+    n->height = 0;
+    insert_leaf(t, leaf);
+    t->nleaves++;
+    return leaf;
+}
+
+/* bvh_remove - remove a leaf previously returned by bvh_insert() */
+void bvh_remove(struct BVH *t, int32_t leaf)
+{
+    remove_leaf(t, leaf);
+    free_node(t, leaf);
+    t->nleaves--;
+}
+
+/* bvh_move - update the box of a leaf
+ * @t: the BVH
+ * @leaf: the leaf returned by bvh_insert()
+ * @lo, @hi: the box's new corners
+ *
+ * Returns whether the tree changed. Boxes that stay inside their fattened
+ * leaf cost nothing. Boxes that moved a little are refit in place, with
+ * rotations on the way up to keep the tree in shape. Boxes that jumped
+ * away from their old position are reinserted at their new best position.
+ */
+bool bvh_move(struct BVH *t, int32_t leaf, const float lo[3], const float hi[3])
+{
+    struct BVHNode *n = &t->nodes[leaf];
+    if (contains(n, lo, hi))
+        return false;
+
+    bool teleported = !overlaps(n, lo, hi);
+    if (teleported)
+        remove_leaf(t, leaf);
+
+    n = &t->nodes[leaf];
+    for (int k = 0; k < 3; k++) {
+        n->lo[k] = lo[k] - t->margin;
+        n->hi[k] = hi[k] + t->margin;
+    }
+
+    if (teleported)
+        insert_leaf(t, leaf);
+    else
+        refit_upwards(t, n->parent);
+    return true;
+}
+
+/* bvh_cull - find every leaf that intersects the frustum
+ * @t: the BVH
+ * @f: the Frustum
+ * @out: receives the user values of the visible leaves
+ *
+ * Subtrees outside any plane are rejected without visiting their leaves
+ * and subtrees inside all planes are accepted without further tests.
+ *
+ * Returns the number of visible leaves
+ *
+ * Contracts:
+ *  - @out has room for every leaf in the tree
+ *  - Threadsafe as long as the tree isn't modified concurrently
+ */
+size_t bvh_cull(const struct BVH *t, const struct Frustum *f, uint32_t *out)
+{
+    if (t->root == BVH_NULL)
+        return 0;
+
+    struct { int32_t node; unsigned planes; } local[STACK_SIZE], *stack = local;
+    if (t->nodes[t->root].height + 1 >= STACK_SIZE) {
+        stack = malloc((t->nodes[t->root].height + 2) * sizeof *stack);
+        ASSERT(stack != NULL, "Out of memory");
+    }
+
+    size_t nvisible = 0, top = 0;
+    stack[top].node = t->root;
+    stack[top++].planes = 0x3f;
+
+    while (top != 0) {
+        top--;
+        int32_t index = stack[top].node;
+        unsigned planes = stack[top].planes;
+        const struct BVHNode *n = &t->nodes[index];
+
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; p++) {
+            if (!(planes & (1u << p)))
+                continue;
+            const float *pl = f->planes[p];
+            float d = pl[3], e = 0.0f;
+            for (int k = 0; k < 3; k++) {
+                d += pl[k] * 0.5f * (n->lo[k] + n->hi[k]);
+                e += fabsf(pl[k]) * 0.5f * (n->hi[k] - n->lo[k]);
+            }
+            if (d + e < 0.0f)
+                outside = true;
+            else if (d - e >= 0.0f)
+                planes &= ~(1u << p); /* children are inside this plane too */
+        }
+        if (outside)
+            continue;
+
+        if (is_leaf(n)) {
+            out[nvisible++] = n->user;
+        } else if (planes == 0) {
+            /* Fully inside, emit the whole subtree */
+            stack[top].node = n->child1;
+            stack[top++].planes = 0;
+            stack[top].node = n->child2;
+            stack[top++].planes = 0;
+        } else {
+            stack[top].node = n->child1;
+            stack[top++].planes = planes;
+            stack[top].node = n->child2;
+            stack[top++].planes = planes;
+        }
+    }
+
+    if (stack != local)
+        free(stack);
+    return nvisible;
+}
+
+/* bvh_overlap - call @fn for every leaf whose box overlaps [@lo, @hi]
+ *  - Threadsafe as long as the tree isn't modified concurrently
+ */
+void bvh_overlap(const struct BVH *t, const float lo[3], const float hi[3],
+        BVHQueryFunc fn, void *ctx)
+{
+    if (t->root == BVH_NULL)
+        return;
+
+    int32_t local[STACK_SIZE], *stack = local;
+    if (t->nodes[t->root].height + 1 >= STACK_SIZE) {
+        stack = malloc((t->nodes[t->root].height + 2) * sizeof *stack);
+        ASSERT(stack != NULL, "Out of memory");
+    }
+
+    size_t top = 0;
+    stack[top++] = t->root;
+    while (top != 0) {
+        const struct BVHNode *n = &t->nodes[stack[--top]];
+        if (!overlaps(n, lo, hi))
+            continue;
+        if (is_leaf(n)) {
+            if (!fn(ctx, n->user))
+                break;
+        } else {
+            stack[top++] = n->child1;
+            stack[top++] = n->child2;
+        }
+    }
+
+    if (stack != local)
+        free(stack);
+}
+
+/* bvh_raycast - walk the leaves along a ray
+ * @t: the BVH
+ * @origin, @dir: the ray, @dir doesn't need to be normalized
+ * @max_t: the ray's length in multiples of @dir
+ * @fn: tests a leaf's contents, returns the clipped ray length
+ * @ctx: passed through to @fn
+ *
+ * Returns the final ray length, which is less than @max_t if @fn reported
+ * a hit. Subtrees beyond the closest hit so far are skipped.
+ */
+float bvh_raycast(const struct BVH *t, const float origin[3],
+        const float dir[3], float max_t, BVHRayFunc fn, void *ctx)
+{
+    if (t->root == BVH_NULL)
+        return max_t;
+
+    int32_t local[STACK_SIZE], *stack = local;
+    if (t->nodes[t->root].height + 1 >= STACK_SIZE) {
+        stack = malloc((t->nodes[t->root].height + 2) * sizeof *stack);
+        ASSERT(stack != NULL, "Out of memory");
+    }
+
+    float inv[3];
+    for (int k = 0; k < 3; k++)
+        inv[k] = 1.0f / dir[k];
+
+    size_t top = 0;
+    stack[top++] = t->root;
+    while (top != 0) {
+        const struct BVHNode *n = &t->nodes[stack[--top]];
+
+        /* Slab test */
+        float tmin = 0.0f, tmax = max_t;
+        for (int k = 0; k < 3; k++) {
+            float t0 = (n->lo[k] - origin[k]) * inv[k];
+            float t1 = (n->hi[k] - origin[k]) * inv[k];
+            tmin = MAX(tmin, MIN(t0, t1));
+            tmax = MIN(tmax, MAX(t0, t1));
+        }
+        if (tmin > tmax)
+            continue;
+
+        if (is_leaf(n)) {
+            max_t = fn(ctx, n->user, origin, dir, max_t);
+        } else {
+            stack[top++] = n->child1;
+            stack[top++] = n->child2;
+        }
+    }
+
+    if (stack != local)
+        free(stack);
+    return max_t;
+}
+
+int32_t bvh_height(const struct BVH *t)
+{
+    return t->root == BVH_NULL ? 0 : t->nodes[t->root].height;
+}
+
+/* bvh_cost - total surface area of the internal nodes, lower is better */
+float bvh_cost(const struct BVH *t)
+{
+    float cost = 0.0f;
+    for (size_t i = 0; i < t->capacity; i++) {
+        const struct BVHNode *n = &t->nodes[i];
+        if (n->height > 0)
+            cost += area(n->lo, n->hi);
+    }
+    return cost;
+}
+
+static int32_t alloc_node(struct BVH *t)
+{
+    if (t->free_list == BVH_NULL) {
+        size_t capacity = MAX(t->capacity * 2, 16);
+        struct BVHNode *nodes = realloc(t->nodes,
+                capacity * sizeof (struct BVHNode));
+        ASSERT(nodes != NULL, "Out of memory");
+        for (size_t i = t->capacity; i < capacity; i++) {
+            nodes[i].parent = i + 1 < capacity ? (int32_t)(i + 1) : BVH_NULL;
+            nodes[i].height = -1;
+        }
+        t->free_list = t->capacity;
+        t->nodes = nodes;
+        t->capacity = capacity;
+    }
+
+    int32_t index = t->free_list;
+    struct BVHNode *n = &t->nodes[index];
+    t->free_list = n->parent;
+    n->parent = BVH_NULL;
+    n->child1 = BVH_NULL;
+    n->child2 = BVH_NULL;
+    n->height = 0;
+    n->user = 0;
+    return index;
+}
+
+static void free_node(struct BVH *t, int32_t node)
+{
+    t->nodes[node].parent = t->free_list;
+    t->nodes[node].height = -1;
+    t->free_list = node;
+}
+
+static void insert_leaf(struct BVH *t, int32_t leaf)
+{
+    if (t->root == BVH_NULL) {
+        t->root = leaf;
+        t->nodes[leaf].parent = BVH_NULL;
+        return;
+    }
+
+    int32_t sibling = find_sibling(t, leaf);
+
+    /* Create a new parent for the leaf and its sibling */
+    int32_t old_parent = t->nodes[sibling].parent;
+    int32_t parent = alloc_node(t);
+    struct BVHNode *nodes = t->nodes; /* alloc_node() may have moved them */
+    nodes[parent].parent = old_parent;
+    nodes[parent].child1 = sibling;
+    nodes[parent].child2 = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+    refit(t, parent);
+
+    if (old_parent == BVH_NULL)
+        t->root = parent;
+    else if (nodes[old_parent].child1 == sibling)
+        nodes[old_parent].child1 = parent;
+    else
+        nodes[old_parent].child2 = parent;
+
+    refit_upwards(t, old_parent);
+}
+
+static void remove_leaf(struct BVH *t, int32_t leaf)
+{
+    if (leaf == t->root) {
+        t->root = BVH_NULL;
+        return;
+    }
+
+    struct BVHNode *nodes = t->nodes;
+    int32_t parent = nodes[leaf].parent;
+    int32_t grandparent = nodes[parent].parent;
+    int32_t sibling = nodes[parent].child1 == leaf
+        ? nodes[parent].child2
+        : nodes[parent].child1;
+
+    /* The sibling takes the parent's place */
+    nodes[sibling].parent = grandparent;
+    if (grandparent == BVH_NULL)
+        t->root = sibling;
+    else if (nodes[grandparent].child1 == parent)
+        nodes[grandparent].child1 = sibling;
+    else
+        nodes[grandparent].child2 = sibling;
+    free_node(t, parent);
+
+    refit_upwards(t, grandparent);
+}
+
+/* Branch and bound search for the sibling with the lowest SAH cost, where
+ * the cost of a sibling is the area of its union with the leaf plus the
+ * area that union adds to each of its ancestors */
+static int32_t find_sibling(struct BVH *t, int32_t leaf)
+{
+    const struct BVHNode *l = &t->nodes[leaf];
+    const float leaf_area = area(l->lo, l->hi);
+
+    int32_t best = t->root;
+    float best_cost = union_area(l, &t->nodes[t->root]);
+
+    size_t n = 0;
+    heap_push(t, &n, (struct BVHCandidate){ t->root, 0.0f });
+    while (n != 0) {
+        struct BVHCandidate c = heap_pop(t, &n);
+        /* Everything left in the heap has at least this lower bound */
+        if (c.inherited + leaf_area >= best_cost)
+            break;
+
+        const struct BVHNode *node = &t->nodes[c.node];
+        float direct = union_area(l, node);
+        float cost = direct + c.inherited;
+        if (cost < best_cost) {
+            best = c.node;
+            best_cost = cost;
+        }
+
+        if (!is_leaf(node)) {
+            float inherited = c.inherited + direct - area(node->lo, node->hi);
+            if (inherited + leaf_area < best_cost) {
+                heap_push(t, &n, (struct BVHCandidate){ node->child1, inherited });
+                heap_push(t, &n, (struct BVHCandidate){ node->child2, inherited });
+            }
+        }
+    }
+    return best;
+}
+
+/* Refit and rotate the ancestors of a changed node, stopping at the first
+ * one that comes out unchanged since nothing above it can change either */
+static void refit_upwards(struct BVH *t, int32_t node)
+{
+    while (node != BVH_NULL) {
+        struct BVHNode old = t->nodes[node];
+        refit(t, node);
+        rotate(t, node);
+
+        const struct BVHNode *n = &t->nodes[node];
+        if (n->height == old.height
+                && memcmp(n->lo, old.lo, sizeof old.lo) == 0
+                && memcmp(n->hi, old.hi, sizeof old.hi) == 0)
+            break;
+        node = n->parent;
+    }
+}
+
+/* Recompute an internal node's box and height from its children */
+static void refit(struct BVH *t, int32_t node)
+{
+    struct BVHNode *n = &t->nodes[node];
+    const struct BVHNode *a = &t->nodes[n->child1];
+    const struct BVHNode *b = &t->nodes[n->child2];
+    for (int k = 0; k < 3; k++) {
+        n->lo[k] = MIN(a->lo[k], b->lo[k]);
+        n->hi[k] = MAX(a->hi[k], b->hi[k]);
+    }
+    n->height = 1 + MAX(a->height, b->height);
+}
+
+/* Tree rotation: swap a child of @a with a grandchild on the other side if
+ * that shrinks the surface area of the other child */
+static void rotate(struct BVH *t, int32_t a)
+{
+    struct BVHNode *nodes = t->nodes;
+    int32_t b = nodes[a].child1, c = nodes[a].child2;
+    if (nodes[b].height == 0 && nodes[c].height == 0)
+        return;
+
+    enum { NONE, B_F, B_G, C_D, C_E } best = NONE;
+    float best_diff = 0.0f;
+
+    if (nodes[c].height > 0) {
+        int32_t f = nodes[c].child1, g = nodes[c].child2;
+        float c_area = area(nodes[c].lo, nodes[c].hi);
+        float diff = union_area(&nodes[b], &nodes[g]) - c_area;
+        if (diff < best_diff) {
+            best = B_F;
+            best_diff = diff;
+        }
+        diff = union_area(&nodes[b], &nodes[f]) - c_area;
+        if (diff < best_diff) {
+            best = B_G;
+            best_diff = diff;
+        }
+    }
+    if (nodes[b].height > 0) {
+        int32_t d = nodes[b].child1, e = nodes[b].child2;
+        float b_area = area(nodes[b].lo, nodes[b].hi);
+        float diff = union_area(&nodes[c], &nodes[e]) - b_area;
+        if (diff < best_diff) {
+            best = C_D;
+            best_diff = diff;
+        }
+        diff = union_area(&nodes[c], &nodes[d]) - b_area;
+        if (diff < best_diff) {
+            best = C_E;
+            best_diff = diff;
+        }
+    }
+
+    /* @child of @a swaps places with @grandchild under @other */
+    int32_t child, other, grandchild;
+    switch (best) {
+    case B_F:
+        child = b, other = c, grandchild = nodes[c].child1;
+        break;
+    case B_G:
+        child = b, other = c, grandchild = nodes[c].child2;
+        break;
+    case C_D:
+        child = c, other = b, grandchild = nodes[b].child1;
+        break;
+    case C_E:
+        child = c, other = b, grandchild = nodes[b].child2;
+        break;
+    default:
+        return;
+    }
+
+    if (nodes[a].child1 == child)
+        nodes[a].child1 = grandchild;
+    else
+        nodes[a].child2 = grandchild;
+    nodes[grandchild].parent = a;
+
+    if (nodes[other].child1 == grandchild)
+        nodes[other].child1 = child;
+    else
+        nodes[other].child2 = child;
+    nodes[child].parent = other;
+
+    refit(t, other);
+    refit(t, a);
+}
+
+static void heap_push(struct BVH *t, size_t *n, struct BVHCandidate c)
+{
+    if (*n == t->heap_capacity) {
+        size_t capacity = MAX(t->heap_capacity * 2, 64);
+        struct BVHCandidate *heap = realloc(t->heap,
+                capacity * sizeof (struct BVHCandidate));
+        ASSERT(heap != NULL, "Out of memory");
+        t->heap = heap;
+        t->heap_capacity = capacity;
+    }
+
+    size_t i = (*n)++;
+    while (i > 0 && t->heap[(i - 1) / 2].inherited > c.inherited) {
+        t->heap[i] = t->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    t->heap[i] = c;
+}
+
+static struct BVHCandidate heap_pop(struct BVH *t, size_t *n)
+{
+    struct BVHCandidate top = t->heap[0];
+    struct BVHCandidate last = t->heap[--(*n)];
+
+    size_t i = 0;
+    while (2 * i + 1 < *n) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < *n
+                && t->heap[child + 1].inherited < t->heap[child].inherited)
+            child++;
+        if (last.inherited <= t->heap[child].inherited)
+            break;
+        t->heap[i] = t->heap[child];
+        i = child;
+    }
+    t->heap[i] = last;
+    return top;
+}
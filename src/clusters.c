@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "clusters.h"
+#include "glutils.h"
+#include "jobs.h"
+
+#if defined(SIMD_DISPATCH)
+# include <immintrin.h>
+#endif
+
+#define TILES (CLUSTER_X * CLUSTER_Y)
+
+/* Lights overlapping one slice's depth range, padded to a multiple of 8
+ * with spheres that can't touch anything */
+struct SliceScratch {
+    float *x, *y, *z, *r2;
+    uint16_t *index;
+    size_t capacity;
+    size_t references, overflows;
+};
+
+/* Globals */
+static bool g_force_scalar = false;
+static struct SliceScratch g_scratch[JOBS_MAX_THREADS];
+
+static void bin_slices(void *arg, size_t begin, size_t end, unsigned thread)
+    ATTR((nonnull(1)));
+static size_t gather_slice(const struct ClusterGrid *g, unsigned slice,
+        struct SliceScratch *s) ATTR((nonnull(1, 3)));
+static void bin_cluster_scalar(struct ClusterGrid *g, unsigned c,
+        struct SliceScratch *s, size_t n) ATTR((nonnull(1, 3)));
+static void push_light(struct ClusterGrid *g, unsigned c, uint16_t light,
+        struct SliceScratch *s) ATTR((nonnull(1, 4)));
+static void reserve_lights(struct ClusterGrid *g, size_t n) ATTR((nonnull(1)));
+
+/* clusters_init - set up an empty ClusterGrid
+ * @g: the ClusterGrid
+ * @width, @height: viewport in pixels
+ * @far: view distance beyond which point lights are ignored
+ *
+ * Responsibilities:
+ *  - Call clusters_build() before binning, and clusters_free() after use
+ */
+void clusters_init(struct ClusterGrid *g, float width, float height,
+        float far)
+{
+    memset(g, 0, sizeof *g);
+    g->width = width;
+    g->height = height;
+    g->far = far;
+    g->slots = malloc(CLUSTER_COUNT * CLUSTER_MAX_PER_CLUSTER
+            * sizeof (uint16_t));
+    ASSERT(g->slots != NULL, "Out of memory");
+}
+
+void clusters_free(struct ClusterGrid *g)
+{
+    free(g->slots);
+    free(g->indices);
+    free(g->x);
+    free(g->y);
+    free(g->z);
+    free(g->r);
+    for (unsigned i = 0; i < 3; i++) {
+        if (g->textures[i] != 0)
+            del_texture(g->textures[i]);
+        if (g->buffers[i] != 0)
+            del_buffer(g->buffers[i]);
+    }
+    memset(g, 0, sizeof *g);
+}
+
+/* clusters_build - compute the clusters' view space bounds
+ * @g: the ClusterGrid
+ * @projection: a symmetric perspective projection, as glm_perspective()
+ *
+ * Call again when the projection changes
+ */
+void clusters_build(struct ClusterGrid *g, mat4 projection)
+{
+    /* Undo glm_perspective()'s depth terms to get its planes back */
+    float near = projection[3][2] / (projection[2][2] - 1.0f);
+    float far = projection[3][2] / (projection[2][2] + 1.0f);
+    g->near = near;
+    g->far = MIN(g->far, far);
+
+    float log_ratio = logf(g->far / near);
+    g->slice_scale = CLUSTER_Z / log_ratio;
+    g->slice_bias = -CLUSTER_Z * logf(near) / log_ratio;
+
+    for (unsigned k = 0; k < CLUSTER_Z; k++) {
+        float d0 = near * powf(g->far / near, (float)k / CLUSTER_Z);
+        float d1 = near * powf(g->far / near, (float)(k + 1) / CLUSTER_Z);
+        for (unsigned j = 0; j < CLUSTER_Y; j++) {
+            for (unsigned i = 0; i < CLUSTER_X; i++) {
+                unsigned c = (k * CLUSTER_Y + j) * CLUSTER_X + i;
+                float x0 = -1.0f + 2.0f * i / CLUSTER_X;
+                float x1 = -1.0f + 2.0f * (i + 1) / CLUSTER_X;
+                float y0 = -1.0f + 2.0f * j / CLUSTER_Y;
+                float y1 = -1.0f + 2.0f * (j + 1) / CLUSTER_Y;
+                /* The tile widens with distance, the extremes are on
+                 * whichever of its depth planes is further */
+                float sx = 1.0f / projection[0][0], sy = 1.0f / projection[1][1];
+                g->min_x[c] = MIN(x0 * d0, x0 * d1) * sx;
+                g->max_x[c] = MAX(x1 * d0, x1 * d1) * sx;
+                g->min_y[c] = MIN(y0 * d0, y0 * d1) * sy;
+                g->max_y[c] = MAX(y1 * d0, y1 * d1) * sy;
+                g->min_z[c] = -d1;
+                g->max_z[c] = -d0;
+            }
+        }
+    }
+}
+
+/* clusters_bin - assign point lights to the clusters they reach
+ * @g: the ClusterGrid, after clusters_build()
+ * @view: the camera's view matrix
+ * @lights: the lights
+ * @n: number of lights, beyond CLUSTER_MAX_LIGHTS they are ignored
+ *
+ * Slices are binned on the job pool, the result is compacted into
+ * @g->table and @g->indices
+ *
+ * Contracts:
+ *  - Called from the thread that owns the job pool, if any
+ */
+void clusters_bin(struct ClusterGrid *g, mat4 view,
+        const struct PointLight *lights, size_t n)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    n = MIN(n, CLUSTER_MAX_LIGHTS);
+    reserve_lights(g, n);
+    for (size_t i = 0; i < n; i++) {
+        vec4 p = { lights[i].position[0], lights[i].position[1],
+                   lights[i].position[2], 1.0f };
+        vec4 v;
+        glm_mat4_mulv(view, p, v);
+        g->x[i] = v[0];
+        g->y[i] = v[1];
+        g->z[i] = v[2];
+        g->r[i] = lights[i].position[3];
+    }
+    g->nlights = n;
+
+    jobs_parallel_for(bin_slices, g, CLUSTER_Z, 1);
+
+    size_t total = 0;
+    for (unsigned c = 0; c < CLUSTER_COUNT; c++)
+        total += g->counts[c];
+    if (total > g->indices_capacity) {
+        size_t capacity = MAX(g->indices_capacity * 2, total);
+        uint16_t *indices = realloc(g->indices, capacity * sizeof (uint16_t));
+        ASSERT(indices != NULL, "Out of memory");
+        g->indices = indices;
+        g->indices_capacity = capacity;
+    }
+    size_t offset = 0;
+    for (unsigned c = 0; c < CLUSTER_COUNT; c++) {
+        g->table[c * 2] = offset;
+        g->table[c * 2 + 1] = g->counts[c];
+        memcpy(g->indices + offset, g->slots + c * CLUSTER_MAX_PER_CLUSTER,
+                g->counts[c] * sizeof (uint16_t));
+        offset += g->counts[c];
+    }
+    g->nindices = total;
+
+    g->stats.lights = n;
+    g->stats.references = total;
+    g->stats.overflows = 0;
+    for (unsigned t = 0; t < JOBS_MAX_THREADS; t++) {
+        g->stats.overflows += g_scratch[t].overflows;
+        g_scratch[t].overflows = 0;
+    }
+    g->stats.bin_seconds = (double)(SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+}
+
+/* clusters_upload - hand the last binning to the shaders
+ * @g: the ClusterGrid
+ * @lights: the lights passed to clusters_bin()
+ * @n: their number
+ *
+ * Binds the buffer textures to FRAME_CLUSTER_UNIT and the two units after
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void clusters_upload(struct ClusterGrid *g, const struct PointLight *lights,
+        size_t n)
+{
+    static const GLenum FORMATS[] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+    if (g->buffers[0] == 0) {
+        GLCHECK(glGenBuffers(3, g->buffers));
+        GLCHECK(glGenTextures(3, g->textures));
+    }
+
+    /* Never empty, a zero sized buffer texture is incomplete */
+    static const uint16_t none = 0;
+    const void *data[] = {
+        lights, g->table, g->nindices ? (const void *)g->indices : &none
+    };
+    size_t sizes[] = {
+        MAX(MIN(n, CLUSTER_MAX_LIGHTS), 1) * sizeof (struct PointLight),
+        sizeof g->table,
+        MAX(g->nindices, 1) * sizeof (uint16_t)
+    };
+    for (unsigned i = 0; i < 3; i++) {
+        bind_buffer(GL_TEXTURE_BUFFER, g->buffers[i]);
+        GLCHECK(glBufferData(GL_TEXTURE_BUFFER, sizes[i],
+                    n || i != 0 ? data[i] : NULL, GL_STREAM_DRAW));
+        active_texture(FRAME_CLUSTER_UNIT + i);
+        GLCHECK(glBindTexture(GL_TEXTURE_BUFFER, g->textures[i]));
+        GLCHECK(glTexBuffer(GL_TEXTURE_BUFFER, FORMATS[i], g->buffers[i]));
+    }
+}
+
+/* clusters_frame - describe the grid in the Frame block's cluster fields */
+void clusters_frame(const struct ClusterGrid *g, struct FrameUniforms *frame)
+{
+    frame->cluster_scale[0] = CLUSTER_X / g->width;
+    frame->cluster_scale[1] = CLUSTER_Y / g->height;
+    frame->cluster_scale[2] = g->slice_scale;
+    frame->cluster_scale[3] = g->slice_bias;
+    frame->cluster_dims[0] = CLUSTER_X;
+    frame->cluster_dims[1] = CLUSTER_Y;
+    frame->cluster_dims[2] = CLUSTER_Z;
+    frame->cluster_dims[3] = g->nlights;
+}
+
+/* clusters_force_scalar - disable the AVX2 tests, for benchmarking */
+void clusters_force_scalar(bool scalar)
+{
+    g_force_scalar = scalar;
+}
+
+#if defined(SIMD_DISPATCH)
+/* bin_cluster_avx2 - sphere vs box tests of eight lights at a time */
+TARGET("avx2,fma")
+static void bin_cluster_avx2(struct ClusterGrid *g, unsigned c,
+        struct SliceScratch *s, size_t n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 lo_x = _mm256_set1_ps(g->min_x[c]), hi_x = _mm256_set1_ps(g->max_x[c]);
+    __m256 lo_y = _mm256_set1_ps(g->min_y[c]), hi_y = _mm256_set1_ps(g->max_y[c]);
+    __m256 lo_z = _mm256_set1_ps(g->min_z[c]), hi_z = _mm256_set1_ps(g->max_z[c]);
+
+    for (size_t i = 0; i < n; i += 8) {
+        __m256 x = _mm256_loadu_ps(s->x + i);
+        __m256 y = _mm256_loadu_ps(s->y + i);
+        __m256 z = _mm256_loadu_ps(s->z + i);
+        /* Distance from the center to the box along each axis, 0 inside */
+        __m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(lo_x, x),
+                    _mm256_sub_ps(x, hi_x)), zero);
+        __m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(lo_y, y),
+                    _mm256_sub_ps(y, hi_y)), zero);
+        __m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(lo_z, z),
+                    _mm256_sub_ps(z, hi_z)), zero);
+        __m256 d2 = _mm256_fmadd_ps(dx, dx,
+                _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+        unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(d2,
+                    _mm256_loadu_ps(s->r2 + i), _CMP_LE_OQ));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            push_light(g, c, s->index[i + bit], s);
+            mask &= mask - 1;
+        }
+    }
+}
+#endif /* SIMD_DISPATCH */
+
+static void bin_slices(void *arg, size_t begin, size_t end, unsigned thread)
+{
+    struct ClusterGrid *g = arg;
+    struct SliceScratch *s = &g_scratch[thread];
+
+    for (size_t k = begin; k < end; k++) {
+        size_t n = gather_slice(g, k, s);
+        for (unsigned c = k * TILES; c < (k + 1) * TILES; c++) {
+            g->counts[c] = 0;
+            if (n == 0)
+                continue;
+#if defined(SIMD_DISPATCH)
+            if (!g_force_scalar && CPU_HAS("avx2") && CPU_HAS("fma")) {
+                bin_cluster_avx2(g, c, s, n);
+                continue;
+            }
+#endif
+            bin_cluster_scalar(g, c, s, n);
+        }
+    }
+}
+
+/* gather_slice - the lights reaching into a slice's depth range
+ *  - returns their number rounded up to a multiple of 8
+ */
+static size_t gather_slice(const struct ClusterGrid *g, unsigned slice,
+        struct SliceScratch *s)
+{
+    size_t need = g->nlights + 8;
+    if (need > s->capacity) {
+        size_t capacity = MAX(s->capacity * 2, need);
+        float **fields[] = { &s->x, &s->y, &s->z, &s->r2 };
+        for (size_t f = 0; f < ARRAY_SIZE(fields); f++) {
+            float *p = realloc(*fields[f], capacity * sizeof (float));
+            ASSERT(p != NULL, "Out of memory");
+            *fields[f] = p;
+        }
+        uint16_t *index = realloc(s->index, capacity * sizeof (uint16_t));
+        ASSERT(index != NULL, "Out of memory");
+        s->index = index;
+        s->capacity = capacity;
+    }
+
+    unsigned c = slice * TILES;
+    float lo = g->min_z[c], hi = g->max_z[c];
+    size_t n = 0;
+    for (size_t i = 0; i < g->nlights; i++) {
+        if (g->z[i] + g->r[i] < lo || g->z[i] - g->r[i] > hi)
+            continue;
+        s->x[n] = g->x[i];
+        s->y[n] = g->y[i];
+        s->z[n] = g->z[i];
+        s->r2[n] = g->r[i] * g->r[i];
+        s->index[n] = i;
+        n++;
+    }
+    if (n == 0)
+        return 0;
+    for (; n % 8 != 0; n++) {
+        s->x[n] = s->y[n] = s->z[n] = 0.0f;
+        s->r2[n] = -1.0f;
+        s->index[n] = 0;
+    }
+    return n;
+}
+
+static void bin_cluster_scalar(struct ClusterGrid *g, unsigned c,
+        struct SliceScratch *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float dx = MAX(MAX(g->min_x[c] - s->x[i], s->x[i] - g->max_x[c]), 0.0f);
+        float dy = MAX(MAX(g->min_y[c] - s->y[i], s->y[i] - g->max_y[c]), 0.0f);
+        float dz = MAX(MAX(g->min_z[c] - s->z[i], s->z[i] - g->max_z[c]), 0.0f);
+        if (dx * dx + dy * dy + dz * dz <= s->r2[i])
+            push_light(g, c, s->index[i], s);
+    }
+}
+
+static void push_light(struct ClusterGrid *g, unsigned c, uint16_t light,
+        struct SliceScratch *s)
+{
+    if (g->counts[c] == CLUSTER_MAX_PER_CLUSTER) {
+        s->overflows++;
+        return;
+    }
+    g->slots[c * CLUSTER_MAX_PER_CLUSTER + g->counts[c]++] = light;
+}
+
+static void reserve_lights(struct ClusterGrid *g, size_t n)
+{
+    if (n <= g->lights_capacity)
+        return;
+    size_t capacity = MAX(g->lights_capacity * 2, n);
+    float **fields[] = { &g->x, &g->y, &g->z, &g->r };
+    for (size_t f = 0; f < ARRAY_SIZE(fields); f++) {
+        float *p = realloc(*fields[f], capacity * sizeof (float));
+        ASSERT(p != NULL, "Out of memory");
+        *fields[f] = p;
+    }
+    g->lights_capacity = capacity;
+}
@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "cmdlist.h"
+#include "glutils.h"
+#include "frame.h"
+#include "cull.h"
+#include "renderqueue.h"
+#include "shaderpp.h"
+
+/* Entities per recording job */
+static const size_t RECORD_GRAIN = 1024;
+
+/* Per-thread culling scratch, a job only touches its thread's */
+struct RecordScratch {
+    struct SphereBatch spheres;
+    uint32_t *visible;
+    size_t capacity;
+};
+
+struct RecordJob {
+    struct CommandQueue *q;
+    const struct Model *m;
+    const struct Entity *entity;           /* either these */
+    const struct TransformBatch *batch;    /* or these, */
+    const uint32_t *indices;               /* picked by these if not NULL */
+    uint64_t key;
+    float reach;
+};
+
+/* Globals */
+static struct RecordScratch g_scratch[JOBS_MAX_THREADS];
+
+static void record_chunk(void *arg, size_t begin, size_t end, unsigned thread)
+    ATTR((nonnull(1)));
+static void record(struct CommandQueue *q, struct RecordJob *job, size_t n)
+    ATTR((nonnull(1, 2)));
+static int compare_packets(const void *a, const void *b) ATTR((nonnull(1, 2)));
+
+/* cmdqueue_init - create an empty CommandQueue
+ *
+ * Responsibilities:
+ *  - Call cmdqueue_free() after use
+ */
+void cmdqueue_init(struct CommandQueue *q)
+{
+    memset(q, 0, sizeof *q);
+}
+
+void cmdqueue_free(struct CommandQueue *q)
+{
+    for (unsigned t = 0; t < JOBS_MAX_THREADS; t++)
+        free(q->lists[t].packets);
+    free(q->merged);
+    free(q->staging);
+    if (q->vbo_staging != 0)
+        del_buffer(q->vbo_staging);
+    memset(q, 0, sizeof *q);
+}
+
+/* cmdqueue_begin - start recording a frame
+ * @q: the CommandQueue
+ * @max_instances: upper bound of the instances recorded this frame
+ *
+ * Contracts:
+ *  - Called on the GL thread, after the frame's ring_begin_frame()
+ */
+void cmdqueue_begin(struct CommandQueue *q, size_t max_instances)
+{
+    for (unsigned t = 0; t < JOBS_MAX_THREADS; t++)
+        q->lists[t].count = 0;
+    SDL_AtomicSet(&q->used, 0);
+    q->recorded = 0;
+    q->capacity = max_instances;
+    memset(&q->stats, 0, sizeof q->stats);
+
+    q->in_ring = max_instances != 0 && ring_alloc(frame_ring(),
+            max_instances * sizeof (mat4), sizeof (mat4), &q->alloc);
+    if (q->in_ring) {
+        q->instances = q->alloc.ptr;
+        return;
+    }
+    if (max_instances > q->staging_capacity) {
+        size_t capacity = MAX(q->staging_capacity * 2, max_instances);
+        mat4 *staging = realloc(q->staging, capacity * sizeof (mat4));
+        ASSERT(staging != NULL, "Out of memory");
+        q->staging = staging;
+        q->staging_capacity = capacity;
+    }
+    q->instances = q->staging;
+}
+
+/* cmdqueue_alloc - room for @n model matrices
+ * @q: the CommandQueue
+ * @n: number of matrices
+ * @first: receives the offset to put in the DrawPacket
+ *
+ * Contracts:
+ *  - Threadsafe
+ *  - The matrices are only written, the memory may be write-combined
+ */
+mat4 *cmdqueue_alloc(struct CommandQueue *q, size_t n, uint32_t *first)
+{
+    size_t start = (size_t)SDL_AtomicAdd(&q->used, (int)n);
+    ASSERT(start + n <= q->capacity, "More instances than cmdqueue_begin() "
+            "reserved");
+    *first = start;
+    return q->instances + start;
+}
+
+/* cmdlist_draw - record a draw
+ * @q: the CommandQueue
+ * @thread: the thread argument of the job doing the recording
+ * @packet: the draw
+ *
+ * Contracts:
+ *  - Threadsafe as long as each thread passes its own @thread
+ */
+void cmdlist_draw(struct CommandQueue *q, unsigned thread,
+        const struct DrawPacket *packet)
+{
+    ASSERT(thread < JOBS_MAX_THREADS, "Bad thread index");
+    struct CommandList *list = &q->lists[thread];
+    if (list->count == list->capacity) {
+        size_t capacity = MAX(list->capacity * 2, 64);
+        struct DrawPacket *packets = realloc(list->packets,
+                capacity * sizeof (struct DrawPacket));
+        ASSERT(packets != NULL, "Out of memory");
+        list->packets = packets;
+        list->capacity = capacity;
+    }
+    list->packets[list->count++] = *packet;
+}
+
+/* cmdqueue_submit - replay everything recorded since cmdqueue_begin()
+ *
+ * Contracts:
+ *  - Called on the GL thread, once no recording jobs are running
+ */
+void cmdqueue_submit(struct CommandQueue *q)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    size_t used = SDL_AtomicGet(&q->used);
+
+    size_t total = 0;
+    for (unsigned t = 0; t < JOBS_MAX_THREADS; t++)
+        total += q->lists[t].count;
+    if (total > q->merged_capacity) {
+        size_t capacity = MAX(q->merged_capacity * 2, total);
+        struct DrawPacket *merged = realloc(q->merged,
+                capacity * sizeof (struct DrawPacket));
+        ASSERT(merged != NULL, "Out of memory");
+        q->merged = merged;
+        q->merged_capacity = capacity;
+    }
+    size_t count = 0;
+    for (unsigned t = 0; t < JOBS_MAX_THREADS; t++) {
+        memcpy(q->merged + count, q->lists[t].packets,
+                q->lists[t].count * sizeof (struct DrawPacket));
+        count += q->lists[t].count;
+    }
+    qsort(q->merged, count, sizeof (struct DrawPacket), compare_packets);
+
+    GLuint buffer;
+    GLintptr base;
+    if (q->in_ring) {
+        /* Other draws may have flushed the ring since cmdqueue_begin(),
+         * before these matrices were written */
+        ring_flush_range(frame_ring(), q->alloc.offset,
+                used * sizeof (mat4));
+        buffer = q->alloc.buffer;
+        base = q->alloc.offset;
+    } else {
+        if (q->vbo_staging == 0)
+            GLCHECK(glGenBuffers(1, &q->vbo_staging));
+        bind_buffer(GL_ARRAY_BUFFER, q->vbo_staging);
+        GLCHECK(glBufferData(GL_ARRAY_BUFFER, used * sizeof (mat4),
+                    q->staging, GL_STREAM_DRAW));
+        buffer = q->vbo_staging;
+        base = 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct DrawPacket *p = &q->merged[i];
+        use_program(ready_variant(p->program));
+        bind_array(p->vao);
+        if (p->texture != 0)
+            bind_texture_unit(0, p->texture);
+        if (p->resident != 0)
+            point_instances(p->resident, p->first * sizeof (mat4));
+        else
+            point_instances(buffer, base + p->first * sizeof (mat4));
+        draw_instanced(p->count, p->ninstances);
+    }
+
+    q->stats.packets += count;
+    q->stats.instances += used;
+    q->stats.submit_seconds += (double)(SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+}
+
+/* cmdqueue_record_entities - record the draws of Entities on the job pool
+ * @q: the CommandQueue, counting @n towards cmdqueue_begin()'s bound
+ * @m: the Model to use
+ * @entity: pointer to the first Entity
+ * @n: number of Entities
+ *
+ * What render_entities() does before touching GL, split into chunks: each
+ * chunk is frustum culled against the current frame, its visible model
+ * matrices are written to the queue's instance memory, and it records one
+ * DrawPacket.
+ *
+ * Contracts:
+ *  - Called from the thread that owns the job pool, if any
+ *  - Occluders set with set_entity_occluders() are not used
+ */
+void cmdqueue_record_entities(struct CommandQueue *q, const struct Model *m,
+        const struct Entity *entity, size_t n)
+{
+    struct RecordJob job = { .m = m, .entity = entity };
+    record(q, &job, n);
+}
+
+/* cmdqueue_record_transforms - cmdqueue_record_entities() for transforms
+ * @q: the CommandQueue, counting @n towards cmdqueue_begin()'s bound
+ * @m: the Model to use
+ * @b: the transforms
+ * @indices: which transforms to draw, or NULL for the first @n
+ * @n: number of transforms
+ *
+ * Chunks that are wholly visible and cover a run of neighbouring transforms
+ * are drawn straight from the batch's resident instance buffer. The cached
+ * matrices of the others' visible transforms are copied into the queue's
+ * instance memory, nothing is recomposed.
+ *
+ * Contracts:
+ *  - After transform_sync() of @b this frame
+ *  - Called from the thread that owns the job pool, if any
+ */
+void cmdqueue_record_transforms(struct CommandQueue *q, const struct Model *m,
+        const struct TransformBatch *b, const uint32_t *indices, size_t n)
+{
+    ASSERT(b->ndirty == 0, "Transforms are not synced");
+    struct RecordJob job = { .m = m, .batch = b, .indices = indices };
+    record(q, &job, n);
+}
+
+/* record - run the jobs of a cmdqueue_record_*() call */
+static void record(struct CommandQueue *q, struct RecordJob *job, size_t n)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    job->q = q;
+    job->key = render_key(RENDER_OPAQUE, job->m, 0.0f);
+    job->reach = glm_vec_norm((float *)job->m->bounds) + job->m->bounds[3];
+    jobs_parallel_for(record_chunk, job, n, RECORD_GRAIN);
+    q->recorded += n;
+    q->stats.record_seconds += (double)(SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+}
+
+static void record_chunk(void *arg, size_t begin, size_t end, unsigned thread)
+{
+    const struct RecordJob *job = arg;
+    struct RecordScratch *s = &g_scratch[thread];
+    size_t n = end - begin;
+
+    sphere_batch_reserve(&s->spheres, n);
+    if (n > s->capacity) {
+        uint32_t *visible = realloc(s->visible, n * sizeof (uint32_t));
+        ASSERT(visible != NULL, "Out of memory");
+        s->visible = visible;
+        s->capacity = n;
+    }
+
+    /* Sphere around each Entity's origin, the rotation isn't applied yet */
+    const struct Entity *entity = job->entity + begin;
+    const struct TransformBatch *b = job->batch;
+    for (size_t i = 0; i < n; i++) {
+        if (b == NULL) {
+            s->spheres.x[i] = entity[i].x;
+            s->spheres.y[i] = entity[i].y;
+            s->spheres.z[i] = entity[i].z;
+            s->spheres.r[i] = entity[i].scale * job->reach;
+            continue;
+        }
+        size_t t = job->indices ? job->indices[begin + i] : begin + i;
+        s->spheres.x[i] = b->x[t];
+        s->spheres.y[i] = b->y[t];
+        s->spheres.z[i] = b->z[t];
+        s->spheres.r[i] = b->scale[t] * job->reach;
+    }
+    s->spheres.count = n;
+    size_t nvisible = cull_spheres(current_frustum(), &s->spheres, s->visible);
+    if (nvisible == 0)
+        return;
+
+    struct DrawPacket packet = {
+        .key = job->key,
+        .order = job->q->recorded + begin,
+        .program = job->m->program,
+        .vao = job->m->vao,
+        .texture = job->m->texture,
+        .count = job->m->num_indices,
+        .ninstances = nvisible,
+    };
+    if (b == NULL) {
+        mat4 *out = cmdqueue_alloc(job->q, nvisible, &packet.first);
+        for (size_t k = 0; k < nvisible; k++)
+            entity_model_matrix(&entity[s->visible[k]], out[k]);
+        cmdlist_draw(job->q, thread, &packet);
+        return;
+    }
+
+    /* Chunk positions to transform indices, in place */
+    const uint32_t *indices = job->indices;
+    for (size_t k = 0; k < nvisible; k++)
+        s->visible[k] = indices ? indices[begin + s->visible[k]]
+            : begin + s->visible[k];
+    if (nvisible == n && s->visible[n - 1] - s->visible[0] == n - 1) {
+        packet.resident = b->instances;
+        packet.first = s->visible[0];
+    } else {
+        mat4 *out = cmdqueue_alloc(job->q, nvisible, &packet.first);
+        transform_gather(b, s->visible, nvisible, out);
+    }
+    cmdlist_draw(job->q, thread, &packet);
+}
+
+static int compare_packets(const void *a, const void *b)
+{
+    const struct DrawPacket *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return (x->order > y->order) - (x->order < y->order);
+}
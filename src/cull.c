@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <cglm/cglm.h>
+#include "cull.h"
+#include "utils.h"
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#if defined(SIMD_DISPATCH)
+# include <immintrin.h>
+#endif
+
+/* Globals */
+static enum CullImpl g_impl = CULL_AUTO;
+
+static float *grow(float *p, size_t n);
+static size_t cull_spheres_scalar(const struct Frustum *f,
+        const struct SphereBatch *b, size_t begin, uint32_t *visible);
+static size_t cull_boxes_scalar(const struct Frustum *f,
+        const struct BoxBatch *b, size_t begin, uint32_t *visible);
+
+/* frustum_from_matrix - extract world space planes from a view-projection
+ * @viewproj: projection * view
+ * @out: the Frustum to fill
+ */
+void frustum_from_matrix(mat4 viewproj, struct Frustum *out)
+{
+    glm_frustum_planes(viewproj, out->planes);
+}
+
+/* sphere_batch_reserve - make room for @n spheres, discarding the contents
+ *
+ * Responsibilities:
+ *  - Call sphere_batch_free() after use
+ */
+void sphere_batch_reserve(struct SphereBatch *b, size_t n)
+{
+    if (n > b->capacity) {
+        size_t capacity = MAX(b->capacity * 2, n);
+        b->x = grow(b->x, capacity);
+        b->y = grow(b->y, capacity);
+        b->z = grow(b->z, capacity);
+        b->r = grow(b->r, capacity);
+        b->capacity = capacity;
+    }
+    b->count = 0;
+}
+
+void sphere_batch_free(struct SphereBatch *b)
+{
+    free(b->x);
+    free(b->y);
+    free(b->z);
+    free(b->r);
+    *b = (struct SphereBatch){ 0 };
+}
+
+/* box_batch_reserve - make room for @n boxes, discarding the contents
+ *
+ * Responsibilities:
+ *  - Call box_batch_free() after use
+ */
+void box_batch_reserve(struct BoxBatch *b, size_t n)
+{
+    if (n > b->capacity) {
+        size_t capacity = MAX(b->capacity * 2, n);
+        b->cx = grow(b->cx, capacity);
+        b->cy = grow(b->cy, capacity);
+        b->cz = grow(b->cz, capacity);
+        b->ex = grow(b->ex, capacity);
+        b->ey = grow(b->ey, capacity);
+        b->ez = grow(b->ez, capacity);
+        b->capacity = capacity;
+    }
+    b->count = 0;
+}
+
+void box_batch_free(struct BoxBatch *b)
+{
+    free(b->cx);
+    free(b->cy);
+    free(b->cz);
+    free(b->ex);
+    free(b->ey);
+    free(b->ez);
+    *b = (struct BoxBatch){ 0 };
+}
+
+/* cull_force_impl - pin the implementation used by the cull functions
+ *  - CULL_AUTO picks the widest one the CPU supports
+ *  - unavailable implementations fall back to the next narrower one
+ */
+void cull_force_impl(enum CullImpl impl)
+{
+    g_impl = impl;
+}
+
+#if defined(__SSE2__)
+static size_t cull_spheres_sse(const struct Frustum *f,
+        const struct SphereBatch *b, uint32_t *visible, size_t *done)
+{
+    __m128 nx[6], ny[6], nz[6], nd[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm_set1_ps(f->planes[p][0]);
+        ny[p] = _mm_set1_ps(f->planes[p][1]);
+        nz[p] = _mm_set1_ps(f->planes[p][2]);
+        nd[p] = _mm_set1_ps(f->planes[p][3]);
+    }
+
+    size_t nvisible = 0, i = 0;
+    for (; i + 4 <= b->count; i += 4) {
+        __m128 x = _mm_loadu_ps(b->x + i);
+        __m128 y = _mm_loadu_ps(b->y + i);
+        __m128 z = _mm_loadu_ps(b->z + i);
+        __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(b->r + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m128 d = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(x, nx[p]), _mm_mul_ps(y, ny[p])),
+                    _mm_add_ps(_mm_mul_ps(z, nz[p]), nd[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++)
+            if (mask & (1 << k))
+                visible[nvisible++] = i + k;
+    }
+    *done = i;
+    return nvisible;
+}
+
+static size_t cull_boxes_sse(const struct Frustum *f,
+        const struct BoxBatch *b, uint32_t *visible, size_t *done)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], nd[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm_set1_ps(f->planes[p][0]);
+        ny[p] = _mm_set1_ps(f->planes[p][1]);
+        nz[p] = _mm_set1_ps(f->planes[p][2]);
+        nd[p] = _mm_set1_ps(f->planes[p][3]);
+        ax[p] = _mm_andnot_ps(sign, nx[p]);
+        ay[p] = _mm_andnot_ps(sign, ny[p]);
+        az[p] = _mm_andnot_ps(sign, nz[p]);
+    }
+
+    size_t nvisible = 0, i = 0;
+    for (; i + 4 <= b->count; i += 4) {
+        __m128 cx = _mm_loadu_ps(b->cx + i);
+        __m128 cy = _mm_loadu_ps(b->cy + i);
+        __m128 cz = _mm_loadu_ps(b->cz + i);
+        __m128 ex = _mm_loadu_ps(b->ex + i);
+        __m128 ey = _mm_loadu_ps(b->ey + i);
+        __m128 ez = _mm_loadu_ps(b->ez + i);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            /* Distance of the box's most positive corner along the normal */
+            __m128 d = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(cx, nx[p]), _mm_mul_ps(cy, ny[p])),
+                    _mm_add_ps(_mm_mul_ps(cz, nz[p]), nd[p]));
+            __m128 e = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(ex, ax[p]), _mm_mul_ps(ey, ay[p])),
+                    _mm_mul_ps(ez, az[p]));
+            inside = _mm_and_ps(inside,
+                    _mm_cmpge_ps(_mm_add_ps(d, e), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++)
+            if (mask & (1 << k))
+                visible[nvisible++] = i + k;
+    }
+    *done = i;
+    return nvisible;
+}
+#endif /* __SSE2__ */
+
+#if defined(SIMD_DISPATCH)
+TARGET("avx")
+static size_t cull_spheres_avx(const struct Frustum *f,
+        const struct SphereBatch *b, uint32_t *visible, size_t *done)
+{
+    __m256 nx[6], ny[6], nz[6], nd[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm256_set1_ps(f->planes[p][0]);
+        ny[p] = _mm256_set1_ps(f->planes[p][1]);
+        nz[p] = _mm256_set1_ps(f->planes[p][2]);
+        nd[p] = _mm256_set1_ps(f->planes[p][3]);
+    }
+
+    size_t nvisible = 0, i = 0;
+    for (; i + 8 <= b->count; i += 8) {
+        __m256 x = _mm256_loadu_ps(b->x + i);
+        __m256 y = _mm256_loadu_ps(b->y + i);
+        __m256 z = _mm256_loadu_ps(b->z + i);
+        __m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(),
+                _mm256_loadu_ps(b->r + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 d = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(x, nx[p]), _mm256_mul_ps(y, ny[p])),
+                    _mm256_add_ps(_mm256_mul_ps(z, nz[p]), nd[p]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++)
+            if (mask & (1 << k))
+                visible[nvisible++] = i + k;
+    }
+    *done = i;
+    return nvisible;
+}
+
+TARGET("avx")
+static size_t cull_boxes_avx(const struct Frustum *f,
+        const struct BoxBatch *b, uint32_t *visible, size_t *done)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], nd[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm256_set1_ps(f->planes[p][0]);
+        ny[p] = _mm256_set1_ps(f->planes[p][1]);
+        nz[p] = _mm256_set1_ps(f->planes[p][2]);
+        nd[p] = _mm256_set1_ps(f->planes[p][3]);
+        ax[p] = _mm256_andnot_ps(sign, nx[p]);
+        ay[p] = _mm256_andnot_ps(sign, ny[p]);
+        az[p] = _mm256_andnot_ps(sign, nz[p]);
+    }
+
+    size_t nvisible = 0, i = 0;
+    for (; i + 8 <= b->count; i += 8) {
+        __m256 cx = _mm256_loadu_ps(b->cx + i);
+        __m256 cy = _mm256_loadu_ps(b->cy + i);
+        __m256 cz = _mm256_loadu_ps(b->cz + i);
+        __m256 ex = _mm256_loadu_ps(b->ex + i);
+        __m256 ey = _mm256_loadu_ps(b->ey + i);
+        __m256 ez = _mm256_loadu_ps(b->ez + i);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 d = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(cx, nx[p]), _mm256_mul_ps(cy, ny[p])),
+                    _mm256_add_ps(_mm256_mul_ps(cz, nz[p]), nd[p]));
+            __m256 e = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(ex, ax[p]), _mm256_mul_ps(ey, ay[p])),
+                    _mm256_mul_ps(ez, az[p]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, e),
+                        _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++)
+            if (mask & (1 << k))
+                visible[nvisible++] = i + k;
+    }
+    *done = i;
+    return nvisible;
+}
+#endif /* SIMD_DISPATCH */
+
+/* cull_spheres - find the spheres that intersect the frustum
+ * @f: the Frustum
+ * @b: the spheres to test
+ * @visible: receives the indices of visible spheres in ascending order
+ *
+ * Returns the number of visible spheres
+ *
+ * Contracts:
+ *  - @visible has room for @b->count indices
+ *  - Threadsafe
+ */
+size_t cull_spheres(const struct Frustum *f, const struct SphereBatch *b,
+        uint32_t *visible)
+{
+    size_t nvisible = 0, done = 0;
+    enum CullImpl impl = g_impl;
+
+#if defined(SIMD_DISPATCH)
+    if ((impl == CULL_AUTO || impl == CULL_AVX) && CPU_HAS("avx")) {
+        nvisible = cull_spheres_avx(f, b, visible, &done);
+        impl = CULL_SCALAR;
+    }
+#endif
+#if defined(__SSE2__)
+    if (impl != CULL_SCALAR)
+        nvisible = cull_spheres_sse(f, b, visible, &done);
+#endif
+    (void)impl;
+
+    return nvisible + cull_spheres_scalar(f, b, done, visible + nvisible);
+}
+
+/* cull_boxes - find the boxes that intersect the frustum
+ *  - see cull_spheres
+ */
+size_t cull_boxes(const struct Frustum *f, const struct BoxBatch *b,
+        uint32_t *visible)
+{
+    size_t nvisible = 0, done = 0;
+    enum CullImpl impl = g_impl;
+
+#if defined(SIMD_DISPATCH)
+    if ((impl == CULL_AUTO || impl == CULL_AVX) && CPU_HAS("avx")) {
+        nvisible = cull_boxes_avx(f, b, visible, &done);
+        impl = CULL_SCALAR;
+    }
+#endif
+#if defined(__SSE2__)
+    if (impl != CULL_SCALAR)
+        nvisible = cull_boxes_sse(f, b, visible, &done);
+#endif
+    (void)impl;
+
+    return nvisible + cull_boxes_scalar(f, b, done, visible + nvisible);
+}
+
+static size_t cull_spheres_scalar(const struct Frustum *f,
+        const struct SphereBatch *b, size_t begin, uint32_t *visible)
+{
+    size_t nvisible = 0;
+    for (size_t i = begin; i < b->count; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            const float *n = f->planes[p];
+            float d = b->x[i] * n[0] + b->y[i] * n[1] + b->z[i] * n[2] + n[3];
+            inside = d >= -b->r[i];
+        }
+        if (inside)
+            visible[nvisible++] = i;
+    }
+    return nvisible;
+}
+
+static size_t cull_boxes_scalar(const struct Frustum *f,
+        const struct BoxBatch *b, size_t begin, uint32_t *visible)
+{
+    size_t nvisible = 0;
+    for (size_t i = begin; i < b->count; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            const float *n = f->planes[p];
+            float d = b->cx[i] * n[0] + b->cy[i] * n[1] + b->cz[i] * n[2] + n[3];
+            float e = b->ex[i] * fabsf(n[0]) + b->ey[i] * fabsf(n[1])
+                    + b->ez[i] * fabsf(n[2]);
+            inside = d + e >= 0.0f;
+        }
+        if (inside)
+            visible[nvisible++] = i;
+    }
+    return nvisible;
+}
+
+static float *grow(float *p, size_t n)
+{
+    float *q = realloc(p, n * sizeof (float));
+    ASSERT(q != NULL, "Out of memory");
+    return q;
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "deferred.h"
+#include "frame.h"
+#include "glutils.h"
+
+/* Texture units of the G-buffer in the lighting pass, below
+ * FRAME_CLUSTER_UNIT */
+enum { ALBEDO_UNIT, NORMAL_UNIT, DEPTH_UNIT };
+
+static GLuint make_target(GLint internal, GLsizei width, GLsizei height,
+        GLenum format, GLenum type);
+static void geometry_model(struct GBuffer *g, const struct Model *m,
+        struct Model *out) ATTR((nonnull(1, 2, 3)));
+
+/* parse_render_mode - RENDER_DEFERRED if "--deferred" is among the
+ * arguments, RENDER_FORWARD otherwise */
+enum RenderMode parse_render_mode(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--deferred") == 0)
+            return RENDER_DEFERRED;
+    return RENDER_FORWARD;
+}
+
+/* gbuffer_init - create a G-buffer and the deferred shading programs
+ * @g: the GBuffer
+ * @width, @height: size of the default framebuffer
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call gbuffer_free() after use
+ */
+void gbuffer_init(struct GBuffer *g, GLsizei width, GLsizei height)
+{
+    memset(g, 0, sizeof *g);
+    g->width = width;
+    g->height = height;
+    g->albedo = make_target(GL_RGBA8, width, height, GL_RGBA,
+            GL_UNSIGNED_BYTE);
+    g->normal = make_target(GL_RG16_SNORM, width, height, GL_RG, GL_SHORT);
+    g->depth = make_target(GL_DEPTH24_STENCIL8, width, height,
+            GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+
+    GLCHECK(glGenFramebuffers(1, &g->fbo));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, g->fbo));
+    GLCHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_TEXTURE_2D, g->albedo, 0));
+    GLCHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                GL_TEXTURE_2D, g->normal, 0));
+    GLCHECK(glFramebufferTexture2D(GL_FRAMEBUFFER,
+                GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, g->depth, 0));
+    const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    GLCHECK(glDrawBuffers(2, buffers));
+    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE,
+            "G-buffer is incomplete");
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+    g->lighting = load_program(RESOURCE_DIR "deferred.vertex.glsl",
+                               RESOURCE_DIR "deferred.fragment.glsl");
+    bind_frame_block(g->lighting);
+    use_program(g->lighting);
+    set_uniform_int(glGetUniformLocation(g->lighting, "gbuffer_albedo"),
+            ALBEDO_UNIT);
+    set_uniform_int(glGetUniformLocation(g->lighting, "gbuffer_normal"),
+            NORMAL_UNIT);
+    set_uniform_int(glGetUniformLocation(g->lighting, "gbuffer_depth"),
+            DEPTH_UNIT);
+    g->inv_view_projection = glGetUniformLocation(g->lighting,
+            "inv_view_projection");
+    g->viewport_size = glGetUniformLocation(g->lighting, "viewport_size");
+
+    g->vao = gen_array();
+}
+
+void gbuffer_free(struct GBuffer *g)
+{
+    del_array(g->vao);
+    del_program(g->lighting);
+    GLCHECK(glDeleteFramebuffers(1, &g->fbo));
+    del_texture(g->depth);
+    del_texture(g->normal);
+    del_texture(g->albedo);
+    memset(g, 0, sizeof *g);
+}
+
+/* deferred_begin - start filling the G-buffer
+ *  - the entities of the frame are drawn with deferred_entities() next
+ *  - the current viewport must fit in the G-buffer
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void deferred_begin(struct GBuffer *g)
+{
+    GLCHECK(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &g->target));
+    GLCHECK(glGetIntegerv(GL_VIEWPORT, g->viewport));
+    ASSERT(g->viewport[0] + g->viewport[2] <= g->width
+            && g->viewport[1] + g->viewport[3] <= g->height,
+            "Viewport is larger than the G-buffer");
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, g->fbo));
+    const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, one = 1.0f;
+    GLCHECK(glClearBufferfv(GL_COLOR, 0, zero));
+    GLCHECK(glClearBufferfv(GL_COLOR, 1, zero));
+    GLCHECK(glClearBufferfv(GL_DEPTH, 0, &one));
+}
+
+/* deferred_entities - render_entities() into the G-buffer
+ *  - culling and instancing are render_entities()', only the program
+ *    differs, the G-buffer variant with @m's features
+ *
+ * Contracts:
+ *  - Between deferred_begin() and deferred_end()
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void deferred_entities(struct GBuffer *g, const struct Model *m,
+        const struct Entity *entity, size_t n)
+{
+    struct Model geometry;
+    geometry_model(g, m, &geometry);
+    render_entities(&geometry, entity, n);
+}
+
+/* deferred_transforms - render_transforms() into the G-buffer
+ *
+ * Contracts:
+ *  - Between deferred_begin() and deferred_end()
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void deferred_transforms(struct GBuffer *g, const struct Model *m,
+        struct TransformBatch *b)
+{
+    struct Model geometry;
+    geometry_model(g, m, &geometry);
+    render_transforms(&geometry, b);
+}
+
+/* deferred_end - light the G-buffer into the framebuffer bound before
+ *  - pixels no entity covered are left as they are, clear that
+ *    framebuffer's color beforehand
+ *  - the G-buffer's depth replaces that framebuffer's, in the viewport
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void deferred_end(const struct GBuffer *g)
+{
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, g->target));
+
+    const struct FrameUniforms *frame = current_frame();
+    mat4 view_projection, inverse;
+    glm_mat4_mul((vec4 *)frame->projection, (vec4 *)frame->view,
+            view_projection);
+    glm_mat4_inv(view_projection, inverse);
+
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    GLCHECK(glDisable(GL_DEPTH_TEST));
+    use_program(g->lighting);
+    set_uniform_mat4(g->inv_view_projection, inverse[0]);
+    GLCHECK(glUniform2f(g->viewport_size, g->viewport[2], g->viewport[3]));
+    bind_texture_unit(ALBEDO_UNIT, g->albedo);
+    bind_texture_unit(NORMAL_UNIT, g->normal);
+    bind_texture_unit(DEPTH_UNIT, g->depth);
+    bind_array(g->vao);
+    draw_arrays_instanced(GL_TRIANGLES, 3, 1);
+    if (depth_test)
+        GLCHECK(glEnable(GL_DEPTH_TEST));
+
+    const GLint *v = g->viewport;
+    GLCHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, g->fbo));
+    GLCHECK(glBlitFramebuffer(v[0], v[1], v[0] + v[2], v[1] + v[3],
+                v[0], v[1], v[0] + v[2], v[1] + v[3],
+                GL_DEPTH_BUFFER_BIT, GL_NEAREST));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, g->target));
+}
+
+/* make_target - a screen sized texture for the G-buffer, sampled with
+ * texelFetch() so no filtering is needed */
+/* geometry_model - @m drawn with the G-buffer variant of its features */
+static void geometry_model(struct GBuffer *g, const struct Model *m,
+        struct Model *out)
+{
+    if (g->geometry[m->features] == 0)
+        g->geometry[m->features] = request_shader_variant(
+                RESOURCE_DIR "entity.vertex.glsl",
+                RESOURCE_DIR "entity.gbuffer.fragment.glsl", m->features);
+    *out = *m;
+    out->program = g->geometry[m->features];
+}
+
+static GLuint make_target(GLint internal, GLsizei width, GLsizei height,
+        GLenum format, GLenum type)
+{
+    GLuint tex;
+    GLCHECK(glGenTextures(1, &tex));
+    bind_texture(tex);
+    GLCHECK(glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0,
+                format, type, NULL));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    return tex;
+}
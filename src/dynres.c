@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GL/glew.h>
+#include "dynres.h"
+#include "glutils.h"
+
+/* Scaling up only goes this fraction of max_step per decision */
+static const float UP_RATE = 0.25f;
+
+static void resize(struct DynRes *d, float scale) ATTR((nonnull(1)));
+
+/* dynres_default_config - 60 Hz with a little to spare, down to half
+ * resolution */
+void dynres_default_config(struct DynResConfig *out)
+{
+    *out = (struct DynResConfig){
+        .target_ms = 14.0,
+        .min_scale = 0.5f,
+        .max_scale = 1.0f,
+        .max_step = 0.1f,
+        .headroom = 0.15,
+        .settle = DYNRES_QUERIES,
+        .log = false,
+    };
+}
+
+/* dynres_parse_args - override @config from command line arguments
+ *  - --target-ms=N, --min-scale=N, --max-scale=N, --dynres-log
+ *  - other arguments are ignored
+ */
+void dynres_parse_args(struct DynResConfig *config, int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--target-ms=", 12) == 0)
+            config->target_ms = atof(arg + 12);
+        else if (strncmp(arg, "--min-scale=", 12) == 0)
+            config->min_scale = atof(arg + 12);
+        else if (strncmp(arg, "--max-scale=", 12) == 0)
+            config->max_scale = atof(arg + 12);
+        else if (strcmp(arg, "--dynres-log") == 0)
+            config->log = true;
+    }
+}
+
+/* dynres_init - create the offscreen target and the timer queries
+ * @d: the DynRes
+ * @width, @height: size of the window the frames end up in
+ * @config: the controller's settings, copied
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call dynres_free() after use
+ */
+void dynres_init(struct DynRes *d, GLsizei width, GLsizei height,
+        const struct DynResConfig *config)
+{
+    ASSERT(config->min_scale > 0.0f && config->min_scale <= config->max_scale
+            && config->max_scale <= 1.0f,
+            "Bad dynamic resolution scale range");
+    memset(d, 0, sizeof *d);
+    d->width = width;
+    d->height = height;
+    d->config = *config;
+
+    /* Always window sized, max_scale only caps what is used of it */
+    GLsizei w = width, h = height;
+    GLCHECK(glGenRenderbuffers(1, &d->color));
+    GLCHECK(glBindRenderbuffer(GL_RENDERBUFFER, d->color));
+    GLCHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h));
+    GLCHECK(glGenRenderbuffers(1, &d->depth));
+    GLCHECK(glBindRenderbuffer(GL_RENDERBUFFER, d->depth));
+    /* Same format as the default framebuffer so depth can be blitted */
+    GLCHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h));
+
+    GLCHECK(glGenFramebuffers(1, &d->fbo));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, d->fbo));
+    GLCHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_RENDERBUFFER, d->color));
+    GLCHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, d->depth));
+    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE,
+            "Dynamic resolution framebuffer is incomplete");
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+    GLCHECK(glGenQueries(DYNRES_QUERIES, d->queries));
+    resize(d, config->max_scale);
+}
+
+void dynres_free(struct DynRes *d)
+{
+    GLCHECK(glDeleteQueries(DYNRES_QUERIES, d->queries));
+    GLCHECK(glDeleteFramebuffers(1, &d->fbo));
+    GLCHECK(glDeleteRenderbuffers(1, &d->depth));
+    GLCHECK(glDeleteRenderbuffers(1, &d->color));
+    memset(d, 0, sizeof *d);
+}
+
+/* dynres_begin - start a frame at the current resolution
+ *  - takes in the oldest measurement if the driver has it, which may
+ *    change the resolution
+ *  - binds the offscreen target and sets the viewport to
+ *    @d->render_width x @d->render_height
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void dynres_begin(struct DynRes *d)
+{
+    unsigned slot = d->frame % DYNRES_QUERIES;
+    d->timing = true;
+    if (d->pending[slot]) {
+        GLuint available = GL_FALSE;
+        GLCHECK(glGetQueryObjectuiv(d->queries[slot],
+                    GL_QUERY_RESULT_AVAILABLE, &available));
+        if (available) {
+            GLuint64 ns;
+            GLCHECK(glGetQueryObjectui64v(d->queries[slot], GL_QUERY_RESULT,
+                        &ns));
+            d->pending[slot] = false;
+            dynres_feedback(d, ns / 1e6);
+        } else {
+            /* Still in flight, skip timing this frame rather than wait */
+            d->timing = false;
+        }
+    }
+
+    GLCHECK(glGetIntegerv(GL_VIEWPORT, d->viewport));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, d->fbo));
+    GLCHECK(glViewport(0, 0, d->render_width, d->render_height));
+    if (d->timing)
+        GLCHECK(glBeginQuery(GL_TIME_ELAPSED, d->queries[slot]));
+}
+
+/* dynres_end - stretch the frame onto the window
+ *  - leaves the default framebuffer bound with the viewport from before
+ *    dynres_begin()
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void dynres_end(struct DynRes *d)
+{
+    GLCHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, d->fbo));
+    GLCHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));
+    GLCHECK(glBlitFramebuffer(0, 0, d->render_width, d->render_height,
+                0, 0, d->width, d->height, GL_COLOR_BUFFER_BIT, GL_LINEAR));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    GLCHECK(glViewport(d->viewport[0], d->viewport[1], d->viewport[2],
+                d->viewport[3]));
+
+    if (d->timing) {
+        GLCHECK(glEndQuery(GL_TIME_ELAPSED));
+        d->pending[d->frame % DYNRES_QUERIES] = true;
+    }
+    d->frame++;
+}
+
+/* dynres_feedback - steer the scale with a frame's GPU time
+ * @d: the DynRes
+ * @gpu_ms: how long the GPU took for a frame
+ *
+ * Frame time is taken to follow the pixel count, the square of the scale.
+ * Over target, the scale drops to what would just meet it; well under, it
+ * rises a fraction of that way. Measurements of frames drawn before the
+ * last change settles are only recorded. Returns the new scale
+ */
+float dynres_feedback(struct DynRes *d, double gpu_ms)
+{
+    const struct DynResConfig *c = &d->config;
+    d->gpu_ms = gpu_ms;
+    if (d->settling > 0) {
+        d->settling--;
+        return d->scale;
+    }
+    if (gpu_ms <= 0.0)
+        return d->scale;
+
+    float ideal = d->scale * sqrt(c->target_ms / gpu_ms);
+    float scale = d->scale;
+    if (gpu_ms > c->target_ms)
+        scale = MAX(ideal, d->scale - c->max_step);
+    else if (gpu_ms < c->target_ms * (1.0 - c->headroom))
+        scale = MIN(d->scale + (ideal - d->scale) * UP_RATE,
+                d->scale + c->max_step * UP_RATE);
+    scale = MIN(MAX(scale, c->min_scale), c->max_scale);
+
+    GLsizei old_width = d->render_width, old_height = d->render_height;
+    resize(d, scale);
+    if (d->render_width != old_width || d->render_height != old_height) {
+        d->settling = c->settle;
+        d->changes++;
+        if (c->log)
+            fprintf(stderr, "dynres: %.2f ms against %.2f ms, "
+                    "%dx%d -> %dx%d\n", gpu_ms, c->target_ms, old_width, old_height,
+                    d->render_width, d->render_height);
+    }
+    return d->scale;
+}
+
+static void resize(struct DynRes *d, float scale)
+{
+    d->scale = scale;
+    d->render_width = MAX((GLsizei)lroundf(d->width * scale), 1);
+    d->render_height = MAX((GLsizei)lroundf(d->height * scale), 1);
+}
@@ -1,15 +1,32 @@
+#include <math.h>
+#include <string.h>
+#include <SDL.h>
 #include <GL/glew.h>
 #include <cglm/cglm.h>
 #include "entity.h"
 #include "glutils.h"
+#include "frame.h"
+#include "cull.h"
+#include "occlusion.h"
+#include "shaderpp.h"
 
-static const GLuint VERT_POS = 0,
-                    TEX_POS  = 1,
-                    NORM_POS = 2;
-static const float FOV        = 70;
-static const float NEAR_PLANE = 0.1f;
-static const float FAR_PLANE  = 1000.0f;
-static const float ASPECT     = 800.0f / 600.0f;
+static const GLuint VERT_POS  = 0,
+                    TEX_POS   = 1,
+                    NORM_POS  = 2,
+                    MODEL_POS = 3; /* mat4, takes locations 3-6 */
+
+/* Globals */
+static mat4  *g_instances = NULL; /* scratch space for model matrices */
+static size_t g_instances_capacity = 0;
+static uint32_t *g_visible = NULL;  /* indices that survived culling */
+static size_t g_visible_capacity = 0;
+static struct SphereBatch g_spheres;
+static struct CullStats g_cull_stats;
+static struct OcclusionBuffer *g_occluders = NULL; /* optional */
+
+static mat4 *reserve_instances(size_t n);
+static size_t cull_instances(const vec4 bounds, mat4 *instances, size_t n)
+    ATTR((nonnull(1, 2)));
 
 /* create_model - generate a Model from ModelData
  * @data: structure containing information about creating Models
@@ -24,7 +41,13 @@ static const float ASPECT     = 800.0f / 600.0f;
  */
 void create_model(const struct ModelData *data, struct Model *out)
 {
-    out->program = load_program(data->vert_filepath, data->frag_filepath);
+    /* Specialized for what the Model has, shared with every Model alike,
+     * may still be compiling, see ready_variant() */
+    out->features = SHADER_LIT | SHADER_INSTANCED;
+    if (data->tex_filepath)
+        out->features |= SHADER_TEXTURED;
+    out->program = request_shader_variant(data->vert_filepath,
+            data->frag_filepath, out->features);
 
     out->vao = gen_array();
 
@@ -50,13 +73,17 @@ void create_model(const struct ModelData *data, struct Model *out)
     out->ebo_indices = gen_buffer(GL_ELEMENT_ARRAY_BUFFER, 
             data->indices_count * sizeof (GLuint), data->indices);
 
-    out->model_uniform       = glGetUniformLocation(out->program, "model");
-    out->view_uniform        = glGetUniformLocation(out->program, "view");
-    out->projection_uniform  = glGetUniformLocation(out->program, "projection");
-    out->light_pos_uniform   = glGetUniformLocation(out->program, "light_pos");
-    out->light_color_uniform = glGetUniformLocation(out->program, "light_color");
+    /* Per-instance model matrices, one column per attribute location */
+    GLCHECK(glGenBuffers(1, &out->vbo_instances));
+    bind_buffer(GL_ARRAY_BUFFER, out->vbo_instances);
+    for (GLuint col = 0; col < 4; col++) {
+        attrib_buffer(MODEL_POS + col, 4, GL_FLOAT, sizeof (mat4), 
+                col * sizeof (vec4));
+        attrib_divisor(MODEL_POS + col, 1);
+    }
 
     out->num_indices = data->indices_count;
+    mesh_bounds(data->vertices, data->vertices_count, out->bounds);
 
     bind_array(0);
     bind_texture(0);
@@ -71,16 +98,16 @@ void create_model(const struct ModelData *data, struct Model *out)
  */
 void destroy_model(const struct Model *model)
 {
-    del_program(model->program);
+    /* The program belongs to the variant cache */
     del_array(model->vao);
     del_buffer(model->vbo_vertices);
     del_buffer(model->vbo_normals);
     del_buffer(model->ebo_indices);
+    del_buffer(model->vbo_instances);
     if (model->vbo_texture_uv != 0){
         del_buffer(model->vbo_texture_uv);
         del_texture(model->texture);
     }
-    /* Don't need to do anything to uniforms */
 }
 
 /* render_entity - render an entity given a model
@@ -91,58 +118,230 @@ void render_entity(const struct Model *model, const struct Entity *entity)
     render_entities(model, entity, 1);
 }
 
+/* entity_model_matrix - compute the model matrix of an Entity
+ * @entity: the Entity
+ * @out: where to store the matrix
+ */
+void entity_model_matrix(const struct Entity *entity, mat4 out)
+{
+    glm_mat4_identity(out);
+    glm_translate_x(out, entity->x);
+    glm_translate_y(out, entity->y);
+    glm_translate_z(out, entity->z);
+    glm_rotate_x(out, entity->rot_x, out);
+    glm_rotate_y(out, entity->rot_y, out);
+    glm_rotate_z(out, entity->rot_z, out);
+    glm_scale_uni(out, entity->scale);
+}
+
+/* collect_instances - model matrices of the Entities that may be visible
+ * @bounds: object space bounding sphere of the mesh the Entities use
+ * @entity: pointer to the first Entity
+ * @n: number of Entities in the array
+ * @out: receives the matrices, room for @n of them
+ *
+ * Entities are culled against the current frame's frustum and the
+ * occluders set with set_entity_occluders(), the survivors keep their order.
+ * Returns the number of matrices written to @out
+ *
+ * Contracts:
+ *  - Not threadsafe - uses static memory
+ */
+size_t collect_instances(const vec4 bounds, const struct Entity *entity,
+        size_t n, mat4 *out)
+{
+    for (size_t i = 0; i < n; i++)
+        entity_model_matrix(&entity[i], out[i]);
+    return cull_instances(bounds, out, n);
+}
+
 /* render_entities - render an array of Entities given a model
  * @m: the Model to use
  * @entity: pointer to the first Entity
  * @n: number of Entities in the array
  *
+ * Entities outside the current frame's frustum are culled, the rest are
+ * drawn with a single instanced draw call, their model matrices streamed
+ * through the frame ring, see upload_instances(). Camera and light come
+ * from the Frame uniform block, see upload_frame().
+ *
  * Contracts:
  *  - @m and @entity are non-null and previously allocated + set-up
  *  - @entity has @n elements
- *  - Not threadsafe - calls OpenGL functions
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
  */
 void render_entities(const struct Model *m, const struct Entity *entity, size_t n)
 {
-    use_program(m->program);
+    if (n == 0)
+        return;
+
+    mat4 *instances = reserve_instances(n);
+    n = collect_instances(m->bounds, entity, n, instances);
+    if (n == 0)
+        return;
+
+    /* Binds are cached by glutils, nothing is reset afterwards so the next
+     * call with the same Model doesn't touch them again */
+    use_program(ready_variant(m->program));
     bind_array(m->vao);
-    if (m->texture != 0) {
-        /* Set up texture uniform */
-        GLCHECK(glActiveTexture(GL_TEXTURE0));
-        bind_texture(m->texture);
-    }
+    if (m->texture != 0)
+        bind_texture_unit(0, m->texture);
 
-    /* Set up view matrix */
-    mat4 view = GLM_MAT4_IDENTITY_INIT;
-    glm_translate(view, (vec3){0.0f, 0.0f, -3.0f});
+    upload_instances(m, instances, n);
+    draw_instanced(m->num_indices, n);
+}
 
-    /* Set up projection matrix */
-    mat4 projection = GLM_MAT4_IDENTITY_INIT;
-    glm_perspective(FOV, ASPECT, NEAR_PLANE, FAR_PLANE, projection);
+/* upload_instances - stream model matrices for the next draw of a Model
+ * @m: the Model, its VAO is bound
+ * @instances: the matrices
+ * @n: number of matrices
+ *
+ * The matrices are copied into the frame ring and the Model's instance
+ * attributes pointed at them. If the ring is full they are uploaded into
+ * the Model's own instance buffer instead.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void upload_instances(const struct Model *m, mat4 *instances, size_t n)
+{
+    GLintptr offset;
+    GLuint buffer = stream_buffer(GL_ARRAY_BUFFER, m->vbo_instances,
+            instances, n * sizeof (mat4), &offset);
+    point_instances(buffer, offset);
+}
 
-    static const vec3 light_pos   = {0.0f, 0.0f, 0.0f};
-    static const vec3 light_color = {1.0f, 1.0f, 1.0f};
+/* point_instances - source the bound Model VAO's model matrices from
+ * @buffer, starting at @offset
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void point_instances(GLuint buffer, GLintptr offset)
+{
+    bind_buffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint col = 0; col < 4; col++)
+        attrib_buffer(MODEL_POS + col, 4, GL_FLOAT, sizeof (mat4),
+                offset + col * sizeof (vec4));
+}
 
+/* entity_cull_stats - frustum culling totals since the last reset */
+const struct CullStats *entity_cull_stats(void)
+{
+    return &g_cull_stats;
+}
+
+void reset_entity_cull_stats(void)
+{
+    g_cull_stats = (struct CullStats){ 0 };
+}
+
+/* cull_entity_spheres - frustum and occlusion cull world space bounds
+ * @spheres: the bounds
+ * @visible: receives the indices of visible spheres in ascending order, room
+ *  for @spheres->count of them
+ *
+ * Uses the current frame's frustum and the occluders set with
+ * set_entity_occluders(), and adds to entity_cull_stats().
+ * Returns the number of visible spheres
+ */
+size_t cull_entity_spheres(const struct SphereBatch *spheres, uint32_t *visible)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    size_t nvisible = cull_spheres(current_frustum(), spheres, visible);
+    if (g_occluders)
+        nvisible = occlusion_cull_spheres(g_occluders, spheres, visible,
+                nvisible, visible);
+
+    g_cull_stats.visible += nvisible;
+    g_cull_stats.culled  += spheres->count - nvisible;
+    g_cull_stats.seconds += (double)(SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+    return nvisible;
+}
+
+/* set_entity_occluders - test entities against a depth buffer after the
+ * frustum
+ * @occluders: a buffer that has been through occlusion_finish() this frame,
+ *  or NULL to disable occlusion culling
+ *
+ * Contracts:
+ *  - @occluders outlives every render_entities() call it is set for
+ */
+void set_entity_occluders(struct OcclusionBuffer *occluders)
+{
+    g_occluders = occluders;
+}
+
+static mat4 *reserve_instances(size_t n)
+{
+    if (n > g_instances_capacity) {
+        size_t capacity = MAX(g_instances_capacity * 2, n);
+        mat4 *instances = realloc(g_instances, capacity * sizeof (mat4));
+        ASSERT(instances != NULL, "Out of memory");
+        g_instances = instances;
+        g_instances_capacity = capacity;
+    }
+    return g_instances;
+}
+
+/* mesh_bounds - bounding sphere around the center of the vertices'
+ * bounding box
+ * @vertices: xyz positions
+ * @count: number of floats in @vertices
+ * @out: xyz center + w radius
+ */
+void mesh_bounds(const GLfloat *vertices, GLsizei count, vec4 out)
+{
+    vec3 lo = { 0.0f, 0.0f, 0.0f }, hi = { 0.0f, 0.0f, 0.0f };
+    for (GLsizei i = 0; i + 2 < count; i += 3) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = i == 0 ? vertices[k] : MIN(lo[k], vertices[i+k]);
+            hi[k] = i == 0 ? vertices[k] : MAX(hi[k], vertices[i+k]);
+        }
+    }
+
+    float radius2 = 0.0f;
+    glm_vec_center(lo, hi, out);
+    for (GLsizei i = 0; i + 2 < count; i += 3)
+        radius2 = MAX(radius2, glm_vec_distance2(out, (float *)&vertices[i]));
+    out[3] = sqrtf(radius2);
+}
+
+/* cull_instances - drop instances whose bounds are outside the frustum or
+ *  behind the occluders
+ * @bounds: the Model's object space bounding sphere
+ * @instances: model matrices, compacted in place
+ * @n: number of instances
+ *
+ * Returns the number of visible instances
+ */
+static size_t cull_instances(const vec4 bounds, mat4 *instances, size_t n)
+{
+    if (n > g_visible_capacity) {
+        size_t capacity = MAX(g_visible_capacity * 2, n);
+        uint32_t *visible = realloc(g_visible, capacity * sizeof (uint32_t));
+        ASSERT(visible != NULL, "Out of memory");
+        g_visible = visible;
+        g_visible_capacity = capacity;
+    }
+    sphere_batch_reserve(&g_spheres, n);
     for (size_t i = 0; i < n; i++) {
-        /* Set up model matrix */
-        mat4 model = GLM_MAT4_IDENTITY_INIT;
-        glm_translate_x(model, entity[i].x);
-        glm_translate_y(model, entity[i].y);
-        glm_translate_z(model, entity[i].z);
-        glm_rotate_x(model, entity[i].rot_x, model);
-        glm_rotate_y(model, entity[i].rot_y, model);
-        glm_rotate_z(model, entity[i].rot_z, model);
-        glm_scale_uni(model, entity[i].scale);
-
-        GLCHECK(glUniformMatrix4fv(m->model_uniform, 1, GL_FALSE, model[0]));
-        GLCHECK(glUniformMatrix4fv(m->view_uniform, 1, GL_FALSE, view[0]));
-        GLCHECK(glUniformMatrix4fv(m->projection_uniform, 1, GL_FALSE, projection[0]));
-        GLCHECK(glUniform3fv(m->light_pos_uniform, 1, light_pos));
-        GLCHECK(glUniform3fv(m->light_color_uniform, 1, light_color));
-        GLCHECK(glDrawElements(GL_TRIANGLES, m->num_indices, GL_UNSIGNED_INT, NULL));
+        vec3 center;
+        glm_mat4_mulv3(instances[i], (float *)bounds, 1.0f, center);
+        /* Entities are uniformly scaled, so any column's length will do */
+        float scale = glm_vec_norm(instances[i][0]);
+        g_spheres.x[i] = center[0];
+        g_spheres.y[i] = center[1];
+        g_spheres.z[i] = center[2];
+        g_spheres.r[i] = bounds[3] * scale;
     }
+    g_spheres.count = n;
 
-    use_program(0);
-    bind_array(0);
-    if (m->texture != 0)
-        bind_texture(0);
+    size_t nvisible = cull_entity_spheres(&g_spheres, g_visible);
+    for (size_t i = 0; i < nvisible; i++)
+        if (g_visible[i] != i)
+            glm_mat4_copy(instances[g_visible[i]], instances[i]);
+    return nvisible;
 }
@@ -0,0 +1,171 @@
+#include <string.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "frame.h"
+#include "glutils.h"
+
+static const float FOV        = 70;
+static const float NEAR_PLANE = 0.1f;
+static const float FAR_PLANE  = 1000.0f;
+static const float ASPECT     = 800.0f / 600.0f;
+
+static_assert(sizeof (struct FrameUniforms) == 480,
+        "struct FrameUniforms does not match the std140 Frame block");
+
+/* Globals */
+static struct RingBuffer g_ring;
+static struct FrameUniforms g_frame;
+static struct Frustum g_frustum;
+
+/* init_frame - create the ring buffer the Frame block is streamed through
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call cleanup_frame() after use
+ */
+void init_frame(void)
+{
+    default_frame(&g_frame);
+    mat4 viewproj;
+    glm_mat4_mul(g_frame.projection, g_frame.view, viewproj);
+    frustum_from_matrix(viewproj, &g_frustum);
+    ring_init(&g_ring, FRAME_RING_SIZE);
+}
+
+void cleanup_frame(void)
+{
+    ring_free(&g_ring);
+}
+
+/* default_frame - the fixed camera and light used by the demo
+ * @out: the FrameUniforms to fill
+ */
+void default_frame(struct FrameUniforms *out)
+{
+    memset(out, 0, sizeof *out);
+
+    /* Set up view matrix */
+    glm_mat4_identity(out->view);
+    glm_translate(out->view, (vec3){0.0f, 0.0f, -3.0f});
+
+    /* Set up projection matrix */
+    glm_perspective(glm_rad(FOV), ASPECT, NEAR_PLANE, FAR_PLANE,
+            out->projection);
+
+    glm_vec4_copy((vec4){0.0f, 0.0f, 0.0f, 1.0f}, out->light_pos);
+    glm_vec4_copy((vec4){1.0f, 1.0f, 1.0f, 1.0f}, out->light_color);
+
+    /* The sun is off until given an intensity */
+    glm_vec4_copy((vec4){-0.3f, -0.9f, -0.3f, 0.0f}, out->sun_direction);
+    glm_vec_normalize(out->sun_direction);
+}
+
+/* upload_frame - start a frame with @frame as its uniforms
+ * @frame: the data to upload
+ *
+ * Moves the frame ring on to the next segment, which may wait for the GPU
+ * to finish the frame that used it RING_SEGMENTS frames ago.
+ *
+ * Contracts:
+ *  - Called once per frame, before any draws
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void upload_frame(const struct FrameUniforms *frame)
+{
+    memcpy(&g_frame, frame, sizeof g_frame);
+
+    ring_begin_frame(&g_ring);
+    struct RingAlloc block;
+    bool ok = ring_alloc(&g_ring, sizeof g_frame, 0, &block);
+    ASSERT(ok, "Frame ring is too small for the Frame block");
+    memcpy(block.ptr, &g_frame, sizeof g_frame);
+    ring_flush(&g_ring);
+    bind_buffer_range(GL_UNIFORM_BUFFER, FRAME_UBO_BINDING, block.buffer,
+            block.offset, sizeof g_frame);
+
+    /* Culling planes are extracted once here for the whole frame */
+    mat4 viewproj;
+    glm_mat4_mul(g_frame.projection, g_frame.view, viewproj);
+    frustum_from_matrix(viewproj, &g_frustum);
+}
+
+/* current_frame - the uniforms last passed to upload_frame() */
+const struct FrameUniforms *current_frame(void)
+{
+    return &g_frame;
+}
+
+/* current_frustum - world space planes of the current frame's camera */
+const struct Frustum *current_frustum(void)
+{
+    return &g_frustum;
+}
+
+/* frame_ring - streaming buffer for data that only lives for this frame */
+struct RingBuffer *frame_ring(void)
+{
+    return &g_ring;
+}
+
+/* stream_buffer - this frame's @data for GL commands to read
+ * @target: binding point the data is read through
+ * @fallback: the caller's own buffer, used if the frame ring is full
+ * @data: bytes to copy
+ * @size: how many
+ * @offset: where the data starts in the returned buffer
+ *
+ * Returns the buffer holding the data, left bound to @target. A full ring
+ * orphans @fallback's old contents, so the driver doesn't wait on the last
+ * draw that read them.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+GLuint stream_buffer(GLenum target, GLuint fallback, const void *data,
+        size_t size, GLintptr *offset)
+{
+    struct RingAlloc alloc;
+    if (ring_alloc(&g_ring, size, 0, &alloc)) {
+        memcpy(alloc.ptr, data, size);
+        ring_flush(&g_ring);
+        bind_buffer(target, alloc.buffer);
+        *offset = alloc.offset;
+        return alloc.buffer;
+    }
+
+    bind_buffer(target, fallback);
+    GLCHECK(glBufferData(target, size, data, GL_STREAM_DRAW));
+    *offset = 0;
+    return fallback;
+}
+
+/* bind_frame_block - point @program's Frame block at the shared buffer
+ *  - also points its clustered light samplers at FRAME_CLUSTER_UNIT on and
+ *    its shadow map at FRAME_SHADOW_UNIT, which makes @program current if
+ *    it has them
+ *  - programs without a Frame block or the samplers are left alone
+ */
+void bind_frame_block(GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex(program, "Frame");
+    if (index != GL_INVALID_INDEX)
+        GLCHECK(glUniformBlockBinding(program, index, FRAME_UBO_BINDING));
+
+    static const struct {
+        const char *name;
+        GLint unit;
+    } SAMPLERS[] = {
+        { "cluster_lights",  FRAME_CLUSTER_UNIT },
+        { "cluster_table",   FRAME_CLUSTER_UNIT + 1 },
+        { "cluster_indices", FRAME_CLUSTER_UNIT + 2 },
+        { "shadow_map",      FRAME_SHADOW_UNIT },
+    };
+    for (unsigned i = 0; i < ARRAY_SIZE(SAMPLERS); i++) {
+        GLint loc = glGetUniformLocation(program, SAMPLERS[i].name);
+        if (loc != -1) {
+            use_program(program);
+            set_uniform_int(loc, SAMPLERS[i].unit);
+        }
+    }
+}
@@ -6,16 +6,85 @@
 #include <SDL_image.h>
 #include "utils.h"
 #include "glutils.h"
+#include "progcache.h"
+#include "shaderpp.h"
+
+/* Name that never matches a real binding, forces the next call through */
+#define UNKNOWN_BINDING ((GLuint)-1)
+#define MAX_TEXTURE_UNITS 16
+
+/* Shadow copy of the bindings the helpers below change. Element array
+ * buffers are VAO state and always go through */
+struct GLState {
+    GLuint program;
+    GLuint vao;
+    GLuint active_unit;
+    GLuint textures[MAX_TEXTURE_UNITS]; /* GL_TEXTURE_2D of each unit */
+    GLuint array_buffer;
+    GLuint uniform_buffer;
+    GLuint draw_indirect_buffer;
+};
+
+/* Globals */
+static struct GLStats g_stats;
+static struct GLState g_state = {
+    .program = UNKNOWN_BINDING,
+    .vao = UNKNOWN_BINDING,
+    .active_unit = UNKNOWN_BINDING,
+    .textures = {
+        UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING,
+        UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING,
+        UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING,
+        UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING,
+    },
+    .array_buffer = UNKNOWN_BINDING,
+    .uniform_buffer = UNKNOWN_BINDING,
+    .draw_indirect_buffer = UNKNOWN_BINDING,
+};
+
+static GLuint *cached_buffer(GLenum target);
+static bool    state_changed(GLuint *cached, GLuint value, GLenum pname)
+    ATTR((nonnull(1)));
+static void    check_shader(GLuint shader);
 
 GLuint gen_buffer(GLenum type, GLsizei size, const void *data)
 {
     GLuint buffer;
     GLCHECK(glGenBuffers(1, &buffer));
-    GLCHECK(glBindBuffer(type, buffer));
+    bind_buffer(type, buffer);
     GLCHECK(glBufferData(type, size, data, GL_STATIC_DRAW));
     return buffer;
 }
 
+/* bind_buffer - glBindBuffer(), skipped when @buffer is already bound */
+void bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint *cached = cached_buffer(target);
+    if (cached == NULL || state_changed(cached, buffer, 0))
+        GLCHECK(glBindBuffer(target, buffer));
+}
+
+/* bind_buffer_range - glBindBufferRange(), which also binds @buffer to the
+ * generic @target binding point */
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+        GLintptr offset, GLsizeiptr size)
+{
+    GLCHECK(glBindBufferRange(target, index, buffer, offset, size));
+    GLuint *cached = cached_buffer(target);
+    if (cached != NULL)
+        *cached = buffer;
+}
+
+/* bind_buffer_base - glBindBufferBase(), which also binds @buffer to the
+ * generic @target binding point */
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer)
+{
+    GLCHECK(glBindBufferBase(target, index, buffer));
+    GLuint *cached = cached_buffer(target);
+    if (cached != NULL)
+        *cached = buffer;
+}
+
 void attrib_buffer(GLuint idx, GLint size, GLenum type, 
         GLsizei stride, intptr_t offset)
 {
@@ -29,9 +98,23 @@ void attrib_buffer(GLuint idx, GLint size, GLenum type,
     GLCHECK(glEnableVertexAttribArray(idx));
 }
 
+void attrib_divisor(GLuint idx, GLuint divisor)
+{
+    GLCHECK(glVertexAttribDivisor(idx, divisor));
+}
+
 void del_buffer(GLuint buffer)
 {
     GLCHECK(glDeleteBuffers(1, &buffer));
+    /* Deleting a bound buffer unbinds it */
+    GLuint *bindings[] = {
+        &g_state.array_buffer,
+        &g_state.uniform_buffer,
+        &g_state.draw_indirect_buffer,
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(bindings); i++)
+        if (*bindings[i] == buffer)
+            *bindings[i] = 0;
 }
 
 GLuint gen_array(void)
@@ -44,53 +127,101 @@ GLuint gen_array(void)
 
 void bind_array(GLuint vao)
 {
-    GLCHECK(glBindVertexArray(vao));
+    if (state_changed(&g_state.vao, vao, GL_VERTEX_ARRAY_BINDING))
+        GLCHECK(glBindVertexArray(vao));
 } 
 
 void del_array(GLuint vao)
 {
     GLCHECK(glDeleteVertexArrays(1, &vao));
+    if (g_state.vao == vao)
+        g_state.vao = 0;
 }
 
 GLuint make_shader(GLenum type, const char *source)
+{
+    GLuint shader = start_shader(type, source);
+    check_shader(shader);
+    return shader;
+}
+
+/* start_shader - queue a shader's compile without waiting for it
+ *  - the driver compiles while the caller goes on, until something asks
+ *    for the result, see start_program()
+ */
+GLuint start_shader(GLenum type, const char *source)
 {
     GLuint shader = glCreateShader(type);
     GLCHECK(glShaderSource(shader, 1, &source, NULL));
     GLCHECK(glCompileShader(shader));
-
-    /* Error checking */
-    GLint status;
-    GLCHECK(glGetShaderiv(shader, GL_COMPILE_STATUS, &status));
-    if (status == GL_FALSE) {
-        GLint status_length;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &status_length);
-        GLchar *info = calloc(status_length, sizeof (GLchar));
-        glGetShaderInfoLog(shader, status_length, NULL, info);
-        FATAL("Error compiling shader: %s", info);
-        free(info);
-    }
     return shader;
 }
 
 GLuint load_shader(GLenum type, const char *path)
 {
-    GLchar *data = load_file(path);
+    GLchar *data = preprocess_shader(path);
     GLuint shader = make_shader(type, data);
     free(data);
     return shader;
 }
 
 GLuint make_program(GLuint shader1, GLuint shader2)
+{
+    GLuint program = start_program(shader1, shader2);
+    finish_program(program);
+    return program;
+}
+
+/* start_program - queue linking two shaders from start_shader() or
+ * make_shader() without waiting for it
+ *
+ * Responsibilities:
+ *  - Call finish_program() before using the program, once
+ *    program_linked() says it won't block if that matters
+ */
+GLuint start_program(GLuint shader1, GLuint shader2)
 {
     GLuint program = glCreateProgram();
+    /* Lets the program cache ask for the binary afterwards */
+    if (GLEW_ARB_get_program_binary)
+        GLCHECK(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                    GL_TRUE));
     GLCHECK(glAttachShader(program, shader1));
     GLCHECK(glAttachShader(program, shader2));
     GLCHECK(glLinkProgram(program));
+    return program;
+}
+
+/* program_linked - whether finish_program() would return without waiting
+ *  - only KHR_parallel_shader_compile can tell, without it this is always
+ *    false, asking any other way waits for the driver
+ */
+bool program_linked(GLuint program)
+{
+    if (!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile)
+        return false;
+    GLint done = GL_FALSE;
+    GLCHECK(glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done));
+    return done == GL_TRUE;
+}
+
+/* finish_program - check a program from start_program() and let go of its
+ * shaders
+ *  - the shaders' compile logs are reported before the link's, a failed
+ *    compile is what usually fails the link
+ */
+void finish_program(GLuint program)
+{
+    GLuint shaders[2];
+    GLsizei count = 0;
+    GLCHECK(glGetAttachedShaders(program, 2, &count, shaders));
 
     /* Error checking */
     GLint status;
     GLCHECK(glGetProgramiv(program, GL_LINK_STATUS, &status));
     if (status == GL_FALSE) {
+        for (GLsizei i = 0; i < count; i++)
+            check_shader(shaders[i]);
         GLint status_length;
         glGetProgramiv(program, GL_INFO_LOG_LENGTH, &status_length);
         GLchar *info = calloc(status_length, sizeof (GLchar));
@@ -99,30 +230,129 @@ GLuint make_program(GLuint shader1, GLuint shader2)
         free(info);
     }
 
-    GLCHECK(glDetachShader(program, shader1));
-    GLCHECK(glDetachShader(program, shader2));
-    GLCHECK(glDeleteShader(shader1));
-    GLCHECK(glDeleteShader(shader2));
-    return program;
+    for (GLsizei i = 0; i < count; i++) {
+        GLCHECK(glDetachShader(program, shaders[i]));
+        GLCHECK(glDeleteShader(shaders[i]));
+    }
 }
 
+/* load_program - link the shaders in two files, through the program cache
+ *  - #includes are expanded, no features are defined, see shader_variant()
+ */
 GLuint load_program(const char *vertexpath, const char *fragmentpath)
 {
-    GLuint vertex   = load_shader(GL_VERTEX_SHADER, vertexpath);
-    GLuint fragment = load_shader(GL_FRAGMENT_SHADER, fragmentpath);
-    return make_program(vertex, fragment);
+    GLchar *vertex   = preprocess_shader(vertexpath);
+    GLchar *fragment = preprocess_shader(fragmentpath);
+    GLuint program = progcache_program(vertex, fragment, NULL);
+    free(vertex);
+    free(fragment);
+    return program;
 }
 
 void use_program(GLuint prog)
 {
-    GLCHECK(glUseProgram(prog));
+    if (state_changed(&g_state.program, prog, GL_CURRENT_PROGRAM))
+        GLCHECK(glUseProgram(prog));
 }
 
+/* del_program - delete a program
+ *  - the current program stays current until another one is used, so
+ *    the cache keeps it
+ */
 void del_program(GLuint prog)
 {
     GLCHECK(glDeleteProgram(prog));
 }
 
+void set_uniform_mat4(GLint loc, const GLfloat *m)
+{
+    g_stats.uniform_calls++;
+    GLCHECK(glUniformMatrix4fv(loc, 1, GL_FALSE, m));
+}
+
+void set_uniform_vec3(GLint loc, const GLfloat *v)
+{
+    g_stats.uniform_calls++;
+    GLCHECK(glUniform3fv(loc, 1, v));
+}
+
+void set_uniform_vec4(GLint loc, const GLfloat *v)
+{
+    g_stats.uniform_calls++;
+    GLCHECK(glUniform4fv(loc, 1, v));
+}
+
+void set_uniform_int(GLint loc, GLint v)
+{
+    g_stats.uniform_calls++;
+    GLCHECK(glUniform1i(loc, v));
+}
+
+void update_uniform_buffer(GLuint ubo, GLintptr offset, GLsizeiptr size,
+        const void *data)
+{
+    g_stats.uniform_buffer_updates++;
+    bind_buffer(GL_UNIFORM_BUFFER, ubo);
+    GLCHECK(glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data));
+}
+
+/* draw_instanced - draw @instances copies of the bound VAO's triangles
+ *  - indices are GL_UNSIGNED_INT, starting at the beginning of the EBO
+ */
+void draw_instanced(GLsizei count, GLsizei instances)
+{
+    g_stats.draw_calls++;
+    GLCHECK(glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT,
+                NULL, instances));
+}
+
+/* draw_arrays_instanced - draw @instances copies of the bound VAO's first
+ * @count vertices, without indices */
+void draw_arrays_instanced(GLenum mode, GLsizei count, GLsizei instances)
+{
+    g_stats.draw_calls++;
+    GLCHECK(glDrawArraysInstanced(mode, 0, count, instances));
+}
+
+/* draw_multi_indirect - draw commands from the bound indirect buffer
+ * @offset: byte offset of the first command in the GL_DRAW_INDIRECT_BUFFER
+ * @ncommands: number of DrawElementsIndirectCommand records, tightly packed
+ *
+ * Contracts:
+ *  - Requires OpenGL 4.3 or ARB_multi_draw_indirect
+ */
+void draw_multi_indirect(GLintptr offset, GLsizei ncommands)
+{
+    g_stats.draw_calls++;
+    GLCHECK(glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (const GLvoid *)offset, ncommands, 0));
+}
+
+/* invalidate_gl_state - forget the cached bindings
+ *  - call after anything outside glutils changes bindings behind its back
+ */
+void invalidate_gl_state(void)
+{
+    g_state.program = UNKNOWN_BINDING;
+    g_state.vao = UNKNOWN_BINDING;
+    g_state.active_unit = UNKNOWN_BINDING;
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; i++)
+        g_state.textures[i] = UNKNOWN_BINDING;
+    g_state.array_buffer = UNKNOWN_BINDING;
+    g_state.uniform_buffer = UNKNOWN_BINDING;
+    g_state.draw_indirect_buffer = UNKNOWN_BINDING;
+}
+
+void reset_gl_stats(void)
+{
+    memset(&g_stats, 0, sizeof g_stats);
+}
+
+const struct GLStats *gl_stats(void)
+{
+    return &g_stats;
+}
+
 GLuint load_texture(const char *path)
 {
     SDL_Surface *surface = IMG_Load(path);
@@ -149,14 +379,128 @@ GLuint load_texture(const char *path)
     return tex;
 }
 
+/* active_texture - select the texture unit bind_texture() binds to
+ * @unit: index of the unit, not the GL_TEXTURE0 + n enum
+ */
+void active_texture(GLuint unit)
+{
+    ASSERT(unit < MAX_TEXTURE_UNITS, "Texture unit out of range");
+    if (g_state.active_unit != unit) {
+        g_stats.state_calls++;
+        g_state.active_unit = unit;
+        GLCHECK(glActiveTexture(GL_TEXTURE0 + unit));
+    } else {
+        g_stats.state_calls_skipped++;
+    }
+#if defined(GL_STATE_VALIDATE)
+    GLint actual;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &actual);
+    if ((GLuint)actual != GL_TEXTURE0 + unit)
+        FATAL("GL state cache: active texture is unit %d, not %u",
+                actual - GL_TEXTURE0, unit);
+#endif
+}
+
 void bind_texture(GLuint tex)
 {
-    GLCHECK(glBindTexture(GL_TEXTURE_2D, tex));
+    if (g_state.active_unit == UNKNOWN_BINDING)
+        active_texture(0);
+    if (state_changed(&g_state.textures[g_state.active_unit], tex,
+                GL_TEXTURE_BINDING_2D))
+        GLCHECK(glBindTexture(GL_TEXTURE_2D, tex));
+}
+
+/* bind_texture_unit - bind a 2D texture to a texture unit */
+void bind_texture_unit(GLuint unit, GLuint tex)
+{
+    ASSERT(unit < MAX_TEXTURE_UNITS, "Texture unit out of range");
+    if (g_state.textures[unit] == tex) {
+        g_stats.state_calls_skipped++;
+        return;
+    }
+    active_texture(unit);
+    bind_texture(tex);
 }
 
 void del_texture(GLuint tex)
 {
     GLCHECK(glDeleteTextures(1, &tex));
+    /* Deleting a bound texture unbinds it from every unit */
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; i++)
+        if (g_state.textures[i] == tex)
+            g_state.textures[i] = 0;
+}
+
+/* The cached binding of a buffer target, NULL if the target isn't cached */
+static GLuint *cached_buffer(GLenum target)
+{
+    switch (target) {
+    case GL_ARRAY_BUFFER:
+        return &g_state.array_buffer;
+    case GL_UNIFORM_BUFFER:
+        return &g_state.uniform_buffer;
+    case GL_DRAW_INDIRECT_BUFFER:
+        return &g_state.draw_indirect_buffer;
+    default:
+        return NULL;
+    }
+}
+
+#if defined(GL_STATE_VALIDATE)
+static GLenum buffer_binding_pname(const GLuint *cached)
+{
+    if (cached == &g_state.array_buffer)
+        return GL_ARRAY_BUFFER_BINDING;
+    if (cached == &g_state.uniform_buffer)
+        return GL_UNIFORM_BUFFER_BINDING;
+    return GL_DRAW_INDIRECT_BUFFER_BINDING;
+}
+#endif
+
+/* state_changed - update a cached binding, counting the call
+ * @cached: the cached value
+ * @value: the value about to be bound
+ * @pname: glGet name of the binding, 0 for buffer bindings
+ *
+ * Returns true if the call has to reach the driver. With GL_STATE_VALIDATE
+ * defined, skipped calls are checked against what the driver reports
+ */
+static bool state_changed(GLuint *cached, GLuint value, GLenum pname)
+{
+    if (*cached != value) {
+        g_stats.state_calls++;
+        *cached = value;
+        return true;
+    }
+    g_stats.state_calls_skipped++;
+
+#if defined(GL_STATE_VALIDATE)
+    if (pname == 0)
+        pname = buffer_binding_pname(cached);
+    GLint actual;
+    glGetIntegerv(pname, &actual);
+    if ((GLuint)actual != value)
+        FATAL("GL state cache: binding 0x%x is %d, cached %u", pname,
+                actual, value);
+#else
+    (void)pname;
+#endif
+    return false;
+}
+
+/* check_shader - FATAL() with the compile log if @shader didn't compile */
+static void check_shader(GLuint shader)
+{
+    GLint status;
+    GLCHECK(glGetShaderiv(shader, GL_COMPILE_STATUS, &status));
+    if (status == GL_FALSE) {
+        GLint status_length;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &status_length);
+        GLchar *info = calloc(status_length, sizeof (GLchar));
+        glGetShaderInfoLog(shader, status_length, NULL, info);
+        FATAL("Error compiling shader: %s", info);
+        free(info);
+    }
 }
 
 #ifndef NDEBUG
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "impostor.h"
+#include "glutils.h"
+#include "frame.h"
+#include "cull.h"
+#include "shaderpp.h"
+
+static const GLuint CENTER_POS   = 0,
+                    ROTATION_POS = 1;
+
+/* Per-instance attributes of impostor.vertex.glsl */
+struct ImpostorInstance {
+    float x, y, z, scale;
+    float rot_x, rot_y, rot_z, pad;
+};
+
+/* Globals */
+static struct ImpostorStats g_stats;
+static struct Entity *g_near = NULL;
+static struct ImpostorInstance *g_far = NULL;
+static struct SphereBatch g_spheres;
+static uint32_t *g_visible = NULL;
+static size_t g_capacity = 0;
+
+static void oct_decode(float u, float v, vec3 out) ATTR((nonnull(3)));
+static GLuint make_atlas(GLsizei size);
+static void reserve_scratch(size_t n);
+
+/* impostor_bake - render a Model's views into atlases
+ * @m: the Model
+ * @grid: views per side, at least 2
+ * @cell: pixels per side of each view
+ * @out: the Impostor to initialize
+ *
+ * The view at cell (i, j) looks at the bounding sphere from the direction
+ * oct_decode(i / (grid - 1), j / (grid - 1)). The bound draw framebuffer,
+ * viewport and depth test are restored afterwards.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call impostor_free() after use
+ */
+void impostor_bake(const struct Model *m, unsigned grid, unsigned cell,
+        struct Impostor *out)
+{
+    ASSERT(grid >= 2, "An impostor needs at least 2x2 views");
+    memset(out, 0, sizeof *out);
+    out->grid = grid;
+    out->cell = cell;
+    glm_vec4_copy((float *)m->bounds, out->bounds);
+
+    GLsizei size = grid * cell;
+    out->albedo = make_atlas(size);
+    out->normal_depth = make_atlas(size);
+
+    /* Drawn into again afterwards, e.g. dynres's target or a G-buffer */
+    GLint target;
+    GLCHECK(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target));
+
+    GLuint depth, fbo;
+    GLCHECK(glGenRenderbuffers(1, &depth));
+    GLCHECK(glBindRenderbuffer(GL_RENDERBUFFER, depth));
+    GLCHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+                size, size));
+    GLCHECK(glGenFramebuffers(1, &fbo));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+    GLCHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_TEXTURE_2D, out->albedo, 0));
+    GLCHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                GL_TEXTURE_2D, out->normal_depth, 0));
+    GLCHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                GL_RENDERBUFFER, depth));
+    const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    GLCHECK(glDrawBuffers(2, buffers));
+    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE,
+            "Impostor framebuffer is incomplete");
+
+    /* Cleared without touching the clear color */
+    const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, one = 1.0f;
+    GLCHECK(glClearBufferfv(GL_COLOR, 0, zero));
+    GLCHECK(glClearBufferfv(GL_COLOR, 1, zero));
+    GLCHECK(glClearBufferfv(GL_DEPTH, 0, &one));
+
+    GLint viewport[4];
+    GLCHECK(glGetIntegerv(GL_VIEWPORT, viewport));
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+
+    GLuint bake = shader_variant(RESOURCE_DIR "impostor.bake.vertex.glsl",
+            RESOURCE_DIR "impostor.bake.fragment.glsl",
+            m->features & SHADER_TEXTURED);
+    use_program(bake);
+    GLint view_projection = glGetUniformLocation(bake, "view_projection");
+    bind_array(m->vao);
+    if (m->features & SHADER_TEXTURED)
+        bind_texture_unit(0, m->texture);
+
+    float r = out->bounds[3];
+    for (unsigned j = 0; j < grid; j++) {
+        for (unsigned i = 0; i < grid; i++) {
+            vec3 dir, eye, up = { 0.0f, 1.0f, 0.0f };
+            oct_decode((float)i / (grid - 1), (float)j / (grid - 1), dir);
+            /* Must match the quad basis in impostor.vertex.glsl */
+            if (fabsf(dir[1]) >= 0.999f)
+                glm_vec_copy((vec3){ 0.0f, 0.0f, 1.0f }, up);
+            glm_vec_scale(dir, 2.0f * r, eye);
+            glm_vec_add(eye, out->bounds, eye);
+
+            mat4 view, projection, vp;
+            glm_lookat(eye, out->bounds, up, view);
+            glm_ortho(-r, r, -r, r, r, 3.0f * r, projection);
+            glm_mat4_mul(projection, view, vp);
+
+            GLCHECK(glViewport(i * cell, j * cell, cell, cell));
+            set_uniform_mat4(view_projection, vp[0]);
+            draw_instanced(m->num_indices, 1);
+        }
+    }
+
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, target));
+    GLCHECK(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+    if (!depth_test)
+        GLCHECK(glDisable(GL_DEPTH_TEST));
+    GLCHECK(glDeleteFramebuffers(1, &fbo));
+    GLCHECK(glDeleteRenderbuffers(1, &depth));
+
+    out->program = load_program(RESOURCE_DIR "impostor.vertex.glsl",
+                                RESOURCE_DIR "impostor.fragment.glsl");
+    bind_frame_block(out->program);
+    use_program(out->program);
+    set_uniform_int(glGetUniformLocation(out->program, "albedo_atlas"), 0);
+    set_uniform_int(glGetUniformLocation(out->program, "normal_atlas"), 1);
+    set_uniform_int(glGetUniformLocation(out->program, "grid"), grid);
+    set_uniform_vec4(glGetUniformLocation(out->program, "bounds"),
+            out->bounds);
+
+    out->vao = gen_array();
+    GLCHECK(glGenBuffers(1, &out->vbo_instances));
+    bind_buffer(GL_ARRAY_BUFFER, out->vbo_instances);
+    attrib_buffer(CENTER_POS, 4, GL_FLOAT, sizeof (struct ImpostorInstance), 0);
+    attrib_divisor(CENTER_POS, 1);
+    attrib_buffer(ROTATION_POS, 3, GL_FLOAT, sizeof (struct ImpostorInstance),
+            offsetof(struct ImpostorInstance, rot_x));
+    attrib_divisor(ROTATION_POS, 1);
+}
+
+void impostor_free(struct Impostor *imp)
+{
+    del_texture(imp->albedo);
+    del_texture(imp->normal_depth);
+    del_program(imp->program);
+    del_buffer(imp->vbo_instances);
+    del_array(imp->vao);
+    memset(imp, 0, sizeof *imp);
+}
+
+/* render_impostors - render Entities, the distant ones as impostors
+ * @m: the Model the Impostor was baked from
+ * @imp: the Impostor
+ * @entity: pointer to the first Entity
+ * @n: number of Entities
+ * @distance: Entities at least this far from the camera are impostors
+ *
+ * Near Entities go through render_entities(), distant ones are culled and
+ * drawn in one instanced draw of quads. Adds to impostor_stats().
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void render_impostors(const struct Model *m, const struct Impostor *imp,
+        const struct Entity *entity, size_t n, float distance)
+{
+    reserve_scratch(n);
+
+    /* Camera position, from the rotation and translation of the view */
+    const struct FrameUniforms *frame = current_frame();
+    vec3 camera;
+    mat3 rotation;
+    glm_mat4_pick3t((vec4 *)frame->view, rotation);
+    glm_mat3_mulv(rotation, (float *)frame->view[3], camera);
+    glm_vec_flipsign(camera);
+
+    float reach = glm_vec_norm((float *)imp->bounds) + imp->bounds[3];
+    float distance2 = distance * distance;
+    size_t nnear = 0, nfar = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct Entity *e = &entity[i];
+        vec3 p = { e->x, e->y, e->z };
+        if (glm_vec_distance2(p, camera) < distance2) {
+            g_near[nnear++] = *e;
+            continue;
+        }
+        g_spheres.x[nfar] = e->x;
+        g_spheres.y[nfar] = e->y;
+        g_spheres.z[nfar] = e->z;
+        g_spheres.r[nfar] = e->scale * reach;
+        g_far[nfar++] = (struct ImpostorInstance){
+            e->x, e->y, e->z, e->scale, e->rot_x, e->rot_y, e->rot_z, 0.0f
+        };
+    }
+    g_stats.meshes += nnear;
+    if (nnear != 0)
+        render_entities(m, g_near, nnear);
+
+    g_spheres.count = nfar;
+    size_t nvisible = nfar ? cull_entity_spheres(&g_spheres, g_visible) : 0;
+    if (nvisible == 0)
+        return;
+    for (size_t k = 0; k < nvisible; k++)
+        g_far[k] = g_far[g_visible[k]];
+    g_stats.impostors += nvisible;
+    g_stats.triangles_saved += nvisible * (m->num_indices / 3);
+
+    use_program(imp->program);
+    bind_array(imp->vao);
+    bind_texture_unit(0, imp->albedo);
+    bind_texture_unit(1, imp->normal_depth);
+
+    size_t size = nvisible * sizeof (struct ImpostorInstance);
+    GLintptr offset;
+    stream_buffer(GL_ARRAY_BUFFER, imp->vbo_instances, g_far, size, &offset);
+    attrib_buffer(CENTER_POS, 4, GL_FLOAT, sizeof (struct ImpostorInstance),
+            offset);
+    attrib_buffer(ROTATION_POS, 3, GL_FLOAT, sizeof (struct ImpostorInstance),
+            offset + offsetof(struct ImpostorInstance, rot_x));
+
+    draw_arrays_instanced(GL_TRIANGLE_STRIP, 4, nvisible);
+}
+
+/* impostor_stats - totals since the last reset */
+const struct ImpostorStats *impostor_stats(void)
+{
+    return &g_stats;
+}
+
+void reset_impostor_stats(void)
+{
+    g_stats = (struct ImpostorStats){ 0 };
+}
+
+/* oct_decode - the unit vector at @u, @v of an octahedral map, both in
+ * [0, 1] */
+static void oct_decode(float u, float v, vec3 out)
+{
+    float x = u * 2.0f - 1.0f, y = v * 2.0f - 1.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f) {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    glm_vec_copy((vec3){ x, y, z }, out);
+    glm_vec_normalize(out);
+}
+
+static GLuint make_atlas(GLsizei size)
+{
+    GLuint tex;
+    GLCHECK(glGenTextures(1, &tex));
+    bind_texture(tex);
+    GLCHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA,
+                GL_UNSIGNED_BYTE, NULL));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                GL_CLAMP_TO_EDGE));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                GL_CLAMP_TO_EDGE));
+    return tex;
+}
+
+static void reserve_scratch(size_t n)
+{
+    sphere_batch_reserve(&g_spheres, n);
+    if (n <= g_capacity)
+        return;
+    size_t capacity = MAX(g_capacity * 2, n);
+    struct Entity *near = realloc(g_near, capacity * sizeof (struct Entity));
+    struct ImpostorInstance *far = realloc(g_far,
+            capacity * sizeof (struct ImpostorInstance));
+    uint32_t *visible = realloc(g_visible, capacity * sizeof (uint32_t));
+    ASSERT(near != NULL && far != NULL && visible != NULL, "Out of memory");
+    g_near = near;
+    g_far = far;
+    g_visible = visible;
+    g_capacity = capacity;
+}
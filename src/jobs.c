@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "jobs.h"
+#include "utils.h"
+
+struct Job {
+    JobFunc fn;
+    void *arg;
+    size_t begin, end;
+    struct JobGroup *group;
+};
+
+struct Worker {
+    SDL_Thread *thread;
+    unsigned index;
+};
+
+/* Globals */
+static struct {
+    SDL_mutex *mutex;
+    SDL_cond *work_cond;  /* signalled when jobs are queued */
+    SDL_cond *done_cond;  /* signalled when a group finishes */
+    struct Job *queue;    /* ring buffer of pending jobs */
+    size_t head, count, capacity;
+    bool quit;
+    unsigned nworkers;
+    struct Worker workers[JOBS_MAX_THREADS - 1];
+} g_pool;
+
+static int  worker_main(void *arg);
+static bool pop_job(struct Job *out) ATTR((nonnull(1)));
+static void run_job(const struct Job *job, unsigned thread) ATTR((nonnull(1)));
+
+/* jobs_init - start the worker threads
+ * @nworkers: number of worker threads, or 0 for one per extra CPU core
+ *
+ * Contracts:
+ *  - Called once, from the main thread, after SDL_Init()
+ * Responsibilities:
+ *  - Call jobs_shutdown() before exiting
+ */
+void jobs_init(unsigned nworkers)
+{
+    if (nworkers == 0) {
+        int ncpu = SDL_GetCPUCount();
+        nworkers = ncpu > 1 ? (unsigned)ncpu - 1 : 0;
+    }
+    nworkers = MIN(nworkers, JOBS_MAX_THREADS - 1);
+
+    g_pool.mutex     = SDL_CreateMutex();
+    g_pool.work_cond = SDL_CreateCond();
+    g_pool.done_cond = SDL_CreateCond();
+    ASSERT(g_pool.mutex && g_pool.work_cond && g_pool.done_cond,
+            SDL_GetError());
+
+    g_pool.capacity = 64;
+    g_pool.queue = calloc(g_pool.capacity, sizeof (struct Job));
+    ASSERT(g_pool.queue != NULL, "Out of memory");
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        g_pool.workers[i].index = i + 1;
+        g_pool.workers[i].thread = SDL_CreateThread(worker_main, "worker",
+                &g_pool.workers[i]);
+        ASSERT(g_pool.workers[i].thread != NULL, SDL_GetError());
+    }
+    g_pool.nworkers = nworkers;
+}
+
+/* jobs_shutdown - stop and join the worker threads
+ *
+ * Contracts:
+ *  - No job groups are still pending
+ */
+void jobs_shutdown(void)
+{
+    if (g_pool.mutex == NULL)
+        return;
+
+    SDL_LockMutex(g_pool.mutex);
+    g_pool.quit = true;
+    SDL_CondBroadcast(g_pool.work_cond);
+    SDL_UnlockMutex(g_pool.mutex);
+
+    for (unsigned i = 0; i < g_pool.nworkers; i++)
+        SDL_WaitThread(g_pool.workers[i].thread, NULL);
+
+    SDL_DestroyCond(g_pool.done_cond);
+    SDL_DestroyCond(g_pool.work_cond);
+    SDL_DestroyMutex(g_pool.mutex);
+    free(g_pool.queue);
+    memset(&g_pool, 0, sizeof g_pool);
+}
+
+unsigned jobs_worker_count(void)
+{
+    return g_pool.nworkers;
+}
+
+/* jobs_submit - queue @fn over [0, @count) in chunks of @grain indices
+ * @group: tracks completion, must outlive the jobs
+ * @fn: the function to run on each chunk
+ * @arg: passed through to @fn
+ * @count: size of the index range
+ * @grain: indices per chunk, 0 picks a chunk size from the thread count
+ *
+ * Contracts:
+ *  - Only called from the main thread, never from inside a job
+ *  - If jobs_init() was not called, runs everything before returning
+ */
+void jobs_submit(struct JobGroup *group, JobFunc fn, void *arg,
+        size_t count, size_t grain)
+{
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = MAX(count / (4 * (g_pool.nworkers + 1)), 1);
+
+    if (g_pool.mutex == NULL) {
+        fn(arg, 0, count, 0);
+        return;
+    }
+
+    size_t njobs = (count + grain - 1) / grain;
+
+    SDL_LockMutex(g_pool.mutex);
+    if (g_pool.count + njobs > g_pool.capacity) {
+        size_t capacity = g_pool.capacity;
+        while (g_pool.count + njobs > capacity)
+            capacity *= 2;
+        struct Job *queue = calloc(capacity, sizeof (struct Job));
+        ASSERT(queue != NULL, "Out of memory");
+        for (size_t i = 0; i < g_pool.count; i++)
+            queue[i] = g_pool.queue[(g_pool.head + i) % g_pool.capacity];
+        free(g_pool.queue);
+        g_pool.queue = queue;
+        g_pool.head = 0;
+        g_pool.capacity = capacity;
+    }
+
+    SDL_AtomicAdd(&group->pending, (int)njobs);
+    for (size_t begin = 0; begin < count; begin += grain) {
+        size_t tail = (g_pool.head + g_pool.count) % g_pool.capacity;
+        g_pool.queue[tail] = (struct Job){
+            .fn    = fn,
+            .arg   = arg,
+            .begin = begin,
+            .end   = MIN(begin + grain, count),
+            .group = group
+        };
+        g_pool.count++;
+    }
+    SDL_CondBroadcast(g_pool.work_cond);
+    SDL_UnlockMutex(g_pool.mutex);
+}
+
+/* jobs_poll - check whether every job in @group has finished
+ *  - never blocks
+ */
+bool jobs_poll(struct JobGroup *group)
+{
+    return SDL_AtomicGet(&group->pending) == 0;
+}
+
+/* jobs_wait - execute queued jobs until every job in @group has finished
+ *
+ * Contracts:
+ *  - Only called from the main thread, never from inside a job
+ */
+void jobs_wait(struct JobGroup *group)
+{
+    if (g_pool.mutex == NULL)
+        return;
+
+    struct Job job;
+    while (SDL_AtomicGet(&group->pending) != 0) {
+        if (pop_job(&job)) {
+            run_job(&job, 0);
+            continue;
+        }
+        /* Nothing left to help with, sleep until a group completes */
+        SDL_LockMutex(g_pool.mutex);
+        while (SDL_AtomicGet(&group->pending) != 0 && g_pool.count == 0)
+            SDL_CondWait(g_pool.done_cond, g_pool.mutex);
+        SDL_UnlockMutex(g_pool.mutex);
+    }
+}
+
+/* jobs_parallel_for - run @fn over [0, @count) and wait for it to finish
+ *  - see jobs_submit
+ */
+void jobs_parallel_for(JobFunc fn, void *arg, size_t count, size_t grain)
+{
+    struct JobGroup group = JOB_GROUP_INIT;
+    jobs_submit(&group, fn, arg, count, grain);
+    jobs_wait(&group);
+}
+
+static bool pop_job(struct Job *out)
+{
+    bool found = false;
+    SDL_LockMutex(g_pool.mutex);
+    if (g_pool.count != 0) {
+        *out = g_pool.queue[g_pool.head];
+        g_pool.head = (g_pool.head + 1) % g_pool.capacity;
+        g_pool.count--;
+        found = true;
+    }
+    SDL_UnlockMutex(g_pool.mutex);
+    return found;
+}
+
+static void run_job(const struct Job *job, unsigned thread)
+{
+    job->fn(job->arg, job->begin, job->end, thread);
+
+    /* The last job of a group wakes anybody blocked in jobs_wait() */
+    if (SDL_AtomicAdd(&job->group->pending, -1) == 1) {
+        SDL_LockMutex(g_pool.mutex);
+        SDL_CondBroadcast(g_pool.done_cond);
+        SDL_UnlockMutex(g_pool.mutex);
+    }
+}
+
+static int worker_main(void *arg)
+{
+    const struct Worker *self = arg;
+    struct Job job;
+
+    SDL_LockMutex(g_pool.mutex);
+    while (1) {
+        while (g_pool.count == 0 && !g_pool.quit)
+            SDL_CondWait(g_pool.work_cond, g_pool.mutex);
+        if (g_pool.count == 0 && g_pool.quit)
+            break;
+
+        job = g_pool.queue[g_pool.head];
+        g_pool.head = (g_pool.head + 1) % g_pool.capacity;
+        g_pool.count--;
+
+        SDL_UnlockMutex(g_pool.mutex);
+        run_job(&job, self->index);
+        SDL_LockMutex(g_pool.mutex);
+    }
+    SDL_UnlockMutex(g_pool.mutex);
+
+    return 0;
+}
@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cglm/cglm.h>
+#include "lod.h"
+
+/* Bias change per lod_feedback() call and its range, 0 is full quality */
+static const float BIAS_STEP = 0.05f;
+static const float BIAS_MAX  = 4.0f;
+/* Frame times within this fraction of the target leave the bias alone */
+static const double FEEDBACK_SLACK = 0.1;
+/* Closest distance used for projection, entities nearer get the finest LOD */
+static const float MIN_DISTANCE = 1e-3f;
+/* Cell size of lod_simplified()'s first coarse level, a fraction of the
+ * bounding radius, each further level is this many times coarser */
+static const float SIMPLIFY_CELL = 1.0f / 64.0f;
+static const float SIMPLIFY_GROWTH = 4.0f;
+/* Grid cells per axis lod_simplify() can tell apart */
+#define CELL_BITS 21
+
+/* A vertex and the grid cell it falls in */
+struct CellVertex {
+    uint64_t cell;
+    GLuint index;
+};
+
+/* Globals */
+static struct Entity *g_sorted = NULL; /* entities grouped by level */
+static size_t g_sorted_capacity = 0;
+
+static void reserve_levels(struct LodSelector *s, size_t n)
+    ATTR((nonnull(1)));
+static void select_levels(struct LodSelector *s, const struct LodChain *chain,
+        const struct FrameUniforms *frame, const struct Entity *entity,
+        const struct TransformBatch *b, size_t n) ATTR((nonnull(1, 2, 3)));
+static void level_starts(const struct LodSelector *s,
+        const struct LodChain *chain, size_t start[LOD_MAX_LEVELS + 1])
+    ATTR((nonnull(1, 2, 3)));
+static int compare_cells(const void *a, const void *b) ATTR((nonnull(1, 2)));
+
+/* lod_init - set up a LodSelector
+ * @s: the LodSelector
+ * @threshold: pixels of geometric error allowed on screen
+ * @viewport_height: height of the viewport in pixels
+ *
+ * Responsibilities:
+ *  - Call lod_free() after use
+ */
+void lod_init(struct LodSelector *s, float threshold, float viewport_height)
+{
+    memset(s, 0, sizeof *s);
+    s->threshold = threshold;
+    s->hysteresis = 0.2f;
+    s->viewport_height = viewport_height;
+}
+
+void lod_free(struct LodSelector *s)
+{
+    free(s->level);
+    memset(s, 0, sizeof *s);
+}
+
+/* lod_select - pick a level for each Entity
+ * @s: the LodSelector, remembers each Entity's level for the next frame
+ * @chain: the levels to choose from
+ * @frame: the camera, e.g. current_frame()
+ * @entity: pointer to the first Entity, the same ones in the same order
+ *          every frame
+ * @n: number of Entities
+ *
+ * Levels are left in @s->level
+ */
+void lod_select(struct LodSelector *s, const struct LodChain *chain,
+        const struct FrameUniforms *frame, const struct Entity *entity,
+        size_t n)
+{
+    select_levels(s, chain, frame, entity, NULL, n);
+}
+
+/* lod_select_transforms - lod_select() for the transforms of a batch
+ *  - levels are left in @s->level, indexed like the batch
+ */
+void lod_select_transforms(struct LodSelector *s, const struct LodChain *chain,
+        const struct FrameUniforms *frame, const struct TransformBatch *b)
+{
+    select_levels(s, chain, frame, NULL, b, b->count);
+}
+
+/* select_levels - lod_select() of Entities or, without @entity, of @b */
+static void select_levels(struct LodSelector *s, const struct LodChain *chain,
+        const struct FrameUniforms *frame, const struct Entity *entity,
+        const struct TransformBatch *b, size_t n)
+{
+    ASSERT(chain->nlevels > 0 && chain->nlevels <= LOD_MAX_LEVELS,
+            "Bad LodChain");
+    reserve_levels(s, n);
+    memset(s->counts, 0, sizeof s->counts);
+    s->switches = 0;
+
+    const float *bounds = chain->levels[0]->bounds;
+    float reach = glm_vec_norm((float *)bounds);
+
+    /* Pixels per world unit of radius at distance 1 */
+    float k = frame->projection[1][1] * s->viewport_height * 0.5f
+            * bounds[3];
+    float threshold = s->threshold * exp2f(s->bias);
+    float lo = threshold * (1.0f - s->hysteresis);
+    float hi = threshold * (1.0f + s->hysteresis);
+    const float *error = chain->error;
+    unsigned last = chain->nlevels - 1;
+
+    for (size_t i = 0; i < n; i++) {
+        vec4 p = { 0.0f, 0.0f, 0.0f, 1.0f };
+        float scale;
+        if (entity != NULL) {
+            p[0] = entity[i].x;
+            p[1] = entity[i].y;
+            p[2] = entity[i].z;
+            scale = entity[i].scale;
+        } else {
+            p[0] = b->x[i];
+            p[1] = b->y[i];
+            p[2] = b->z[i];
+            scale = b->scale[i];
+        }
+        vec4 v;
+        glm_mat4_mulv((vec4 *)frame->view, p, v);
+        float d = glm_vec_norm(v) - scale * (reach + bounds[3]);
+        float radius = k * scale / MAX(d, MIN_DISTANCE);
+
+        unsigned level = s->level[i];
+        unsigned current = level;
+        if (level == LOD_UNSET) {
+            level = 0;
+            while (level < last && radius * error[level + 1] <= threshold)
+                level++;
+        } else if (radius * error[MIN(level, last)] > hi) {
+            /* Too coarse even allowing for the band, refine fully */
+            level = MIN(level, last);
+            while (level > 0 && radius * error[level] > threshold)
+                level--;
+        } else {
+            level = MIN(level, last);
+            while (level < last && radius * error[level + 1] <= lo)
+                level++;
+        }
+
+        s->switches += current != LOD_UNSET && level != current;
+        s->level[i] = level;
+        s->counts[level]++;
+    }
+}
+
+/* lod_feedback - steer the bias towards a frame time budget
+ * @s: the LodSelector
+ * @frame_ms: how long the last frame took
+ * @target_ms: the budget
+ *
+ * Coarsens a little every call the frame is over budget, refines back while
+ * it is comfortably under. Returns the new bias
+ */
+float lod_feedback(struct LodSelector *s, double frame_ms, double target_ms)
+{
+    if (frame_ms > target_ms * (1.0 + FEEDBACK_SLACK))
+        s->bias = MIN(s->bias + BIAS_STEP, BIAS_MAX);
+    else if (frame_ms < target_ms * (1.0 - FEEDBACK_SLACK))
+        s->bias = MAX(s->bias - BIAS_STEP, 0.0f);
+    return s->bias;
+}
+
+/* lod_group - the Entities of the last lod_select(), ordered by level
+ * @s: the LodSelector
+ * @chain: the LodChain it selected from
+ * @entity: the Entities it selected for
+ * @n: number of Entities
+ * @start: receives where each level's Entities begin, and where the last
+ *         level's end
+ *
+ * Returns static memory, valid until the next call
+ *
+ * Contracts:
+ *  - Not threadsafe - uses static memory
+ */
+const struct Entity *lod_group(const struct LodSelector *s,
+        const struct LodChain *chain, const struct Entity *entity, size_t n,
+        size_t start[LOD_MAX_LEVELS + 1])
+{
+    if (n > g_sorted_capacity) {
+        size_t capacity = MAX(g_sorted_capacity * 2, n);
+        struct Entity *sorted = realloc(g_sorted,
+                capacity * sizeof (struct Entity));
+        ASSERT(sorted != NULL, "Out of memory");
+        g_sorted = sorted;
+        g_sorted_capacity = capacity;
+    }
+
+    level_starts(s, chain, start);
+    size_t fill[LOD_MAX_LEVELS];
+    memcpy(fill, start, sizeof fill);
+    for (size_t i = 0; i < n; i++)
+        g_sorted[fill[s->level[i]]++] = entity[i];
+    return g_sorted;
+}
+
+/* lod_order - lod_group() as indices, for when the selection was made on a
+ * TransformBatch
+ * @s: the LodSelector
+ * @chain: the LodChain it selected from
+ * @n: number of transforms it selected for
+ * @order: receives @n indices, ascending within each level
+ * @start: receives where each level's indices begin, and where the last
+ *         level's end
+ */
+void lod_order(const struct LodSelector *s, const struct LodChain *chain,
+        size_t n, uint32_t *order, size_t start[LOD_MAX_LEVELS + 1])
+{
+    level_starts(s, chain, start);
+    size_t fill[LOD_MAX_LEVELS];
+    memcpy(fill, start, sizeof fill);
+    for (size_t i = 0; i < n; i++)
+        order[fill[s->level[i]]++] = i;
+}
+
+/* render_lod - select levels and draw each with render_entities()
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void render_lod(struct LodSelector *s, const struct LodChain *chain,
+        const struct Entity *entity, size_t n)
+{
+    lod_select(s, chain, current_frame(), entity, n);
+
+    size_t start[LOD_MAX_LEVELS + 1];
+    const struct Entity *sorted = lod_group(s, chain, entity, n, start);
+    for (unsigned l = 0; l < chain->nlevels; l++)
+        if (start[l + 1] != start[l])
+            render_entities(chain->levels[l], sorted + start[l],
+                    start[l + 1] - start[l]);
+}
+
+/* lod_simplify - coarser indices for a mesh, by clustering its vertices
+ * @data: the mesh
+ * @cell: edge of the grid cells vertices are merged in, object space
+ * @out: room for @data->indices_count indices
+ *
+ * Every vertex is moved onto the first vertex of its cell and triangles
+ * that collapse are dropped, so the result indexes @data's own vertices.
+ * No vertex moves further than a cell's diagonal, cell * sqrt(3).
+ * Returns the number of indices written
+ */
+GLsizei lod_simplify(const struct ModelData *data, float cell, GLuint *out)
+{
+    size_t nvertices = data->vertices_count / 3;
+    struct CellVertex *cells = malloc(nvertices * sizeof *cells);
+    GLuint *remap = malloc(nvertices * sizeof *remap);
+    ASSERT(cells != NULL && remap != NULL, "Out of memory");
+
+    vec4 bounds;
+    mesh_bounds(data->vertices, data->vertices_count, bounds);
+    const uint64_t max_cell = (1u << CELL_BITS) - 1;
+    for (size_t i = 0; i < nvertices; i++) {
+        uint64_t key = 0;
+        for (int k = 0; k < 3; k++) {
+            float lo = bounds[k] - bounds[3];
+            float c = floorf((data->vertices[3 * i + k] - lo) / cell);
+            key |= (uint64_t)MIN(MAX(c, 0.0f), (float)max_cell)
+                << (k * CELL_BITS);
+        }
+        cells[i] = (struct CellVertex){ key, i };
+    }
+    qsort(cells, nvertices, sizeof *cells, compare_cells);
+    for (size_t i = 0, first = 0; i < nvertices; i++) {
+        if (cells[i].cell != cells[first].cell)
+            first = i;
+        remap[cells[i].index] = cells[first].index;
+    }
+
+    GLsizei count = 0;
+    for (GLsizei i = 0; i + 2 < data->indices_count; i += 3) {
+        GLuint a = remap[data->indices[i]],
+               b = remap[data->indices[i + 1]],
+               c = remap[data->indices[i + 2]];
+        if (a != b && b != c && a != c) {
+            out[count++] = a;
+            out[count++] = b;
+            out[count++] = c;
+        }
+    }
+
+    free(cells);
+    free(remap);
+    return count;
+}
+
+/* lod_simplified - a LodChain of a Model and coarser copies of its mesh
+ * @chain: the LodChain to fill
+ * @base: the Model created from @data, the finest level
+ * @data: the mesh, with the shaders and texture of @base
+ * @coarse: where to create the other @nlevels - 1 Models
+ * @nlevels: levels in the chain, at most LOD_MAX_LEVELS
+ *
+ * The levels come from lod_simplify(), each SIMPLIFY_GROWTH times coarser
+ * than the one before.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call destroy_model() on each of @coarse after use
+ */
+void lod_simplified(struct LodChain *chain, const struct Model *base,
+        const struct ModelData *data, struct Model *coarse, unsigned nlevels)
+{
+    ASSERT(nlevels > 0 && nlevels <= LOD_MAX_LEVELS, "Bad LOD level count");
+    memset(chain, 0, sizeof *chain);
+    chain->levels[0] = base;
+    chain->nlevels = nlevels;
+
+    GLuint *indices = malloc(data->indices_count * sizeof (GLuint));
+    ASSERT(indices != NULL, "Out of memory");
+    struct ModelData simplified = *data;
+    simplified.indices = indices;
+    float fraction = SIMPLIFY_CELL;
+    for (unsigned l = 1; l < nlevels; l++, fraction *= SIMPLIFY_GROWTH) {
+        float cell = fraction * base->bounds[3];
+        simplified.indices_count = lod_simplify(data, cell, indices);
+        create_model(&simplified, &coarse[l - 1]);
+        chain->levels[l] = &coarse[l - 1];
+        chain->error[l] = fraction * sqrtf(3.0f);
+    }
+    free(indices);
+}
+
+/* level_starts - prefix sums of the last selection's counts */
+static void level_starts(const struct LodSelector *s,
+        const struct LodChain *chain, size_t start[LOD_MAX_LEVELS + 1])
+{
+    start[0] = 0;
+    for (unsigned l = 0; l < LOD_MAX_LEVELS; l++)
+        start[l + 1] = start[l] + (l < chain->nlevels ? s->counts[l] : 0);
+}
+
+static void reserve_levels(struct LodSelector *s, size_t n)
+{
+    if (n <= s->capacity)
+        return;
+    size_t capacity = MAX(s->capacity * 2, n);
+    uint8_t *level = realloc(s->level, capacity);
+    ASSERT(level != NULL, "Out of memory");
+    memset(level + s->capacity, LOD_UNSET, capacity - s->capacity);
+    s->level = level;
+    s->capacity = capacity;
+}
+
+static int compare_cells(const void *a, const void *b)
+{
+    const struct CellVertex *x = a, *y = b;
+    if (x->cell != y->cell)
+        return x->cell < y->cell ? -1 : 1;
+    return (x->index > y->index) - (x->index < y->index);
+}
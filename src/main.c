@@ -11,61 +11,148 @@
 #include "cube.h"
 #include "entity.h"
 #include "objloader.h"
+#include "jobs.h"
+#include "frame.h"
+#include "clusters.h"
+#include "deferred.h"
+#include "shadows.h"
+#include "dynres.h"
+#include "pacer.h"
+#include "progcache.h"
+#include "shaderpp.h"
+#include "cmdlist.h"
+#include "lod.h"
+#include "transform.h"
 
-static const GLint WIDTH = 800, HEIGHT = 600;
-static const Uint32 SDL_FLAGS = SDL_INIT_VIDEO;
-static const int    IMG_FLAGS = IMG_INIT_PNG;
+static const GLint   WIDTH = 800, HEIGHT = 600;
+static const Uint32  SDL_FLAGS = SDL_INIT_VIDEO;
+static const int     IMG_FLAGS = IMG_INIT_PNG;
+static const float   LIGHT_RANGE = 100.0f;
+static const float   SHADOW_RANGE = 50.0f;
+static const GLsizei SHADOW_SIZE = 2048;
+static const float   LOD_THRESHOLD = 2.0f;  /* pixels of error */
+#define DRAGON_LODS 3
+#define DRAGONS 10
 
 static void init_sdl(SDL_Window **w, SDL_GLContext *ctx)           ATTR((nonnull(1,2)));
 static void cleanup_sdl(SDL_Window *window, SDL_GLContext context) ATTR((nonnull(1, 2)));
-static void handle_inputs(struct Entity *cube)                     ATTR((nonnull(1)));
+static void handle_inputs(struct TransformBatch *b, size_t i)      ATTR((nonnull(1)));
 static int log_cube(void *arg);
 
 int main(int argc, char *argv[])
 {
-    (void)argc, (void)argv;
+    /* --deferred selects deferred shading, forward is the default */
+    enum RenderMode mode = parse_render_mode(argc, argv);
+    struct DynResConfig dynres_config;
+    dynres_default_config(&dynres_config);
+    dynres_parse_args(&dynres_config, argc, argv);
+    struct PacerConfig pacer_config;
+    pacer_default_config(&pacer_config);
+    pacer_parse_args(&pacer_config, argc, argv);
 
     /* Init SDL and OpenGL */
     SDL_GLContext context;
     SDL_Window *window;
     init_sdl(&window, &context);
 
+    /* Start the worker threads */
+    jobs_init(0);
+
+    /* Linked programs are kept on disk, later runs skip compiling them */
+    progcache_init(NULL);
+
     /* Set the OpenGL viewport to the entire window */
     GLCHECK(glViewport(0, 0, WIDTH, HEIGHT));
 
     /* Enable depth testing */
     GLCHECK(glEnable(GL_DEPTH_TEST));
 
-    /* Limit swap interval */
-    int ret = SDL_GL_SetSwapInterval(1);
-    ASSERT(ret == 0, SDL_GetError());
+    /* Swap interval, frames in flight and when frames start */
+    struct Pacer pacer;
+    pacer_init(&pacer, window, &pacer_config);
+
+    /* Create the per-frame uniform buffer */
+    init_frame();
+
+    /* Entity programs compile while everything else loads, and are drawn
+     * flat until they're done */
+    shader_variants_async(true);
 
-    /* Create object models */
+    /* Create object models, distant dragons use simplified copies */
     struct Model dragonmodel;
-    load_obj_model(RESOURCE_DIR "dragon.obj",
-                   NULL,
-                   RESOURCE_DIR "entity.vertex.glsl",
-                   RESOURCE_DIR "entity.fragment.glsl",
-                   &dragonmodel);
+    struct ModelData dragondata = {
+        .vert_filepath = RESOURCE_DIR "entity.vertex.glsl",
+        .frag_filepath = RESOURCE_DIR "entity.fragment.glsl",
+        .tex_filepath  = NULL,
+    };
+    load_obj(RESOURCE_DIR "dragon.obj", &dragondata);
+    create_model(&dragondata, &dragonmodel);
+    struct Model dragonlods[DRAGON_LODS - 1];
+    struct LodChain dragonchain;
+    lod_simplified(&dragonchain, &dragonmodel, &dragondata, dragonlods,
+            DRAGON_LODS);
+    free_obj_modeldata(&dragondata);
+    struct LodSelector lod;
+    lod_init(&lod, LOD_THRESHOLD, HEIGHT);
+
+    struct GBuffer gbuffer;
+    if (mode == RENDER_DEFERRED)
+        gbuffer_init(&gbuffer, WIDTH, HEIGHT);
+
+    /* Point lights, binned into clusters for either mode */
+    struct ClusterGrid *clusters = malloc(sizeof *clusters);
+    ASSERT(clusters != NULL, "Out of memory");
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    clusters_init(clusters, WIDTH, HEIGHT, LIGHT_RANGE);
+    clusters_build(clusters, frame.projection);
+
+    struct ShadowMaps shadows;
+    shadows_init(&shadows, SHADOW_SIZE, SHADOW_RANGE);
+
+    /* Frames are drawn offscreen at a resolution that follows GPU time */
+    struct DynRes dynres;
+    dynres_init(&dynres, WIDTH, HEIGHT, &dynres_config);
 
-    struct Entity dragons[10];
+    /* Forward draws are recorded on the job pool, replayed on this thread */
+    struct CommandQueue queue;
+    cmdqueue_init(&queue);
+
+    /* Dragon transforms, one array per field */
+    struct TransformBatch dragons = { 0 };
+    transform_batch_reserve(&dragons, DRAGONS);
+    uint32_t dragon_order[DRAGONS];
+    struct PointLight lights[32];
 
 restart:
     srand(time(NULL));
-    for (size_t i = 0; i < ARRAY_SIZE(dragons); i++) {
-        dragons[i].x     =  (rand() % 18) - 9;
-        dragons[i].y     =  (rand() % 18) - 9;
-        dragons[i].z     = -(rand() % 20) - 5;
-        dragons[i].rot_x = (rand() % 3) - 1;
-        dragons[i].rot_y = (rand() % 3) - 1;
-        dragons[i].rot_z = (rand() % 3) - 1;
-        dragons[i].scale =  0.3f;
+    for (size_t i = 0; i < DRAGONS; i++) {
+        struct Entity dragon;
+        dragon.x     =  (rand() % 18) - 9;
+        dragon.y     =  (rand() % 18) - 9;
+        dragon.z     = -(rand() % 20) - 5;
+        dragon.rot_x = (rand() % 3) - 1;
+        dragon.rot_y = (rand() % 3) - 1;
+        dragon.rot_z = (rand() % 3) - 1;
+        dragon.scale =  0.3f;
+        transform_batch_set(&dragons, i, &dragon);
+    }
+    dragons.count = DRAGONS;
+    for (size_t i = 0; i < ARRAY_SIZE(lights); i++) {
+        lights[i] = (struct PointLight){
+            .position = { (rand() % 18) - 9, (rand() % 18) - 9,
+                          -(rand() % 20) - 5, 4.0f },
+            .color = { (rand() % 100) / 100.0f, (rand() % 100) / 100.0f,
+                       (rand() % 100) / 100.0f, 1.0f },
+        };
     }
 
     /* Event Loop */
     SDL_Event e;
     while (1)
     {
+        /* Input is sampled right after, as late as the pacing allows */
+        pacer_wait(&pacer);
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT
                     || (e.type == SDL_KEYUP && e.key.keysym.sym == SDLK_q)) {
@@ -77,19 +164,82 @@ restart:
         }
 
         SDL_PumpEvents();
-        for (unsigned i = 0; i < ARRAY_SIZE(dragons); i++)
-            handle_inputs(&dragons[i]);
+        for (size_t i = 0; i < dragons.count; i++)
+            handle_inputs(&dragons, i);
+        /* Only dragons moved since the last frame are recomposed and
+         * re-uploaded, every pass then reads the cached matrices */
+        transform_sync(&dragons);
+
+        poll_shader_variants();
+        reset_gl_stats();
+        reset_entity_cull_stats();
+        dynres_begin(&dynres);
+        clusters->width = dynres.render_width;
+        clusters->height = dynres.render_height;
+
+        default_frame(&frame);
+        clusters_bin(clusters, frame.view, lights, ARRAY_SIZE(lights));
+        clusters_upload(clusters, lights, ARRAY_SIZE(lights));
+        clusters_frame(clusters, &frame);
+        frame.sun_direction[3] = 0.6f;
+        shadows_fit(&shadows, &frame);
+        upload_frame(&frame);
+        if (mode == RENDER_FORWARD) {
+            /* Coarser levels while frames run over the pacer's period */
+            lod.viewport_height = dynres.render_height;
+            lod_feedback(&lod, pacer.work_ms, pacer.period_ms);
+            lod_select_transforms(&lod, &dragonchain, current_frame(),
+                    &dragons);
+            size_t start[LOD_MAX_LEVELS + 1];
+            lod_order(&lod, &dragonchain, dragons.count, dragon_order, start);
+
+            cmdqueue_begin(&queue, dragons.count);
+            for (unsigned l = 0; l < dragonchain.nlevels; l++)
+                if (start[l + 1] != start[l])
+                    cmdqueue_record_transforms(&queue, dragonchain.levels[l],
+                            &dragons, dragon_order + start[l],
+                            start[l + 1] - start[l]);
+        }
+
+        /* The GPU time of the frame starts with its first draw */
+        pacer_gpu_begin(&pacer);
+        shadows_begin(&shadows);
+        shadows_render_transforms(&shadows, &dragonmodel, &dragons);
+        shadows_end(&shadows);
 
         GLCHECK(glClearColor(0.2f, 0.3f, 0.3f, 1.0f));
         GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 
-        render_entities(&dragonmodel, dragons, ARRAY_SIZE(dragons));
+        if (mode == RENDER_DEFERRED) {
+            deferred_begin(&gbuffer);
+            deferred_transforms(&gbuffer, &dragonmodel, &dragons);
+            deferred_end(&gbuffer);
+        } else {
+            cmdqueue_submit(&queue);
+        }
 
-        SDL_GL_SwapWindow(window);
+        dynres_end(&dynres);
+        pacer_present(&pacer, window);
     }
 
 cleanup:
+    cmdqueue_free(&queue);
+    pacer_free(&pacer);
+    dynres_free(&dynres);
+    shadows_free(&shadows);
+    clusters_free(clusters);
+    free(clusters);
+    if (mode == RENDER_DEFERRED)
+        gbuffer_free(&gbuffer);
+    lod_free(&lod);
+    transform_batch_free(&dragons);
+    for (size_t i = 0; i < ARRAY_SIZE(dragonlods); i++)
+        destroy_model(&dragonlods[i]);
     destroy_model(&dragonmodel);
+    cleanup_frame();
+    free_shader_variants();
+    progcache_shutdown();
+    jobs_shutdown();
     cleanup_sdl(window, context);
 
     return EXIT_SUCCESS;
@@ -133,41 +283,54 @@ static void cleanup_sdl(SDL_Window *window, SDL_GLContext context)
     SDL_Quit();
 }
 
-static void handle_inputs(struct Entity *cube)
+/* handle_inputs - move dragon @i with the keyboard, through the setters so
+ * only changed transforms are marked dirty */
+static void handle_inputs(struct TransformBatch *b, size_t i)
 {
     static const Uint8 *keyboardStates = NULL;
 
     if (keyboardStates == NULL)
         keyboardStates = SDL_GetKeyboardState(NULL);
 
+    float dx = 0.0f, dy = 0.0f, dz = 0.0f;
+    float drot_x = 0.0f, drot_y = 0.0f, drot_z = 0.0f, dscale = 0.0f;
     if (keyboardStates[SDL_SCANCODE_UP])
-        cube->rot_x += -0.04f;
+        drot_x += -0.04f;
     if (keyboardStates[SDL_SCANCODE_DOWN])
-        cube->rot_x += 0.04f;
+        drot_x += 0.04f;
     if (keyboardStates[SDL_SCANCODE_LEFT])
-        cube->rot_y += -0.04f;
+        drot_y += -0.04f;
     if (keyboardStates[SDL_SCANCODE_RIGHT])
-        cube->rot_y += 0.04f;
+        drot_y += 0.04f;
     if (keyboardStates[SDL_SCANCODE_COMMA])
-        cube->rot_z += 0.04f;
+        drot_z += 0.04f;
     if (keyboardStates[SDL_SCANCODE_PERIOD])
-        cube->rot_z += -0.04f;
+        drot_z += -0.04f;
     if (keyboardStates[SDL_SCANCODE_EQUALS])
-        cube->scale += 0.04f;
+        dscale += 0.04f;
     if (keyboardStates[SDL_SCANCODE_MINUS])
-        cube->scale += -0.04f;
+        dscale += -0.04f;
     if (keyboardStates[SDL_SCANCODE_W])
-        cube->y += 0.04f;
+        dy += 0.04f;
     if (keyboardStates[SDL_SCANCODE_S])
-        cube->y += -0.04f;
+        dy += -0.04f;
     if (keyboardStates[SDL_SCANCODE_A])
-        cube->x += -0.04f;
+        dx += -0.04f;
     if (keyboardStates[SDL_SCANCODE_D])
-        cube->x += 0.04f;
+        dx += 0.04f;
     if (keyboardStates[SDL_SCANCODE_F])
-        cube->z += 0.04f;
+        dz += 0.04f;
     if (keyboardStates[SDL_SCANCODE_G])
-        cube->z += -0.04f;
+        dz += -0.04f;
+
+    if (dx != 0.0f || dy != 0.0f || dz != 0.0f)
+        transform_set_position(b, i, b->x[i] + dx, b->y[i] + dy,
+                b->z[i] + dz);
+    if (drot_x != 0.0f || drot_y != 0.0f || drot_z != 0.0f)
+        transform_set_rotation(b, i, b->rot_x[i] + drot_x,
+                b->rot_y[i] + drot_y, b->rot_z[i] + drot_z);
+    if (dscale != 0.0f)
+        transform_set_scale(b, i, b->scale[i] + dscale);
 }
 
 ATTR((unused))
@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include <kvec.h>
+#include "mdi.h"
+#include "glutils.h"
+#include "frame.h"
+#include "shaderpp.h"
+
+/* Pools are drawn with the entity shaders, so they share entity.c's
+ * attribute locations */
+static const GLuint VERT_POS  = 0,
+                    TEX_POS   = 1,
+                    NORM_POS  = 2,
+                    MODEL_POS = 3; /* mat4, takes locations 3-6 */
+
+struct MeshStaging {
+    kvec_t(GLfloat) vertices;
+    kvec_t(GLfloat) texture_uv;
+    kvec_t(GLfloat) normals;
+    kvec_t(GLuint) indices;
+};
+
+/* Globals */
+static mat4  *g_instances = NULL; /* scratch space for model matrices */
+static size_t g_instances_capacity = 0;
+static struct DrawElementsIndirectCommand *g_commands = NULL;
+static size_t g_commands_capacity = 0;
+
+static void reserve_scratch(size_t ninstances, size_t ncommands);
+
+/* mdi_supported - whether the current context can draw a MeshPool */
+bool mdi_supported(void)
+{
+    return GLEW_VERSION_4_3
+        || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+/* mesh_pool_init - start an empty MeshPool
+ * @pool: the MeshPool to initialize
+ * @vert_filepath, @frag_filepath: shaders used for every mesh in the pool
+ * @tex_filepath: texture used for every mesh in the pool, or NULL
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Add meshes with mesh_pool_add(), then call mesh_pool_upload() once
+ *  - Call mesh_pool_free() after use
+ */
+void mesh_pool_init(struct MeshPool *pool, const char *vert_filepath,
+        const char *frag_filepath, const char *tex_filepath)
+{
+    memset(pool, 0, sizeof *pool);
+    unsigned features = SHADER_LIT | SHADER_INSTANCED;
+    if (tex_filepath)
+        features |= SHADER_TEXTURED;
+    pool->program = shader_variant(vert_filepath, frag_filepath, features);
+    if (tex_filepath)
+        pool->texture = load_texture(tex_filepath);
+
+    pool->staging = calloc(1, sizeof *pool->staging);
+    ASSERT(pool->staging != NULL, "Out of memory");
+}
+
+/* mesh_pool_add - append a mesh to a MeshPool
+ * @pool: the MeshPool, before mesh_pool_upload()
+ * @data: the mesh, its file paths are ignored
+ *
+ * Returns the mesh's index for PoolBatch.mesh
+ */
+uint32_t mesh_pool_add(struct MeshPool *pool, const struct ModelData *data)
+{
+    struct MeshStaging *s = pool->staging;
+    ASSERT(s != NULL, "mesh_pool_add() after mesh_pool_upload()");
+
+    if (pool->nmeshes == pool->meshes_capacity) {
+        size_t capacity = MAX(pool->meshes_capacity * 2, 8);
+        struct PoolMesh *meshes = realloc(pool->meshes,
+                capacity * sizeof (struct PoolMesh));
+        ASSERT(meshes != NULL, "Out of memory");
+        pool->meshes = meshes;
+        pool->meshes_capacity = capacity;
+    }
+
+    struct PoolMesh *mesh = &pool->meshes[pool->nmeshes];
+    GLsizei nvertices = data->vertices_count / 3;
+    mesh->first_index = kv_size(s->indices);
+    mesh->index_count = data->indices_count;
+    mesh->base_vertex = kv_size(s->vertices) / 3;
+    mesh_bounds(data->vertices, data->vertices_count, mesh->bounds);
+
+    for (GLsizei i = 0; i < nvertices * 3; i++) {
+        kv_push(GLfloat, s->vertices, data->vertices[i]);
+        kv_push(GLfloat, s->normals,
+                i < data->normals_count ? data->normals[i] : 0.0f);
+    }
+    /* Keep the streams in step for meshes without texture coordinates */
+    for (GLsizei i = 0; i < nvertices * 2; i++)
+        kv_push(GLfloat, s->texture_uv, data->texture_uv
+                && i < data->texture_uv_count ? data->texture_uv[i] : 0.0f);
+    for (GLsizei i = 0; i < data->indices_count; i++)
+        kv_push(GLuint, s->indices, data->indices[i]);
+
+    return pool->nmeshes++;
+}
+
+/* mesh_pool_upload - create the pool's buffers from the added meshes
+ *
+ * Contracts:
+ *  - At least one mesh was added
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void mesh_pool_upload(struct MeshPool *pool)
+{
+    struct MeshStaging *s = pool->staging;
+    ASSERT(s != NULL && pool->nmeshes > 0, "Empty or uploaded MeshPool");
+
+    pool->vao = gen_array();
+
+    pool->vbo_vertices = gen_buffer(GL_ARRAY_BUFFER,
+            kv_size(s->vertices) * sizeof (GLfloat), s->vertices.a);
+    attrib_buffer(VERT_POS, 3, GL_FLOAT, sizeof (GLfloat) * 3, 0);
+
+    pool->vbo_texture_uv = gen_buffer(GL_ARRAY_BUFFER,
+            kv_size(s->texture_uv) * sizeof (GLfloat), s->texture_uv.a);
+    attrib_buffer(TEX_POS, 2, GL_FLOAT, sizeof (GLfloat) * 2, 0);
+
+    pool->vbo_normals = gen_buffer(GL_ARRAY_BUFFER,
+            kv_size(s->normals) * sizeof (GLfloat), s->normals.a);
+    attrib_buffer(NORM_POS, 3, GL_FLOAT, sizeof (GLfloat) * 3, 0);
+
+    pool->ebo_indices = gen_buffer(GL_ELEMENT_ARRAY_BUFFER,
+            kv_size(s->indices) * sizeof (GLuint), s->indices.a);
+
+    /* Per-instance model matrices, base_instance selects each mesh's run */
+    GLCHECK(glGenBuffers(1, &pool->vbo_instances));
+    bind_buffer(GL_ARRAY_BUFFER, pool->vbo_instances);
+    for (GLuint col = 0; col < 4; col++) {
+        attrib_buffer(MODEL_POS + col, 4, GL_FLOAT, sizeof (mat4),
+                col * sizeof (vec4));
+        attrib_divisor(MODEL_POS + col, 1);
+    }
+
+    GLCHECK(glGenBuffers(1, &pool->ibo_commands));
+
+    bind_array(0);
+
+    kv_destroy(s->vertices);
+    kv_destroy(s->texture_uv);
+    kv_destroy(s->normals);
+    kv_destroy(s->indices);
+    free(s);
+    pool->staging = NULL;
+}
+
+/* mesh_pool_free - destroy a MeshPool created with mesh_pool_init()
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void mesh_pool_free(struct MeshPool *pool)
+{
+    if (pool->staging) {
+        kv_destroy(pool->staging->vertices);
+        kv_destroy(pool->staging->texture_uv);
+        kv_destroy(pool->staging->normals);
+        kv_destroy(pool->staging->indices);
+        free(pool->staging);
+    } else {
+        del_array(pool->vao);
+        del_buffer(pool->vbo_vertices);
+        del_buffer(pool->vbo_texture_uv);
+        del_buffer(pool->vbo_normals);
+        del_buffer(pool->ebo_indices);
+        del_buffer(pool->vbo_instances);
+        del_buffer(pool->ibo_commands);
+    }
+    if (pool->texture != 0)
+        del_texture(pool->texture);
+    free(pool->meshes);
+    memset(pool, 0, sizeof *pool);
+}
+
+/* render_pool - render Entities of many meshes with one draw call
+ * @pool: the MeshPool, after mesh_pool_upload()
+ * @batch: pointer to the first PoolBatch
+ * @nbatches: number of PoolBatches in the array
+ *
+ * Every batch is culled like render_entities() does, then the visible
+ * model matrices of all batches are streamed into one instance buffer and
+ * each batch with something left becomes an indirect command.
+ *
+ * Contracts:
+ *  - mdi_supported() is true
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void render_pool(const struct MeshPool *pool, const struct PoolBatch *batch,
+        size_t nbatches)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < nbatches; i++)
+        total += batch[i].count;
+    if (total == 0)
+        return;
+    reserve_scratch(total, nbatches);
+
+    size_t ninstances = 0, ncommands = 0;
+    for (size_t i = 0; i < nbatches; i++) {
+        ASSERT(batch[i].mesh < pool->nmeshes, "Mesh is not in the pool");
+        const struct PoolMesh *mesh = &pool->meshes[batch[i].mesh];
+        size_t n = collect_instances(mesh->bounds, batch[i].entities,
+                batch[i].count, g_instances + ninstances);
+        if (n == 0)
+            continue;
+
+        g_commands[ncommands++] = (struct DrawElementsIndirectCommand){
+            .count          = mesh->index_count,
+            .instance_count = n,
+            .first_index    = mesh->first_index,
+            .base_vertex    = mesh->base_vertex,
+            .base_instance  = ninstances,
+        };
+        ninstances += n;
+    }
+    if (ncommands == 0)
+        return;
+
+    use_program(pool->program);
+    bind_array(pool->vao);
+    if (pool->texture != 0)
+        bind_texture_unit(0, pool->texture);
+
+    GLintptr offset;
+    stream_buffer(GL_ARRAY_BUFFER, pool->vbo_instances, g_instances,
+            ninstances * sizeof (mat4), &offset);
+    for (GLuint col = 0; col < 4; col++)
+        attrib_buffer(MODEL_POS + col, 4, GL_FLOAT, sizeof (mat4),
+                offset + col * sizeof (vec4));
+    stream_buffer(GL_DRAW_INDIRECT_BUFFER, pool->ibo_commands, g_commands,
+            ncommands * sizeof (struct DrawElementsIndirectCommand), &offset);
+
+    draw_multi_indirect(offset, ncommands);
+}
+
+static void reserve_scratch(size_t ninstances, size_t ncommands)
+{
+    if (ninstances > g_instances_capacity) {
+        size_t capacity = MAX(g_instances_capacity * 2, ninstances);
+        mat4 *instances = realloc(g_instances, capacity * sizeof (mat4));
+        ASSERT(instances != NULL, "Out of memory");
+        g_instances = instances;
+        g_instances_capacity = capacity;
+    }
+    if (ncommands > g_commands_capacity) {
+        size_t capacity = MAX(g_commands_capacity * 2, ncommands);
+        struct DrawElementsIndirectCommand *commands = realloc(g_commands,
+                capacity * sizeof (struct DrawElementsIndirectCommand));
+        ASSERT(commands != NULL, "Out of memory");
+        g_commands = commands;
+        g_commands_capacity = capacity;
+    }
+}
@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+#include <cglm/cglm.h>
+#include "occlusion.h"
+#include "utils.h"
+
+#if defined(SIMD_DISPATCH)
+# include <immintrin.h>
+#endif
+
+/* Triangles with a vertex closer than this (in clip space w) are skipped
+ * instead of clipped, which only ever makes occlusion less aggressive */
+#define MIN_W 1e-3f
+
+/* A triangle ready for rasterization: E(x, y) = dx * x + dy * y + c is
+ * non-negative inside each edge, and depth is planar in screen space */
+struct Triangle {
+    float e_dx[3], e_dy[3], e_c[3];
+    float z_dx, z_dy, z_c;
+    int minx, maxx, miny, maxy; /* inclusive pixel bounds */
+};
+
+/* Globals */
+static bool g_force_scalar = false;
+
+static bool setup_triangle(const struct OcclusionBuffer *b, const vec4 c0,
+        const vec4 c1, const vec4 c2, struct Triangle *out)
+    ATTR((nonnull(1, 5)));
+static void raster_scalar(struct OcclusionBuffer *b, const struct Triangle *t)
+    ATTR((nonnull(1, 2)));
+static bool project_box_scalar(const struct OcclusionBuffer *b,
+        const float lo[3], const float hi[3], float rect[5])
+    ATTR((nonnull(1, 2, 3, 4)));
+static bool test_rect_scalar(const struct OcclusionBuffer *b, int x0, int y0,
+        int x1, int y1, float zmin) ATTR((nonnull(1)));
+static double seconds_since(Uint64 start);
+
+/* occlusion_init - allocate a depth buffer
+ * @b: the OcclusionBuffer to initialize
+ * @width, @height: resolution, rounded up to the tile size
+ *
+ * Responsibilities:
+ *  - Call occlusion_free() after use
+ */
+void occlusion_init(struct OcclusionBuffer *b, int width, int height)
+{
+    memset(b, 0, sizeof *b);
+    b->tiles_x = (width  + OCCLUSION_TILE_W - 1) / OCCLUSION_TILE_W;
+    b->tiles_y = (height + OCCLUSION_TILE_H - 1) / OCCLUSION_TILE_H;
+    b->width   = b->tiles_x * OCCLUSION_TILE_W;
+    b->height  = b->tiles_y * OCCLUSION_TILE_H;
+    b->depth    = calloc((size_t)b->width * b->height, sizeof (float));
+    b->tile_max = calloc((size_t)b->tiles_x * b->tiles_y, sizeof (float));
+    ASSERT(b->depth && b->tile_max, "Out of memory");
+    glm_mat4_identity(b->viewproj);
+}
+
+void occlusion_free(struct OcclusionBuffer *b)
+{
+    free(b->depth);
+    free(b->tile_max);
+    memset(b, 0, sizeof *b);
+}
+
+/* occlusion_begin - clear the buffer for a new frame
+ * @b: the OcclusionBuffer
+ * @viewproj: the camera's projection * view
+ */
+void occlusion_begin(struct OcclusionBuffer *b, mat4 viewproj)
+{
+    size_t npixels = (size_t)b->width * b->height;
+    for (size_t i = 0; i < npixels; i++)
+        b->depth[i] = 1.0f;
+    for (int i = 0; i < b->tiles_x * b->tiles_y; i++)
+        b->tile_max[i] = 1.0f;
+    glm_mat4_copy(viewproj, b->viewproj);
+    memset(&b->stats, 0, sizeof b->stats);
+}
+
+#if defined(SIMD_DISPATCH)
+TARGET("avx2,fma")
+static void raster_avx2(struct OcclusionBuffer *b, const struct Triangle *t)
+{
+    const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f,
+                                       4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 e_dx[3], e_dy[3], e_c[3];
+    for (int i = 0; i < 3; i++) {
+        e_dx[i] = _mm256_set1_ps(t->e_dx[i]);
+        e_dy[i] = _mm256_set1_ps(t->e_dy[i]);
+        e_c[i]  = _mm256_set1_ps(t->e_c[i]);
+    }
+    const __m256 z_dx = _mm256_set1_ps(t->z_dx);
+    const __m256 z_dy = _mm256_set1_ps(t->z_dy);
+    const __m256 z_c  = _mm256_set1_ps(t->z_c);
+
+    int x_begin = t->minx & ~(OCCLUSION_TILE_W - 1);
+    for (int y = t->miny; y <= t->maxy; y++) {
+        __m256 py = _mm256_set1_ps(y + 0.5f);
+        /* Row constant parts of the edge and depth functions */
+        __m256 row[3];
+        for (int i = 0; i < 3; i++)
+            row[i] = _mm256_fmadd_ps(e_dy[i], py, e_c[i]);
+        __m256 zrow = _mm256_fmadd_ps(z_dy, py, z_c);
+
+        float *line = b->depth + (size_t)y * b->width;
+        for (int x = x_begin; x <= t->maxx; x += 8) {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+            __m256 inside = _mm256_cmp_ps(
+                    _mm256_fmadd_ps(e_dx[0], px, row[0]), zero, _CMP_GE_OQ);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(
+                    _mm256_fmadd_ps(e_dx[1], px, row[1]), zero, _CMP_GE_OQ));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(
+                    _mm256_fmadd_ps(e_dx[2], px, row[2]), zero, _CMP_GE_OQ));
+            if (_mm256_testz_ps(inside, inside))
+                continue;
+
+            __m256 z = _mm256_max_ps(_mm256_fmadd_ps(z_dx, px, zrow), zero);
+            __m256 old = _mm256_loadu_ps(line + x);
+            __m256 nearer = _mm256_and_ps(inside,
+                    _mm256_cmp_ps(z, old, _CMP_LT_OQ));
+            _mm256_storeu_ps(line + x, _mm256_blendv_ps(old, z, nearer));
+        }
+    }
+}
+
+TARGET("avx2")
+static float hmin_avx(__m256 v)
+{
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+TARGET("avx2")
+static float hmax_avx(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+/* project_box_avx2 - project_box_scalar() with one corner per lane */
+TARGET("avx2,fma")
+static bool project_box_avx2(const struct OcclusionBuffer *b,
+        const float lo[3], const float hi[3], float rect[5])
+{
+    const __m256 x = _mm256_setr_ps(lo[0], hi[0], lo[0], hi[0],
+                                    lo[0], hi[0], lo[0], hi[0]);
+    const __m256 y = _mm256_setr_ps(lo[1], lo[1], hi[1], hi[1],
+                                    lo[1], lo[1], hi[1], hi[1]);
+    const __m256 z = _mm256_setr_ps(lo[2], lo[2], lo[2], lo[2],
+                                    hi[2], hi[2], hi[2], hi[2]);
+
+    /* Rows of the clip space position, the matrix is column-major */
+    __m256 clip[4];
+    for (int r = 0; r < 4; r++) {
+        __m256 v = _mm256_set1_ps(b->viewproj[3][r]);
+        v = _mm256_fmadd_ps(_mm256_set1_ps(b->viewproj[0][r]), x, v);
+        v = _mm256_fmadd_ps(_mm256_set1_ps(b->viewproj[1][r]), y, v);
+        clip[r] = _mm256_fmadd_ps(_mm256_set1_ps(b->viewproj[2][r]), z, v);
+    }
+    if (_mm256_movemask_ps(_mm256_cmp_ps(clip[3], _mm256_set1_ps(MIN_W),
+                    _CMP_LT_OQ)))
+        return false;
+
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256 inv_w = _mm256_div_ps(_mm256_set1_ps(1.0f), clip[3]);
+    __m256 sx = _mm256_mul_ps(_mm256_fmadd_ps(_mm256_mul_ps(clip[0], inv_w),
+                half, half), _mm256_set1_ps((float)b->width));
+    __m256 sy = _mm256_mul_ps(_mm256_fmadd_ps(_mm256_mul_ps(clip[1], inv_w),
+                half, half), _mm256_set1_ps((float)b->height));
+    __m256 sz = _mm256_fmadd_ps(_mm256_mul_ps(clip[2], inv_w), half, half);
+
+    rect[0] = hmin_avx(sx);
+    rect[1] = hmin_avx(sy);
+    rect[2] = hmax_avx(sx);
+    rect[3] = hmax_avx(sy);
+    rect[4] = hmin_avx(sz);
+    return true;
+}
+
+TARGET("avx2")
+static bool test_rect_avx2(const struct OcclusionBuffer *b, int x0, int y0,
+        int x1, int y1, float zmin)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lo = _mm256_set1_epi32(x0 - 1);
+    const __m256i hi = _mm256_set1_epi32(x1 + 1);
+    const __m256 z = _mm256_set1_ps(zmin);
+
+    for (int y = y0; y <= y1; y++) {
+        const float *line = b->depth + (size_t)y * b->width;
+        for (int x = x0 & ~7; x <= x1; x += 8) {
+            __m256i px = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+            __m256i in_rect = _mm256_and_si256(_mm256_cmpgt_epi32(px, lo),
+                    _mm256_cmpgt_epi32(hi, px));
+            __m256 farther = _mm256_cmp_ps(_mm256_loadu_ps(line + x), z,
+                    _CMP_GE_OQ);
+            if (!_mm256_testz_ps(farther, _mm256_castsi256_ps(in_rect)))
+                return true;
+        }
+    }
+    return false;
+}
+#endif /* SIMD_DISPATCH */
+
+/* occlusion_rasterize - draw an occluder mesh into the depth buffer
+ * @b: the OcclusionBuffer, after occlusion_begin()
+ * @model: the occluder's model matrix
+ * @vertices: xyz positions
+ * @indices: triangle list
+ * @nindices: number of indices, a multiple of 3
+ *
+ * Contracts:
+ *  - The mesh lies entirely inside the object it stands in for, so that it
+ *    never hides anything the real object wouldn't
+ *  - Occluders are treated as two-sided
+ */
+void occlusion_rasterize(struct OcclusionBuffer *b, mat4 model,
+        const float *vertices, const uint32_t *indices, size_t nindices)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    mat4 mvp;
+    glm_mat4_mul(b->viewproj, model, mvp);
+    bool avx2 = false;
+#if defined(SIMD_DISPATCH)
+    avx2 = !g_force_scalar && CPU_HAS("avx2") && CPU_HAS("fma");
+#endif
+
+    for (size_t i = 0; i + 2 < nindices; i += 3) {
+        vec4 clip[3];
+        for (int k = 0; k < 3; k++) {
+            const float *v = vertices + 3 * (size_t)indices[i + k];
+            glm_mat4_mulv(mvp, (vec4){ v[0], v[1], v[2], 1.0f }, clip[k]);
+        }
+
+        struct Triangle t;
+        if (!setup_triangle(b, clip[0], clip[1], clip[2], &t))
+            continue;
+
+        b->stats.triangles++;
+#if defined(SIMD_DISPATCH)
+        if (avx2) {
+            raster_avx2(b, &t);
+            continue;
+        }
+#endif
+        raster_scalar(b, &t);
+    }
+    (void)avx2;
+
+    b->stats.raster_seconds += seconds_since(start);
+}
+
+/* occlusion_finish - update the per-tile depth after rasterizing
+ *  - call once after the last occlusion_rasterize() of a frame
+ */
+void occlusion_finish(struct OcclusionBuffer *b)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    for (int ty = 0; ty < b->tiles_y; ty++) {
+        for (int tx = 0; tx < b->tiles_x; tx++) {
+            float farthest = 0.0f;
+            for (int y = 0; y < OCCLUSION_TILE_H; y++) {
+                const float *line = b->depth
+                    + (size_t)(ty * OCCLUSION_TILE_H + y) * b->width
+                    + tx * OCCLUSION_TILE_W;
+                for (int x = 0; x < OCCLUSION_TILE_W; x++)
+                    farthest = MAX(farthest, line[x]);
+            }
+            b->tile_max[ty * b->tiles_x + tx] = farthest;
+        }
+    }
+
+    b->stats.raster_seconds += seconds_since(start);
+}
+
+/* occlusion_test_box - check whether a world space box may be visible
+ * @b: the OcclusionBuffer, after occlusion_finish()
+ * @lo, @hi: the box's corners
+ *
+ * Returns false only if the box is certainly hidden behind occluders
+ */
+bool occlusion_test_box(struct OcclusionBuffer *b, const float lo[3],
+        const float hi[3])
+{
+    b->stats.tested++;
+
+    /* Screen rectangle and nearest depth of the box's corners */
+    float rect[5];
+    bool in_front;
+#if defined(SIMD_DISPATCH)
+    if (!g_force_scalar && CPU_HAS("avx2") && CPU_HAS("fma"))
+        in_front = project_box_avx2(b, lo, hi, rect);
+    else
+#endif
+        in_front = project_box_scalar(b, lo, hi, rect);
+    if (!in_front)
+        return true; /* crosses the near plane */
+    float sx0 = rect[0], sy0 = rect[1], sx1 = rect[2], sy1 = rect[3];
+    float zmin = rect[4];
+
+    int x0 = MAX((int)floorf(sx0), 0);
+    int y0 = MAX((int)floorf(sy0), 0);
+    int x1 = MIN((int)ceilf(sx1), b->width - 1);
+    int y1 = MIN((int)ceilf(sy1), b->height - 1);
+    if (x0 > x1 || y0 > y1)
+        return true; /* off screen, leave that to frustum culling */
+
+    /* Tiles whose farthest depth is in front of the box hide it entirely,
+     * only the remaining tiles need a per-pixel look */
+    for (int ty = y0 / OCCLUSION_TILE_H; ty <= y1 / OCCLUSION_TILE_H; ty++) {
+        for (int tx = x0 / OCCLUSION_TILE_W; tx <= x1 / OCCLUSION_TILE_W; tx++) {
+            if (b->tile_max[ty * b->tiles_x + tx] < zmin)
+                continue;
+
+            int px0 = MAX(x0, tx * OCCLUSION_TILE_W);
+            int py0 = MAX(y0, ty * OCCLUSION_TILE_H);
+            int px1 = MIN(x1, (tx + 1) * OCCLUSION_TILE_W - 1);
+            int py1 = MIN(y1, (ty + 1) * OCCLUSION_TILE_H - 1);
+            bool visible;
+#if defined(SIMD_DISPATCH)
+            if (!g_force_scalar && CPU_HAS("avx2"))
+                visible = test_rect_avx2(b, px0, py0, px1, py1, zmin);
+            else
+#endif
+                visible = test_rect_scalar(b, px0, py0, px1, py1, zmin);
+            if (visible)
+                return true;
+        }
+    }
+
+    b->stats.occluded++;
+    return false;
+}
+
+/* occlusion_cull_spheres - filter a list of spheres down to visible ones
+ * @b: the OcclusionBuffer, after occlusion_finish()
+ * @spheres: the bounding spheres
+ * @in: indices into @spheres to test, e.g. the output of cull_spheres()
+ * @n: number of indices in @in
+ * @out: receives the indices that may be visible, may be the same as @in
+ *
+ * Returns the number of indices written to @out
+ */
+size_t occlusion_cull_spheres(struct OcclusionBuffer *b,
+        const struct SphereBatch *spheres, const uint32_t *in, size_t n,
+        uint32_t *out)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    size_t nvisible = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t s = in[i];
+        float r = spheres->r[s];
+        float lo[3] = { spheres->x[s] - r, spheres->y[s] - r, spheres->z[s] - r };
+        float hi[3] = { spheres->x[s] + r, spheres->y[s] + r, spheres->z[s] + r };
+        if (occlusion_test_box(b, lo, hi))
+            out[nvisible++] = s;
+    }
+
+    b->stats.test_seconds += seconds_since(start);
+    return nvisible;
+}
+
+/* occlusion_force_scalar - disable the AVX2 paths, for benchmarking */
+void occlusion_force_scalar(bool scalar)
+{
+    g_force_scalar = scalar;
+}
+
+static bool setup_triangle(const struct OcclusionBuffer *b, const vec4 c0,
+        const vec4 c1, const vec4 c2, struct Triangle *out)
+{
+    if (c0[3] < MIN_W || c1[3] < MIN_W || c2[3] < MIN_W)
+        return false;
+
+    /* Screen space positions and depths */
+    float x[3], y[3], z[3];
+    const float *c[3] = { c0, c1, c2 };
+    for (int k = 0; k < 3; k++) {
+        float inv_w = 1.0f / c[k][3];
+        x[k] = (c[k][0] * inv_w * 0.5f + 0.5f) * b->width;
+        y[k] = (c[k][1] * inv_w * 0.5f + 0.5f) * b->height;
+        z[k] = c[k][2] * inv_w * 0.5f + 0.5f;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (fabsf(area) < 1e-6f)
+        return false;
+    if (area < 0.0f) {
+        /* Flip to counter-clockwise */
+        float tx = x[1], ty = y[1], tz = z[1];
+        x[1] = x[2], y[1] = y[2], z[1] = z[2];
+        x[2] = tx, y[2] = ty, z[2] = tz;
+        area = -area;
+    }
+
+    float fminx = MAX(MIN(x[0], MIN(x[1], x[2])), 0.0f);
+    float fminy = MAX(MIN(y[0], MIN(y[1], y[2])), 0.0f);
+    float fmaxx = MIN(MAX(x[0], MAX(x[1], x[2])), b->width - 1.0f);
+    float fmaxy = MIN(MAX(y[0], MAX(y[1], y[2])), b->height - 1.0f);
+    if (fminx > fmaxx || fminy > fmaxy)
+        return false;
+    out->minx = (int)fminx;
+    out->miny = (int)fminy;
+    out->maxx = (int)fmaxx;
+    out->maxy = (int)fmaxy;
+
+    /* Edge from vertex a to b, positive on the inside */
+    for (int k = 0; k < 3; k++) {
+        int a = k, e = (k + 1) % 3;
+        out->e_dx[k] = -(y[e] - y[a]);
+        out->e_dy[k] = x[e] - x[a];
+        out->e_c[k]  = (y[e] - y[a]) * x[a] - (x[e] - x[a]) * y[a];
+    }
+
+    out->z_dx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0]))
+        / area;
+    out->z_dy = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0]))
+        / area;
+    out->z_c  = z[0] - out->z_dx * x[0] - out->z_dy * y[0];
+    return true;
+}
+
+static void raster_scalar(struct OcclusionBuffer *b, const struct Triangle *t)
+{
+    for (int y = t->miny; y <= t->maxy; y++) {
+        float py = y + 0.5f;
+        float *line = b->depth + (size_t)y * b->width;
+        for (int x = t->minx; x <= t->maxx; x++) {
+            float px = x + 0.5f;
+            bool inside = true;
+            for (int k = 0; k < 3 && inside; k++)
+                inside = t->e_dx[k] * px + t->e_dy[k] * py + t->e_c[k] >= 0.0f;
+            if (!inside)
+                continue;
+            float z = MAX(t->z_dx * px + t->z_dy * py + t->z_c, 0.0f);
+            if (z < line[x])
+                line[x] = z;
+        }
+    }
+}
+
+/* project_box_scalar - screen space bounds of a world space box
+ *  - writes min x, min y, max x, max y and the nearest depth to @rect
+ *  - returns false if a corner is behind the near plane
+ */
+static bool project_box_scalar(const struct OcclusionBuffer *b,
+        const float lo[3], const float hi[3], float rect[5])
+{
+    rect[0] = rect[1] = rect[4] = INFINITY;
+    rect[2] = rect[3] = -INFINITY;
+    for (int i = 0; i < 8; i++) {
+        vec4 corner = {
+            i & 1 ? hi[0] : lo[0],
+            i & 2 ? hi[1] : lo[1],
+            i & 4 ? hi[2] : lo[2],
+            1.0f
+        }, clip;
+        glm_mat4_mulv((vec4 *)b->viewproj, corner, clip);
+        if (clip[3] < MIN_W)
+            return false;
+        float inv_w = 1.0f / clip[3];
+        float x = (clip[0] * inv_w * 0.5f + 0.5f) * b->width;
+        float y = (clip[1] * inv_w * 0.5f + 0.5f) * b->height;
+        float z = clip[2] * inv_w * 0.5f + 0.5f;
+        rect[0] = MIN(rect[0], x);
+        rect[1] = MIN(rect[1], y);
+        rect[2] = MAX(rect[2], x);
+        rect[3] = MAX(rect[3], y);
+        rect[4] = MIN(rect[4], z);
+    }
+    return true;
+}
+
+static bool test_rect_scalar(const struct OcclusionBuffer *b, int x0, int y0,
+        int x1, int y1, float zmin)
+{
+    for (int y = y0; y <= y1; y++) {
+        const float *line = b->depth + (size_t)y * b->width;
+        for (int x = x0; x <= x1; x++)
+            if (line[x] >= zmin)
+                return true;
+    }
+    return false;
+}
+
+static double seconds_since(Uint64 start)
+{
+    return (double)(SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+}
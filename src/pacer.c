@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "pacer.h"
+#include "glutils.h"
+
+/* How long one glClientWaitSync() blocks before checking again */
+static const GLuint64 WAIT_TIMEOUT_NS = 1000000;
+/* Refresh rate assumed when the display doesn't say */
+static const int DEFAULT_HZ = 60;
+/* Weight of the newest frame in the smoothed work estimate */
+static const double WORK_SMOOTHING = 0.1;
+
+static double now_ms(void);
+static double sleep_until(double deadline, double spin_ms);
+static double wait_fence(GLsync fence);
+static void log_summary(const struct Pacer *p) ATTR((nonnull(1)));
+
+/* pacer_default_config - vsync with two frames in flight */
+void pacer_default_config(struct PacerConfig *out)
+{
+    *out = (struct PacerConfig){
+        .mode = PACE_VSYNC,
+        .fps = 0.0,
+        .in_flight = 2,
+        .spin_ms = 1.0,
+        .margin_ms = 1.0,
+        .log = false,
+    };
+}
+
+/* pacer_parse_args - override @config from command line arguments
+ *  - --pace=vsync|adaptive|capped|low-latency, --fps=N, --in-flight=N,
+ *    --pace-log
+ *  - other arguments are ignored
+ */
+void pacer_parse_args(struct PacerConfig *config, int argc, char *argv[])
+{
+    static const char *const MODES[] = {
+        [PACE_VSYNC] = "vsync",
+        [PACE_ADAPTIVE] = "adaptive",
+        [PACE_CAPPED] = "capped",
+        [PACE_LOW_LATENCY] = "low-latency",
+    };
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--pace=", 7) == 0) {
+            unsigned m = 0;
+            while (m < ARRAY_SIZE(MODES) && strcmp(arg + 7, MODES[m]) != 0)
+                m++;
+            if (m == ARRAY_SIZE(MODES))
+                FATAL("Unknown pacing mode \"%s\"", arg + 7);
+            config->mode = m;
+        } else if (strncmp(arg, "--fps=", 6) == 0) {
+            config->fps = atof(arg + 6);
+        } else if (strncmp(arg, "--in-flight=", 12) == 0) {
+            config->in_flight = atoi(arg + 12);
+        } else if (strcmp(arg, "--pace-log") == 0) {
+            config->log = true;
+        }
+    }
+}
+
+/* pacer_init - set the swap interval for the mode and create the queries
+ * @p: the Pacer
+ * @window: the window frames are presented to, for its refresh rate
+ * @config: the settings, copied
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call pacer_free() after use
+ */
+void pacer_init(struct Pacer *p, SDL_Window *window,
+        const struct PacerConfig *config)
+{
+    memset(p, 0, sizeof *p);
+    p->config = *config;
+    if (p->config.mode == PACE_LOW_LATENCY)
+        p->config.in_flight = 1;
+    p->config.in_flight = MIN(MAX(p->config.in_flight, 1u),
+            PACER_MAX_IN_FLIGHT);
+
+    SDL_DisplayMode display;
+    int hz = DEFAULT_HZ;
+    if (SDL_GetWindowDisplayMode(window, &display) == 0
+            && display.refresh_rate > 0)
+        hz = display.refresh_rate;
+    p->period_ms = 1000.0 / hz;
+    if (p->config.mode == PACE_CAPPED && p->config.fps > 0.0)
+        p->period_ms = 1000.0 / p->config.fps;
+
+    static const int INTERVALS[] = {
+        [PACE_VSYNC] = 1,
+        [PACE_ADAPTIVE] = -1,
+        [PACE_CAPPED] = 0,
+        [PACE_LOW_LATENCY] = 1,
+    };
+    p->swap_interval = INTERVALS[p->config.mode];
+    if (SDL_GL_SetSwapInterval(p->swap_interval) != 0) {
+        /* Late swap tearing is an extension, fall back to plain vsync */
+        ASSERT(p->swap_interval == -1, SDL_GetError());
+        p->swap_interval = 1;
+        int ret = SDL_GL_SetSwapInterval(1);
+        ASSERT(ret == 0, SDL_GetError());
+    }
+
+    GLCHECK(glGenQueries(PACER_QUERIES * 2, p->queries));
+    double now = now_ms();
+    p->last_start = p->last_present = now;
+}
+
+void pacer_free(struct Pacer *p)
+{
+    for (unsigned i = 0; i < PACER_MAX_IN_FLIGHT; i++)
+        if (p->fences[i])
+            glDeleteSync(p->fences[i]);
+    GLCHECK(glDeleteQueries(PACER_QUERIES * 2, p->queries));
+    memset(p, 0, sizeof *p);
+}
+
+/* pacer_wait - hold the next frame back until the mode wants it started
+ *  - call right before sampling input
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void pacer_wait(struct Pacer *p)
+{
+    struct FrameTiming *t = &p->history[p->frames % PACER_HISTORY];
+    memset(t, 0, sizeof *t);
+
+    /* The fence of the frame in_flight frames ago */
+    unsigned slot = p->frames % p->config.in_flight;
+    if (p->fences[slot]) {
+        t->fence_ms = wait_fence(p->fences[slot]);
+        glDeleteSync(p->fences[slot]);
+        p->fences[slot] = NULL;
+    }
+
+    double deadline = 0.0;
+    if (p->config.mode == PACE_CAPPED)
+        deadline = p->last_start + p->period_ms;
+    else if (p->config.mode == PACE_LOW_LATENCY)
+        deadline = p->last_present + p->period_ms - p->work_ms
+                - p->config.margin_ms;
+    t->sleep_ms = sleep_until(deadline, p->config.spin_ms);
+
+    p->frame_start = now_ms();
+    t->interval_ms = p->frame_start - p->last_start;
+    p->last_start = p->frame_start;
+
+    /* This frame's query pair was last used PACER_QUERIES frames ago, take
+     * its result if there, dropped otherwise rather than waited for */
+    unsigned q = p->frames % PACER_QUERIES;
+    if (p->pending[q] && p->frames >= PACER_QUERIES) {
+        GLuint available = GL_FALSE;
+        GLCHECK(glGetQueryObjectuiv(p->queries[q * 2 + 1],
+                    GL_QUERY_RESULT_AVAILABLE, &available));
+        if (available) {
+            GLuint64 start, end;
+            GLCHECK(glGetQueryObjectui64v(p->queries[q * 2], GL_QUERY_RESULT,
+                        &start));
+            GLCHECK(glGetQueryObjectui64v(p->queries[q * 2 + 1],
+                        GL_QUERY_RESULT, &end));
+            unsigned long frame = p->frames - PACER_QUERIES;
+            p->history[frame % PACER_HISTORY].gpu_ms = (end - start) / 1e6;
+        }
+    }
+    p->pending[q] = false;
+}
+
+/* pacer_gpu_begin - start timing the frame's GPU work
+ *  - call once the frame's CPU-only work is done, right before its draws,
+ *    so the GPU time leaves out the GPU idling while the CPU prepares the
+ *    frame
+ *  - frames without it have no GPU time
+ *
+ * Contracts:
+ *  - After pacer_wait()
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void pacer_gpu_begin(struct Pacer *p)
+{
+    unsigned q = p->frames % PACER_QUERIES;
+    GLCHECK(glQueryCounter(p->queries[q * 2], GL_TIMESTAMP));
+    p->gpu_begun = true;
+}
+
+/* pacer_present - swap @window's buffers and finish timing the frame
+ *
+ * Contracts:
+ *  - After pacer_wait()
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void pacer_present(struct Pacer *p, SDL_Window *window)
+{
+    struct FrameTiming *t = &p->history[p->frames % PACER_HISTORY];
+    if (p->gpu_begun) {
+        unsigned q = p->frames % PACER_QUERIES;
+        GLCHECK(glQueryCounter(p->queries[q * 2 + 1], GL_TIMESTAMP));
+        p->pending[q] = true;
+        p->gpu_begun = false;
+    }
+
+    double start = now_ms();
+    t->cpu_ms = start - p->frame_start;
+    SDL_GL_SwapWindow(window);
+    p->last_present = now_ms();
+    t->present_ms = p->last_present - start;
+
+    unsigned slot = p->frames % p->config.in_flight;
+    p->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    /* The newest GPU time known is a few frames old, close enough */
+    double gpu_ms = 0.0;
+    if (p->frames >= PACER_QUERIES)
+        gpu_ms = p->history[(p->frames - PACER_QUERIES) % PACER_HISTORY].gpu_ms;
+    double work = MAX(t->cpu_ms, gpu_ms);
+    p->work_ms += (work - p->work_ms) * WORK_SMOOTHING;
+
+    p->frames++;
+    if (p->config.log && p->frames % PACER_HISTORY == 0)
+        log_summary(p);
+}
+
+/* pacer_timing - a recent frame's timing
+ * @p: the Pacer
+ * @ago: 0 for the last frame presented, up to PACER_HISTORY - 1
+ *
+ * GPU times of the last PACER_QUERIES frames aren't known yet
+ */
+const struct FrameTiming *pacer_timing(const struct Pacer *p, unsigned ago)
+{
+    ASSERT(ago < PACER_HISTORY && ago < p->frames, "Frame timing is gone");
+    return &p->history[(p->frames - 1 - ago) % PACER_HISTORY];
+}
+
+static double now_ms(void)
+{
+    return (double)SDL_GetPerformanceCounter() * 1000.0
+        / SDL_GetPerformanceFrequency();
+}
+
+/* sleep_until - SDL_Delay() to about @spin_ms before @deadline, spin the
+ * rest
+ *  - returns the time slept, 0 if the deadline is past
+ */
+static double sleep_until(double deadline, double spin_ms)
+{
+    double start = now_ms(), now = start;
+    if (deadline <= now)
+        return 0.0;
+    /* One long SDL_Delay() can overshoot by a scheduler tick, short ones
+     * only by a fraction of one */
+    while (deadline - now > spin_ms + 1.0) {
+        SDL_Delay(1);
+        now = now_ms();
+    }
+    while ((now = now_ms()) < deadline)
+        ;
+    return now - start;
+}
+
+/* wait_fence - block until the GPU passes @fence, returns the time waited */
+static double wait_fence(GLsync fence)
+{
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_TIMEOUT_EXPIRED) {
+        ASSERT(status != GL_WAIT_FAILED, "glClientWaitSync() failed");
+        return 0.0;
+    }
+    double start = now_ms();
+    do {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                WAIT_TIMEOUT_NS);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    ASSERT(status != GL_WAIT_FAILED, "glClientWaitSync() failed");
+    return now_ms() - start;
+}
+
+/* log_summary - averages and worst cases of the frames in the history */
+static void log_summary(const struct Pacer *p)
+{
+    struct FrameTiming sum = { 0 }, worst = { 0 };
+    unsigned ngpu = 0;
+    for (unsigned i = 0; i < PACER_HISTORY; i++) {
+        const struct FrameTiming *t = &p->history[i];
+        sum.cpu_ms += t->cpu_ms;
+        sum.gpu_ms += t->gpu_ms;
+        sum.present_ms += t->present_ms;
+        sum.fence_ms += t->fence_ms;
+        sum.sleep_ms += t->sleep_ms;
+        sum.interval_ms += t->interval_ms;
+        worst.cpu_ms = MAX(worst.cpu_ms, t->cpu_ms);
+        worst.gpu_ms = MAX(worst.gpu_ms, t->gpu_ms);
+        worst.interval_ms = MAX(worst.interval_ms, t->interval_ms);
+        ngpu += t->gpu_ms > 0.0;
+    }
+    double n = PACER_HISTORY;
+    fprintf(stderr, "pacer: interval %.2f (max %.2f) cpu %.2f (max %.2f) "
+            "gpu %.2f (max %.2f) present %.2f fence %.2f sleep %.2f ms\n",
+            sum.interval_ms / n, worst.interval_ms, sum.cpu_ms / n,
+            worst.cpu_ms, ngpu ? sum.gpu_ms / ngpu : 0.0, worst.gpu_ms,
+            sum.present_ms / n, sum.fence_ms / n, sum.sleep_ms / n);
+}
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "progcache.h"
+#include "glutils.h"
+
+#define CACHE_VERSION 1
+/* A cache grown past this is started over rather than read */
+#define MAX_FILE_BYTES (64u << 20)
+
+static const char MAGIC[8] = "GLPROGS";
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+static const uint64_t FNV_PRIME = 0x100000001b3ull;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t driver;   /* hash of the strings that identify the driver */
+};
+
+struct EntryHeader {
+    uint64_t key;
+    uint32_t format;   /* binary format, as glGetProgramBinary() gave it */
+    uint32_t length;   /* bytes of binary that follow */
+};
+
+struct Entry {
+    struct EntryHeader header;
+    void *binary;
+};
+
+/* A compile progcache_start() left running */
+struct Pending {
+    GLuint program;
+    uint64_t key;
+    bool store;        /* the cache was on when it started */
+};
+
+/* Globals */
+static struct {
+    bool enabled;
+    char *path;
+    uint64_t driver;
+    struct Entry *entries;
+    size_t count, capacity;
+    struct Pending *pending;
+    size_t npending, pending_capacity;
+    struct ProgCacheStats stats;
+} g_cache;
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size);
+static uint64_t hash_string(uint64_t h, const char *s);
+static uint64_t driver_hash(void);
+static bool read_cache(FILE *file) ATTR((nonnull(1)));
+static void start_cache(void);
+static struct Entry *find_entry(uint64_t key);
+static bool add_entry(const struct EntryHeader *header, void *binary)
+    ATTR((nonnull(1, 2)));
+static GLuint load_binary(const struct Entry *entry) ATTR((nonnull(1)));
+static void store_binary(uint64_t key, GLuint program);
+static GLuint start_compile(const char *vertex, const char *fragment,
+        const char *defines) ATTR((nonnull(1, 2)));
+static char *with_defines(const char *source, const char *defines)
+    ATTR((nonnull(1, 2)));
+static double now_seconds(void);
+
+/* progcache_init - open the cache file, or start one
+ * @path: the cache file, NULL for "programs.bin" in SDL's pref path
+ *
+ * Returns false, and leaves the cache off, when the driver can't hand out
+ * program binaries or there's nowhere to keep them. A file from another
+ * driver, version or layout is started over.
+ *
+ * Contracts:
+ *  - After the GL context is made and GLEW is initialized
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call progcache_shutdown() before exiting
+ */
+bool progcache_init(const char *path)
+{
+    ASSERT(!g_cache.enabled, "Program cache is already open");
+    memset(&g_cache.stats, 0, sizeof g_cache.stats);
+    if (!GLEW_ARB_get_program_binary)
+        return false;
+    GLint formats = 0;
+    GLCHECK(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+    if (formats <= 0)
+        return false;
+
+    if (path != NULL) {
+        g_cache.path = strdup(path);
+    } else {
+        char *dir = SDL_GetPrefPath("GL_testing", "GL_testing");
+        if (dir == NULL) {
+            fprintf(stderr, "progcache: no place for the cache: %s\n",
+                    SDL_GetError());
+            return false;
+        }
+        size_t size = strlen(dir) + sizeof "programs.bin";
+        g_cache.path = malloc(size);
+        if (g_cache.path != NULL)
+            snprintf(g_cache.path, size, "%sprograms.bin", dir);
+        SDL_free(dir);
+    }
+    ASSERT(g_cache.path != NULL, "Out of memory");
+    g_cache.driver = driver_hash();
+    g_cache.enabled = true;
+
+    FILE *file = fopen(g_cache.path, "rb");
+    bool valid = file != NULL && read_cache(file);
+    if (file != NULL)
+        fclose(file);
+    if (!valid)
+        start_cache();
+    return g_cache.enabled;
+}
+
+void progcache_shutdown(void)
+{
+    ASSERT(g_cache.npending == 0, "Program compiles are still pending");
+    for (size_t i = 0; i < g_cache.count; i++)
+        free(g_cache.entries[i].binary);
+    free(g_cache.entries);
+    free(g_cache.pending);
+    free(g_cache.path);
+    memset(&g_cache, 0, sizeof g_cache);
+}
+
+/* progcache_program - a linked program from two shader sources
+ * @vertex, @fragment: GLSL sources, each starting with its #version line
+ * @defines: lines put right after each #version line, or NULL
+ *
+ * Loads the program's binary if the cache has one the driver accepts,
+ * otherwise compiles it and stores its binary for next time.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call del_program() on the returned program
+ */
+GLuint progcache_program(const char *vertex, const char *fragment,
+        const char *defines)
+{
+    GLuint program = progcache_start(vertex, fragment, defines);
+    progcache_finish(program, true);
+    return program;
+}
+
+/* progcache_start - progcache_program() without waiting for a compile
+ *  - a cached binary is loaded right away, anything else is only queued
+ *    with the driver, see start_program()
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call progcache_finish() until it returns true before using the
+ *    program, then del_program() on it
+ */
+GLuint progcache_start(const char *vertex, const char *fragment,
+        const char *defines)
+{
+    double start = now_seconds();
+    GLuint program = 0;
+    uint64_t key = 0;
+    if (g_cache.enabled) {
+        /* The separators keep moving text between the parts from colliding */
+        key = hash_bytes(FNV_OFFSET, &g_cache.driver, sizeof g_cache.driver);
+        key = hash_bytes(hash_string(key, vertex), "", 1);
+        key = hash_bytes(hash_string(key, fragment), "", 1);
+        key = hash_string(key, defines != NULL ? defines : "");
+
+        struct Entry *entry = find_entry(key);
+        if (entry != NULL)
+            program = load_binary(entry);
+        if (program != 0) {
+            g_cache.stats.hits++;
+            g_cache.stats.seconds += now_seconds() - start;
+            return program;
+        }
+        if (entry != NULL)
+            g_cache.stats.rejected++;
+        else
+            g_cache.stats.misses++;
+    } else {
+        g_cache.stats.misses++;
+    }
+
+    program = start_compile(vertex, fragment, defines);
+    if (g_cache.npending == g_cache.pending_capacity) {
+        size_t capacity = MAX(g_cache.pending_capacity * 2, 16u);
+        struct Pending *pending = realloc(g_cache.pending,
+                capacity * sizeof *pending);
+        ASSERT(pending != NULL, "Out of memory");
+        g_cache.pending = pending;
+        g_cache.pending_capacity = capacity;
+    }
+    g_cache.pending[g_cache.npending++] = (struct Pending){
+        .program = program,
+        .key = key,
+        .store = g_cache.enabled,
+    };
+    g_cache.stats.seconds += now_seconds() - start;
+    return program;
+}
+
+/* progcache_finish - whether a program from progcache_start() is usable
+ * @program: the program
+ * @wait: block until it is rather than return false
+ *
+ * A compile that finished is checked, see finish_program(), and its binary
+ * stored. Without KHR_parallel_shader_compile there's no telling a compile
+ * finished without waiting for it, only @wait gets it in, see
+ * program_linked().
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+bool progcache_finish(GLuint program, bool wait)
+{
+    size_t i = 0;
+    while (i < g_cache.npending && g_cache.pending[i].program != program)
+        i++;
+    if (i == g_cache.npending)
+        return true;
+    if (!wait && !program_linked(program))
+        return false;
+
+    double start = now_seconds();
+    struct Pending p = g_cache.pending[i];
+    g_cache.pending[i] = g_cache.pending[--g_cache.npending];
+    finish_program(program);
+    if (p.store && g_cache.enabled)
+        store_binary(p.key, program);
+    g_cache.stats.seconds += now_seconds() - start;
+    return true;
+}
+
+/* progcache_stats - counters since progcache_init(), cleared by
+ * progcache_shutdown() */
+const struct ProgCacheStats *progcache_stats(void)
+{
+    return &g_cache.stats;
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * FNV_PRIME;
+    return h;
+}
+
+static uint64_t hash_string(uint64_t h, const char *s)
+{
+    return hash_bytes(h, s, strlen(s));
+}
+
+/* driver_hash - anything that may change what a binary means */
+static uint64_t driver_hash(void)
+{
+    static const GLenum NAMES[] = {
+        GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION,
+    };
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < ARRAY_SIZE(NAMES); i++) {
+        const GLubyte *s = glGetString(NAMES[i]);
+        h = hash_bytes(hash_string(h, s ? (const char *)s : ""), "", 1);
+    }
+    return h;
+}
+
+/* read_cache - take in every entry of @file, false if it isn't one of ours
+ * for this driver or is damaged */
+static bool read_cache(FILE *file)
+{
+    if (fseek(file, 0, SEEK_END) != 0)
+        return false;
+    long size = ftell(file);
+    if (size < 0 || (unsigned long)size > MAX_FILE_BYTES)
+        return false;
+    rewind(file);
+
+    struct FileHeader fh;
+    if (fread(&fh, sizeof fh, 1, file) != 1
+            || memcmp(fh.magic, MAGIC, sizeof MAGIC) != 0
+            || fh.version != CACHE_VERSION || fh.driver != g_cache.driver)
+        return false;
+
+    long offset = sizeof fh;
+    while (offset < size) {
+        struct EntryHeader eh;
+        if (fread(&eh, sizeof eh, 1, file) != 1)
+            return false;
+        offset += sizeof eh;
+        if (eh.length == 0 || eh.length > (unsigned long)(size - offset))
+            return false;
+        void *binary = malloc(eh.length);
+        ASSERT(binary != NULL, "Out of memory");
+        if (fread(binary, eh.length, 1, file) != 1 || !add_entry(&eh, binary)) {
+            free(binary);
+            return false;
+        }
+        offset += eh.length;
+    }
+    return true;
+}
+
+/* start_cache - replace the cache file with an empty one, turning the cache
+ * off if it can't be written */
+static void start_cache(void)
+{
+    for (size_t i = 0; i < g_cache.count; i++)
+        free(g_cache.entries[i].binary);
+    g_cache.count = 0;
+
+    struct FileHeader fh = {
+        .version = CACHE_VERSION,
+        .driver = g_cache.driver,
+    };
+    memcpy(fh.magic, MAGIC, sizeof MAGIC);
+    FILE *file = fopen(g_cache.path, "wb");
+    bool written = file != NULL && fwrite(&fh, sizeof fh, 1, file) == 1;
+    if (file != NULL && fclose(file) != 0)
+        written = false;
+    if (!written) {
+        fprintf(stderr, "progcache: could not write %s, disabled: %s\n",
+                g_cache.path, strerror(errno));
+        g_cache.enabled = false;
+    }
+}
+
+/* find_entry - the newest entry for @key, a rejected binary's replacement
+ * comes after it */
+static struct Entry *find_entry(uint64_t key)
+{
+    for (size_t i = g_cache.count; i-- > 0;)
+        if (g_cache.entries[i].header.key == key)
+            return &g_cache.entries[i];
+    return NULL;
+}
+
+/* add_entry - keep an entry in memory, taking ownership of @binary */
+static bool add_entry(const struct EntryHeader *header, void *binary)
+{
+    if (g_cache.count == g_cache.capacity) {
+        size_t capacity = g_cache.capacity ? g_cache.capacity * 2 : 16;
+        struct Entry *entries = realloc(g_cache.entries,
+                capacity * sizeof *entries);
+        if (entries == NULL)
+            return false;
+        g_cache.entries = entries;
+        g_cache.capacity = capacity;
+    }
+    g_cache.entries[g_cache.count++] = (struct Entry){ *header, binary };
+    return true;
+}
+
+/* load_binary - a program from @entry, 0 if the driver refuses it */
+static GLuint load_binary(const struct Entry *entry)
+{
+    GLuint program;
+    GLCHECK(program = glCreateProgram());
+    /* A format the driver dropped is an error rather than a failed link,
+     * either just means compiling. Any earlier error was caught above, so
+     * this one belongs to glProgramBinary() */
+    glProgramBinary(program, entry->header.format, entry->binary,
+            entry->header.length);
+    GLenum error = glGetError();
+    GLint status = GL_FALSE;
+    if (error == GL_NO_ERROR)
+        GLCHECK(glGetProgramiv(program, GL_LINK_STATUS, &status));
+    if (status == GL_FALSE) {
+        GLCHECK(glDeleteProgram(program));
+        return 0;
+    }
+    return program;
+}
+
+/* store_binary - append @program's binary to the cache file */
+static void store_binary(uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    GLCHECK(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0)
+        return;
+    void *binary = malloc(length);
+    ASSERT(binary != NULL, "Out of memory");
+    struct EntryHeader eh = { .key = key, .length = length };
+    GLenum format;
+    GLCHECK(glGetProgramBinary(program, length, NULL, &format, binary));
+    eh.format = format;
+
+    FILE *file = fopen(g_cache.path, "ab");
+    bool written = file != NULL && fwrite(&eh, sizeof eh, 1, file) == 1
+        && fwrite(binary, length, 1, file) == 1;
+    if (file != NULL && fclose(file) != 0)
+        written = false;
+    if (!written) {
+        /* A partial entry would damage the file, start over next run */
+        fprintf(stderr, "progcache: could not write %s, disabled: %s\n",
+                g_cache.path, strerror(errno));
+        remove(g_cache.path);
+        g_cache.enabled = false;
+    }
+    if (!written || !add_entry(&eh, binary)) {
+        free(binary);
+        return;
+    }
+    g_cache.stats.stored++;
+}
+
+static GLuint start_compile(const char *vertex, const char *fragment,
+        const char *defines)
+{
+    if (defines == NULL || defines[0] == '\0')
+        return start_program(start_shader(GL_VERTEX_SHADER, vertex),
+                start_shader(GL_FRAGMENT_SHADER, fragment));
+    char *v = with_defines(vertex, defines);
+    char *f = with_defines(fragment, defines);
+    GLuint program = start_program(start_shader(GL_VERTEX_SHADER, v),
+            start_shader(GL_FRAGMENT_SHADER, f));
+    free(v);
+    free(f);
+    return program;
+}
+
+/* with_defines - @source with @defines after its #version line, which has
+ * to stay first */
+static char *with_defines(const char *source, const char *defines)
+{
+    size_t split = 0;
+    const char *version = strstr(source, "#version");
+    if (version != NULL) {
+        const char *eol = strchr(version, '\n');
+        split = eol ? (size_t)(eol + 1 - source) : strlen(source);
+    }
+    size_t nsource = strlen(source), ndefines = strlen(defines);
+    bool newline = defines[ndefines - 1] != '\n';
+    char *out = malloc(nsource + ndefines + newline + 2);
+    ASSERT(out != NULL, "Out of memory");
+    char *p = out;
+    memcpy(p, source, split);
+    p += split;
+    if (split > 0 && source[split - 1] != '\n')
+        *p++ = '\n';
+    memcpy(p, defines, ndefines);
+    p += ndefines;
+    if (newline)
+        *p++ = '\n';
+    memcpy(p, source + split, nsource - split + 1);
+    return out;
+}
+
+static double now_seconds(void)
+{
+    return (double)SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+}
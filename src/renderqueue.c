@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "renderqueue.h"
+#include "glutils.h"
+#include "frame.h"
+#include "shaderpp.h"
+
+#define LAYER_SHIFT   60
+#define PROGRAM_BITS  10
+#define TEXTURE_BITS  12
+#define VAO_BITS      12
+#define DEPTH_BITS    24
+#define FIELD(v, bits) ((uint64_t)(v) & ((UINT64_C(1) << (bits)) - 1))
+
+static void reserve_items(struct RenderQueue *q, size_t n) ATTR((nonnull(1)));
+static void radix_sort(struct RenderItem *items, struct RenderItem *scratch,
+        size_t n) ATTR((nonnull(1, 2)));
+static uint32_t depth_bits(float depth);
+
+/* render_queue_init - create an empty RenderQueue
+ *
+ * Responsibilities:
+ *  - Call render_queue_free() after use
+ */
+void render_queue_init(struct RenderQueue *q)
+{
+    memset(q, 0, sizeof *q);
+}
+
+void render_queue_free(struct RenderQueue *q)
+{
+    free(q->items);
+    free(q->scratch);
+    free(q->instances);
+    free(q->sorted);
+    memset(q, 0, sizeof *q);
+}
+
+/* render_key - build the sort key of a draw
+ * @layer: RENDER_OPAQUE draws before RENDER_TRANSPARENT
+ * @m: the Model, its GL names are folded into the key
+ * @depth: view space distance from the camera
+ *
+ * GL names wider than their field alias each other, which only costs
+ * batching: the queue compares real state before changing it.
+ */
+uint64_t render_key(enum RenderLayer layer, const struct Model *m, float depth)
+{
+    uint64_t state = FIELD(m->program, PROGRAM_BITS) << (TEXTURE_BITS + VAO_BITS)
+                   | FIELD(m->texture, TEXTURE_BITS) << VAO_BITS
+                   | FIELD(m->vao, VAO_BITS);
+    uint64_t key = FIELD(layer, 64 - LAYER_SHIFT) << LAYER_SHIFT;
+    if (layer == RENDER_TRANSPARENT) {
+        uint64_t far_first = FIELD(~depth_bits(depth), DEPTH_BITS);
+        key |= far_first << (LAYER_SHIFT - DEPTH_BITS);
+        key |= state << 2;
+    } else {
+        key |= state << (DEPTH_BITS + 2);
+        key |= (uint64_t)depth_bits(depth) << 2;
+    }
+    return key;
+}
+
+/* render_queue_begin - start a new frame's worth of draws */
+void render_queue_begin(struct RenderQueue *q)
+{
+    q->count = 0;
+    memset(&q->stats, 0, sizeof q->stats);
+}
+
+/* render_queue_submit - queue Entities to be drawn with a Model
+ * @q: the RenderQueue
+ * @m: the Model to use
+ * @entity: pointer to the first Entity
+ * @n: number of Entities in the array
+ * @layer: RENDER_TRANSPARENT draws are blended, after every opaque draw
+ *
+ * Entities are culled on submission like render_entities() does, using the
+ * current frame's camera, see upload_frame().
+ *
+ * Contracts:
+ *  - @m outlives the next render_queue_flush()
+ *  - Not threadsafe - uses static memory of entity.c
+ */
+void render_queue_submit(struct RenderQueue *q, const struct Model *m,
+        const struct Entity *entity, size_t n, enum RenderLayer layer)
+{
+    reserve_items(q, q->count + n);
+    mat4 *instances = q->instances + q->count;
+    size_t nvisible = collect_instances(m->bounds, entity, n, instances);
+
+    /* Only the view's third row is needed for the distance */
+    const struct FrameUniforms *frame = current_frame();
+    float vz[4] = {
+        frame->view[0][2], frame->view[1][2], frame->view[2][2],
+        frame->view[3][2]
+    };
+    for (size_t i = 0; i < nvisible; i++) {
+        const float *pos = instances[i][3];
+        float depth = -(vz[0] * pos[0] + vz[1] * pos[1] + vz[2] * pos[2]
+                + vz[3]);
+        q->items[q->count + i] = (struct RenderItem){
+            .key = render_key(layer, m, depth),
+            .model = m,
+            .instance = q->count + i,
+        };
+    }
+    q->count += nvisible;
+}
+
+/* render_queue_sort - order the queued draws by key
+ *  - render_queue_flush() sorts too, call this to time the sort by itself
+ */
+void render_queue_sort(struct RenderQueue *q)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    radix_sort(q->items, q->scratch, q->count);
+    q->stats.sort_seconds += (double)(SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+}
+
+/* render_queue_flush - sort and draw everything submitted since
+ * render_queue_begin()
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void render_queue_flush(struct RenderQueue *q)
+{
+    render_queue_sort(q);
+    q->stats.items = q->count;
+
+    GLuint program = 0, vao = 0, texture = 0;
+    bool blending = false;
+    for (size_t i = 0; i < q->count; ) {
+        const struct Model *m = q->items[i].model;
+
+        /* Gather the run of this Model in draw order */
+        size_t run = 0;
+        for (; i + run < q->count && q->items[i + run].model == m; run++)
+            glm_mat4_copy(q->instances[q->items[i + run].instance],
+                    q->sorted[run]);
+
+        if (!blending && q->items[i].key >> LAYER_SHIFT == RENDER_TRANSPARENT) {
+            GLCHECK(glEnable(GL_BLEND));
+            GLCHECK(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+            GLCHECK(glDepthMask(GL_FALSE));
+            blending = true;
+        }
+        if (m->program != program) {
+            use_program(ready_variant(m->program));
+            program = m->program;
+            q->stats.program_changes++;
+        }
+        if (m->vao != vao) {
+            bind_array(m->vao);
+            vao = m->vao;
+            q->stats.vao_changes++;
+        }
+        if (m->texture != 0 && m->texture != texture) {
+            bind_texture_unit(0, m->texture);
+            texture = m->texture;
+            q->stats.texture_changes++;
+        }
+
+        upload_instances(m, q->sorted, run);
+        draw_instanced(m->num_indices, run);
+        q->stats.draws++;
+        i += run;
+    }
+
+    if (blending) {
+        GLCHECK(glDisable(GL_BLEND));
+        GLCHECK(glDepthMask(GL_TRUE));
+    }
+    q->count = 0;
+}
+
+static void reserve_items(struct RenderQueue *q, size_t n)
+{
+    if (n <= q->capacity)
+        return;
+
+    size_t capacity = MAX(q->capacity * 2, n);
+    struct RenderItem *items = realloc(q->items, capacity * sizeof *items);
+    struct RenderItem *scratch = realloc(q->scratch, capacity * sizeof *scratch);
+    mat4 *instances = realloc(q->instances, capacity * sizeof (mat4));
+    mat4 *sorted = realloc(q->sorted, capacity * sizeof (mat4));
+    ASSERT(items && scratch && instances && sorted, "Out of memory");
+    q->items = items;
+    q->scratch = scratch;
+    q->instances = instances;
+    q->sorted = sorted;
+    q->capacity = capacity;
+}
+
+/* LSD radix sort on 8-bit digits, stable. Digits that are the same for
+ * every key (unused layers, a single program...) are skipped */
+static void radix_sort(struct RenderItem *items, struct RenderItem *scratch,
+        size_t n)
+{
+    static size_t counts[8][256];
+    memset(counts, 0, sizeof counts);
+    for (size_t i = 0; i < n; i++)
+        for (int d = 0; d < 8; d++)
+            counts[d][(items[i].key >> (d * 8)) & 0xff]++;
+
+    struct RenderItem *src = items, *dst = scratch;
+    for (int d = 0; d < 8; d++) {
+        if (n == 0 || counts[d][(items[0].key >> (d * 8)) & 0xff] == n)
+            continue;
+
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t c = counts[d][b];
+            counts[d][b] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[counts[d][(src[i].key >> (d * 8)) & 0xff]++] = src[i];
+
+        struct RenderItem *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != items)
+        memcpy(items, src, n * sizeof *items);
+}
+
+/* Positive floats order like their bit patterns, keep the top bits below
+ * the sign */
+static uint32_t depth_bits(float depth)
+{
+    union { float f; uint32_t u; } bits = { .f = MAX(depth, 0.0f) };
+    return (bits.u >> (31 - DEPTH_BITS)) & ((1u << DEPTH_BITS) - 1);
+}
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "ringbuffer.h"
+#include "glutils.h"
+
+/* How long one glClientWaitSync() blocks before checking again */
+static const GLuint64 WAIT_TIMEOUT_NS = 1000000;
+
+static void wait_segment(struct RingBuffer *r, unsigned segment)
+    ATTR((nonnull(1)));
+
+/* ring_init - create a RingBuffer
+ * @r: the RingBuffer to initialize
+ * @segment_size: bytes available to each frame
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call ring_free() after use
+ */
+void ring_init(struct RingBuffer *r, size_t segment_size)
+{
+    memset(r, 0, sizeof *r);
+
+    /* Every allocation may be bound as a uniform buffer range */
+    GLint ubo_alignment = 256;
+    GLCHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ubo_alignment));
+    r->alignment = MAX((size_t)ubo_alignment, 16);
+    r->segment_size = (segment_size + r->alignment - 1) & ~(r->alignment - 1);
+    r->persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+    GLCHECK(glGenBuffers(1, &r->buffer));
+    bind_buffer(GL_ARRAY_BUFFER, r->buffer);
+    if (r->persistent) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+                               | GL_MAP_COHERENT_BIT;
+        size_t size = r->segment_size * RING_SEGMENTS;
+        GLCHECK(glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags));
+        r->memory = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        ASSERT(r->memory != NULL, "Could not map the ring buffer");
+    } else {
+        /* The driver keeps older copies alive when the buffer is orphaned,
+         * so one segment of storage is enough */
+        GLCHECK(glBufferData(GL_ARRAY_BUFFER, r->segment_size, NULL,
+                    GL_STREAM_DRAW));
+        r->memory = malloc(r->segment_size);
+        ASSERT(r->memory != NULL, "Out of memory");
+    }
+}
+
+void ring_free(struct RingBuffer *r)
+{
+    for (unsigned i = 0; i < RING_SEGMENTS; i++)
+        if (r->fences[i])
+            glDeleteSync(r->fences[i]);
+    if (r->persistent) {
+        bind_buffer(GL_ARRAY_BUFFER, r->buffer);
+        GLCHECK(glUnmapBuffer(GL_ARRAY_BUFFER));
+    } else {
+        free(r->memory);
+    }
+    del_buffer(r->buffer);
+    memset(r, 0, sizeof *r);
+}
+
+/* ring_begin_frame - move on to the next frame's segment
+ *  - fences the previous frame's segment, then waits until the GPU is done
+ *    with the segment about to be reused
+ *
+ * Contracts:
+ *  - Called once per frame, before the frame's first ring_alloc()
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void ring_begin_frame(struct RingBuffer *r)
+{
+    r->stats.bytes = 0;
+    r->stats.overflows = 0;
+    r->head = r->flushed = 0;
+
+    if (!r->persistent) {
+        bind_buffer(GL_ARRAY_BUFFER, r->buffer);
+        GLCHECK(glBufferData(GL_ARRAY_BUFFER, r->segment_size, NULL,
+                    GL_STREAM_DRAW));
+        r->in_frame = true;
+        return;
+    }
+
+    if (r->in_frame)
+        r->fences[r->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->segment = (r->segment + 1) % RING_SEGMENTS;
+    wait_segment(r, r->segment);
+    r->in_frame = true;
+}
+
+/* ring_alloc - carve space for this frame's data out of the ring
+ * @r: the RingBuffer
+ * @size: bytes needed
+ * @align: alignment of the offset, a power of two, 0 for the default
+ * @out: where the data goes
+ *
+ * Returns false if the segment is full, the caller then needs another way
+ * to get its data to the GPU this frame
+ *
+ * Contracts:
+ *  - Data written through @out->ptr is only read by GL commands issued
+ *    after ring_flush()
+ */
+bool ring_alloc(struct RingBuffer *r, size_t size, size_t align,
+        struct RingAlloc *out)
+{
+    ASSERT(r->in_frame, "ring_alloc() before ring_begin_frame()");
+    align = MAX(align, r->alignment);
+    size_t start = (r->head + align - 1) & ~(align - 1);
+    if (start + size > r->segment_size) {
+        r->stats.overflows++;
+        return false;
+    }
+    r->head = start + size;
+    r->stats.bytes += size;
+
+    size_t base = r->persistent ? r->segment * r->segment_size : 0;
+    out->ptr = r->memory + base + start;
+    out->buffer = r->buffer;
+    out->offset = base + start;
+    return true;
+}
+
+/* ring_flush - make everything allocated so far visible to GL
+ *  - a no-op for persistent coherent mappings
+ */
+void ring_flush(struct RingBuffer *r)
+{
+    if (r->persistent || r->flushed == r->head)
+        return;
+    bind_buffer(GL_ARRAY_BUFFER, r->buffer);
+    GLCHECK(glBufferSubData(GL_ARRAY_BUFFER, r->flushed,
+                r->head - r->flushed, r->memory + r->flushed));
+    r->flushed = r->head;
+}
+
+/* ring_flush_range - make @size bytes at @offset visible to GL
+ *  - for data written after a ring_flush() already went past it
+ *  - a no-op for persistent coherent mappings
+ */
+void ring_flush_range(struct RingBuffer *r, GLintptr offset, size_t size)
+{
+    if (r->persistent || size == 0)
+        return;
+    ASSERT((size_t)offset + size <= r->head, "Flushing past the allocations");
+    bind_buffer(GL_ARRAY_BUFFER, r->buffer);
+    GLCHECK(glBufferSubData(GL_ARRAY_BUFFER, offset, size,
+                r->memory + offset));
+}
+
+static void wait_segment(struct RingBuffer *r, unsigned segment)
+{
+    GLsync fence = r->fences[segment];
+    if (fence == NULL)
+        return;
+
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        r->stats.waits++;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                    WAIT_TIMEOUT_NS);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        r->stats.wait_seconds += (double)(SDL_GetPerformanceCounter() - start)
+            / SDL_GetPerformanceFrequency();
+    }
+    ASSERT(status != GL_WAIT_FAILED, "glClientWaitSync() failed");
+
+    glDeleteSync(fence);
+    r->fences[segment] = NULL;
+}
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <cglm/cglm.h>
+#include "scenegraph.h"
+#include "jobs.h"
+
+/* Levels narrower than this are propagated on the calling thread */
+static const size_t PARALLEL_GRAIN = 1024;
+
+struct LevelJob {
+    struct SceneGraph *g;
+    size_t first;
+};
+
+static void reserve_nodes(struct SceneGraph *g, size_t n) ATTR((nonnull(1)));
+static void push_level(struct SceneGraph *g, size_t first) ATTR((nonnull(1)));
+static void propagate(void *arg, size_t begin, size_t end, unsigned thread)
+    ATTR((nonnull(1)));
+
+void scene_init(struct SceneGraph *g)
+{
+    memset(g, 0, sizeof *g);
+    g->sorted = true;
+}
+
+void scene_free(struct SceneGraph *g)
+{
+    free(g->parent);
+    free(g->local);
+    free(g->world);
+    free(g->node_id);
+    free(g->index);
+    free(g->levels);
+    memset(g, 0, sizeof *g);
+}
+
+/* scene_add - add a node
+ * @g: the SceneGraph
+ * @parent: id of the parent node, or SCENE_ROOT
+ * @local: transform relative to the parent
+ *
+ * Returns the id of the new node. The arrays are re-sorted by the next
+ * scene_update()
+ */
+uint32_t scene_add(struct SceneGraph *g, uint32_t parent, mat4 local)
+{
+    ASSERT(parent == SCENE_ROOT || parent < g->count, "No such parent node");
+    reserve_nodes(g, g->count + 1);
+
+    uint32_t id = g->count++;
+    g->parent[id] = parent == SCENE_ROOT ? SCENE_ROOT : g->index[parent];
+    glm_mat4_copy(local, g->local[id]);
+    glm_mat4_identity(g->world[id]);
+    g->node_id[id] = id;
+    g->index[id] = id;
+    g->sorted = false;
+    return id;
+}
+
+void scene_set_local(struct SceneGraph *g, uint32_t id, mat4 local)
+{
+    ASSERT(id < g->count, "No such node");
+    glm_mat4_copy(local, g->local[g->index[id]]);
+}
+
+/* scene_set_entity - set a node's local transform from an Entity's
+ * position, rotation and scale */
+void scene_set_entity(struct SceneGraph *g, uint32_t id,
+        const struct Entity *entity)
+{
+    ASSERT(id < g->count, "No such node");
+    entity_model_matrix(entity, g->local[g->index[id]]);
+}
+
+/* scene_world - copy out a node's world matrix as of the last update */
+void scene_world(const struct SceneGraph *g, uint32_t id, mat4 out)
+{
+    ASSERT(id < g->count, "No such node");
+    glm_mat4_copy(g->world[g->index[id]], out);
+}
+
+/* scene_sort - reorder the nodes breadth-first
+ *  - siblings stay together, in the order of their parents
+ *  - world matrices move with their nodes
+ */
+void scene_sort(struct SceneGraph *g)
+{
+    size_t n = g->count;
+    g->nlevels = 0;
+    if (n == 0) {
+        g->sorted = true;
+        return;
+    }
+
+    /* Children of each node, compressed: child[first[i]..first[i + 1]) */
+    uint32_t *first = calloc(n + 1, sizeof (uint32_t));
+    uint32_t *child = malloc(n * sizeof (uint32_t));
+    uint32_t *order = malloc(n * sizeof (uint32_t));
+    ASSERT(first != NULL && child != NULL && order != NULL, "Out of memory");
+
+    for (size_t i = 0; i < n; i++)
+        if (g->parent[i] != SCENE_ROOT)
+            first[g->parent[i] + 1]++;
+    for (size_t i = 0; i < n; i++)
+        first[i + 1] += first[i];
+    size_t nroots = n - first[n];
+    for (size_t i = 0, r = 0; i < n; i++) {
+        if (g->parent[i] == SCENE_ROOT)
+            order[r++] = i;
+        else
+            child[first[g->parent[i]]++] = i;
+    }
+    /* The fill advanced each start to the next node's, shift them back */
+    memmove(first + 1, first, n * sizeof (uint32_t));
+    first[0] = 0;
+
+    /* order doubles as the queue, one level after the other */
+    size_t begin = 0, end = nroots;
+    while (begin < end) {
+        push_level(g, begin);
+        size_t tail = end;
+        for (size_t k = begin; k < end; k++) {
+            uint32_t i = order[k];
+            for (uint32_t c = first[i]; c < first[i + 1]; c++)
+                order[tail++] = child[c];
+        }
+        begin = end;
+        end = tail;
+    }
+    ASSERT(end == n, "Scene node unreachable from the roots");
+    push_level(g, n);
+    g->nlevels--;
+
+    /* child is free now, reuse it for the new index of every old index */
+    uint32_t *remap = child;
+    for (size_t k = 0; k < n; k++)
+        remap[order[k]] = k;
+
+    uint32_t *parent = malloc(g->capacity * sizeof (uint32_t));
+    uint32_t *node_id = malloc(g->capacity * sizeof (uint32_t));
+    mat4 *local = malloc(g->capacity * sizeof (mat4));
+    mat4 *world = malloc(g->capacity * sizeof (mat4));
+    ASSERT(parent && node_id && local && world, "Out of memory");
+    for (size_t k = 0; k < n; k++) {
+        uint32_t i = order[k];
+        parent[k] = g->parent[i] == SCENE_ROOT ? SCENE_ROOT
+                                               : remap[g->parent[i]];
+        node_id[k] = g->node_id[i];
+        glm_mat4_copy(g->local[i], local[k]);
+        glm_mat4_copy(g->world[i], world[k]);
+        g->index[node_id[k]] = k;
+    }
+    free(g->parent);
+    free(g->node_id);
+    free(g->local);
+    free(g->world);
+    g->parent = parent;
+    g->node_id = node_id;
+    g->local = local;
+    g->world = world;
+
+    free(order);
+    free(child);
+    free(first);
+    g->sorted = true;
+}
+
+/* scene_update - compute every world matrix from the local ones
+ *  - sorts the nodes first if any were added since the last sort
+ *
+ * Contracts:
+ *  - Called from the thread that owns the job pool, if any
+ */
+void scene_update(struct SceneGraph *g)
+{
+    if (!g->sorted)
+        scene_sort(g);
+    if (g->count == 0)
+        return;
+
+    for (size_t i = 0; i < g->levels[1]; i++)
+        glm_mat4_copy(g->local[i], g->world[i]);
+
+    for (size_t l = 1; l < g->nlevels; l++) {
+        struct LevelJob job = { g, g->levels[l] };
+        size_t n = g->levels[l + 1] - g->levels[l];
+        if (n < PARALLEL_GRAIN * 2)
+            propagate(&job, 0, n, 0);
+        else
+            jobs_parallel_for(propagate, &job, n, PARALLEL_GRAIN);
+    }
+}
+
+static void reserve_nodes(struct SceneGraph *g, size_t n)
+{
+    if (n <= g->capacity)
+        return;
+
+    size_t capacity = MAX(g->capacity * 2, MAX(n, 64));
+    uint32_t *parent = realloc(g->parent, capacity * sizeof (uint32_t));
+    uint32_t *node_id = realloc(g->node_id, capacity * sizeof (uint32_t));
+    uint32_t *index = realloc(g->index, capacity * sizeof (uint32_t));
+    mat4 *local = realloc(g->local, capacity * sizeof (mat4));
+    mat4 *world = realloc(g->world, capacity * sizeof (mat4));
+    ASSERT(parent && node_id && index && local && world, "Out of memory");
+    g->parent = parent;
+    g->node_id = node_id;
+    g->index = index;
+    g->local = local;
+    g->world = world;
+    g->capacity = capacity;
+}
+
+static void push_level(struct SceneGraph *g, size_t first)
+{
+    if (g->nlevels == g->levels_capacity) {
+        size_t capacity = MAX(g->levels_capacity * 2, 16);
+        size_t *levels = realloc(g->levels, capacity * sizeof (size_t));
+        ASSERT(levels != NULL, "Out of memory");
+        g->levels = levels;
+        g->levels_capacity = capacity;
+    }
+    g->levels[g->nlevels++] = first;
+}
+
+/* The parents of a level are all in earlier levels, finished already */
+static void propagate(void *arg, size_t begin, size_t end, unsigned thread)
+{
+    (void)thread;
+    const struct LevelJob *job = arg;
+    struct SceneGraph *g = job->g;
+    for (size_t i = job->first + begin; i < job->first + end; i++)
+        glm_mat4_mul(g->world[g->parent[i]], g->local[i], g->world[i]);
+}
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <kvec.h>
+#include <GL/glew.h>
+#include "shaderpp.h"
+#include "glutils.h"
+#include "progcache.h"
+#include "frame.h"
+
+/* Deeper nesting than this is taken to be a mistake */
+#define MAX_INCLUDE_DEPTH 16
+
+typedef kvec_t(char) Text;
+
+struct Preprocessor {
+    Text out;
+    kvec_t(char *) files; /* paths included so far, index is the string number */
+};
+
+struct Variant {
+    char *vpath, *fpath;
+    unsigned features;
+    GLuint program;
+    bool pending;       /* still compiling, see request_shader_variant() */
+};
+
+/* Globals */
+static kvec_t(struct Variant) g_variants;
+static unsigned g_pending;           /* variants still compiling */
+static bool g_async;
+static GLuint g_placeholders[2];     /* without and with SHADER_INSTANCED */
+
+static struct Variant *find_variant(const char *vpath, const char *fpath,
+        unsigned features) ATTR((nonnull(1, 2)));
+static struct Variant *start_variant(const char *vpath, const char *fpath,
+        unsigned features) ATTR((nonnull(1, 2)));
+static bool finish_variant(struct Variant *v, bool wait) ATTR((nonnull(1)));
+static GLuint placeholder(unsigned features);
+static void expand(struct Preprocessor *pp, const char *path, unsigned depth)
+    ATTR((nonnull(1, 2)));
+static bool include_name(const char *line, const char *end, const char **name,
+        size_t *length) ATTR((nonnull(1, 2, 3, 4)));
+static bool is_directive(const char *line, const char *end, const char *name)
+    ATTR((nonnull(1, 2, 3)));
+static void append(Text *text, const char *s, size_t n) ATTR((nonnull(1, 2)));
+static void append_line(Text *text, unsigned line, unsigned file)
+    ATTR((nonnull(1)));
+
+/* preprocess_shader - load a shader with its #includes spliced in
+ * @path: the shader
+ *
+ * Contracts:
+ *  - @path and every file it includes exist
+ * Responsibilities:
+ *  - Call free() on the returned string
+ */
+char *preprocess_shader(const char *path)
+{
+    struct Preprocessor pp;
+    kv_init(pp.out);
+    kv_init(pp.files);
+    expand(&pp, path, 0);
+    kv_push(char, pp.out, '\0');
+
+    for (size_t i = 0; i < kv_size(pp.files); i++)
+        free(kv_A(pp.files, i));
+    kv_destroy(pp.files);
+    return pp.out.a;
+}
+
+/* shader_defines - the #define lines for a set of ShaderFeatures
+ * @features: ShaderFeature bits
+ * @out: receives the lines, NUL terminated and cut short to fit @size
+ * @size: bytes at @out
+ *
+ * Returns the length the lines need, not counting the NUL, as snprintf()
+ */
+size_t shader_defines(unsigned features, char *out, size_t size)
+{
+    static const char *const NAMES[SHADER_FEATURE_BITS] = {
+        "TEXTURED", "LIT", "INSTANCED",
+    };
+    size_t length = 0;
+    if (size > 0)
+        out[0] = '\0';
+    for (unsigned bit = 0; bit < SHADER_FEATURE_BITS; bit++) {
+        if (!(features & (1u << bit)))
+            continue;
+        int n = snprintf(out + MIN(length, size), size - MIN(length, size),
+                "#define %s\n", NAMES[bit]);
+        length += n;
+    }
+    return length;
+}
+
+/* shader_variant - the program for two shaders with a set of features
+ * @vpath, @fpath: the vertex and fragment shader
+ * @features: ShaderFeature bits #defined in both
+ *
+ * Builds the program the first time a combination is asked for, through
+ * the program cache, and points its Frame block at the shared buffer, see
+ * bind_frame_block(). Later calls return the same program, waiting for it
+ * if request_shader_variant() left it compiling.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ * Responsibilities:
+ *  - The program belongs to the variant cache, don't delete it, call
+ *    free_shader_variants() once the programs are no longer used
+ */
+GLuint shader_variant(const char *vpath, const char *fpath, unsigned features)
+{
+    struct Variant *v = find_variant(vpath, fpath, features);
+    if (v == NULL)
+        v = start_variant(vpath, fpath, features);
+    if (v->pending)
+        finish_variant(v, true);
+    return v->program;
+}
+
+/* request_shader_variant - shader_variant() without waiting for a compile
+ *  - the program may not be linked yet, draw with ready_variant() of it
+ *  - waits as shader_variant() unless shader_variants_async() enabled this
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ * Responsibilities:
+ *  - As shader_variant()
+ */
+GLuint request_shader_variant(const char *vpath, const char *fpath,
+        unsigned features)
+{
+    if (!g_async)
+        return shader_variant(vpath, fpath, features);
+    struct Variant *v = find_variant(vpath, fpath, features);
+    if (v == NULL)
+        v = start_variant(vpath, fpath, features);
+    return v->program;
+}
+
+/* shader_variants_async - let request_shader_variant() return before the
+ * compile is done
+ *  - asks the driver for as many compiler threads as it likes where
+ *    KHR_parallel_shader_compile is there, compiles run one at a time
+ *    without it, spread over poll_shader_variants() calls
+ *  - builds the placeholder that stands in for unfinished programs
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void shader_variants_async(bool enable)
+{
+    g_async = enable;
+    if (!enable)
+        return;
+    if (GLEW_KHR_parallel_shader_compile)
+        GLCHECK(glMaxShaderCompilerThreadsKHR(0xFFFFFFFF));
+    else if (GLEW_ARB_parallel_shader_compile)
+        GLCHECK(glMaxShaderCompilerThreadsARB(0xFFFFFFFF));
+    placeholder(SHADER_INSTANCED);
+}
+
+/* poll_shader_variants - take in the compiles that are done
+ *  - never waits with KHR_parallel_shader_compile, without it there's no
+ *    telling what is done, the oldest compile is waited for
+ *  - returns the number still compiling
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+unsigned poll_shader_variants(void)
+{
+    bool parallel = GLEW_KHR_parallel_shader_compile
+        || GLEW_ARB_parallel_shader_compile;
+    for (size_t i = 0; i < kv_size(g_variants) && g_pending > 0; i++) {
+        struct Variant *v = &kv_A(g_variants, i);
+        if (!v->pending)
+            continue;
+        finish_variant(v, !parallel);
+        if (!parallel)
+            break;
+    }
+    return g_pending;
+}
+
+/* finish_shader_variants - wait for every compile still running */
+void finish_shader_variants(void)
+{
+    for (size_t i = 0; i < kv_size(g_variants) && g_pending > 0; i++) {
+        struct Variant *v = &kv_A(g_variants, i);
+        if (v->pending)
+            finish_variant(v, true);
+    }
+}
+
+/* ready_variant - @program if it can be drawn with, a placeholder if not
+ * @program: from request_shader_variant(), or any other program
+ *
+ * The placeholder draws the same vertices flat grey, with the Frame's
+ * camera and the variant's SHADER_INSTANCED, until poll_shader_variants()
+ * takes the compile in. Other programs are returned as they are.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+GLuint ready_variant(GLuint program)
+{
+    if (g_pending == 0)
+        return program;
+    for (size_t i = 0; i < kv_size(g_variants); i++) {
+        const struct Variant *v = &kv_A(g_variants, i);
+        if (v->program == program)
+            return v->pending ? placeholder(v->features) : program;
+    }
+    return program;
+}
+
+/* free_shader_variants - delete every program shader_variant() built
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void free_shader_variants(void)
+{
+    finish_shader_variants();
+    for (size_t i = 0; i < kv_size(g_variants); i++) {
+        struct Variant *v = &kv_A(g_variants, i);
+        del_program(v->program);
+        free(v->vpath);
+        free(v->fpath);
+    }
+    kv_destroy(g_variants);
+    kv_init(g_variants);
+    memset(g_placeholders, 0, sizeof g_placeholders);
+}
+
+static struct Variant *find_variant(const char *vpath, const char *fpath,
+        unsigned features)
+{
+    ASSERT(features < SHADER_VARIANTS, "Unknown shader feature");
+    for (size_t i = 0; i < kv_size(g_variants); i++) {
+        struct Variant *v = &kv_A(g_variants, i);
+        if (v->features == features && strcmp(v->vpath, vpath) == 0
+                && strcmp(v->fpath, fpath) == 0)
+            return v;
+    }
+    return NULL;
+}
+
+/* start_variant - add a variant, its program loaded from the program cache
+ * or left compiling */
+static struct Variant *start_variant(const char *vpath, const char *fpath,
+        unsigned features)
+{
+    char defines[128];
+    size_t length = shader_defines(features, defines, sizeof defines);
+    ASSERT(length < sizeof defines, "Shader defines don't fit");
+    char *vertex = preprocess_shader(vpath);
+    char *fragment = preprocess_shader(fpath);
+    struct Variant v = {
+        .vpath = strdup(vpath),
+        .fpath = strdup(fpath),
+        .features = features,
+        .program = progcache_start(vertex, fragment, defines),
+        .pending = true,
+    };
+    ASSERT(v.vpath != NULL && v.fpath != NULL, "Out of memory");
+    free(vertex);
+    free(fragment);
+    kv_push(struct Variant, g_variants, v);
+    g_pending++;
+
+    /* Taken in right away if it came from a binary */
+    struct Variant *added = &kv_A(g_variants, kv_size(g_variants) - 1);
+    finish_variant(added, false);
+    return added;
+}
+
+/* finish_variant - take in @v's compile if done, or once done if @wait */
+static bool finish_variant(struct Variant *v, bool wait)
+{
+    if (!progcache_finish(v->program, wait))
+        return false;
+    bind_frame_block(v->program);
+    v->pending = false;
+    g_pending--;
+    return true;
+}
+
+/* placeholder - the stand-in for unfinished variants with @features'
+ * SHADER_INSTANCED, built on first use */
+static GLuint placeholder(unsigned features)
+{
+    unsigned instanced = (features & SHADER_INSTANCED) != 0;
+    if (g_placeholders[instanced] == 0)
+        g_placeholders[instanced] = shader_variant(
+                RESOURCE_DIR "placeholder.vertex.glsl",
+                RESOURCE_DIR "placeholder.fragment.glsl",
+                features & SHADER_INSTANCED);
+    return g_placeholders[instanced];
+}
+
+/* expand - append @path to @pp->out with its includes expanded
+ *  - files already included are skipped, which also stops cycles
+ */
+static void expand(struct Preprocessor *pp, const char *path, unsigned depth)
+{
+    ASSERT(depth < MAX_INCLUDE_DEPTH, "Shader includes nest too deep");
+    for (size_t i = 0; i < kv_size(pp->files); i++)
+        if (strcmp(kv_A(pp->files, i), path) == 0)
+            return;
+    unsigned file = kv_size(pp->files);
+    char *copy = strdup(path);
+    ASSERT(copy != NULL, "Out of memory");
+    kv_push(char *, pp->files, copy);
+    if (file > 0)
+        append_line(&pp->out, 1, file);
+
+    /* Includes are relative to the including file */
+    const char *slash = strrchr(path, '/');
+    size_t dir = slash ? (size_t)(slash + 1 - path) : 0;
+
+    char *source = load_file(path);
+    unsigned line = 1;
+    for (const char *p = source; *p != '\0'; line++) {
+        const char *end = strchr(p, '\n');
+        if (end == NULL)
+            end = p + strlen(p);
+        const char *next = *end != '\0' ? end + 1 : end;
+
+        const char *name;
+        size_t length;
+        if (include_name(p, end, &name, &length)) {
+            char *included = malloc(dir + length + 1);
+            ASSERT(included != NULL, "Out of memory");
+            memcpy(included, path, dir);
+            memcpy(included + dir, name, length);
+            included[dir + length] = '\0';
+            expand(pp, included, depth + 1);
+            free(included);
+            append_line(&pp->out, line + 1, file);
+        } else {
+            append(&pp->out, p, next - p);
+            if (*end == '\0')
+                append(&pp->out, "\n", 1);
+            /* Defines are spliced in after #version, the line after keeps
+             * counting from the file */
+            if (file == 0 && is_directive(p, end, "version"))
+                append_line(&pp->out, line + 1, file);
+        }
+        p = next;
+    }
+    free(source);
+}
+
+/* include_name - the file named by an #include "file" line */
+static bool include_name(const char *line, const char *end, const char **name,
+        size_t *length)
+{
+    if (!is_directive(line, end, "include"))
+        return false;
+    const char *open = memchr(line, '"', end - line);
+    const char *close = open ? memchr(open + 1, '"', end - open - 1) : NULL;
+    if (close == NULL || close == open + 1)
+        FATAL("Bad #include: %.*s", (int)(end - line), line);
+    *name = open + 1;
+    *length = close - open - 1;
+    return true;
+}
+
+/* is_directive - whether @line is the preprocessor directive @name */
+static bool is_directive(const char *line, const char *end, const char *name)
+{
+    while (line < end && isspace((unsigned char)*line))
+        line++;
+    if (line == end || *line++ != '#')
+        return false;
+    while (line < end && isspace((unsigned char)*line))
+        line++;
+    size_t n = strlen(name);
+    return (size_t)(end - line) >= n && strncmp(line, name, n) == 0
+        && (line + n == end || isspace((unsigned char)line[n]));
+}
+
+static void append(Text *text, const char *s, size_t n)
+{
+    if (kv_size(*text) + n > kv_max(*text))
+        kv_resize(char, *text, MAX(kv_max(*text) * 2, kv_size(*text) + n));
+    memcpy(text->a + kv_size(*text), s, n);
+    kv_size(*text) += n;
+}
+
+/* append_line - a #line directive, the next line is @line of @file */
+static void append_line(Text *text, unsigned line, unsigned file)
+{
+    char directive[32];
+    int n = snprintf(directive, sizeof directive, "#line %u %u\n", line, file);
+    append(text, directive, n);
+}
@@ -0,0 +1,354 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "shadows.h"
+#include "glutils.h"
+
+/* Sphere radii are rounded up to this fraction of a unit, so they don't
+ * flicker with float noise as the camera turns */
+static const float RADIUS_STEP = 1.0f / 16.0f;
+/* Depth bias of the shadow pass, constant and per unit of slope */
+static const GLfloat OFFSET_FACTOR = 2.0f, OFFSET_UNITS = 4.0f;
+
+/* Globals */
+static mat4 *g_instances = NULL; /* every Entity's model matrix */
+static mat4 *g_casters = NULL;   /* those of one cascade */
+static uint32_t *g_visible = NULL;
+static size_t g_capacity = 0;
+static struct SphereBatch g_spheres;
+
+static void fit_cascade(const struct ShadowMaps *s, mat4 inv_view,
+        const float *sun, float d0, float d1, float sx, float sy,
+        struct ShadowCascade *out) ATTR((nonnull(1, 2, 3, 8)));
+static void reserve_scratch(size_t n);
+static void draw_cascades(struct ShadowMaps *s, const struct Model *m,
+        const struct TransformBatch *b, size_t n) ATTR((nonnull(1, 2)));
+static void gather_casters(const struct Model *m,
+        const struct TransformBatch *b, size_t n) ATTR((nonnull(1, 2)));
+
+/* shadows_init - create the shadow map array and the depth-only program
+ * @s: the ShadowMaps
+ * @size: texels per side of each cascade
+ * @range: view distance beyond which nothing is shadowed
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ * Responsibilities:
+ *  - Call shadows_free() after use
+ */
+void shadows_init(struct ShadowMaps *s, GLsizei size, float range)
+{
+    memset(s, 0, sizeof *s);
+    s->size = size;
+    s->range = range;
+    s->lambda = 0.75f;
+
+    GLCHECK(glGenTextures(1, &s->depth));
+    GLCHECK(glBindTexture(GL_TEXTURE_2D_ARRAY, s->depth));
+    GLCHECK(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+                size, size, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+                NULL));
+    /* Linear filtering of a compared lookup gives 2x2 PCF for free */
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                GL_LINEAR));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER,
+                GL_LINEAR));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,
+                GL_CLAMP_TO_EDGE));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,
+                GL_CLAMP_TO_EDGE));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+                GL_COMPARE_REF_TO_TEXTURE));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC,
+                GL_LEQUAL));
+    GLCHECK(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+    GLCHECK(glGenFramebuffers(SHADOW_CASCADES, s->fbo));
+    for (unsigned i = 0; i < SHADOW_CASCADES; i++) {
+        GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, s->fbo[i]));
+        GLCHECK(glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                    s->depth, 0, i));
+        GLCHECK(glDrawBuffer(GL_NONE));
+        GLCHECK(glReadBuffer(GL_NONE));
+        ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER)
+                == GL_FRAMEBUFFER_COMPLETE, "Shadow framebuffer is incomplete");
+    }
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+    s->program = load_program(RESOURCE_DIR "shadow.vertex.glsl",
+                              RESOURCE_DIR "shadow.fragment.glsl");
+    s->light_view_projection = glGetUniformLocation(s->program,
+            "light_view_projection");
+}
+
+void shadows_free(struct ShadowMaps *s)
+{
+    del_program(s->program);
+    GLCHECK(glDeleteFramebuffers(SHADOW_CASCADES, s->fbo));
+    del_texture(s->depth);
+    memset(s, 0, sizeof *s);
+}
+
+/* shadows_fit - place the cascades around the camera of @frame
+ * @s: the ShadowMaps
+ * @frame: the frame about to be uploaded, its sun_direction is the light's,
+ *         the cascades are written to its shadow fields
+ *
+ * Call every frame the camera or the sun moves, before upload_frame()
+ */
+void shadows_fit(struct ShadowMaps *s, struct FrameUniforms *frame)
+{
+    mat4 inv_view;
+    glm_mat4_inv(frame->view, inv_view);
+    float (*p)[4] = frame->projection;
+    float near = p[3][2] / (p[2][2] - 1.0f);
+    float far = MIN(s->range, p[3][2] / (p[2][2] + 1.0f));
+    /* View space half extents of the frustum per unit of depth */
+    float sx = 1.0f / p[0][0], sy = 1.0f / p[1][1];
+
+    vec3 sun;
+    glm_vec_copy(frame->sun_direction, sun);
+    glm_vec_normalize(sun);
+
+    float d0 = near;
+    for (unsigned i = 0; i < SHADOW_CASCADES; i++) {
+        float u = (float)(i + 1) / SHADOW_CASCADES;
+        float log_split = near * powf(far / near, u);
+        float uniform_split = near + (far - near) * u;
+        float d1 = s->lambda * log_split + (1.0f - s->lambda) * uniform_split;
+
+        struct ShadowCascade *c = &s->cascades[i];
+        fit_cascade(s, inv_view, sun, d0, d1, sx, sy, c);
+        glm_mat4_copy(c->view_projection, frame->shadow_matrices[i]);
+        frame->shadow_splits[i] = d1;
+        d0 = d1;
+    }
+}
+
+/* shadows_begin - clear the cascades for this frame's casters
+ *
+ * Contracts:
+ *  - After shadows_fit() and upload_frame()
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void shadows_begin(struct ShadowMaps *s)
+{
+    GLCHECK(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &s->target));
+    GLCHECK(glGetIntegerv(GL_VIEWPORT, s->viewport));
+    GLCHECK(glViewport(0, 0, s->size, s->size));
+    const GLfloat one = 1.0f;
+    for (unsigned i = 0; i < SHADOW_CASCADES; i++) {
+        GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, s->fbo[i]));
+        GLCHECK(glClearBufferfv(GL_DEPTH, 0, &one));
+    }
+    GLCHECK(glEnable(GL_POLYGON_OFFSET_FILL));
+    GLCHECK(glPolygonOffset(OFFSET_FACTOR, OFFSET_UNITS));
+}
+
+/* shadows_render - draw Entities into every cascade they may shadow
+ * @s: the ShadowMaps
+ * @m: the Model the Entities use
+ * @entity: pointer to the first Entity
+ * @n: number of Entities
+ *
+ * Model matrices and bounds are computed once, then culled against each
+ * cascade and drawn with one instanced call per cascade.
+ *
+ * Contracts:
+ *  - Between shadows_begin() and shadows_end()
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void shadows_render(struct ShadowMaps *s, const struct Model *m,
+        const struct Entity *entity, size_t n)
+{
+    if (n == 0)
+        return;
+    reserve_scratch(n);
+    for (size_t i = 0; i < n; i++) {
+        entity_model_matrix(&entity[i], g_instances[i]);
+        vec3 center;
+        glm_mat4_mulv3(g_instances[i], (float *)m->bounds, 1.0f, center);
+        g_spheres.x[i] = center[0];
+        g_spheres.y[i] = center[1];
+        g_spheres.z[i] = center[2];
+        g_spheres.r[i] = m->bounds[3] * entity[i].scale;
+    }
+    g_spheres.count = n;
+    draw_cascades(s, m, NULL, n);
+}
+
+/* shadows_render_transforms - shadows_render() for a TransformBatch
+ * @s: the ShadowMaps
+ * @m: the Model the transforms use
+ * @b: one transform per instance
+ *
+ * Casters are culled with a sphere around each transform's origin, as
+ * render_transforms() does. A cascade every transform falls in is drawn
+ * straight from the batch's resident instance buffer, the cached matrices
+ * of other cascades' casters are copied into the frame ring.
+ *
+ * Contracts:
+ *  - After transform_sync() of @b this frame
+ *  - Between shadows_begin() and shadows_end()
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void shadows_render_transforms(struct ShadowMaps *s, const struct Model *m,
+        const struct TransformBatch *b)
+{
+    size_t n = b->count;
+    if (n == 0)
+        return;
+    ASSERT(b->ndirty == 0, "Transforms are not synced");
+    reserve_scratch(n);
+    float reach = glm_vec_norm((float *)m->bounds) + m->bounds[3];
+    for (size_t i = 0; i < n; i++) {
+        g_spheres.x[i] = b->x[i];
+        g_spheres.y[i] = b->y[i];
+        g_spheres.z[i] = b->z[i];
+        g_spheres.r[i] = b->scale[i] * reach;
+    }
+    g_spheres.count = n;
+    draw_cascades(s, m, b, n);
+}
+
+/* shadows_end - go back to the framebuffer bound at shadows_begin() and
+ * bind the shadow map at FRAME_SHADOW_UNIT
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions
+ */
+void shadows_end(struct ShadowMaps *s)
+{
+    GLCHECK(glDisable(GL_POLYGON_OFFSET_FILL));
+    GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, s->target));
+    GLCHECK(glViewport(s->viewport[0], s->viewport[1], s->viewport[2],
+                s->viewport[3]));
+    active_texture(FRAME_SHADOW_UNIT);
+    GLCHECK(glBindTexture(GL_TEXTURE_2D_ARRAY, s->depth));
+}
+
+void reset_shadow_stats(struct ShadowMaps *s)
+{
+    memset(&s->stats, 0, sizeof s->stats);
+}
+
+/* fit_cascade - light view of the frustum slice between view distances @d0
+ * and @d1
+ *
+ * The slice is bounded by its smallest sphere, which only depends on the
+ * distances and the projection, not the camera's orientation. The light
+ * looks at its center from far enough back to catch casters up to
+ * @s->range beyond it, and the projection is moved by less than a texel so
+ * the world origin lands on a texel corner.
+ */
+static void fit_cascade(const struct ShadowMaps *s, mat4 inv_view,
+        const float *sun, float d0, float d1, float sx, float sy,
+        struct ShadowCascade *out)
+{
+    /* Squared half diagonal of the slice per unit of depth */
+    float k = sx * sx + sy * sy;
+    /* Center on the view axis equidistant from the near and far corners */
+    float z = 0.5f * (d1 * d1 * (1.0f + k) - d0 * d0 * (1.0f + k))
+            / (d1 - d0);
+    z = MIN(z, d1);
+    float r = sqrtf((d1 - z) * (d1 - z) + d1 * d1 * k);
+    r = ceilf(r / RADIUS_STEP) * RADIUS_STEP;
+
+    vec4 center;
+    glm_mat4_mulv(inv_view, (vec4){ 0.0f, 0.0f, -z, 1.0f }, center);
+
+    vec3 eye, up = { 0.0f, 1.0f, 0.0f };
+    if (fabsf(sun[1]) > 0.99f)
+        glm_vec_copy((vec3){ 0.0f, 0.0f, 1.0f }, up);
+    glm_vec_scale((float *)sun, -(r + s->range), eye);
+    glm_vec_add(eye, center, eye);
+
+    mat4 view, projection;
+    glm_lookat(eye, center, up, view);
+    glm_ortho(-r, r, -r, r, 0.0f, 2.0f * r + s->range, projection);
+
+    /* Snap the origin to a texel */
+    vec4 origin;
+    mat4 vp;
+    glm_mat4_mul(projection, view, vp);
+    glm_mat4_mulv(vp, (vec4){ 0.0f, 0.0f, 0.0f, 1.0f }, origin);
+    float half = s->size * 0.5f;
+    projection[3][0] += (roundf(origin[0] * half) - origin[0] * half) / half;
+    projection[3][1] += (roundf(origin[1] * half) - origin[1] * half) / half;
+
+    glm_mat4_mul(projection, view, out->view_projection);
+    frustum_from_matrix(out->view_projection, &out->frustum);
+    out->split = d1;
+}
+
+/* draw_cascades - cull g_spheres against each cascade and draw the casters
+ *  - the matrices come from g_instances, or from @b's cache
+ */
+static void draw_cascades(struct ShadowMaps *s, const struct Model *m,
+        const struct TransformBatch *b, size_t n)
+{
+    use_program(s->program);
+    bind_array(m->vao);
+    for (unsigned c = 0; c < SHADOW_CASCADES; c++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        size_t ncasters = cull_spheres(&s->cascades[c].frustum, &g_spheres,
+                g_visible);
+        if (b == NULL)
+            for (size_t i = 0; i < ncasters; i++)
+                glm_mat4_copy(g_instances[g_visible[i]], g_casters[i]);
+        s->stats.cull_seconds += (double)(SDL_GetPerformanceCounter() - start)
+            / SDL_GetPerformanceFrequency();
+        s->stats.casters[c] += ncasters;
+        s->stats.culled += n - ncasters;
+        if (ncasters == 0)
+            continue;
+
+        GLCHECK(glBindFramebuffer(GL_FRAMEBUFFER, s->fbo[c]));
+        set_uniform_mat4(s->light_view_projection,
+                s->cascades[c].view_projection[0]);
+        if (b == NULL)
+            upload_instances(m, g_casters, ncasters);
+        else if (ncasters == n)
+            point_instances(b->instances, 0);
+        else
+            gather_casters(m, b, ncasters);
+        draw_instanced(m->num_indices, ncasters);
+        s->stats.draw_calls++;
+    }
+}
+
+/* gather_casters - instances of the g_visible transforms of @b, copied
+ * into the frame ring, or uploaded if it is full */
+static void gather_casters(const struct Model *m,
+        const struct TransformBatch *b, size_t n)
+{
+    struct RingBuffer *ring = frame_ring();
+    struct RingAlloc alloc;
+    if (ring_alloc(ring, n * sizeof (mat4), sizeof (mat4), &alloc)) {
+        transform_gather(b, g_visible, n, alloc.ptr);
+        ring_flush(ring);
+        point_instances(alloc.buffer, alloc.offset);
+    } else {
+        transform_gather(b, g_visible, n, g_casters);
+        upload_instances(m, g_casters, n);
+    }
+}
+
+static void reserve_scratch(size_t n)
+{
+    sphere_batch_reserve(&g_spheres, n);
+    if (n <= g_capacity)
+        return;
+    size_t capacity = MAX(g_capacity * 2, n);
+    mat4 *instances = realloc(g_instances, capacity * sizeof (mat4));
+    mat4 *casters = realloc(g_casters, capacity * sizeof (mat4));
+    uint32_t *visible = realloc(g_visible, capacity * sizeof (uint32_t));
+    ASSERT(instances && casters && visible, "Out of memory");
+    g_instances = instances;
+    g_casters = casters;
+    g_visible = visible;
+    g_capacity = capacity;
+}
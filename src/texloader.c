@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+#include <SDL_image.h>
+#include <GL/glew.h>
+#include "texloader.h"
+#include "glutils.h"
+#include "jobs.h"
+#include "utils.h"
+
+#if defined(SIMD_DISPATCH)
+# include <immintrin.h>
+#endif
+
+#define ERROR_LEN 256
+
+struct DecodeTask {
+    const char *path;
+    unsigned flags;
+    struct JobGroup group;
+    /* Filled in by the worker */
+    unsigned char *pixels; /* tightly packed RGBA8 */
+    int w, h;
+    char error[ERROR_LEN];
+};
+
+/* Globals */
+static float         g_srgb_to_linear[256];
+static unsigned char g_linear_to_srgb[4096];
+static bool          g_tables_ready = false;
+
+static void init_srgb_tables(void);
+static void decode_job(void *arg, size_t begin, size_t end, unsigned thread);
+static void decode_image(struct DecodeTask *task) ATTR((nonnull(1)));
+static GLuint upload_image(const struct DecodeTask *task) ATTR((nonnull(1)));
+
+/* load_textures - load many textures, decoding them in parallel
+ * @paths: the image files
+ * @n: number of paths
+ * @flags: bitwise OR of enum TextureFlags, applied to every image
+ * @out: receives @n texture names, in the same order as @paths
+ *
+ * Contracts:
+ *  - @paths has @n valid image files and @out has room for @n textures
+ *  - Not threadsafe - calls OpenGL functions
+ *  - Decoding runs on the job pool, uploading runs on the calling thread
+ *    in order, overlapping with the remaining decodes
+ * Responsibilities:
+ *  - Call del_texture() on every texture in @out after use
+ */
+void load_textures(const char *const *paths, size_t n, unsigned flags,
+        GLuint *out)
+{
+    if (n == 0)
+        return;
+
+    struct DecodeTask *tasks = calloc(n, sizeof (struct DecodeTask));
+    ASSERT(tasks != NULL, "Out of memory");
+
+    init_srgb_tables();
+    for (size_t i = 0; i < n; i++) {
+        tasks[i].path  = paths[i];
+        tasks[i].flags = flags;
+        jobs_submit(&tasks[i].group, decode_job, &tasks[i], 1, 1);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        jobs_wait(&tasks[i].group);
+        if (tasks[i].pixels == NULL)
+            FATAL("Could not load %s: %s", tasks[i].path, tasks[i].error);
+        out[i] = upload_image(&tasks[i]);
+        free(tasks[i].pixels);
+    }
+
+    free(tasks);
+}
+
+/* expand_rgb_to_rgba - convert packed RGB8 pixels to RGBA8 with alpha 255
+ * @src: 3 * @npixels bytes
+ * @dst: 4 * @npixels bytes, must not overlap @src
+ */
+#if defined(SIMD_DISPATCH)
+TARGET("ssse3")
+static size_t expand_rgb_to_rgba_ssse3(const unsigned char *src,
+        unsigned char *dst, size_t npixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    size_t i = 0;
+
+    /* Each 16 byte load covers 4 pixels plus 4 bytes of the next ones, so
+     * stop while a full load still fits inside @src */
+    for (; i + 6 <= npixels; i += 4) {
+        __m128i rgb = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+        _mm_storeu_si128((__m128i *)(dst + i * 4), rgba);
+    }
+    return i;
+}
+#endif /* SIMD_DISPATCH */
+
+void expand_rgb_to_rgba(const unsigned char *src, unsigned char *dst,
+        size_t npixels)
+{
+    size_t i = 0;
+#if defined(SIMD_DISPATCH)
+    if (CPU_HAS("ssse3"))
+        i = expand_rgb_to_rgba_ssse3(src, dst, npixels);
+#endif
+    for (; i < npixels; i++) {
+        dst[i*4]   = src[i*3];
+        dst[i*4+1] = src[i*3+1];
+        dst[i*4+2] = src[i*3+2];
+        dst[i*4+3] = 255;
+    }
+}
+
+/* premultiply_rgba - multiply the color channels by alpha
+ * @pixels: 4 * @npixels bytes of RGBA8
+ * @srgb: whether the color channels are sRGB encoded, in which case the
+ *        multiply is done in linear space
+ *
+ * Contracts:
+ *  - The first call is not concurrent with any other call
+ */
+void premultiply_rgba(unsigned char *pixels, size_t npixels, bool srgb)
+{
+    init_srgb_tables();
+
+    for (size_t i = 0; i < npixels; i++) {
+        unsigned char *p = pixels + i * 4;
+        unsigned a = p[3];
+        if (a == 255)
+            continue;
+        for (int c = 0; c < 3; c++) {
+            if (srgb) {
+                float lin = g_srgb_to_linear[p[c]] * (a / 255.0f);
+                p[c] = g_linear_to_srgb[(unsigned)(lin * 4095.0f + 0.5f)];
+            } else {
+                p[c] = (unsigned char)((p[c] * a + 127) / 255);
+            }
+        }
+    }
+}
+
+static void init_srgb_tables(void)
+{
+    if (g_tables_ready)
+        return;
+
+    for (int i = 0; i < 256; i++) {
+        float c = i / 255.0f;
+        g_srgb_to_linear[i] = c <= 0.04045f
+            ? c / 12.92f
+            : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 4096; i++) {
+        float l = i / 4095.0f;
+        float c = l <= 0.0031308f
+            ? l * 12.92f
+            : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+        g_linear_to_srgb[i] = (unsigned char)(c * 255.0f + 0.5f);
+    }
+    g_tables_ready = true;
+}
+
+static void decode_job(void *arg, size_t begin, size_t end, unsigned thread)
+{
+    (void)begin, (void)end, (void)thread;
+    decode_image(arg);
+}
+
+static void decode_image(struct DecodeTask *task)
+{
+    SDL_Surface *surface = IMG_Load(task->path);
+    if (surface == NULL) {
+        snprintf(task->error, sizeof task->error, "%s", IMG_GetError());
+        return;
+    }
+
+    /* Anything that isn't plain RGB24/RGBA32 goes through SDL's converter */
+    if (surface->format->format != SDL_PIXELFORMAT_RGB24
+            && surface->format->format != SDL_PIXELFORMAT_RGBA32) {
+        SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface,
+                SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(surface);
+        if (converted == NULL) {
+            snprintf(task->error, sizeof task->error, "%s", SDL_GetError());
+            return;
+        }
+        surface = converted;
+    }
+
+    size_t w = surface->w, h = surface->h;
+    task->pixels = malloc(w * h * 4);
+    if (task->pixels == NULL) {
+        snprintf(task->error, sizeof task->error, "Out of memory");
+        SDL_FreeSurface(surface);
+        return;
+    }
+
+    /* Repack row by row since surface rows may be padded */
+    const unsigned char *src = surface->pixels;
+    for (size_t y = 0; y < h; y++) {
+        const unsigned char *row = src + y * surface->pitch;
+        if (surface->format->BytesPerPixel == 3)
+            expand_rgb_to_rgba(row, task->pixels + y * w * 4, w);
+        else
+            memcpy(task->pixels + y * w * 4, row, w * 4);
+    }
+    task->w = surface->w;
+    task->h = surface->h;
+    SDL_FreeSurface(surface);
+
+    if (task->flags & TEXTURE_PREMULTIPLY)
+        premultiply_rgba(task->pixels, w * h, task->flags & TEXTURE_SRGB);
+}
+
+static GLuint upload_image(const struct DecodeTask *task)
+{
+    GLuint tex;
+    GLCHECK(glGenTextures(1, &tex));
+    bind_texture(tex);
+
+    GLint min_filter = task->flags & TEXTURE_MIPMAPS
+        ? GL_LINEAR_MIPMAP_LINEAR
+        : GL_LINEAR;
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+    GLCHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+
+    GLint internal = task->flags & TEXTURE_SRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    GLCHECK(glTexImage2D(GL_TEXTURE_2D, 0, internal, task->w, task->h, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, task->pixels));
+    if (task->flags & TEXTURE_MIPMAPS)
+        GLCHECK(glGenerateMipmap(GL_TEXTURE_2D));
+
+    bind_texture(0);
+    return tex;
+}
@@ -0,0 +1,548 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "transform.h"
+#include "glutils.h"
+#include "frame.h"
+#include "cull.h"
+#include "shaderpp.h"
+
+#if defined(SIMD_DISPATCH)
+# include <immintrin.h>
+#endif
+
+/* Dirty matrices this close together are uploaded as one range, re-sending
+ * 4 KiB of clean ones costs less than another glBufferSubData() */
+static const uint32_t MERGE_GAP = 64;
+
+/* Globals */
+static struct TransformStats g_stats;
+static bool g_force_scalar = false;
+static struct SphereBatch g_spheres;
+static uint32_t *g_visible = NULL;
+static mat4 *g_scratch = NULL; /* for when the frame ring is full */
+static size_t g_capacity = 0;
+
+static void compose_one(const struct TransformBatch *b, size_t i, mat4 out)
+    ATTR((nonnull(1)));
+static void reserve_scratch(size_t n);
+static int compare_u32(const void *a, const void *b) ATTR((nonnull(1, 2)));
+static void upload_dirty(struct TransformBatch *b) ATTR((nonnull(1)));
+
+/* transform_batch_reserve - make room for @n transforms
+ *  - keeps the current contents and count
+ * Responsibilities:
+ *  - Call transform_batch_free() after use
+ */
+void transform_batch_reserve(struct TransformBatch *b, size_t n)
+{
+    if (n <= b->capacity)
+        return;
+
+    size_t capacity = MAX(b->capacity * 2, n);
+    float **fields[] = {
+        &b->x, &b->y, &b->z, &b->rot_x, &b->rot_y, &b->rot_z, &b->scale
+    };
+    for (size_t f = 0; f < ARRAY_SIZE(fields); f++) {
+        float *p = realloc(*fields[f], capacity * sizeof (float));
+        ASSERT(p != NULL, "Out of memory");
+        *fields[f] = p;
+    }
+    mat4 *world = realloc(b->world, capacity * sizeof (mat4));
+    uint8_t *dirty = realloc(b->dirty, capacity);
+    uint32_t *dirty_list = realloc(b->dirty_list,
+            capacity * sizeof (uint32_t));
+    ASSERT(world != NULL && dirty != NULL && dirty_list != NULL,
+            "Out of memory");
+    memset(dirty + b->capacity, 0, capacity - b->capacity);
+    b->world = world;
+    b->dirty = dirty;
+    b->dirty_list = dirty_list;
+    b->capacity = capacity;
+}
+
+void transform_batch_free(struct TransformBatch *b)
+{
+    free(b->x);
+    free(b->y);
+    free(b->z);
+    free(b->rot_x);
+    free(b->rot_y);
+    free(b->rot_z);
+    free(b->scale);
+    free(b->world);
+    free(b->dirty);
+    free(b->dirty_list);
+    if (b->instances != 0)
+        del_buffer(b->instances);
+    memset(b, 0, sizeof *b);
+}
+
+/* transform_batch_set - copy an Entity's transform into slot @i */
+void transform_batch_set(struct TransformBatch *b, size_t i,
+        const struct Entity *entity)
+{
+    ASSERT(i < b->capacity, "Transform index out of range");
+    b->x[i] = entity->x;
+    b->y[i] = entity->y;
+    b->z[i] = entity->z;
+    b->rot_x[i] = entity->rot_x;
+    b->rot_y[i] = entity->rot_y;
+    b->rot_z[i] = entity->rot_z;
+    b->scale[i] = entity->scale;
+    transform_mark_dirty(b, i);
+}
+
+/* transform_batch_load - replace the contents with @n Entities */
+void transform_batch_load(struct TransformBatch *b,
+        const struct Entity *entity, size_t n)
+{
+    transform_batch_reserve(b, n);
+    for (size_t i = 0; i < n; i++)
+        transform_batch_set(b, i, &entity[i]);
+    b->count = n;
+}
+
+void transform_set_position(struct TransformBatch *b, size_t i,
+        float x, float y, float z)
+{
+    b->x[i] = x;
+    b->y[i] = y;
+    b->z[i] = z;
+    transform_mark_dirty(b, i);
+}
+
+void transform_set_rotation(struct TransformBatch *b, size_t i,
+        float rot_x, float rot_y, float rot_z)
+{
+    b->rot_x[i] = rot_x;
+    b->rot_y[i] = rot_y;
+    b->rot_z[i] = rot_z;
+    transform_mark_dirty(b, i);
+}
+
+void transform_set_scale(struct TransformBatch *b, size_t i, float scale)
+{
+    b->scale[i] = scale;
+    transform_mark_dirty(b, i);
+}
+
+/* transform_mark_dirty - queue slot @i for recomposition and upload
+ *  - for code writing the arrays directly, the setters call it already
+ */
+void transform_mark_dirty(struct TransformBatch *b, size_t i)
+{
+    ASSERT(i < b->capacity, "Transform index out of range");
+    if (b->dirty[i])
+        return;
+    b->dirty[i] = 1;
+    b->dirty_list[b->ndirty++] = i;
+}
+
+/* transform_update - recompose the world matrices of dirty transforms
+ *  - also sorts the dirty list, so uploads see runs of neighbours, unless
+ *    most of the batch is dirty and everything is recomposed
+ *
+ * Returns the number of matrices recomposed. The transforms stay dirty, see
+ * transform_clear_dirty()
+ */
+size_t transform_update(struct TransformBatch *b)
+{
+    size_t n = b->ndirty;
+    if (n == 0)
+        return 0;
+
+    /* Gathering and scattering costs more than composing the clean ones */
+    if (n * 2 > b->count) {
+        transform_compose(b, NULL, b->count, b->world);
+        return n;
+    }
+
+    /* Past a few percent, scanning the flags beats sorting the list */
+    if (n * 64 > b->count) {
+        size_t k = 0;
+        for (size_t i = 0; i < b->count; i++)
+            if (b->dirty[i])
+                b->dirty_list[k++] = i;
+        ASSERT(k == n, "Dirty transform past the end of the batch");
+    } else {
+        qsort(b->dirty_list, n, sizeof (uint32_t), compare_u32);
+    }
+
+    reserve_scratch(n);
+    transform_compose(b, b->dirty_list, n, g_scratch);
+    for (size_t k = 0; k < n; k++)
+        glm_mat4_copy(g_scratch[k], b->world[b->dirty_list[k]]);
+    return n;
+}
+
+void transform_clear_dirty(struct TransformBatch *b)
+{
+    if (b->ndirty * 2 > b->count) {
+        memset(b->dirty, 0, b->count);
+    } else {
+        for (size_t k = 0; k < b->ndirty; k++)
+            b->dirty[b->dirty_list[k]] = 0;
+    }
+    b->ndirty = 0;
+}
+
+#if defined(SIMD_DISPATCH)
+/* sincos_avx2 - sine and cosine of 8 floats
+ *  - Cephes' single precision polynomials, accurate to a couple of ulps for
+ *    angles within a few thousand radians
+ */
+TARGET("avx2,fma")
+static void sincos_avx2(__m256 x, __m256 *s, __m256 *c)
+{
+    const __m256 sign_mask = _mm256_castsi256_ps(_mm256_set1_epi32(INT32_MIN));
+    __m256 sign_sin = _mm256_and_ps(x, sign_mask);
+    x = _mm256_andnot_ps(sign_mask, x);
+
+    /* Octant, rounded up to even */
+    __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x,
+                _mm256_set1_ps(1.27323954473516f))); /* 4 / pi */
+    j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)),
+            _mm256_set1_epi32(~1));
+    __m256 y = _mm256_cvtepi32_ps(j);
+
+    __m256 swap_sin = _mm256_castsi256_ps(_mm256_slli_epi32(
+                _mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+    __m256 use_sin_poly = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(j, _mm256_set1_epi32(2)),
+                _mm256_setzero_si256()));
+    __m256 sign_cos = _mm256_castsi256_ps(_mm256_slli_epi32(
+                _mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)),
+                    _mm256_set1_epi32(4)), 29));
+    sign_sin = _mm256_xor_ps(sign_sin, swap_sin);
+
+    /* Extended precision modular arithmetic, x - y * pi / 4 */
+    x = _mm256_fmadd_ps(y, _mm256_set1_ps(-0.78515625f), x);
+    x = _mm256_fmadd_ps(y, _mm256_set1_ps(-2.4187564849853515625e-4f), x);
+    x = _mm256_fmadd_ps(y, _mm256_set1_ps(-3.77489497744594108e-8f), x);
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 pc = _mm256_set1_ps(2.443315711809948e-5f);
+    pc = _mm256_fmadd_ps(pc, z, _mm256_set1_ps(-1.388731625493765e-3f));
+    pc = _mm256_fmadd_ps(pc, z, _mm256_set1_ps(4.166664568298827e-2f));
+    pc = _mm256_mul_ps(_mm256_mul_ps(pc, z), z);
+    pc = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), pc);
+    pc = _mm256_add_ps(pc, _mm256_set1_ps(1.0f));
+
+    __m256 ps = _mm256_set1_ps(-1.9515295891e-4f);
+    ps = _mm256_fmadd_ps(ps, z, _mm256_set1_ps(8.3321608736e-3f));
+    ps = _mm256_fmadd_ps(ps, z, _mm256_set1_ps(-1.6666654611e-1f));
+    ps = _mm256_fmadd_ps(_mm256_mul_ps(ps, z), x, x);
+
+    __m256 sin_v = _mm256_blendv_ps(pc, ps, use_sin_poly);
+    __m256 cos_v = _mm256_blendv_ps(ps, pc, use_sin_poly);
+    *s = _mm256_xor_ps(sin_v, sign_sin);
+    *c = _mm256_xor_ps(cos_v, sign_cos);
+}
+
+/* Row k of the result holds lane k of every input row */
+TARGET("avx2")
+static void transpose8(__m256 r[8])
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+/* compose8_avx2 - matrices of 8 transforms, @idx selects them when
+ * @indices is used, else they start at @first */
+TARGET("avx2,fma")
+static void compose8_avx2(const struct TransformBatch *b,
+        const uint32_t *indices, size_t first, mat4 *out)
+{
+    __m256 x, y, z, ax, ay, az, s;
+    if (indices) {
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(indices + first));
+        x  = _mm256_i32gather_ps(b->x, idx, 4);
+        y  = _mm256_i32gather_ps(b->y, idx, 4);
+        z  = _mm256_i32gather_ps(b->z, idx, 4);
+        ax = _mm256_i32gather_ps(b->rot_x, idx, 4);
+        ay = _mm256_i32gather_ps(b->rot_y, idx, 4);
+        az = _mm256_i32gather_ps(b->rot_z, idx, 4);
+        s  = _mm256_i32gather_ps(b->scale, idx, 4);
+    } else {
+        x  = _mm256_loadu_ps(b->x + first);
+        y  = _mm256_loadu_ps(b->y + first);
+        z  = _mm256_loadu_ps(b->z + first);
+        ax = _mm256_loadu_ps(b->rot_x + first);
+        ay = _mm256_loadu_ps(b->rot_y + first);
+        az = _mm256_loadu_ps(b->rot_z + first);
+        s  = _mm256_loadu_ps(b->scale + first);
+    }
+
+    __m256 sx, cx, sy, cy, sz, cz;
+    sincos_avx2(ax, &sx, &cx);
+    sincos_avx2(ay, &sy, &cy);
+    sincos_avx2(az, &sz, &cz);
+
+    __m256 sxsy = _mm256_mul_ps(sx, sy);
+    __m256 cxsy = _mm256_mul_ps(cx, sy);
+    __m256 zero = _mm256_setzero_ps();
+
+    /* Element e of every matrix, column-major */
+    __m256 lo[8], hi[8];
+    lo[0] = _mm256_mul_ps(s, _mm256_mul_ps(cy, cz));
+    lo[1] = _mm256_mul_ps(s, _mm256_fmadd_ps(sxsy, cz, _mm256_mul_ps(cx, sz)));
+    lo[2] = _mm256_mul_ps(s, _mm256_fnmadd_ps(cxsy, cz, _mm256_mul_ps(sx, sz)));
+    lo[3] = zero;
+    lo[4] = _mm256_mul_ps(s, _mm256_mul_ps(_mm256_sub_ps(zero, cy), sz));
+    lo[5] = _mm256_mul_ps(s, _mm256_fnmadd_ps(sxsy, sz, _mm256_mul_ps(cx, cz)));
+    lo[6] = _mm256_mul_ps(s, _mm256_fmadd_ps(cxsy, sz, _mm256_mul_ps(sx, cz)));
+    lo[7] = zero;
+    hi[0] = _mm256_mul_ps(s, sy);
+    hi[1] = _mm256_mul_ps(s, _mm256_mul_ps(_mm256_sub_ps(zero, sx), cy));
+    hi[2] = _mm256_mul_ps(s, _mm256_mul_ps(cx, cy));
+    hi[3] = zero;
+    hi[4] = x;
+    hi[5] = y;
+    hi[6] = z;
+    hi[7] = _mm256_set1_ps(1.0f);
+
+    transpose8(lo);
+    transpose8(hi);
+    for (int k = 0; k < 8; k++) {
+        float *m = out[k][0];
+        _mm256_storeu_ps(m, lo[k]);
+        _mm256_storeu_ps(m + 8, hi[k]);
+    }
+}
+#endif /* SIMD_DISPATCH */
+
+/* transform_compose - build model matrices
+ * @b: the transforms
+ * @indices: which transforms to compose, or NULL for the first @n
+ * @n: number of matrices
+ * @out: receives @n matrices, may be write-combined mapped memory
+ */
+void transform_compose(const struct TransformBatch *b, const uint32_t *indices,
+        size_t n, mat4 *out)
+{
+    size_t i = 0;
+#if defined(SIMD_DISPATCH)
+    if (!g_force_scalar && CPU_HAS("avx2") && CPU_HAS("fma"))
+        for (; i + 8 <= n; i += 8)
+            compose8_avx2(b, indices, i, out + i);
+#endif
+    for (; i < n; i++)
+        compose_one(b, indices ? indices[i] : i, out[i]);
+}
+
+/* transform_gather - copy cached world matrices
+ * @b: the transforms, up to date, see transform_sync()
+ * @indices: which transforms
+ * @n: number of matrices
+ * @out: receives @n matrices, may be write-combined mapped memory
+ *
+ * Contracts:
+ *  - Threadsafe as long as @b doesn't change
+ */
+void transform_gather(const struct TransformBatch *b, const uint32_t *indices,
+        size_t n, mat4 *out)
+{
+    for (size_t k = 0; k < n; k++)
+        glm_mat4_copy(b->world[indices[k]], out[k]);
+}
+
+/* transform_force_scalar - disable the AVX2 path, for benchmarking */
+void transform_force_scalar(bool scalar)
+{
+    g_force_scalar = scalar;
+}
+
+/* transform_sync - bring the batch's instance buffer up to date
+ *  - recomposes and uploads the dirty transforms, then clears them
+ *
+ * Returns the number of matrices recomposed
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+size_t transform_sync(struct TransformBatch *b)
+{
+    size_t n = transform_update(b);
+    upload_dirty(b);
+    transform_clear_dirty(b);
+    return n;
+}
+
+/* render_transforms - render a TransformBatch given a model
+ * @m: the Model to use
+ * @b: one transform per instance
+ *
+ * Like render_entities(), but culling runs on the positions and scales
+ * before any matrix is read, and only the matrices of transforms changed
+ * since the last call are recomposed and re-uploaded. When everything is
+ * visible the instances come straight from the batch's resident buffer,
+ * otherwise the visible cached matrices are copied into the frame ring.
+ *
+ * Contracts:
+ *  - Not threadsafe - calls OpenGL functions and uses static memory
+ */
+void render_transforms(const struct Model *m, struct TransformBatch *b)
+{
+    size_t n = b->count;
+    if (n == 0)
+        return;
+    reserve_scratch(n);
+    transform_sync(b);
+
+    /* Sphere around the origin of the Model containing its bounds, since
+     * the rotation of the bounds' center is not known here */
+    float reach = glm_vec_norm((float *)m->bounds) + m->bounds[3];
+    sphere_batch_reserve(&g_spheres, n);
+    for (size_t i = 0; i < n; i++) {
+        g_spheres.x[i] = b->x[i];
+        g_spheres.y[i] = b->y[i];
+        g_spheres.z[i] = b->z[i];
+        g_spheres.r[i] = b->scale[i] * reach;
+    }
+    g_spheres.count = n;
+
+    size_t nvisible = cull_entity_spheres(&g_spheres, g_visible);
+    if (nvisible == 0)
+        return;
+
+    use_program(ready_variant(m->program));
+    bind_array(m->vao);
+    if (m->texture != 0)
+        bind_texture_unit(0, m->texture);
+
+    struct RingBuffer *ring = frame_ring();
+    struct RingAlloc alloc;
+    if (nvisible == n) {
+        point_instances(b->instances, 0);
+    } else if (ring_alloc(ring, nvisible * sizeof (mat4), sizeof (mat4),
+                &alloc)) {
+        transform_gather(b, g_visible, nvisible, alloc.ptr);
+        ring_flush(ring);
+        point_instances(alloc.buffer, alloc.offset);
+    } else {
+        transform_gather(b, g_visible, nvisible, g_scratch);
+        upload_instances(m, g_scratch, nvisible);
+    }
+    draw_instanced(m->num_indices, nvisible);
+}
+
+/* transform_stats - instance buffer uploads since the last reset */
+const struct TransformStats *transform_stats(void)
+{
+    return &g_stats;
+}
+
+void reset_transform_stats(void)
+{
+    memset(&g_stats, 0, sizeof g_stats);
+}
+
+/* compose_one - M = T * Rx * Ry * Rz * S, multiplied out */
+static void compose_one(const struct TransformBatch *b, size_t i, mat4 out)
+{
+    float sx = sinf(b->rot_x[i]), cx = cosf(b->rot_x[i]);
+    float sy = sinf(b->rot_y[i]), cy = cosf(b->rot_y[i]);
+    float sz = sinf(b->rot_z[i]), cz = cosf(b->rot_z[i]);
+    float s = b->scale[i];
+
+    out[0][0] = s * cy * cz;
+    out[0][1] = s * (cx * sz + sx * sy * cz);
+    out[0][2] = s * (sx * sz - cx * sy * cz);
+    out[0][3] = 0.0f;
+    out[1][0] = s * -cy * sz;
+    out[1][1] = s * (cx * cz - sx * sy * sz);
+    out[1][2] = s * (sx * cz + cx * sy * sz);
+    out[1][3] = 0.0f;
+    out[2][0] = s * sy;
+    out[2][1] = s * -sx * cy;
+    out[2][2] = s * cx * cy;
+    out[2][3] = 0.0f;
+    out[3][0] = b->x[i];
+    out[3][1] = b->y[i];
+    out[3][2] = b->z[i];
+    out[3][3] = 1.0f;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* upload_dirty - copy the dirty world matrices to the resident buffer
+ *  - neighbouring runs closer than MERGE_GAP matrices share one upload,
+ *    re-sending the clean ones in between
+ */
+static void upload_dirty(struct TransformBatch *b)
+{
+    if (b->instances == 0 || b->instances_capacity < b->count) {
+        if (b->instances != 0)
+            del_buffer(b->instances);
+        b->instances = gen_buffer(GL_ARRAY_BUFFER, b->count * sizeof (mat4),
+                b->world);
+        b->instances_capacity = b->count;
+        g_stats.uploads++;
+        g_stats.bytes += b->count * sizeof (mat4);
+        return;
+    }
+    if (b->ndirty == 0)
+        return;
+
+    bind_buffer(GL_ARRAY_BUFFER, b->instances);
+    if (b->ndirty * 2 > b->count) {
+        GLCHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, b->count * sizeof (mat4),
+                    b->world));
+        g_stats.uploads++;
+        g_stats.bytes += b->count * sizeof (mat4);
+        return;
+    }
+    const uint32_t *list = b->dirty_list;
+    for (size_t k = 0; k < b->ndirty;) {
+        uint32_t first = list[k], last = list[k];
+        for (k++; k < b->ndirty && list[k] - last <= MERGE_GAP; k++)
+            last = list[k];
+        size_t size = (last - first + 1) * sizeof (mat4);
+        GLCHECK(glBufferSubData(GL_ARRAY_BUFFER, first * sizeof (mat4), size,
+                    b->world[first]));
+        g_stats.uploads++;
+        g_stats.bytes += size;
+    }
+}
+
+static void reserve_scratch(size_t n)
+{
+    if (n <= g_capacity)
+        return;
+    size_t capacity = MAX(g_capacity * 2, n);
+    uint32_t *visible = realloc(g_visible, capacity * sizeof (uint32_t));
+    mat4 *scratch = realloc(g_scratch, capacity * sizeof (mat4));
+    ASSERT(visible != NULL && scratch != NULL, "Out of memory");
+    g_visible = visible;
+    g_scratch = scratch;
+    g_capacity = capacity;
+}
@@ -0,0 +1,78 @@
+/* benchutil.h - Shared helpers for the benchmark programs
+ *
+ * Header-only so each benchmark stays a single translation unit. Plain
+ * static rather than inline, -Winline would flag them at -O2, and unused
+ * so benchmarks needing only some of them build warning-free
+ */
+#ifndef BENCHUTIL_H_INCLUDED
+#define BENCHUTIL_H_INCLUDED
+
+#include <SDL.h>
+#include <GL/glew.h>
+#include "utils.h"
+#include "glutils.h"
+
+/* Seconds elapsed since an arbitrary point */
+ATTR((unused))
+static double bench_now(void)
+{
+    return (double)SDL_GetPerformanceCounter()
+        / (double)SDL_GetPerformanceFrequency();
+}
+
+/* bench_try_gl - create a hidden window with an OpenGL core context
+ *  - returns false if the driver can't provide version @major.@minor
+ *  - works with Mesa's llvmpipe (LIBGL_ALWAYS_SOFTWARE=1) for headless runs
+ */
+ATTR((unused))
+static bool bench_try_gl(int major, int minor, int w, int h,
+        SDL_Window **window, SDL_GLContext *context)
+{
+    if (!SDL_WasInit(SDL_INIT_VIDEO)) {
+        int ret = SDL_Init(SDL_INIT_VIDEO);
+        ASSERT(ret == 0, SDL_GetError());
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, major);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, minor);
+
+    *window = SDL_CreateWindow("bench", 0, 0, w, h,
+            SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    ASSERT(*window != NULL, SDL_GetError());
+    *context = SDL_GL_CreateContext(*window);
+    if (*context == NULL) {
+        SDL_DestroyWindow(*window);
+        return false;
+    }
+
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+    ASSERT(err == GLEW_OK, glewGetErrorString(err));
+    /* glewInit() can leave a spurious GL_INVALID_ENUM behind */
+    glGetError();
+
+    GLCHECK(glViewport(0, 0, w, h));
+    SDL_GL_SetSwapInterval(0);
+    return true;
+}
+
+/* bench_init_gl - create a hidden window with an OpenGL 3.3 core context */
+ATTR((unused))
+static void bench_init_gl(int w, int h, SDL_Window **window,
+        SDL_GLContext *context)
+{
+    bool ok = bench_try_gl(3, 3, w, h, window, context);
+    ASSERT(ok, SDL_GetError());
+}
+
+ATTR((unused))
+static void bench_cleanup_gl(SDL_Window *window, SDL_GLContext context)
+{
+    SDL_GL_DeleteContext(context);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+#endif /* BENCHUTIL_H_INCLUDED */
@@ -0,0 +1,112 @@
+/* bvhbench - dynamic BVH update cost and culling against a flat cull
+ *
+ * usage: bvhbench [entities]
+ * CPU only, no OpenGL context is needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "bvh.h"
+#include "cull.h"
+
+static const int   FRAMES = 20;
+static const float WORLD  = 400.0f; /* entities live in a cube this wide */
+static const float HALF   = 0.6f;   /* entity half extent */
+static const float MARGIN = 0.2f;
+static const float SPEED  = 0.25f;  /* per frame displacement of movers */
+static const float FAR    = 150.0f; /* draw distance */
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * ((float)rand() / (float)RAND_MAX);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 100000;
+
+    mat4 view, projection, viewproj;
+    glm_mat4_identity(view);
+    glm_translate(view, (vec3){0.0f, 0.0f, -3.0f});
+    glm_perspective(glm_rad(70.0f), 800.0f / 600.0f, 0.1f, FAR, projection);
+    glm_mat4_mul(projection, view, viewproj);
+    struct Frustum frustum;
+    frustum_from_matrix(viewproj, &frustum);
+
+    struct BoxBatch boxes = { 0 };
+    box_batch_reserve(&boxes, n);
+    int32_t *leaves = calloc(n, sizeof (int32_t));
+    uint32_t *visible = calloc(n, sizeof (uint32_t));
+    ASSERT(leaves && visible, "Out of memory");
+
+    srand(1234);
+    struct BVH tree;
+    bvh_init(&tree, MARGIN);
+    double start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        boxes.cx[i] = frand(-WORLD / 2, WORLD / 2);
+        boxes.cy[i] = frand(-WORLD / 2, WORLD / 2);
+        boxes.cz[i] = frand(-WORLD / 2, WORLD / 2);
+        boxes.ex[i] = boxes.ey[i] = boxes.ez[i] = HALF;
+        float lo[3] = { boxes.cx[i] - HALF, boxes.cy[i] - HALF, boxes.cz[i] - HALF };
+        float hi[3] = { boxes.cx[i] + HALF, boxes.cy[i] + HALF, boxes.cz[i] + HALF };
+        leaves[i] = bvh_insert(&tree, lo, hi, i);
+    }
+    boxes.count = n;
+    printf("%zu entities, built incrementally in %.2f ms, height %d\n",
+            n, (bench_now() - start) * 1000.0, bvh_height(&tree));
+
+    static const float FRACTIONS[] = { 0.01f, 0.1f, 0.5f, 1.0f };
+    printf("%8s %12s %10s %8s %10s %10s %12s %12s\n", "moving", "update ms",
+            "updates", "height", "cost", "visible", "bvh cull ms",
+            "flat cull ms");
+
+    float base_cost = bvh_cost(&tree);
+    for (size_t k = 0; k < ARRAY_SIZE(FRACTIONS); k++) {
+        size_t nmoving = n * FRACTIONS[k];
+        double update = 0.0;
+        size_t updates = 0;
+
+        for (int f = 0; f < FRAMES; f++) {
+            /* Movers are a random contiguous window, like one system's
+             * worth of entities */
+            size_t first = nmoving < n ? (size_t)rand() % (n - nmoving) : 0;
+            for (size_t i = first; i < first + nmoving; i++) {
+                boxes.cx[i] += frand(-SPEED, SPEED);
+                boxes.cy[i] += frand(-SPEED, SPEED);
+                boxes.cz[i] += frand(-SPEED, SPEED);
+            }
+
+            start = bench_now();
+            for (size_t i = first; i < first + nmoving; i++) {
+                float lo[3] = { boxes.cx[i] - HALF, boxes.cy[i] - HALF, boxes.cz[i] - HALF };
+                float hi[3] = { boxes.cx[i] + HALF, boxes.cy[i] + HALF, boxes.cz[i] + HALF };
+                updates += bvh_move(&tree, leaves[i], lo, hi);
+            }
+            update += bench_now() - start;
+        }
+
+        size_t nvisible_bvh = 0, nvisible_flat = 0;
+        start = bench_now();
+        for (int f = 0; f < FRAMES; f++)
+            nvisible_bvh = bvh_cull(&tree, &frustum, visible);
+        double bvh_ms = (bench_now() - start) * 1000.0 / FRAMES;
+        start = bench_now();
+        for (int f = 0; f < FRAMES; f++)
+            nvisible_flat = cull_boxes(&frustum, &boxes, visible);
+        double flat_ms = (bench_now() - start) * 1000.0 / FRAMES;
+        ASSERT(nvisible_bvh >= nvisible_flat, "BVH missed visible entities");
+
+        printf("%7.0f%% %12.3f %10zu %8d %10.3f %10zu %12.3f %12.3f\n",
+                FRACTIONS[k] * 100.0f, update * 1000.0 / FRAMES,
+                updates / FRAMES, bvh_height(&tree),
+                bvh_cost(&tree) / base_cost, nvisible_bvh, bvh_ms, flat_ms);
+    }
+
+    bvh_free(&tree);
+    box_batch_free(&boxes);
+    free(visible);
+    free(leaves);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/* clusterbench - CPU light binning for clustered forward lighting
+ *
+ * usage: clusterbench [workers]
+ * Bins random point lights in front of the default camera into the
+ * ClusterGrid, with the scalar and the AVX2 sphere-vs-cluster tests, and
+ * reports the cost per 1K lights. CPU only, no OpenGL context is needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "clusters.h"
+#include "jobs.h"
+
+static const int ROUNDS = 50;
+static const size_t COUNTS[] = { 256, 1024, 4096, 16384 };
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
+
+/* Lights scattered through the first 100 units in front of the camera */
+static void scatter(struct PointLight *lights, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float z = frand(1.0f, 100.0f);
+        lights[i] = (struct PointLight){
+            .position = { frand(-z, z), frand(-0.7f * z, 0.7f * z), -z,
+                          frand(1.0f, 5.0f) },
+            .color = { frand(0, 1), frand(0, 1), frand(0, 1), 1.0f },
+        };
+    }
+}
+
+static double bin_ms(struct ClusterGrid *g, mat4 view,
+        const struct PointLight *lights, size_t n)
+{
+    double start = bench_now();
+    for (int r = 0; r < ROUNDS; r++)
+        clusters_bin(g, view, lights, n);
+    return (bench_now() - start) * 1000.0 / ROUNDS;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned nworkers = argc > 1 ? touint(argv[1]) : 0;
+    size_t max = COUNTS[ARRAY_SIZE(COUNTS) - 1];
+    struct PointLight *lights = malloc(max * sizeof (struct PointLight));
+    struct ClusterGrid *g = malloc(sizeof *g);
+    uint32_t *table = malloc(sizeof g->table);
+    ASSERT(lights != NULL && g != NULL && table != NULL, "Out of memory");
+
+    mat4 projection, view = GLM_MAT4_IDENTITY_INIT;
+    glm_perspective(glm_rad(70.0f), 800.0f / 600.0f, 0.1f, 1000.0f,
+            projection);
+    clusters_init(g, 800.0f, 600.0f, 100.0f);
+    clusters_build(g, projection);
+
+    jobs_init(nworkers);
+    printf("%dx%dx%d clusters, %u workers\n", CLUSTER_X, CLUSTER_Y,
+            CLUSTER_Z, jobs_worker_count());
+    printf("%8s %12s %12s %14s %14s %10s %10s\n", "lights", "scalar ms",
+            "avx2 ms", "scalar ms/1K", "avx2 ms/1K", "refs", "overflow");
+
+    srand(1234);
+    for (size_t c = 0; c < ARRAY_SIZE(COUNTS); c++) {
+        size_t n = COUNTS[c];
+        scatter(lights, n);
+
+        clusters_force_scalar(true);
+        double scalar = bin_ms(g, view, lights, n);
+        memcpy(table, g->table, sizeof g->table);
+        size_t refs = g->stats.references;
+
+        clusters_force_scalar(false);
+        double simd = bin_ms(g, view, lights, n);
+        ASSERT(memcmp(table, g->table, sizeof g->table) == 0
+                && refs == g->stats.references, "AVX2 binning differs");
+
+        printf("%8zu %12.3f %12.3f %14.3f %14.3f %10zu %10zu\n", n, scalar,
+                simd, scalar * 1000.0 / n, simd * 1000.0 / n, refs,
+                g->stats.overflows);
+    }
+
+    jobs_shutdown();
+    clusters_free(g);
+    free(table);
+    free(g);
+    free(lights);
+    return EXIT_SUCCESS;
+}
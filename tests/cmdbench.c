@@ -0,0 +1,143 @@
+/* cmdbench - render_entities() vs recording on the job pool
+ *
+ * usage: cmdbench [model.obj] [entities] [workers]
+ * Both paths cull against the frustum, build model matrices and draw the
+ * visible entities. The command queue does the CPU work on the job pool and
+ * keeps only the replay on this thread. Then one frame of each is read
+ * back and compared, with other data streamed through the frame ring
+ * after the queue reserved its instances, as in a real frame.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "cmdlist.h"
+#include "entity.h"
+#include "frame.h"
+#include "jobs.h"
+#include "objloader.h"
+
+static const int WIDTH = 64, HEIGHT = 64;
+static const int FRAMES = 20;
+
+static void draw_frame(struct CommandQueue *queue, const struct Model *m,
+        const struct Entity *e, size_t n, bool replay, GLubyte *pixels);
+
+int main(int argc, char *argv[])
+{
+    const char *obj = argc > 1 ? argv[1] : RESOURCE_DIR "stall.obj";
+    size_t n = argc > 2 ? touint(argv[2]) : 100000;
+    unsigned nworkers = argc > 3 ? touint(argv[3]) : 0;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    init_frame();
+    jobs_init(nworkers);
+
+    struct Model model;
+    load_obj_model(obj, NULL,
+                   RESOURCE_DIR "entity.vertex.glsl",
+                   RESOURCE_DIR "entity.fragment.glsl",
+                   &model);
+
+    /* Scattered all around the camera, roughly a fifth is visible */
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    ASSERT(entities != NULL, "Out of memory");
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x = (rand() % 2000) / 10.0f - 100.0f;
+        entities[i].y = (rand() % 2000) / 10.0f - 100.0f;
+        entities[i].z = (rand() % 2000) / 10.0f - 100.0f;
+        entities[i].rot_y = (rand() % 628) / 100.0f;
+        entities[i].scale = 0.01f;
+    }
+
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    struct CommandQueue queue;
+    cmdqueue_init(&queue);
+
+    printf("%zu entities, %u workers\n", n, jobs_worker_count());
+    printf("%-16s %10s %10s %10s %10s\n", "path", "ms/frame", "record ms",
+            "submit ms", "packets");
+    for (int path = 0; path < 2; path++) {
+        static const char *const NAMES[] = { "render_entities", "cmdqueue" };
+        double record = 0.0, submit = 0.0;
+        size_t packets = 0;
+
+        glFinish();
+        double start = bench_now();
+        for (int f = 0; f < FRAMES; f++) {
+            upload_frame(&frame);
+            GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+            if (path == 0) {
+                render_entities(&model, entities, n);
+            } else {
+                cmdqueue_begin(&queue, n);
+                cmdqueue_record_entities(&queue, &model, entities, n);
+                cmdqueue_submit(&queue);
+                record += queue.stats.record_seconds;
+                submit += queue.stats.submit_seconds;
+                packets = queue.stats.packets;
+            }
+            SDL_GL_SwapWindow(window);
+        }
+        glFinish();
+        double ms = (bench_now() - start) * 1000.0 / FRAMES;
+        printf("%-16s %10.3f %10.3f %10.3f %10zu\n", NAMES[path], ms,
+                record * 1000.0 / FRAMES, submit * 1000.0 / FRAMES, packets);
+    }
+
+    size_t npixels = WIDTH * HEIGHT * 4;
+    GLubyte *expected = malloc(npixels), *actual = malloc(npixels);
+    ASSERT(expected != NULL && actual != NULL, "Out of memory");
+    draw_frame(&queue, &model, entities, n, false, expected);
+    draw_frame(&queue, &model, entities, n, true, actual);
+    size_t differ = 0;
+    for (size_t i = 0; i < npixels; i++)
+        differ += expected[i] != actual[i];
+    printf("framebuffers %s (%zu bytes differ)\n",
+            differ == 0 ? "match" : "DIFFER", differ);
+
+    free(expected);
+    free(actual);
+    cmdqueue_free(&queue);
+    free(entities);
+    destroy_model(&model);
+    jobs_shutdown();
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return differ == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* draw_frame - one frame of either path, read back into @pixels
+ *  - other data is streamed and flushed while the queue is recording
+ */
+static void draw_frame(struct CommandQueue *queue, const struct Model *m,
+        const struct Entity *e, size_t n, bool replay, GLubyte *pixels)
+{
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    upload_frame(&frame);
+    GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+
+    if (replay)
+        cmdqueue_begin(queue, n);
+    static const GLubyte OTHER[4096];
+    GLintptr offset;
+    stream_buffer(GL_ARRAY_BUFFER, m->vbo_instances, OTHER, sizeof OTHER,
+            &offset);
+    if (replay) {
+        cmdqueue_record_entities(queue, m, e, n);
+        cmdqueue_submit(queue);
+    } else {
+        render_entities(m, e, n);
+    }
+
+    GLCHECK(glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE,
+                pixels));
+}
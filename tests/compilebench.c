@@ -0,0 +1,79 @@
+/* compilebench - serial against batched shader compiles
+ *
+ * usage: compilebench [rounds]
+ * Builds every entity and G-buffer variant, first one after another with
+ * shader_variant(), which waits for each, then requesting them all with
+ * request_shader_variant() before waiting for any. Reports the time until
+ * the requests returned, which a loading screen would spend blocked, and
+ * until every program was usable. The program cache is left off.
+ * Drivers keep their own shader caches, which make later rounds look
+ * cheap. Disable them to measure a first start, e.g.
+ * MESA_SHADER_CACHE_DISABLE=true or __GL_SHADER_DISK_CACHE=0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "shaderpp.h"
+
+static const int WIDTH = 64, HEIGHT = 64;
+
+static const char *const FRAGMENTS[] = {
+    RESOURCE_DIR "entity.fragment.glsl",
+    RESOURCE_DIR "entity.gbuffer.fragment.glsl",
+};
+
+/* build_all - every variant, serially or batched, returns the ms until the
+ * calls returned in @issue_ms and until all are usable */
+static double build_all(bool batch, double *issue_ms)
+{
+    double start = bench_now();
+    for (size_t f = 0; f < ARRAY_SIZE(FRAGMENTS); f++) {
+        for (unsigned features = 0; features < SHADER_VARIANTS; features++) {
+            if (batch)
+                request_shader_variant(RESOURCE_DIR "entity.vertex.glsl",
+                        FRAGMENTS[f], features);
+            else
+                shader_variant(RESOURCE_DIR "entity.vertex.glsl",
+                        FRAGMENTS[f], features);
+        }
+    }
+    *issue_ms = (bench_now() - start) * 1e3;
+    finish_shader_variants();
+    GLCHECK(glFinish());
+    double ms = (bench_now() - start) * 1e3;
+    free_shader_variants();
+    return ms;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned rounds = argc > 1 ? touint(argv[1]) : 3;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    bool parallel = GLEW_KHR_parallel_shader_compile
+        || GLEW_ARB_parallel_shader_compile;
+    printf("%s, %zu programs, parallel compile %s, best of %u\n",
+            glGetString(GL_RENDERER), ARRAY_SIZE(FRAGMENTS) * SHADER_VARIANTS,
+            parallel ? "on" : "unavailable", rounds);
+    printf("%-8s %12s %12s\n", "mode", "issue ms", "total ms");
+
+    for (int batch = 0; batch < 2; batch++) {
+        double issue = 1e30, total = 1e30;
+        for (unsigned r = 0; r < rounds; r++) {
+            /* The placeholder is built up front, as the renderer does */
+            shader_variants_async(batch);
+            double issue_ms;
+            total = MIN(total, build_all(batch, &issue_ms));
+            issue = MIN(issue, issue_ms);
+        }
+        printf("%-8s %12.2f %12.2f\n", batch ? "batch" : "serial", issue,
+                total);
+    }
+
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/* cullbench - frustum culling cost per 100K entities
+ *
+ * usage: cullbench [entities]
+ * CPU only, no OpenGL context is needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "cull.h"
+
+static const int ROUNDS = 50;
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 100000;
+
+    /* Same camera as default_frame() */
+    mat4 view, projection, viewproj;
+    glm_mat4_identity(view);
+    glm_translate(view, (vec3){0.0f, 0.0f, -3.0f});
+    glm_perspective(glm_rad(70.0f), 800.0f / 600.0f, 0.1f, 1000.0f, projection);
+    glm_mat4_mul(projection, view, viewproj);
+    struct Frustum frustum;
+    frustum_from_matrix(viewproj, &frustum);
+
+    /* Entities scattered all around the camera */
+    struct SphereBatch spheres = { 0 };
+    struct BoxBatch boxes = { 0 };
+    sphere_batch_reserve(&spheres, n);
+    box_batch_reserve(&boxes, n);
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        float x = (rand() % 2000) / 10.0f - 100.0f;
+        float y = (rand() % 2000) / 10.0f - 100.0f;
+        float z = (rand() % 2000) / 10.0f - 100.0f;
+        spheres.x[i] = boxes.cx[i] = x;
+        spheres.y[i] = boxes.cy[i] = y;
+        spheres.z[i] = boxes.cz[i] = z;
+        spheres.r[i] = 1.0f;
+        boxes.ex[i] = boxes.ey[i] = boxes.ez[i] = 0.6f;
+    }
+    spheres.count = boxes.count = n;
+
+    uint32_t *visible = calloc(n, sizeof (uint32_t));
+    ASSERT(visible != NULL, "Out of memory");
+
+    static const enum CullImpl IMPLS[] = { CULL_SCALAR, CULL_SSE, CULL_AVX };
+    static const char *const NAMES[] = { "scalar", "sse", "avx" };
+
+    printf("%zu entities\n", n);
+    printf("%-8s %-7s %10s %10s %14s\n",
+            "impl", "bounds", "visible", "culled", "ms per 100K");
+    for (size_t k = 0; k < ARRAY_SIZE(IMPLS); k++) {
+        cull_force_impl(IMPLS[k]);
+
+        size_t nvisible = 0;
+        double start = bench_now();
+        for (int r = 0; r < ROUNDS; r++)
+            nvisible = cull_spheres(&frustum, &spheres, visible);
+        double ms = (bench_now() - start) * 1000.0 / ROUNDS * 100000.0 / n;
+        printf("%-8s %-7s %10zu %10zu %14.4f\n",
+                NAMES[k], "sphere", nvisible, n - nvisible, ms);
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; r++)
+            nvisible = cull_boxes(&frustum, &boxes, visible);
+        ms = (bench_now() - start) * 1000.0 / ROUNDS * 100000.0 / n;
+        printf("%-8s %-7s %10zu %10zu %14.4f\n",
+                NAMES[k], "aabb", nvisible, n - nvisible, ms);
+    }
+
+    free(visible);
+    sphere_batch_free(&spheres);
+    box_batch_free(&boxes);
+    return EXIT_SUCCESS;
+}
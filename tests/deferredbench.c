@@ -0,0 +1,118 @@
+/* deferredbench - forward vs deferred shading as the light count grows
+ *
+ * usage: deferredbench [model.obj] [entities]
+ * Draws a field of entities lit by a growing number of clustered point
+ * lights, once forward and once through the G-buffer, and reports the
+ * frame time of each with the lights binned per frame.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "clusters.h"
+#include "deferred.h"
+#include "entity.h"
+#include "frame.h"
+#include "objloader.h"
+
+static const int    WIDTH = 800, HEIGHT = 600;
+static const int    FRAMES = 10;
+static const size_t LIGHTS[] = { 0, 16, 64, 256, 1024, 4096 };
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *obj = argc > 1 ? argv[1] : RESOURCE_DIR "stall.obj";
+    size_t n = argc > 2 ? touint(argv[2]) : 1000;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    init_frame();
+
+    struct Model model;
+    load_obj_model(obj, NULL,
+                   RESOURCE_DIR "entity.vertex.glsl",
+                   RESOURCE_DIR "entity.fragment.glsl",
+                   &model);
+    struct GBuffer gbuffer;
+    gbuffer_init(&gbuffer, WIDTH, HEIGHT);
+
+    size_t max = LIGHTS[ARRAY_SIZE(LIGHTS) - 1];
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    struct PointLight *lights = malloc(max * sizeof (struct PointLight));
+    struct ClusterGrid *clusters = malloc(sizeof *clusters);
+    ASSERT(entities && lights && clusters, "Out of memory");
+
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x = frand(-20.0f, 20.0f);
+        entities[i].y = frand(-10.0f, 10.0f);
+        entities[i].z = frand(-60.0f, -5.0f);
+        entities[i].rot_y = frand(0.0f, 6.28f);
+        entities[i].scale = 0.3f;
+    }
+    for (size_t i = 0; i < max; i++) {
+        lights[i] = (struct PointLight){
+            .position = { frand(-20.0f, 20.0f), frand(-10.0f, 10.0f),
+                          frand(-60.0f, -5.0f), frand(2.0f, 6.0f) },
+            .color = { frand(0, 1), frand(0, 1), frand(0, 1), 0.5f },
+        };
+    }
+
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    clusters_init(clusters, WIDTH, HEIGHT, 100.0f);
+    clusters_build(clusters, frame.projection);
+
+    printf("%s, %zu entities of %d triangles, %dx%d\n",
+            glGetString(GL_RENDERER), n, (int)model.num_indices / 3,
+            WIDTH, HEIGHT);
+    printf("%8s %12s %12s %10s %10s\n", "lights", "forward ms",
+            "deferred ms", "refs", "bin ms");
+    for (size_t l = 0; l < ARRAY_SIZE(LIGHTS); l++) {
+        double ms[2];
+        for (int mode = RENDER_FORWARD; mode <= RENDER_DEFERRED; mode++) {
+            glFinish();
+            double start = bench_now();
+            for (int f = 0; f < FRAMES; f++) {
+                default_frame(&frame);
+                clusters_bin(clusters, frame.view, lights, LIGHTS[l]);
+                clusters_upload(clusters, lights, LIGHTS[l]);
+                clusters_frame(clusters, &frame);
+                upload_frame(&frame);
+                GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+                if (mode == RENDER_DEFERRED) {
+                    deferred_begin(&gbuffer);
+                    deferred_entities(&gbuffer, &model, entities, n);
+                    deferred_end(&gbuffer);
+                } else {
+                    render_entities(&model, entities, n);
+                }
+                SDL_GL_SwapWindow(window);
+            }
+            glFinish();
+            ms[mode] = (bench_now() - start) * 1000.0 / FRAMES;
+        }
+        printf("%8zu %12.3f %12.3f %10zu %10.3f\n", LIGHTS[l], ms[0], ms[1],
+                clusters->stats.references,
+                clusters->stats.bin_seconds * 1000.0);
+    }
+
+    clusters_free(clusters);
+    free(clusters);
+    free(lights);
+    free(entities);
+    gbuffer_free(&gbuffer);
+    destroy_model(&model);
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
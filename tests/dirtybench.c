@@ -0,0 +1,98 @@
+/* dirtybench - per-frame transform cost with cached world matrices
+ *
+ * usage: dirtybench [entities]
+ * Each frame a fixed random subset of the entities moves. Compares
+ * recomposing and uploading every matrix to transform_sync(), which
+ * recomposes the dirty ones and uploads them in merged runs, both waiting
+ * for GL to finish. The dirty bytes and uploads are what transform_sync()
+ * actually sent, see transform_stats().
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "transform.h"
+
+static const int WIDTH = 64, HEIGHT = 64;
+static const int FRAMES = 50;
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 100000;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+
+    struct TransformBatch batch = { 0 };
+    transform_batch_reserve(&batch, n);
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        struct Entity e = {
+            .x = (rand() % 2000) / 10.0f - 100.0f,
+            .y = (rand() % 2000) / 10.0f - 100.0f,
+            .z = (rand() % 2000) / 10.0f - 100.0f,
+            .rot_y = (rand() % 6284) / 1000.0f,
+            .scale = 1.0f,
+        };
+        transform_batch_set(&batch, i, &e);
+    }
+    batch.count = n;
+    transform_sync(&batch);
+
+    /* What every frame cost before: rebuild and re-send it all */
+    mat4 *all = malloc(n * sizeof (mat4));
+    uint32_t *movers = malloc(n * sizeof (uint32_t));
+    ASSERT(all != NULL && movers != NULL, "Out of memory");
+    GLuint everything = gen_buffer(GL_ARRAY_BUFFER, n * sizeof (mat4),
+            batch.world);
+
+    printf("%s, %zu entities, %d frames\n", glGetString(GL_RENDERER), n,
+            FRAMES);
+    printf("%-8s %14s %14s %12s %12s %14s\n", "moving", "all ms/frame",
+            "dirty ms/frame", "all KiB", "dirty KiB", "dirty uploads");
+
+    static const double FRACTIONS[] = { 0.01, 0.10, 1.0 };
+    for (size_t f = 0; f < ARRAY_SIZE(FRACTIONS); f++) {
+        size_t nmovers = (size_t)(n * FRACTIONS[f]);
+        for (size_t i = 0; i < nmovers; i++)
+            movers[i] = nmovers == n ? i : (size_t)rand() % n;
+
+        double full = 0.0, dirty = 0.0;
+        reset_transform_stats();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            for (size_t i = 0; i < nmovers; i++) {
+                uint32_t k = movers[i];
+                transform_set_rotation(&batch, k, 0.0f,
+                        batch.rot_y[k] + 0.01f, 0.0f);
+            }
+            double start = bench_now();
+            transform_sync(&batch);
+            GLCHECK(glFinish());
+            dirty += bench_now() - start;
+
+            start = bench_now();
+            transform_compose(&batch, NULL, n, all);
+            bind_buffer(GL_ARRAY_BUFFER, everything);
+            GLCHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, n * sizeof (mat4),
+                        all));
+            GLCHECK(glFinish());
+            full += bench_now() - start;
+        }
+        const struct TransformStats *stats = transform_stats();
+        printf("%6.0f%% %14.3f %14.3f %12zu %12zu %14zu\n",
+                FRACTIONS[f] * 100.0, full * 1000.0 / FRAMES,
+                dirty * 1000.0 / FRAMES, n * sizeof (mat4) / 1024,
+                stats->bytes / FRAMES / 1024, stats->uploads / FRAMES);
+    }
+
+    free(movers);
+    free(all);
+    del_buffer(everything);
+    transform_batch_free(&batch);
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/* impostorbench - frame cost of distant entities as meshes vs impostors
+ *
+ * usage: impostorbench [model.obj] [entities]
+ * Bakes the model, then draws a field of entities stretching away from the
+ * camera, once all as meshes and once with impostors past a distance, and
+ * reports the triangles the impostors saved per frame.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to bake and measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "frame.h"
+#include "impostor.h"
+#include "objloader.h"
+
+static const int      WIDTH = 800, HEIGHT = 600;
+static const int      FRAMES = 10;
+static const unsigned GRID = 8, CELL = 64;
+static const float    DISTANCE = 25.0f;
+
+int main(int argc, char *argv[])
+{
+    const char *obj = argc > 1 ? argv[1] : RESOURCE_DIR "stall.obj";
+    size_t n = argc > 2 ? touint(argv[2]) : 10000;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    init_frame();
+
+    struct Model model;
+    load_obj_model(obj, NULL,
+                   RESOURCE_DIR "entity.vertex.glsl",
+                   RESOURCE_DIR "entity.fragment.glsl",
+                   &model);
+
+    glFinish();
+    double start = bench_now();
+    struct Impostor impostor;
+    impostor_bake(&model, GRID, CELL, &impostor);
+    glFinish();
+    double bake_ms = (bench_now() - start) * 1000.0;
+
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    ASSERT(entities != NULL, "Out of memory");
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x = (rand() % 400) / 10.0f - 20.0f;
+        entities[i].y = (rand() % 200) / 10.0f - 10.0f;
+        entities[i].z = -(rand() % 1000) / 5.0f - 5.0f;
+        entities[i].rot_y = (rand() % 628) / 100.0f;
+        entities[i].scale = 0.3f;
+    }
+
+    struct FrameUniforms frame;
+    default_frame(&frame);
+
+    printf("%s, %zu entities of %d triangles\n", glGetString(GL_RENDERER), n,
+            (int)model.num_indices / 3);
+    printf("baked %ux%u views of %upx in %.1f ms\n", GRID, GRID, CELL, bake_ms);
+    printf("%-10s %10s %10s %10s %18s\n", "mode", "ms/frame", "meshes",
+            "impostors", "triangles saved");
+    for (int mode = 0; mode < 2; mode++) {
+        static const char *const NAMES[] = { "meshes", "impostors" };
+        float distance = mode == 0 ? 1e30f : DISTANCE;
+
+        glFinish();
+        start = bench_now();
+        for (int f = 0; f < FRAMES; f++) {
+            reset_impostor_stats();
+            upload_frame(&frame);
+            GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+            render_impostors(&model, &impostor, entities, n, distance);
+            SDL_GL_SwapWindow(window);
+        }
+        glFinish();
+        double ms = (bench_now() - start) * 1000.0 / FRAMES;
+
+        const struct ImpostorStats *stats = impostor_stats();
+        printf("%-10s %10.3f %10zu %10zu %18zu\n", NAMES[mode], ms,
+                stats->meshes, stats->impostors, stats->triangles_saved);
+    }
+
+    free(entities);
+    impostor_free(&impostor);
+    destroy_model(&model);
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
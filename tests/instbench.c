@@ -0,0 +1,103 @@
+/* instbench - frame cost of instanced render_entities() vs one draw per entity
+ *
+ * usage: instbench [model.obj]
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "frame.h"
+#include "objloader.h"
+
+static const int    WIDTH = 800, HEIGHT = 600;
+static const int    FRAMES = 10;
+static const size_t PER_ENTITY_LIMIT = 100000; /* the slow path gets too slow */
+
+static void scatter(struct Entity *e, size_t n);
+static double time_frames(const struct Model *m, const struct Entity *e,
+        size_t n, bool instanced);
+
+int main(int argc, char *argv[])
+{
+    const char *obj = argc > 1 ? argv[1] : RESOURCE_DIR "stall.obj";
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+
+    init_frame();
+
+    struct Model model;
+    load_obj_model(obj, NULL,
+                   RESOURCE_DIR "entity.vertex.glsl",
+                   RESOURCE_DIR "entity.fragment.glsl",
+                   &model);
+
+    printf("%10s %16s %16s %16s %16s\n", "entities", "instanced ms",
+            "per-entity ms", "uniforms/frame", "binds/skipped");
+    for (size_t n = 10; n <= 1000000; n *= 10) {
+        struct Entity *entities = calloc(n, sizeof (struct Entity));
+        ASSERT(entities != NULL, "Out of memory");
+        scatter(entities, n);
+
+        double instanced = time_frames(&model, entities, n, true);
+        const struct GLStats *stats = gl_stats();
+        unsigned uniforms = stats->uniform_calls + stats->uniform_buffer_updates;
+        unsigned binds = stats->state_calls, skipped = stats->state_calls_skipped;
+        if (n <= PER_ENTITY_LIMIT) {
+            double single = time_frames(&model, entities, n, false);
+            printf("%10zu %16.3f %16.3f %16u %9u/%u\n", n, instanced, single,
+                    uniforms, binds, skipped);
+        } else {
+            printf("%10zu %16.3f %16s %16u %9u/%u\n", n, instanced, "-",
+                    uniforms, binds, skipped);
+        }
+        free(entities);
+    }
+
+    destroy_model(&model);
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
+
+static void scatter(struct Entity *e, size_t n)
+{
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        e[i].x     =  (rand() % 18) - 9;
+        e[i].y     =  (rand() % 18) - 9;
+        e[i].z     = -(rand() % 20) - 5;
+        e[i].rot_x = (rand() % 3) - 1;
+        e[i].rot_y = (rand() % 3) - 1;
+        e[i].rot_z = (rand() % 3) - 1;
+        e[i].scale = 0.3f;
+    }
+}
+
+/* Average milliseconds per frame, including waiting for the GPU */
+static double time_frames(const struct Model *m, const struct Entity *e,
+        size_t n, bool instanced)
+{
+    glFinish();
+    double start = bench_now();
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    for (int f = 0; f < FRAMES; f++) {
+        reset_gl_stats();
+        upload_frame(&frame);
+        GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+        if (instanced) {
+            render_entities(m, e, n);
+        } else {
+            for (size_t i = 0; i < n; i++)
+                render_entity(m, &e[i]);
+        }
+        glFinish();
+    }
+    return (bench_now() - start) * 1000.0 / FRAMES;
+}
@@ -0,0 +1,159 @@
+/* lodtest - level selection and bias feedback of lod.c, no GPU needed
+ *
+ * usage: lodtest
+ * Moves one entity along the view axis of default_frame()'s camera and
+ * checks that levels only get coarser going away and finer coming back,
+ * that distances jittering inside the hysteresis band around a switch
+ * never change the level, and that leaving the band does, and that without
+ * the band the same jitter flips the level every frame. Then steps
+ * lod_feedback() over, inside and under the budget.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lod.h"
+#include "frame.h"
+
+static const float THRESHOLD = 1.0f, VIEWPORT_HEIGHT = 600.0f;
+static const float STEP = 0.05f, FAR = 200.0f;
+
+static unsigned g_failures = 0;
+
+#define CHECK(X) do {                                              \
+    if (!(X)) {                                                    \
+        fprintf(stderr, "%s:%d: check failed: %s\n",               \
+                __FILE__, __LINE__, #X);                           \
+        g_failures++;                                              \
+    }                                                              \
+} while (0)
+
+/* level - select for one entity @distance in front of the camera */
+static unsigned level(struct LodSelector *s, const struct LodChain *chain,
+        const struct FrameUniforms *frame, float distance)
+{
+    /* default_frame()'s camera sits at z = 3 looking down -z */
+    struct Entity e = { .z = 3.0f - distance, .scale = 1.0f };
+    lod_select(s, chain, frame, &e, 1);
+    return s->level[0];
+}
+
+/* fresh_switch - nearest distance a fresh selector picks @target at */
+static float fresh_switch(const struct LodChain *chain,
+        const struct FrameUniforms *frame, unsigned target)
+{
+    for (float d = 2.0f; d < FAR; d += STEP) {
+        struct LodSelector s;
+        lod_init(&s, THRESHOLD, VIEWPORT_HEIGHT);
+        unsigned l = level(&s, chain, frame, d);
+        lod_free(&s);
+        if (l >= target)
+            return d;
+    }
+    return FAR;
+}
+
+static void test_select(const struct LodChain *chain,
+        const struct FrameUniforms *frame)
+{
+    struct LodSelector s;
+    lod_init(&s, THRESHOLD, VIEWPORT_HEIGHT);
+
+    /* Away and back, monotonic with one switch per level each way */
+    unsigned last = level(&s, chain, frame, 2.0f), switches = 0;
+    CHECK(last == 0);
+    for (float d = 2.0f; d < FAR; d += STEP) {
+        unsigned l = level(&s, chain, frame, d);
+        CHECK(l >= last);
+        switches += s.switches;
+        last = l;
+    }
+    CHECK(last == chain->nlevels - 1);
+    for (float d = FAR; d > 2.0f; d -= STEP) {
+        unsigned l = level(&s, chain, frame, d);
+        CHECK(l <= last);
+        switches += s.switches;
+        last = l;
+    }
+    CHECK(last == 0);
+    CHECK(switches == 2 * (chain->nlevels - 1));
+    lod_free(&s);
+
+    /* Jitter around each switch stays put, leaving the band doesn't */
+    for (unsigned target = 1; target < chain->nlevels; target++) {
+        float edge = fresh_switch(chain, frame, target);
+        lod_init(&s, THRESHOLD, VIEWPORT_HEIGHT);
+        unsigned settled = level(&s, chain, frame, edge);
+        CHECK(settled == target);
+        for (int i = 0; i < 100; i++) {
+            float d = edge * (i % 2 ? 1.1f : 0.9f);
+            CHECK(level(&s, chain, frame, d) == settled);
+            CHECK(s.switches == 0);
+        }
+        CHECK(level(&s, chain, frame, edge * 0.7f) < settled);
+        CHECK(level(&s, chain, frame, edge * 1.3f) >= settled);
+        lod_free(&s);
+    }
+}
+
+/* Without the band, jitter across a switch flips the level each frame */
+static void test_no_band(const struct LodChain *chain,
+        const struct FrameUniforms *frame)
+{
+    float edge = fresh_switch(chain, frame, 1);
+    struct LodSelector s;
+    lod_init(&s, THRESHOLD, VIEWPORT_HEIGHT);
+    s.hysteresis = 0.0f;
+
+    unsigned switches = 0;
+    level(&s, chain, frame, edge);
+    for (int i = 0; i < 100; i++) {
+        level(&s, chain, frame, edge * (i % 2 ? 1.1f : 0.9f));
+        switches += s.switches;
+    }
+    CHECK(switches == 100);
+    lod_free(&s);
+}
+
+static void test_feedback(void)
+{
+    struct LodSelector s;
+    lod_init(&s, THRESHOLD, VIEWPORT_HEIGHT);
+
+    CHECK(lod_feedback(&s, 20.0, 16.0) > 0.0f);
+    float bias = s.bias;
+    CHECK(lod_feedback(&s, 16.5, 16.0) == bias);
+    CHECK(lod_feedback(&s, 15.0, 16.0) == bias);
+    CHECK(lod_feedback(&s, 10.0, 16.0) < bias);
+    for (int i = 0; i < 1000; i++)
+        lod_feedback(&s, 10.0, 16.0);
+    CHECK(s.bias == 0.0f);
+    for (int i = 0; i < 1000; i++)
+        lod_feedback(&s, 40.0, 16.0);
+    bias = s.bias;
+    CHECK(bias > 0.0f);
+    CHECK(lod_feedback(&s, 40.0, 16.0) == bias);
+
+    lod_free(&s);
+}
+
+int main(void)
+{
+    /* Levels only need bounds for selection */
+    static struct Model models[3];
+    for (unsigned l = 0; l < 3; l++)
+        glm_vec4_copy((vec4){ 0.0f, 0.0f, 0.0f, 1.0f }, models[l].bounds);
+    struct LodChain chain = {
+        .levels = { &models[0], &models[1], &models[2] },
+        .error = { 0.0f, 0.01f, 0.04f },
+        .nlevels = 3,
+    };
+    struct FrameUniforms frame;
+    default_frame(&frame);
+
+    test_select(&chain, &frame);
+    test_no_band(&chain, &frame);
+    test_feedback();
+
+    printf("lodtest: %u failures\n", g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,157 @@
+/* mdibench - one multi-draw indirect call vs one instanced draw per Model
+ *
+ * usage: mdibench [meshes] [entities per mesh]
+ * Asks for an OpenGL 4.3 context and falls back to 3.3, where only the
+ * render_entities() path runs. Both paths render the same scene, the
+ * framebuffers are compared to check the indirect path.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "frame.h"
+#include "mdi.h"
+#include "objloader.h"
+
+static const int WIDTH = 400, HEIGHT = 300;
+static const int FRAMES = 10;
+
+static void scatter(struct Entity *e, size_t n, unsigned seed);
+static double time_frames(const struct Model *models,
+        const struct MeshPool *pool, const struct PoolBatch *batches,
+        size_t nmeshes, uint8_t *pixels);
+
+int main(int argc, char *argv[])
+{
+    size_t nmeshes = argc > 1 ? touint(argv[1]) : 64;
+    size_t per_mesh = argc > 2 ? touint(argv[2]) : 100;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    if (!bench_try_gl(4, 3, WIDTH, HEIGHT, &window, &context))
+        bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    bool mdi = mdi_supported();
+    printf("%s, multi-draw indirect %s\n", glGetString(GL_VERSION),
+            mdi ? "supported" : "unsupported, falling back");
+
+    init_frame();
+
+    /* Distinct meshes: the same object stretched differently each time */
+    struct ModelData data = {
+        .vert_filepath = RESOURCE_DIR "entity.vertex.glsl",
+        .frag_filepath = RESOURCE_DIR "entity.fragment.glsl",
+        .tex_filepath  = NULL,
+    };
+    load_obj(RESOURCE_DIR "stall.obj", &data);
+    const GLfloat *original = data.vertices;
+    GLfloat *stretched = malloc(data.vertices_count * sizeof (GLfloat));
+    ASSERT(stretched != NULL, "Out of memory");
+    memcpy(stretched, original, data.vertices_count * sizeof (GLfloat));
+    data.vertices = stretched;
+
+    struct Model *models = calloc(nmeshes, sizeof (struct Model));
+    struct PoolBatch *batches = calloc(nmeshes, sizeof (struct PoolBatch));
+    struct Entity *entities = calloc(nmeshes * per_mesh, sizeof (struct Entity));
+    ASSERT(models && batches && entities, "Out of memory");
+
+    struct MeshPool pool;
+    if (mdi)
+        mesh_pool_init(&pool, data.vert_filepath, data.frag_filepath, NULL);
+    for (size_t k = 0; k < nmeshes; k++) {
+        float stretch = 1.0f + 0.05f * (float)(k % 10);
+        for (GLsizei i = 0; i < data.vertices_count; i += 3)
+            stretched[i + 1] = original[i + 1] * stretch;
+        create_model(&data, &models[k]);
+        if (mdi)
+            batches[k].mesh = mesh_pool_add(&pool, &data);
+        batches[k].entities = entities + k * per_mesh;
+        batches[k].count = per_mesh;
+        scatter(entities + k * per_mesh, per_mesh, k);
+    }
+    if (mdi)
+        mesh_pool_upload(&pool);
+    data.vertices = original;
+    free(stretched);
+    free_obj_modeldata(&data);
+
+    size_t npixels = (size_t)WIDTH * HEIGHT * 4;
+    uint8_t *expected = malloc(npixels), *actual = malloc(npixels);
+    ASSERT(expected && actual, "Out of memory");
+
+    printf("%zu meshes x %zu entities\n", nmeshes, per_mesh);
+    printf("%-16s %10s %12s\n", "path", "ms/frame", "draws/frame");
+    double ms = time_frames(models, NULL, batches, nmeshes, expected);
+    printf("%-16s %10.3f %12u\n", "per model", ms, gl_stats()->draw_calls);
+    if (mdi) {
+        ms = time_frames(NULL, &pool, batches, nmeshes, actual);
+        printf("%-16s %10.3f %12u\n", "multi-draw", ms,
+                gl_stats()->draw_calls);
+
+        size_t differ = 0;
+        for (size_t i = 0; i < npixels; i++)
+            differ += expected[i] != actual[i];
+        printf("framebuffers %s (%zu bytes differ)\n",
+                differ == 0 ? "match" : "DIFFER", differ);
+        mesh_pool_free(&pool);
+    }
+
+    for (size_t k = 0; k < nmeshes; k++)
+        destroy_model(&models[k]);
+    free(models);
+    free(batches);
+    free(entities);
+    free(expected);
+    free(actual);
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
+
+static void scatter(struct Entity *e, size_t n, unsigned seed)
+{
+    srand(seed);
+    for (size_t i = 0; i < n; i++) {
+        e[i].x     =  (rand() % 18) - 9;
+        e[i].y     =  (rand() % 18) - 9;
+        e[i].z     = -(rand() % 20) - 5;
+        e[i].rot_x = (rand() % 3) - 1;
+        e[i].rot_y = (rand() % 3) - 1;
+        e[i].rot_z = (rand() % 3) - 1;
+        e[i].scale = 0.05f;
+    }
+}
+
+/* Average milliseconds per frame, including waiting for the GPU. Draws
+ * every batch through @pool if it isn't NULL, else through @models */
+static double time_frames(const struct Model *models,
+        const struct MeshPool *pool, const struct PoolBatch *batches,
+        size_t nmeshes, uint8_t *pixels)
+{
+    glFinish();
+    double start = bench_now();
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    for (int f = 0; f < FRAMES; f++) {
+        reset_gl_stats();
+        upload_frame(&frame);
+        GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+        if (pool) {
+            render_pool(pool, batches, nmeshes);
+        } else {
+            for (size_t k = 0; k < nmeshes; k++)
+                render_entities(&models[k], batches[k].entities,
+                        batches[k].count);
+        }
+        glFinish();
+    }
+    double ms = (bench_now() - start) * 1000.0 / FRAMES;
+
+    GLCHECK(glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE,
+                pixels));
+    return ms;
+}
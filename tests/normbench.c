@@ -0,0 +1,118 @@
+/* normbench - vertex throughput of the normal matrix in entity.vertex.glsl
+ *
+ * usage: normbench [model.obj] [instances]
+ * Draws the same instances with the shipped shader, which uses the upper
+ * 3x3 of the model matrix, and with a copy that inverts the model matrix
+ * per vertex as it used to. The window is tiny to keep fragment work small.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "frame.h"
+#include "objloader.h"
+#include "progcache.h"
+#include "shaderpp.h"
+
+static const int WIDTH = 64, HEIGHT = 64;
+static const int FRAMES = 20;
+
+static const char *const SHORTCUT = "mat3(model) * normal";
+static const char *const INVERSE  = "mat3(transpose(inverse(model))) * normal";
+
+/* The shipped vertex shader with the per-vertex inverse put back, built with
+ * @features as the shipped one */
+static GLuint inverse_program(unsigned features)
+{
+    char *src = preprocess_shader(RESOURCE_DIR "entity.vertex.glsl");
+    char *at = strstr(src, SHORTCUT);
+    ASSERT(at != NULL, "entity.vertex.glsl no longer uses the shortcut");
+
+    size_t head = at - src;
+    char *patched = malloc(strlen(src) + strlen(INVERSE) + 1);
+    ASSERT(patched != NULL, "Out of memory");
+    memcpy(patched, src, head);
+    strcpy(patched + head, INVERSE);
+    strcat(patched, at + strlen(SHORTCUT));
+
+    char defines[128];
+    shader_defines(features, defines, sizeof defines);
+    char *fragment = preprocess_shader(RESOURCE_DIR "entity.fragment.glsl");
+    GLuint program = progcache_program(patched, fragment, defines);
+    bind_frame_block(program);
+    free(fragment);
+    free(patched);
+    free(src);
+    return program;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *obj = argc > 1 ? argv[1] : RESOURCE_DIR "stall.obj";
+    size_t n = argc > 2 ? touint(argv[2]) : 1000;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    init_frame();
+
+    struct Model model;
+    load_obj_model(obj, NULL,
+                   RESOURCE_DIR "entity.vertex.glsl",
+                   RESOURCE_DIR "entity.fragment.glsl",
+                   &model);
+    struct Model inverse = model;
+    inverse.program = inverse_program(model.features);
+
+    /* Everything in front of the default camera, so nothing is culled */
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    ASSERT(entities != NULL, "Out of memory");
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x = (rand() % 5) - 2;
+        entities[i].y = (rand() % 5) - 2;
+        entities[i].z = -(rand() % 10) - 5;
+        entities[i].rot_y = (rand() % 628) / 100.0f;
+        entities[i].scale = 0.3f;
+    }
+
+    struct FrameUniforms frame;
+    default_frame(&frame);
+
+    printf("%s, %zu instances of %d indices\n", glGetString(GL_RENDERER), n,
+            (int)model.num_indices);
+    printf("%-10s %12s %16s\n", "normal", "ms/frame", "Mvertices/s");
+    for (int variant = 0; variant < 2; variant++) {
+        static const char *const NAMES[] = { "mat3", "inverse" };
+        const struct Model *m = variant == 0 ? &model : &inverse;
+
+        upload_frame(&frame);
+        render_entities(m, entities, n);
+        glFinish();
+
+        double start = bench_now();
+        for (int f = 0; f < FRAMES; f++) {
+            upload_frame(&frame);
+            GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+            render_entities(m, entities, n);
+            SDL_GL_SwapWindow(window);
+        }
+        glFinish();
+        double seconds = (bench_now() - start) / FRAMES;
+        printf("%-10s %12.3f %16.1f\n", NAMES[variant], seconds * 1000.0,
+                (double)model.num_indices * n / seconds / 1e6);
+    }
+
+    del_program(inverse.program);
+    free(entities);
+    destroy_model(&model);
+    free_shader_variants();
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/* occlbench - software occlusion culling rate and cost
+ *
+ * usage: occlbench [entities] [width] [height]
+ * A row of walls stands in front of the camera with entities scattered
+ * behind and around them. Before timing, each implementation must hide
+ * probes placed behind a wall and keep the ones in front of the walls and
+ * above them visible, or the benchmark fails.
+ * CPU only, no OpenGL context is needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "cull.h"
+#include "occlusion.h"
+
+static const int ROUNDS = 20;
+
+/* Unit quad in the xy plane, scaled and placed by the model matrix */
+static const float QUAD_VERTICES[] = {
+    -0.5f, -0.5f, 0.0f,
+     0.5f, -0.5f, 0.0f,
+     0.5f,  0.5f, 0.0f,
+    -0.5f,  0.5f, 0.0f,
+};
+static const uint32_t QUAD_INDICES[] = { 0, 1, 2, 0, 2, 3 };
+
+/* Spheres with a known answer against rasterize_walls() */
+static const struct {
+    float x, y, z, r;
+    bool visible;
+    const char *where;
+} PROBES[] = {
+    {   0.0f,  0.0f, -40.0f, 1.0f, false, "behind the middle wall" },
+    {   2.0f, -3.0f, -25.0f, 0.5f, false, "just behind the middle wall" },
+    {   9.0f,  2.0f, -60.0f, 2.0f, false, "far behind a recessed wall" },
+    {   0.0f,  0.0f,  -8.0f, 1.0f, true,  "in front of the middle wall" },
+    { -10.0f,  1.0f, -12.0f, 1.0f, true,  "in front of a recessed wall" },
+    {   0.0f, 20.0f, -40.0f, 1.0f, true,  "above the walls" },
+    {  10.0f, -24.0f, -50.0f, 1.0f, true,  "below the walls" },
+    {   0.0f,  6.5f, -18.0f, 1.0f, true,  "poking over the middle wall" },
+};
+
+static void rasterize_walls(struct OcclusionBuffer *b, mat4 viewproj)
+{
+    occlusion_begin(b, viewproj);
+    for (int i = -2; i <= 2; i++) {
+        mat4 model;
+        glm_mat4_identity(model);
+        glm_translate(model, (vec3){ i * 9.0f, 0.0f, -15.0f - (i & 1) * 4.0f });
+        glm_scale(model, (vec3){ 8.0f, 12.0f, 1.0f });
+        occlusion_rasterize(b, model, QUAD_VERTICES, QUAD_INDICES,
+                ARRAY_SIZE(QUAD_INDICES));
+    }
+    occlusion_finish(b);
+}
+
+/* check_probes - whether the current implementation sorts every probe */
+static bool check_probes(struct OcclusionBuffer *b, mat4 viewproj,
+        const struct Frustum *frustum)
+{
+    struct SphereBatch probes = { 0 };
+    size_t n = ARRAY_SIZE(PROBES);
+    sphere_batch_reserve(&probes, n);
+    for (size_t i = 0; i < n; i++) {
+        probes.x[i] = PROBES[i].x;
+        probes.y[i] = PROBES[i].y;
+        probes.z[i] = PROBES[i].z;
+        probes.r[i] = PROBES[i].r;
+    }
+    probes.count = n;
+
+    uint32_t in[ARRAY_SIZE(PROBES)], out[ARRAY_SIZE(PROBES)];
+    bool ok = cull_spheres(frustum, &probes, in) == n;
+    if (!ok)
+        printf("a probe is outside the frustum\n");
+    for (size_t i = 0; i < n; i++)
+        in[i] = i;
+    rasterize_walls(b, viewproj);
+    size_t nvisible = occlusion_cull_spheres(b, &probes, in, n, out);
+
+    for (size_t i = 0, k = 0; i < n; i++) {
+        bool visible = k < nvisible && out[k] == i;
+        k += visible;
+        if (visible != PROBES[i].visible) {
+            printf("sphere %s is %s\n", PROBES[i].where,
+                    visible ? "visible" : "hidden");
+            ok = false;
+        }
+    }
+    sphere_batch_free(&probes);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 100000;
+    int width  = argc > 2 ? (int)touint(argv[2]) : 256;
+    int height = argc > 3 ? (int)touint(argv[3]) : 192;
+
+    /* Same camera as default_frame() */
+    mat4 view, projection, viewproj;
+    glm_mat4_identity(view);
+    glm_translate(view, (vec3){0.0f, 0.0f, -3.0f});
+    glm_perspective(glm_rad(70.0f), 800.0f / 600.0f, 0.1f, 1000.0f, projection);
+    glm_mat4_mul(projection, view, viewproj);
+    struct Frustum frustum;
+    frustum_from_matrix(viewproj, &frustum);
+
+    struct SphereBatch spheres = { 0 };
+    sphere_batch_reserve(&spheres, n);
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        spheres.x[i] = (rand() % 2000) / 10.0f - 100.0f;
+        spheres.y[i] = (rand() % 400) / 10.0f - 20.0f;
+        spheres.z[i] = -(rand() % 2000) / 10.0f;
+        spheres.r[i] = 1.0f;
+    }
+    spheres.count = n;
+
+    uint32_t *in_frustum = calloc(n, sizeof (uint32_t));
+    uint32_t *visible = calloc(n, sizeof (uint32_t));
+    ASSERT(in_frustum != NULL && visible != NULL, "Out of memory");
+    size_t nfrustum = cull_spheres(&frustum, &spheres, in_frustum);
+
+    struct OcclusionBuffer buffer;
+    occlusion_init(&buffer, width, height);
+
+    static const char *const NAMES[] = { "scalar", "avx2" };
+
+    printf("%zu entities, %zu in the frustum, %dx%d depth buffer\n",
+            n, nfrustum, buffer.width, buffer.height);
+    printf("%-8s %10s %10s %10s %12s %14s\n", "impl", "visible", "occluded",
+            "rate", "raster ms", "test ms/100K");
+    bool ok = true;
+    for (size_t k = 0; k < ARRAY_SIZE(NAMES); k++) {
+        occlusion_force_scalar(k == 0);
+        if (!check_probes(&buffer, viewproj, &frustum)) {
+            printf("%-8s failed the probes\n", NAMES[k]);
+            ok = false;
+            continue;
+        }
+
+        double raster = 0.0, test = 0.0;
+        size_t nvisible = 0;
+        for (int r = 0; r < ROUNDS; r++) {
+            rasterize_walls(&buffer, viewproj);
+            nvisible = occlusion_cull_spheres(&buffer, &spheres, in_frustum,
+                    nfrustum, visible);
+            raster += buffer.stats.raster_seconds;
+            test += buffer.stats.test_seconds;
+        }
+        raster *= 1000.0 / ROUNDS;
+        test *= 1000.0 / ROUNDS * 100000.0 / MAX(nfrustum, 1);
+        printf("%-8s %10zu %10zu %9.1f%% %12.4f %14.4f\n", NAMES[k], nvisible,
+                nfrustum - nvisible,
+                100.0 * (nfrustum - nvisible) / MAX(nfrustum, 1), raster, test);
+    }
+
+    occlusion_free(&buffer);
+    free(in_frustum);
+    free(visible);
+    sphere_batch_free(&spheres);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,94 @@
+/* progcachebench - startup cost of the repo's programs with the program cache
+ *
+ * usage: progcachebench [cache file] [rounds]
+ * Loads every program the renderer uses three ways: compiled with the cache
+ * off, cold (empty cache, compiled and stored) and warm (loaded from the
+ * binaries the cold pass stored), and reports the time of each.
+ * Drivers keep their own shader caches, which make compiling look cheap on
+ * a second run. Disable them for cold numbers that match a first start,
+ * e.g. MESA_SHADER_CACHE_DISABLE=true or __GL_SHADER_DISK_CACHE=0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "progcache.h"
+
+static const int WIDTH = 64, HEIGHT = 64;
+
+static const char *const PROGRAMS[][2] = {
+    { RESOURCE_DIR "entity.vertex.glsl", RESOURCE_DIR "entity.fragment.glsl" },
+    { RESOURCE_DIR "entity.vertex.glsl",
+        RESOURCE_DIR "entity.gbuffer.fragment.glsl" },
+    { RESOURCE_DIR "deferred.vertex.glsl",
+        RESOURCE_DIR "deferred.fragment.glsl" },
+    { RESOURCE_DIR "shadow.vertex.glsl", RESOURCE_DIR "shadow.fragment.glsl" },
+    { RESOURCE_DIR "impostor.bake.vertex.glsl",
+        RESOURCE_DIR "impostor.bake.fragment.glsl" },
+    { RESOURCE_DIR "impostor.vertex.glsl",
+        RESOURCE_DIR "impostor.fragment.glsl" },
+};
+
+/* load_all - load and delete every program, returns the milliseconds it
+ * took until the driver finished */
+static double load_all(void)
+{
+    GLuint programs[ARRAY_SIZE(PROGRAMS)];
+    double start = bench_now();
+    for (size_t i = 0; i < ARRAY_SIZE(PROGRAMS); i++)
+        programs[i] = load_program(PROGRAMS[i][0], PROGRAMS[i][1]);
+    GLCHECK(glFinish());
+    double ms = (bench_now() - start) * 1e3;
+    for (size_t i = 0; i < ARRAY_SIZE(PROGRAMS); i++)
+        del_program(programs[i]);
+    return ms;
+}
+
+static void report(const char *name, double ms)
+{
+    const struct ProgCacheStats *s = progcache_stats();
+    printf("%-8s %8.2f ms  %u hits, %u misses, %u rejected, %u stored\n",
+            name, ms, s->hits, s->misses, s->rejected, s->stored);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "progcachebench.bin";
+    unsigned rounds = argc > 2 ? touint(argv[2]) : 5;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    printf("%s, %zu programs, best of %u\n", glGetString(GL_RENDERER),
+            ARRAY_SIZE(PROGRAMS), rounds);
+
+    double off = 1e30, cold = 1e30, warm = 1e30;
+    for (unsigned r = 0; r < rounds; r++) {
+        off = MIN(off, load_all());
+        if (r + 1 == rounds)
+            report("off", off);
+
+        remove(path);
+        if (!progcache_init(path)) {
+            printf("The driver can't save program binaries\n");
+            break;
+        }
+        cold = MIN(cold, load_all());
+        if (r + 1 == rounds)
+            report("cold", cold);
+        progcache_shutdown();
+
+        progcache_init(path);
+        warm = MIN(warm, load_all());
+        if (r + 1 == rounds)
+            report("warm", warm);
+        progcache_shutdown();
+    }
+    if (warm < 1e30)
+        printf("warm start is %.1fx faster than cold\n", cold / warm);
+
+    remove(path);
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/* queuebench - sorted render queue vs drawing in submission order
+ *
+ * usage: queuebench [models] [entities]
+ * Entities of every Model are submitted interleaved, a quarter of them in
+ * the transparent layer.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "frame.h"
+#include "objloader.h"
+#include "renderqueue.h"
+
+static const int WIDTH = 400, HEIGHT = 300;
+static const int FRAMES = 10;
+
+int main(int argc, char *argv[])
+{
+    size_t nmodels = argc > 1 ? touint(argv[1]) : 8;
+    size_t n = argc > 2 ? touint(argv[2]) : 20000;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    init_frame();
+
+    struct Model *models = calloc(nmodels, sizeof (struct Model));
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    ASSERT(models && entities, "Out of memory");
+    for (size_t k = 0; k < nmodels; k++)
+        load_obj_model(RESOURCE_DIR "stall.obj", NULL,
+                       RESOURCE_DIR "entity.vertex.glsl",
+                       RESOURCE_DIR "entity.fragment.glsl",
+                       &models[k]);
+
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x     =  (rand() % 18) - 9;
+        entities[i].y     =  (rand() % 18) - 9;
+        entities[i].z     = -(rand() % 20) - 5;
+        entities[i].rot_x = (rand() % 3) - 1;
+        entities[i].rot_y = (rand() % 3) - 1;
+        entities[i].rot_z = (rand() % 3) - 1;
+        entities[i].scale = 0.05f;
+    }
+
+    struct FrameUniforms frame;
+    default_frame(&frame);
+
+    /* Submission order, one draw and one set of binds per Entity */
+    glFinish();
+    double start = bench_now();
+    for (int f = 0; f < FRAMES; f++) {
+        upload_frame(&frame);
+        GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+        for (size_t i = 0; i < n; i++)
+            render_entity(&models[i % nmodels], &entities[i]);
+        glFinish();
+    }
+    double unsorted = (bench_now() - start) * 1000.0 / FRAMES;
+
+    struct RenderQueue queue;
+    render_queue_init(&queue);
+    glFinish();
+    start = bench_now();
+    double sort = 0.0;
+    for (int f = 0; f < FRAMES; f++) {
+        upload_frame(&frame);
+        GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+        render_queue_begin(&queue);
+        for (size_t i = 0; i < n; i++)
+            render_queue_submit(&queue, &models[i % nmodels], &entities[i], 1,
+                    i % 4 == 0 ? RENDER_TRANSPARENT : RENDER_OPAQUE);
+        render_queue_flush(&queue);
+        sort += queue.stats.sort_seconds;
+        glFinish();
+    }
+    double sorted = (bench_now() - start) * 1000.0 / FRAMES;
+    const struct RenderQueueStats *s = &queue.stats;
+
+    printf("%zu models, %zu entities, %zu visible\n", nmodels, n, s->items);
+    printf("%-12s %10s %8s %10s %10s %10s\n",
+            "path", "ms/frame", "draws", "programs", "vaos", "textures");
+    printf("%-12s %10.3f %8zu %10zu %10zu %10zu\n",
+            "submission", unsorted, s->items, s->items, s->items, (size_t)0);
+    printf("%-12s %10.3f %8zu %10zu %10zu %10zu\n",
+            "queue", sorted, s->draws, s->program_changes, s->vao_changes,
+            s->texture_changes);
+    printf("radix sort: %.3f ms per frame, %.3f ms per 100K items\n",
+            sort * 1000.0 / FRAMES,
+            sort * 1000.0 / FRAMES * 100000.0 / MAX(s->items, 1));
+
+    render_queue_free(&queue);
+    for (size_t k = 0; k < nmodels; k++)
+        destroy_model(&models[k]);
+    free(models);
+    free(entities);
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
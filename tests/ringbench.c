@@ -0,0 +1,102 @@
+/* ringbench - streaming per-frame data through the ring vs re-specifying
+ *
+ * usage: ringbench [matrices per frame]
+ * Each frame writes the matrices, then draws a point from the written
+ * range so the GPU actually reads what was streamed. Asks for an OpenGL 4.4
+ * context to get the persistent mapping, and falls back to 3.3.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "ringbuffer.h"
+
+static const int WIDTH = 64, HEIGHT = 64;
+static const int FRAMES = 200;
+
+static const char *const VERTEX_SRC =
+    "#version 330 core\n"
+    "layout (location = 0) in vec4 column;\n"
+    "void main() { gl_Position = column; }\n";
+static const char *const FRAGMENT_SRC =
+    "#version 330 core\n"
+    "out vec4 color;\n"
+    "void main() { color = vec4(1.0); }\n";
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 10000;
+    size_t size = n * sizeof (mat4);
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    if (!bench_try_gl(4, 4, WIDTH, HEIGHT, &window, &context))
+        bench_init_gl(WIDTH, HEIGHT, &window, &context);
+
+    mat4 *matrices = malloc(size);
+    ASSERT(matrices != NULL, "Out of memory");
+    for (size_t i = 0; i < n; i++)
+        glm_mat4_identity(matrices[i]);
+
+    /* Reading one vertex per frame is enough to create the dependency */
+    GLuint program = make_program(make_shader(GL_VERTEX_SHADER, VERTEX_SRC),
+            make_shader(GL_FRAGMENT_SHADER, FRAGMENT_SRC));
+    use_program(program);
+    GLuint vao = gen_array();
+    struct RingBuffer ring;
+    ring_init(&ring, size);
+    GLuint buffer = gen_buffer(GL_ARRAY_BUFFER, size, matrices);
+
+    printf("%s, %zu matrices (%zu KiB) per frame, ring is %s\n",
+            glGetString(GL_VERSION), n, size / 1024,
+            ring.persistent ? "persistently mapped" : "orphaned");
+    printf("%-12s %12s %10s\n", "method", "ms/frame", "waits");
+
+    for (int method = 0; method < 3; method++) {
+        static const char *const NAMES[] = { "ring", "orphan", "subdata" };
+        unsigned waits = ring.stats.waits;
+
+        glFinish();
+        double start = bench_now();
+        for (int f = 0; f < FRAMES; f++) {
+            GLintptr offset = 0;
+            if (method == 0) {
+                ring_begin_frame(&ring);
+                struct RingAlloc alloc;
+                bool ok = ring_alloc(&ring, size, 0, &alloc);
+                ASSERT(ok, "Ring segment too small");
+                memcpy(alloc.ptr, matrices, size);
+                ring_flush(&ring);
+                bind_buffer(GL_ARRAY_BUFFER, alloc.buffer);
+                offset = alloc.offset;
+            } else {
+                bind_buffer(GL_ARRAY_BUFFER, buffer);
+                if (method == 1)
+                    GLCHECK(glBufferData(GL_ARRAY_BUFFER, size, matrices,
+                                GL_STREAM_DRAW));
+                else
+                    GLCHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, size,
+                                matrices));
+            }
+            attrib_buffer(0, 4, GL_FLOAT, sizeof (mat4), offset);
+            GLCHECK(glDrawArrays(GL_POINTS, 0, 1));
+            SDL_GL_SwapWindow(window);
+        }
+        glFinish();
+        double ms = (bench_now() - start) * 1000.0 / FRAMES;
+        printf("%-12s %12.4f %10u\n", NAMES[method], ms,
+                method == 0 ? ring.stats.waits - waits : 0);
+    }
+
+    ring_free(&ring);
+    del_buffer(buffer);
+    del_array(vao);
+    del_program(program);
+    free(matrices);
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/* scenebench - world transform propagation on deep and wide hierarchies
+ *
+ * usage: scenebench [nodes] [workers]
+ * Compares a pointer-linked scene graph updated recursively to the
+ * breadth-first SceneGraph, updated serially and then on the job pool.
+ * CPU only, no OpenGL context is needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <SDL.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "scenegraph.h"
+#include "jobs.h"
+
+static const int ROUNDS = 20;
+
+/* The classic layout: one allocation per node, children in a linked list */
+struct LinkedNode {
+    struct LinkedNode *first_child, *next_sibling;
+    mat4 local, world;
+};
+
+static void linked_update(struct LinkedNode *node, mat4 parent)
+{
+    for (; node != NULL; node = node->next_sibling) {
+        glm_mat4_mul(parent, node->local, node->world);
+        linked_update(node->first_child, node->world);
+    }
+}
+
+/* Parent of node i in each shape, nodes are added in index order */
+static uint32_t shape_parent(int shape, size_t i, size_t n)
+{
+    switch (shape) {
+    case 0: /* wide: 100 roots with a thousand children each */
+        return i % 1000 == 0 ? SCENE_ROOT : i - i % 1000;
+    case 1: /* deep: 10 chains of n / 10 nodes */
+        return i % (n / 10) == 0 ? SCENE_ROOT : i - 1;
+    default: /* random: any earlier node, a few roots */
+        return i == 0 || rand() % 100 == 0 ? SCENE_ROOT : rand() % i;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 100000;
+    unsigned nworkers = argc > 2 ? touint(argv[2]) : 0;
+
+    static const char *const SHAPES[] = { "wide", "deep", "random" };
+    struct SceneGraph graphs[3];
+    struct LinkedNode **linked = calloc(n, sizeof (struct LinkedNode *));
+    struct LinkedNode *roots[3] = { 0 };
+    double linked_ms[3], serial_ms[3], parallel_ms[3];
+    float error[3];
+    ASSERT(linked != NULL, "Out of memory");
+
+    srand(1234);
+    for (int shape = 0; shape < 3; shape++) {
+        struct SceneGraph *g = &graphs[shape];
+        scene_init(g);
+
+        struct LinkedNode *last_root = NULL;
+        for (size_t i = 0; i < n; i++) {
+            struct Entity e = {
+                .x = 0.1f, .rot_y = 0.001f * (rand() % 100), .scale = 1.0f,
+            };
+            mat4 local;
+            entity_model_matrix(&e, local);
+            uint32_t parent = shape_parent(shape, i, n);
+            scene_add(g, parent, local);
+
+            struct LinkedNode *node = calloc(1, sizeof *node);
+            ASSERT(node != NULL, "Out of memory");
+            glm_mat4_copy(local, node->local);
+            struct LinkedNode **head = parent == SCENE_ROOT
+                ? (last_root ? &last_root->next_sibling : &roots[shape])
+                : &linked[parent]->first_child;
+            if (parent == SCENE_ROOT) {
+                *head = node;
+                last_root = node;
+            } else {
+                node->next_sibling = *head;
+                *head = node;
+            }
+            linked[i] = node;
+        }
+        scene_sort(g);
+
+        mat4 identity = GLM_MAT4_IDENTITY_INIT;
+        double start = bench_now();
+        for (int r = 0; r < ROUNDS; r++)
+            linked_update(roots[shape], identity);
+        linked_ms[shape] = (bench_now() - start) * 1000.0 / ROUNDS;
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; r++)
+            scene_update(g);
+        serial_ms[shape] = (bench_now() - start) * 1000.0 / ROUNDS;
+
+        error[shape] = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            mat4 world;
+            scene_world(g, i, world);
+            for (int c = 0; c < 4; c++)
+                for (int k = 0; k < 4; k++)
+                    error[shape] = fmaxf(error[shape],
+                            fabsf(world[c][k] - linked[i]->world[c][k]));
+        }
+        for (size_t i = 0; i < n; i++)
+            free(linked[i]);
+    }
+
+    /* Without jobs_init() the pool runs everything on this thread */
+    jobs_init(nworkers);
+    for (int shape = 0; shape < 3; shape++) {
+        double start = bench_now();
+        for (int r = 0; r < ROUNDS; r++)
+            scene_update(&graphs[shape]);
+        parallel_ms[shape] = (bench_now() - start) * 1000.0 / ROUNDS;
+    }
+
+    printf("%zu nodes, %u workers\n", n, jobs_worker_count());
+    printf("%-8s %8s %12s %12s %12s %10s\n", "shape", "levels",
+            "linked ms", "serial ms", "parallel ms", "max error");
+    for (int shape = 0; shape < 3; shape++)
+        printf("%-8s %8zu %12.3f %12.3f %12.3f %10.2e\n", SHAPES[shape],
+                graphs[shape].nlevels, linked_ms[shape], serial_ms[shape],
+                parallel_ms[shape], error[shape]);
+
+    jobs_shutdown();
+    for (int shape = 0; shape < 3; shape++)
+        scene_free(&graphs[shape]);
+    free(linked);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/* shadowbench - cost of the cascaded shadow passes
+ *
+ * usage: shadowbench [model.obj] [entities]
+ * Draws a field of entities lit by the sun, without shadows and then with
+ * SHADOW_CASCADES cascades, and reports the shadow passes' draw calls,
+ * casters per cascade and time per frame.
+ * Run with LIBGL_ALWAYS_SOFTWARE=1 to measure on Mesa's llvmpipe
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "frame.h"
+#include "objloader.h"
+#include "shadows.h"
+
+static const int     WIDTH = 800, HEIGHT = 600;
+static const int     FRAMES = 10;
+static const GLsizei SIZE = 2048;
+static const float   RANGE = 60.0f;
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *obj = argc > 1 ? argv[1] : RESOURCE_DIR "stall.obj";
+    size_t n = argc > 2 ? touint(argv[2]) : 5000;
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(WIDTH, HEIGHT, &window, &context);
+    GLCHECK(glEnable(GL_DEPTH_TEST));
+    init_frame();
+
+    struct Model model;
+    load_obj_model(obj, NULL,
+                   RESOURCE_DIR "entity.vertex.glsl",
+                   RESOURCE_DIR "entity.fragment.glsl",
+                   &model);
+    struct ShadowMaps shadows;
+    shadows_init(&shadows, SIZE, RANGE);
+
+    /* A floor of entities stretching away from the camera */
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    ASSERT(entities != NULL, "Out of memory");
+    srand(1234);
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x = frand(-40.0f, 40.0f);
+        entities[i].y = frand(-3.0f, 0.0f);
+        entities[i].z = frand(-80.0f, 5.0f);
+        entities[i].rot_y = frand(0.0f, 6.28f);
+        entities[i].scale = 0.3f;
+    }
+
+    struct FrameUniforms frame;
+    default_frame(&frame);
+    frame.sun_direction[3] = 0.6f;
+
+    printf("%s, %zu entities of %d triangles, %d cascades of %dpx\n",
+            glGetString(GL_RENDERER), n, (int)model.num_indices / 3,
+            SHADOW_CASCADES, (int)SIZE);
+    printf("%-10s %10s %10s %10s %10s  %s\n", "mode", "ms/frame",
+            "shadow ms", "cull ms", "draws", "casters per cascade");
+    for (int mode = 0; mode < 2; mode++) {
+        static const char *const NAMES[] = { "unshadowed", "cascaded" };
+        double shadow_ms = 0.0;
+        reset_shadow_stats(&shadows);
+
+        glFinish();
+        double start = bench_now();
+        for (int f = 0; f < FRAMES; f++) {
+            if (mode == 1)
+                shadows_fit(&shadows, &frame);
+            upload_frame(&frame);
+            if (mode == 1) {
+                glFinish();
+                double pass = bench_now();
+                shadows_begin(&shadows);
+                shadows_render(&shadows, &model, entities, n);
+                shadows_end(&shadows);
+                glFinish();
+                shadow_ms += (bench_now() - pass) * 1000.0;
+            }
+            GLCHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+            render_entities(&model, entities, n);
+            SDL_GL_SwapWindow(window);
+        }
+        glFinish();
+        double ms = (bench_now() - start) * 1000.0 / FRAMES;
+
+        const struct ShadowStats *stats = &shadows.stats;
+        printf("%-10s %10.3f %10.3f %10.3f %10.1f ", NAMES[mode], ms,
+                shadow_ms / FRAMES, stats->cull_seconds * 1000.0 / FRAMES,
+                (double)stats->draw_calls / FRAMES);
+        for (unsigned c = 0; c < SHADOW_CASCADES; c++)
+            printf(" %zu", stats->casters[c] / FRAMES);
+        printf("\n");
+    }
+
+    free(entities);
+    shadows_free(&shadows);
+    destroy_model(&model);
+    cleanup_frame();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+/* texbench - textures/second for serial load_texture() vs load_textures()
+ *
+ * usage: texbench [copies] [image.png ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include <SDL_image.h>
+#include <GL/glew.h>
+#include "benchutil.h"
+#include "glutils.h"
+#include "jobs.h"
+#include "texloader.h"
+
+static const char *const DEFAULT_IMAGES[] = {
+    RESOURCE_DIR "justinian.png",
+    RESOURCE_DIR "stallTexture.png",
+    RESOURCE_DIR "cube.texture.png"
+};
+
+int main(int argc, char *argv[])
+{
+    size_t copies = argc > 1 ? touint(argv[1]) : 64;
+    const char *const *images = DEFAULT_IMAGES;
+    size_t nimages = ARRAY_SIZE(DEFAULT_IMAGES);
+    if (argc > 2) {
+        images = (const char *const *)&argv[2];
+        nimages = argc - 2;
+    }
+
+    SDL_Window *window;
+    SDL_GLContext context;
+    bench_init_gl(64, 64, &window, &context);
+    int ret = IMG_Init(IMG_INIT_PNG);
+    ASSERT(ret & IMG_INIT_PNG, IMG_GetError());
+    jobs_init(0);
+
+    size_t n = copies * nimages;
+    const char **paths = calloc(n, sizeof (char *));
+    GLuint *textures = calloc(n, sizeof (GLuint));
+    ASSERT(paths && textures, "Out of memory");
+    for (size_t i = 0; i < n; i++)
+        paths[i] = images[i % nimages];
+
+    /* Serial baseline */
+    double start = bench_now();
+    for (size_t i = 0; i < n; i++)
+        textures[i] = load_texture(paths[i]);
+    glFinish();
+    double serial = bench_now() - start;
+    for (size_t i = 0; i < n; i++)
+        del_texture(textures[i]);
+
+    /* Batched, decoding on the job pool */
+    static const unsigned FLAGS[] = {
+        0, TEXTURE_SRGB, TEXTURE_SRGB | TEXTURE_PREMULTIPLY
+    };
+    static const char *const FLAG_NAMES[] = {
+        "rgba8", "srgb", "srgb+premultiply"
+    };
+
+    printf("%zu textures, %u worker threads\n", n, jobs_worker_count());
+    printf("%-28s %10.1f tex/s\n", "load_texture() serial", n / serial);
+    for (size_t f = 0; f < ARRAY_SIZE(FLAGS); f++) {
+        start = bench_now();
+        load_textures(paths, n, FLAGS[f], textures);
+        glFinish();
+        double batched = bench_now() - start;
+        for (size_t i = 0; i < n; i++)
+            del_texture(textures[i]);
+        printf("load_textures() %-12s %10.1f tex/s (%.2fx)\n",
+                FLAG_NAMES[f], n / batched, serial / batched);
+    }
+
+    free(textures);
+    free(paths);
+    jobs_shutdown();
+    IMG_Quit();
+    bench_cleanup_gl(window, context);
+    return EXIT_SUCCESS;
+}
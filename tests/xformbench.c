@@ -0,0 +1,100 @@
+/* xformbench - model matrix construction per 100K entities
+ *
+ * usage: xformbench [entities]
+ * Compares the cglm chain of entity_model_matrix() to the closed form of
+ * transform_compose(), scalar and AVX2, over every entity and over a
+ * scattered half of them as culling would leave.
+ * CPU only, no OpenGL context is needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cglm/cglm.h>
+#include "benchutil.h"
+#include "entity.h"
+#include "transform.h"
+
+static const int ROUNDS = 20;
+
+static float max_error(mat4 *a, mat4 *b, size_t n)
+{
+    float err = 0.0f;
+    for (size_t i = 0; i < n; i++)
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                err = fmaxf(err, fabsf(a[i][c][r] - b[i][c][r]));
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? touint(argv[1]) : 100000;
+
+    struct Entity *entities = calloc(n, sizeof (struct Entity));
+    mat4 *expected = malloc(n * sizeof (mat4));
+    mat4 *out = malloc(n * sizeof (mat4));
+    uint32_t *half = malloc(n * sizeof (uint32_t));
+    ASSERT(entities && expected && out && half, "Out of memory");
+
+    srand(1234);
+    size_t nhalf = 0;
+    for (size_t i = 0; i < n; i++) {
+        entities[i].x = (rand() % 2000) / 10.0f - 100.0f;
+        entities[i].y = (rand() % 2000) / 10.0f - 100.0f;
+        entities[i].z = (rand() % 2000) / 10.0f - 100.0f;
+        entities[i].rot_x = (rand() % 6284) / 1000.0f - 3.142f;
+        entities[i].rot_y = (rand() % 6284) / 1000.0f - 3.142f;
+        entities[i].rot_z = (rand() % 6284) / 1000.0f - 3.142f;
+        entities[i].scale = 0.5f + (rand() % 100) / 100.0f;
+        if (rand() % 2)
+            half[nhalf++] = i;
+    }
+    struct TransformBatch batch = { 0 };
+    transform_batch_load(&batch, entities, n);
+
+    printf("%zu entities, %zu in the scattered half\n", n, nhalf);
+    printf("%-14s %14s %14s %12s\n",
+            "method", "ms per 100K", "half, ms/100K", "max error");
+
+    for (int method = 0; method < 3; method++) {
+        static const char *const NAMES[] = { "cglm chain", "closed scalar",
+                                             "closed avx2" };
+        transform_force_scalar(method == 1);
+
+        double start = bench_now();
+        for (int r = 0; r < ROUNDS; r++) {
+            if (method == 0)
+                for (size_t i = 0; i < n; i++)
+                    entity_model_matrix(&entities[i], out[i]);
+            else
+                transform_compose(&batch, NULL, n, out);
+        }
+        double all = (bench_now() - start) / ROUNDS;
+
+        if (method == 0)
+            for (size_t i = 0; i < n; i++)
+                entity_model_matrix(&entities[i], expected[i]);
+        float err = max_error(expected, out, n);
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; r++) {
+            if (method == 0)
+                for (size_t i = 0; i < nhalf; i++)
+                    entity_model_matrix(&entities[half[i]], out[i]);
+            else
+                transform_compose(&batch, half, nhalf, out);
+        }
+        double part = (bench_now() - start) / ROUNDS;
+
+        printf("%-14s %14.3f %14.3f %12.2e\n", NAMES[method],
+                all * 1000.0 * 100000.0 / n, part * 1000.0 * 100000.0 / n,
+                err);
+    }
+
+    transform_batch_free(&batch);
+    free(half);
+    free(out);
+    free(expected);
+    free(entities);
+    return EXIT_SUCCESS;
+}